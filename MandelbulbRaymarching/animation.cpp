@@ -0,0 +1,263 @@
+//------------------------------
+//- animation.cpp
+//------------------------------
+
+// Includes
+#include "animation.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool PowerCurve::Parse(const char* text)
+{
+	m_keys.clear();
+	while (*text)
+	{
+		Key key;
+		char* end;
+		key.seconds = strtod(text, &end);
+		if (end == text || *end != ':')
+			return false;
+		text = end + 1;
+		key.power = strtof(text, &end);
+		if (end == text || (*end && *end != ','))
+			return false;
+		text = *end ? end + 1 : end;
+
+		if (!m_keys.empty() && key.seconds <= m_keys.back().seconds)
+			return false;
+		m_keys.push_back(key);
+	}
+	return !m_keys.empty();
+}
+
+float PowerCurve::Evaluate(double seconds) const
+{
+	if (m_keys.empty())
+	{
+		// The live Animation setting, from the same code the window uses
+		FrameConstants constants = {};
+		constants.animated = 1;
+		constants.time = float(seconds * 1000.0);
+		return CreateFrameSetup(constants).params.power;
+	}
+
+	if (seconds <= m_keys.front().seconds)
+		return m_keys.front().power;
+	for (size_t i = 1; i < m_keys.size(); i++)
+	{
+		if (seconds < m_keys[i].seconds)
+		{
+			const Key& a = m_keys[i - 1];
+			const Key& b = m_keys[i];
+			float t = float((seconds - a.seconds) / (b.seconds - a.seconds));
+			return a.power + (b.power - a.power) * t;
+		}
+	}
+	return m_keys.back().power;
+}
+
+bool PngSequenceSink::Encode(int frame, const Image& image, std::vector<uint8_t>& /*encoded*/)
+{
+	char fileName[1024];
+	snprintf(fileName, sizeof(fileName), m_pattern.c_str(), frame);
+	if (!WritePng(fileName, image))
+	{
+		fprintf(stderr, "Failed to write %s\n", fileName);
+		return false;
+	}
+	return true;
+}
+
+// Destructor
+Y4mSink::~Y4mSink()
+{
+	if (m_file && m_file != stdout)
+		fclose(m_file);
+}
+
+bool Y4mSink::Begin(int width, int height, double fps)
+{
+	m_file = m_fileName == "-" ? stdout : fopen(m_fileName.c_str(), "wb");
+	if (!m_file)
+	{
+		fprintf(stderr, "Failed to open %s\n", m_fileName.c_str());
+		return false;
+	}
+
+	// Frame rate as a fraction in thousandths so 29.97 and friends survive
+	long long numerator = (long long)(fps * 1000.0 + 0.5);
+	fprintf(m_file, "YUV4MPEG2 W%d H%d F%lld:1000 Ip A1:1 C420jpeg\n", width, height, numerator);
+	return ferror(m_file) == 0;
+}
+
+bool Y4mSink::Encode(int /*frame*/, const Image& image, std::vector<uint8_t>& encoded)
+{
+	static const char frameHeader[] = "FRAME\n";
+	const size_t headerSize = sizeof(frameHeader) - 1;
+
+	int width = image.width;
+	int height = image.height;
+	int chromaWidth = (width + 1) / 2;
+	int chromaHeight = (height + 1) / 2;
+	size_t lumaSize = size_t(width) * height;
+	size_t chromaSize = size_t(chromaWidth) * chromaHeight;
+	encoded.resize(headerSize + lumaSize + 2 * chromaSize);
+
+	uint8_t* y = encoded.data() + headerSize;
+	uint8_t* u = y + lumaSize;
+	uint8_t* v = u + chromaSize;
+	memcpy(encoded.data(), frameHeader, headerSize);
+
+	auto clampByte = [](float value) { return uint8_t(value < 0.0f ? 0.0f : (value > 255.0f ? 255.0f : value + 0.5f)); };
+
+	// Full range BT.601, chroma averaged over each 2x2 block
+	for (int row = 0; row < height; row++)
+	{
+		const uint8_t* rgb = image.Row(row);
+		for (int x = 0; x < width; x++)
+		{
+			float r = rgb[x * 3], g = rgb[x * 3 + 1], b = rgb[x * 3 + 2];
+			y[size_t(row) * width + x] = clampByte(0.299f * r + 0.587f * g + 0.114f * b);
+		}
+	}
+	for (int cy = 0; cy < chromaHeight; cy++)
+	{
+		for (int cx = 0; cx < chromaWidth; cx++)
+		{
+			float r = 0.0f, g = 0.0f, b = 0.0f;
+			int count = 0;
+			for (int dy = 0; dy < 2 && cy * 2 + dy < height; dy++)
+			{
+				const uint8_t* rgb = image.Row(cy * 2 + dy);
+				for (int dx = 0; dx < 2 && cx * 2 + dx < width; dx++)
+				{
+					const uint8_t* p = rgb + (cx * 2 + dx) * 3;
+					r += p[0];
+					g += p[1];
+					b += p[2];
+					count++;
+				}
+			}
+			r /= count;
+			g /= count;
+			b /= count;
+			u[size_t(cy) * chromaWidth + cx] = clampByte(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+			v[size_t(cy) * chromaWidth + cx] = clampByte(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+		}
+	}
+	return true;
+}
+
+bool Y4mSink::Write(int /*frame*/, const std::vector<uint8_t>& encoded)
+{
+	return fwrite(encoded.data(), 1, encoded.size(), m_file) == encoded.size();
+}
+
+bool Y4mSink::End()
+{
+	bool ok = fflush(m_file) == 0 && ferror(m_file) == 0;
+	if (m_file != stdout)
+		ok = fclose(m_file) == 0 && ok;
+	m_file = nullptr;
+	return ok;
+}
+
+// Constructor
+AnimationRenderer::AnimationRenderer(ThreadPool& pool)
+	: m_pool(pool)
+{
+}
+
+bool AnimationRenderer::Render(const FrameConstants& constants, const AnimationSettings& settings, FrameSink& sink)
+{
+	auto start = std::chrono::steady_clock::now();
+	m_stats = {};
+
+	int inFlight = settings.framesInFlight > 0 ? settings.framesInFlight : int(m_pool.GetThreadCount()) + 1;
+	inFlight = inFlight < settings.frames ? inFlight : settings.frames;
+	m_stats.framesInFlight = inFlight;
+
+	// A slot holds one frame from render to write, frame i uses slot i % inFlight. Each has its
+	// own CpuRenderer as they keep per frame state
+	struct Slot
+	{
+		std::unique_ptr<CpuRenderer> renderer;
+		TaskGroup group;
+		Image image;
+		std::vector<uint8_t> encoded;
+		bool ok = false;
+		double renderMs = 0.0;
+		double encodeMs = 0.0;
+	};
+	std::vector<Slot> slots(inFlight);
+	for (Slot& slot : slots)
+	{
+		slot.renderer.reset(new CpuRenderer(m_pool));
+		slot.renderer->m_tileSize = m_tileSize;
+		slot.renderer->m_brickMap = m_brickMap;
+	}
+
+	if (!sink.Begin(constants.screenWidth, constants.screenHeight, settings.fps))
+		return false;
+
+	auto submit = [&](int frame) {
+		Slot& slot = slots[frame % inFlight];
+		m_pool.Run(slot.group, [&, frame]() {
+			// Deterministic time and power for this frame
+			FrameConstants frameConstants = constants;
+			double seconds = settings.startSeconds + double(frame) / settings.fps;
+			frameConstants.animated = 0;
+			frameConstants.time = float(seconds * 1000.0);
+			FrameSetup setup = CreateFrameSetup(frameConstants);
+			SetFramePower(setup, settings.curve.Evaluate(seconds));
+
+			auto renderStart = std::chrono::steady_clock::now();
+			slot.renderer->Render(frameConstants, setup, slot.image);
+			slot.renderMs = ElapsedMs(renderStart);
+
+			auto encodeStart = std::chrono::steady_clock::now();
+			slot.ok = sink.Encode(frame, slot.image, slot.encoded);
+			slot.encodeMs = ElapsedMs(encodeStart);
+		});
+	};
+
+	bool ok = true;
+	int submitted = 0;
+	for (int frame = 0; frame < settings.frames; frame++)
+	{
+		// Keep every slot busy, the slot of a frame is free once the frame before it was written
+		while (submitted < settings.frames && submitted < frame + inFlight)
+			submit(submitted++);
+
+		// Runs other frames' tasks while this one finishes
+		Slot& slot = slots[frame % inFlight];
+		auto waitStart = std::chrono::steady_clock::now();
+		m_pool.Wait(slot.group);
+		m_stats.waitMs += ElapsedMs(waitStart);
+		m_stats.renderMs += slot.renderMs;
+		m_stats.encodeMs += slot.encodeMs;
+
+		auto writeStart = std::chrono::steady_clock::now();
+		if (!slot.ok || !sink.Write(frame, slot.encoded))
+		{
+			ok = false;
+			// Let the frames already queued finish before their slots go away
+			for (Slot& other : slots)
+				m_pool.Wait(other.group);
+			break;
+		}
+		m_stats.writeMs += ElapsedMs(writeStart);
+	}
+
+	ok = sink.End() && ok;
+	m_stats.totalMs = ElapsedMs(start);
+	return ok;
+}
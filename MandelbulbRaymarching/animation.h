@@ -0,0 +1,129 @@
+#pragma once
+
+//------------------------------
+//- animation.h
+//------------------------------
+
+// Offline animation rendering. Every frame's power comes from its time through a curve instead
+// of the wall clock, so a clip renders the same every time. Several frames are in flight at once,
+// each rendered with its tiles spread over the pool and then encoded by the same task, while the
+// calling thread writes finished frames out in order. The number of frames in flight bounds memory
+
+// Includes
+#include "camera.h"
+#include "cpurenderer.h"
+#include "kernel.h"
+#include "pngwriter.h"
+#include "threadpool.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Power as a function of time in seconds. Without keys it is the Animation setting's curve,
+// otherwise linear between keys and held past the ends
+class PowerCurve
+{
+public:
+	struct Key
+	{
+		double seconds;
+		float power;
+	};
+
+	// Parse "seconds:power,seconds:power,...", keys in increasing time
+	bool Parse(const char* text);
+
+	float Evaluate(double seconds) const;
+	bool HasKeys() const { return !m_keys.empty(); }
+private:
+	std::vector<Key> m_keys;
+};
+
+// Where finished frames go. Encode runs on pool threads for several frames at once, Write runs
+// on one thread in frame order with what Encode produced
+class FrameSink
+{
+public:
+	virtual ~FrameSink() = default;
+
+	virtual bool Begin(int width, int height, double fps) = 0;
+	virtual bool Encode(int frame, const Image& image, std::vector<uint8_t>& encoded) = 0;
+	virtual bool Write(int frame, const std::vector<uint8_t>& encoded) = 0;
+	virtual bool End() = 0;
+};
+
+// One PNG per frame, named by a printf pattern with the frame number such as "frame_%04d.png".
+// Frames are written straight from Encode as their files do not depend on each other
+class PngSequenceSink : public FrameSink
+{
+public:
+	explicit PngSequenceSink(const std::string& pattern) : m_pattern(pattern) {}
+
+	bool Begin(int /*width*/, int /*height*/, double /*fps*/) override { return true; }
+	bool Encode(int frame, const Image& image, std::vector<uint8_t>& encoded) override;
+	bool Write(int /*frame*/, const std::vector<uint8_t>& /*encoded*/) override { return true; }
+	bool End() override { return true; }
+private:
+	std::string m_pattern;
+};
+
+// YUV4MPEG2 stream of 4:2:0 frames with full range BT.601 colours, to a file or stdout
+class Y4mSink : public FrameSink
+{
+public:
+	// "-" writes to stdout
+	explicit Y4mSink(const std::string& fileName) : m_fileName(fileName) {}
+	~Y4mSink() override;
+
+	bool Begin(int width, int height, double fps) override;
+	bool Encode(int frame, const Image& image, std::vector<uint8_t>& encoded) override;
+	bool Write(int frame, const std::vector<uint8_t>& encoded) override;
+	bool End() override;
+private:
+	std::string m_fileName;
+	FILE* m_file = nullptr;
+};
+
+struct AnimationSettings
+{
+	int frames = 100;
+	double fps = 30.0;
+	// Time of the first frame
+	double startSeconds = 0.0;
+	// Frames being rendered, encoded or waiting to be written at once, 0 for one per thread plus one
+	int framesInFlight = 0;
+	PowerCurve curve;
+};
+
+struct AnimationStats
+{
+	double totalMs = 0.0;
+	// Summed over frames, so with frames in flight these add up to more than totalMs
+	double renderMs = 0.0;
+	double encodeMs = 0.0;
+	// Time the writing thread spent writing, and waiting for the next frame in order
+	double writeMs = 0.0;
+	double waitMs = 0.0;
+	int framesInFlight = 0;
+};
+
+class AnimationRenderer
+{
+public:
+	// Settings every frame's CpuRenderer gets
+	int m_tileSize = 16;
+	const BrickMap* m_brickMap = nullptr;
+
+	// Constructor
+	AnimationRenderer(ThreadPool& pool);
+
+	// Render settings.frames frames of the constants' view to sink. The constants' time and
+	// animation are replaced per frame, everything else is used as given
+	bool Render(const FrameConstants& constants, const AnimationSettings& settings, FrameSink& sink);
+
+	const AnimationStats& GetStats() const { return m_stats; }
+private:
+	ThreadPool& m_pool;
+	AnimationStats m_stats;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+//------------------------------
+//- backend.h
+//------------------------------
+
+// Interfaces that keep Renderer free of any graphics API or window system. The D3D11 window
+// build uses D3D11Backend and Win32Input, the headless tools use the backends in cpubackend.h
+
+// Includes
+#include "kernel.h"
+#include "pngwriter.h"
+
+// Camera movement requested for one frame
+struct InputState
+{
+	// WASD
+	bool forward = false;
+	bool back = false;
+	bool left = false;
+	bool right = false;
+
+	// Mouse look in radians
+	float yaw = 0.0f;
+	float pitch = 0.0f;
+};
+
+// Somewhere to read camera input from each frame
+class InputSource
+{
+public:
+	virtual ~InputSource() = default;
+
+	// Sample the input for the frame about to be rendered
+	virtual InputState Poll() = 0;
+};
+
+// Input that never moves the camera
+class NullInput : public InputSource
+{
+public:
+	InputState Poll() override { return InputState(); }
+};
+
+// Owns the device and whatever the frame is drawn to
+class RenderBackend
+{
+public:
+	virtual ~RenderBackend() = default;
+
+	// Name for logs and benchmark output
+	virtual const char* GetName() const = 0;
+
+	// Current output size in pixels
+	virtual int GetWidth() const = 0;
+	virtual int GetHeight() const = 0;
+
+	// Make the constants visible to the next Draw
+	virtual void UploadConstants(const FrameConstants& constants) = 0;
+	// Render the fractal with the last uploaded constants and present it
+	virtual void Draw() = 0;
+	// Copy the last drawn frame to RGB8, false if the backend keeps no image
+	virtual bool Readback(Image& image) = 0;
+	// GPU time of the latest frame it has finished in milliseconds, negative when there is none.
+	// Draw's CPU time stands in for backends that do all their work inside it
+	virtual double GetGpuTime() const { return -1.0; }
+};
@@ -0,0 +1,437 @@
+//------------------------------
+//- benchmark.cpp
+//------------------------------
+
+// Benchmarks for the CPU kernels and whole frames at fixed camera poses, so a change can be
+// measured against the revision before it. Every case runs a few warmup repetitions and then
+// times each repetition on its own, reporting the mean, spread and rate, optionally as JSON
+
+// Includes
+#include "cpurenderer.h"
+#include "kernel.h"
+#include "kernel_simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct BenchmarkOptions
+{
+	int width = 640;
+	int height = 360;
+	int warmup = 2;
+	int repetitions = 10;
+	unsigned threads = 0;
+	SimdLevel simd = DetectSimdLevel();
+	// Only cases whose name or pose contains this run
+	std::string filter;
+	std::string json;
+};
+
+// A camera the results are tied to, changing one invalidates comparisons with old results
+struct BenchmarkPose
+{
+	const char* name;
+	float3 position;
+	float3 target;
+	float fovDegrees;
+};
+
+static const BenchmarkPose g_poses[] = {
+	// camera.h and Settings > Reset Camera
+	{ "default", { -1.3084f, 0.0610f, -2.8699f }, { -1.3084f + 0.422039f, 0.0610f - 0.052336f, -2.8699f + 0.905065f }, 45.0f },
+	// Grazing the surface, where marches take the most steps
+	{ "closeup", { -0.42f, 0.36f, -1.18f }, { -0.05f, 0.12f, -0.55f }, 45.0f },
+	// The whole bulb small in frame, most rays miss
+	{ "wide", { -2.6f, 1.4f, -5.8f }, { 0.0f, 0.0f, 0.0f }, 35.0f },
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	std::string pose;
+	// -1 for cases that do not depend on the quality level
+	int quality = -1;
+	// What one unit of work is, and how many a repetition does
+	std::string unit;
+	double work = 0.0;
+	std::vector<double> ms;
+
+	double Mean() const
+	{
+		double sum = 0.0;
+		for (double value : ms)
+			sum += value;
+		return sum / double(ms.size());
+	}
+
+	// Sample standard deviation
+	double StdDev() const
+	{
+		if (ms.size() < 2)
+			return 0.0;
+		double mean = Mean();
+		double sum = 0.0;
+		for (double value : ms)
+			sum += (value - mean) * (value - mean);
+		return sqrt(sum / double(ms.size() - 1));
+	}
+
+	double Min() const { return *std::min_element(ms.begin(), ms.end()); }
+
+	double Median() const
+	{
+		std::vector<double> sorted = ms;
+		std::sort(sorted.begin(), sorted.end());
+		size_t middle = sorted.size() / 2;
+		return sorted.size() % 2 ? sorted[middle] : 0.5 * (sorted[middle - 1] + sorted[middle]);
+	}
+
+	// Work per second at the mean time
+	double Rate() const { return work / (Mean() / 1000.0); }
+};
+
+// Time the FrameAnimated cases are drawn at, a power of about 7.003
+static const float g_animatedTime = 2000.0f;
+
+// Results feed this so the compiler cannot drop the work being timed
+static volatile float g_sink = 0.0f;
+
+static void PrintUsage()
+{
+	printf(
+		"Usage: mandelbulb-bench [options]\n"
+		"\n"
+		"  --width <n>            Frame width for the frame and ray cases (default 640)\n"
+		"  --height <n>           Frame height (default 360)\n"
+		"  --warmup <n>           Untimed repetitions before timing (default 2)\n"
+		"  --repetitions <n>      Timed repetitions per case (default 10)\n"
+		"  --threads <n>          Worker threads for frames, 0 for all cores (default 0)\n"
+		"  --simd <level>         scalar, avx2 or avx512 (default widest supported)\n"
+		"  --filter <text>        Only run cases whose name or pose contains text\n"
+		"  --json <file>          Also write the results as JSON\n");
+}
+
+static bool ParseOptions(int argc, char** argv, BenchmarkOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const char* value = argv[++i];
+
+		bool ok = true;
+		if (arg == "--width")
+			ok = (options.width = atoi(value)) > 0;
+		else if (arg == "--height")
+			ok = (options.height = atoi(value)) > 0;
+		else if (arg == "--warmup")
+			ok = (options.warmup = atoi(value)) >= 0;
+		else if (arg == "--repetitions")
+			ok = (options.repetitions = atoi(value)) > 0;
+		else if (arg == "--threads")
+			options.threads = unsigned(atoi(value));
+		else if (arg == "--simd")
+			ok = ParseSimdLevel(value, options.simd);
+		else if (arg == "--filter")
+			options.filter = value;
+		else if (arg == "--json")
+			options.json = value;
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			return false;
+		}
+
+		if (!ok)
+		{
+			fprintf(stderr, "Bad value for %s: %s\n", arg.c_str(), value);
+			return false;
+		}
+	}
+	return true;
+}
+
+static FrameConstants PoseConstants(const BenchmarkPose& pose, int width, int height, int quality)
+{
+	Camera camera;
+	camera.LookAt(pose.position, pose.target, float3{ 0.0f, 1.0f, 0.0f });
+	camera.SetLens(pose.fovDegrees * 0.01745329252f, float(width) / float(height), 0.1f, 1000.0f);
+
+	FrameConstants constants = CreateFrameConstants(camera, width, height);
+	constants.quality = quality;
+	constants.colour1 = { 255.0f, 255.0f, 255.0f };
+	constants.colour2 = { 255.0f, 255.0f, 255.0f };
+	return constants;
+}
+
+// Points a scalar sphere trace visits on a grid of the pose's rays, which is where the march
+// evaluates the DE, and the hits the grid finds with the direction their ray came from
+static void TracePose(const FrameConstants& constants, const FrameSetup& setup, std::vector<float3>& visited, std::vector<float3>& hits)
+{
+	const int gridX = 80;
+	const int gridY = 45;
+	for (int gy = 0; gy < gridY; gy++)
+	{
+		for (int gx = 0; gx < gridX; gx++)
+		{
+			float2 pixel = { (gx + 0.5f) * constants.screenWidth / gridX, (gy + 0.5f) * constants.screenHeight / gridY };
+			Ray ray = CreateCamRay(PixelToUV(constants, pixel), constants.projInverse, constants.viewInverse, constants.camPos);
+
+			// Same steps as MarchRay
+			float3 p = ray.pos;
+			visited.push_back(p);
+			float distance = DistToScene(p, setup.params);
+			for (int i = 0; i < setup.maxIters; i++)
+			{
+				p += ray.dir * distance;
+				visited.push_back(p);
+				distance = DistToScene(p, setup.params);
+				if (length(p) > 2.5f)
+					break;
+				if (distance < setup.minDist)
+				{
+					hits.push_back(p);
+					break;
+				}
+			}
+		}
+	}
+}
+
+// Run warmup then timed repetitions of body
+static void Measure(const BenchmarkOptions& options, BenchmarkResult& result, const std::function<void()>& body)
+{
+	for (int i = 0; i < options.warmup; i++)
+		body();
+
+	result.ms.clear();
+	for (int i = 0; i < options.repetitions; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		body();
+		result.ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	printf("%-18s %-8s %2s %10.3f ms +- %5.1f%% %10.3f M%s\n", result.name.c_str(), result.pose.c_str(),
+		result.quality >= 0 ? std::to_string(result.quality).c_str() : "-", result.Mean(), 100.0 * result.StdDev() / result.Mean(),
+		result.Rate() / 1e6, result.unit.c_str());
+	fflush(stdout);
+}
+
+static bool Selected(const BenchmarkOptions& options, const char* name, const char* pose)
+{
+	return options.filter.empty() || strstr(name, options.filter.c_str()) || strstr(pose, options.filter.c_str());
+}
+
+static void RunPose(const BenchmarkOptions& options, const BenchmarkPose& pose, ThreadPool& pool, std::vector<BenchmarkResult>& results)
+{
+	// Kernel cases use the medium quality march to find their points
+	FrameConstants constants = PoseConstants(pose, options.width, options.height, 1);
+	FrameSetup setup = CreateFrameSetup(constants);
+
+	std::vector<float3> visited;
+	std::vector<float3> hits;
+	TracePose(constants, setup, visited, hits);
+	if (hits.empty())
+		hits.push_back(float3{ 0.0f, 0.0f, -1.0f });
+
+	std::vector<float> xs(visited.size()), ys(visited.size()), zs(visited.size()), dist(visited.size()), lenZ(visited.size());
+	for (size_t i = 0; i < visited.size(); i++)
+	{
+		xs[i] = visited[i].x;
+		ys[i] = visited[i].y;
+		zs[i] = visited[i].z;
+	}
+
+	auto add = [&](const char* name, int quality, const char* unit, double work, const std::function<void()>& body) {
+		if (!Selected(options, name, pose.name))
+			return;
+		BenchmarkResult result;
+		result.name = name;
+		result.pose = pose.name;
+		result.quality = quality;
+		result.unit = unit;
+		result.work = work;
+		Measure(options, result, body);
+		results.push_back(result);
+	};
+
+	add("DistToScene", -1, "evals/s", double(visited.size()), [&]() {
+		float sum = 0.0f;
+		for (const float3& p : visited)
+			sum += DistToScene(p, setup.params);
+		g_sink = sum;
+	});
+
+	add("DistToSceneLenZ", -1, "evals/s", double(visited.size()), [&]() {
+		float sum = 0.0f;
+		for (const float3& p : visited)
+		{
+			float orbit;
+			sum += DistToScene(p, setup.params, orbit) + orbit;
+		}
+		g_sink = sum;
+	});
+
+	add("DistToScenePacket", -1, "evals/s", double(visited.size()), [&]() {
+		DistToScenePacket(xs.data(), ys.data(), zs.data(), int(visited.size()), setup.params, dist.data());
+		g_sink = dist[0];
+	});
+
+	add("DistToScenePacketLenZ", -1, "evals/s", double(visited.size()), [&]() {
+		DistToScenePacket(xs.data(), ys.data(), zs.data(), int(visited.size()), setup.params, dist.data(), lenZ.data());
+		g_sink = dist[0] + lenZ[0];
+	});
+
+	add("NormalEstimate", -1, "normals/s", double(hits.size()), [&]() {
+		float sum = 0.0f;
+		for (const float3& p : hits)
+			sum += NormalEstimate(p, setup.params).x;
+		g_sink = sum;
+	});
+
+	add("NormalTetrahedral", -1, "normals/s", double(hits.size()), [&]() {
+		float sum = 0.0f;
+		for (const float3& p : hits)
+			sum += NormalEstimateTetrahedral(p, 0.0001f, setup.params).x;
+		g_sink = sum;
+	});
+
+	add("NormalAnalytic", -1, "normals/s", double(hits.size()), [&]() {
+		float sum = 0.0f;
+		for (const float3& p : hits)
+			sum += NormalEstimateAnalytic(p, setup.params).x;
+		g_sink = sum;
+	});
+
+	// ShadeHit's first light, cast from just off each hit along its normal
+	std::vector<float3> shadowStarts;
+	for (const float3& p : hits)
+		shadowStarts.push_back(p + 0.01f * NormalEstimate(p, setup.params));
+	add("SoftShadow", -1, "rays/s", double(hits.size()), [&]() {
+		float sum = 0.0f;
+		for (const float3& p : shadowStarts)
+			sum += SoftShadow(p, normalize(float3{ 10.0f, 10.0f, -10.0f } - p), setup.minDist, g_shadowDistance, 3.0f, setup.params);
+		g_sink = sum;
+	});
+
+	// Every light of each hit, batched and clipped as the renderer traces them
+	std::vector<MarchResult> shadowHits(hits.size());
+	std::vector<float3> shadowNormals(hits.size());
+	std::vector<float> shadows(hits.size() * g_lightCount);
+	for (size_t i = 0; i < hits.size(); i++)
+	{
+		shadowHits[i].hit = true;
+		shadowHits[i].pos = hits[i];
+		shadowNormals[i] = NormalEstimate(hits[i], setup.params);
+	}
+	add("TraceShadows", -1, "hits/s", double(hits.size()), [&]() {
+		TraceShadows(shadowHits.data(), shadowNormals.data(), int(hits.size()), setup, shadows.data());
+		g_sink = shadows[0];
+	});
+
+	double pixels = double(options.width) * options.height;
+	add("CreateCamRay", -1, "rays/s", pixels, [&]() {
+		float sum = 0.0f;
+		for (int y = 0; y < options.height; y++)
+		{
+			for (int x = 0; x < options.width; x++)
+			{
+				float2 uv = PixelToUV(constants, float2{ x + 0.5f, y + 0.5f });
+				sum += CreateCamRay(uv, constants.projInverse, constants.viewInverse, constants.camPos).dir.x;
+			}
+		}
+		g_sink = sum;
+	});
+
+	CpuRenderer renderer(pool);
+	Image image;
+	for (int quality = 0; quality <= 2; quality++)
+	{
+		FrameConstants frame = PoseConstants(pose, options.width, options.height, quality);
+		add("Frame", quality, "rays/s", pixels, [&]() { renderer.Render(frame, image); });
+	}
+
+	// The animated power at g_animatedTime is fractional, so these run the polar kernel variant
+	for (int quality = 0; quality <= 2; quality++)
+	{
+		FrameConstants frame = PoseConstants(pose, options.width, options.height, quality);
+		frame.animated = 1;
+		frame.time = g_animatedTime;
+		add("FrameAnimated", quality, "rays/s", pixels, [&]() { renderer.Render(frame, image); });
+	}
+}
+
+static void WriteJson(const BenchmarkOptions& options, const ThreadPool& pool, const std::vector<BenchmarkResult>& results)
+{
+	FILE* file = fopen(options.json.c_str(), "w");
+	if (!file)
+	{
+		fprintf(stderr, "Failed to write %s\n", options.json.c_str());
+		return;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"version\": 1,\n");
+	fprintf(file, "  \"simd\": \"%s\",\n", SimdLevelName(GetSimdLevel()));
+	fprintf(file, "  \"threads\": %u,\n", pool.GetThreadCount());
+	fprintf(file, "  \"width\": %d,\n", options.width);
+	fprintf(file, "  \"height\": %d,\n", options.height);
+	fprintf(file, "  \"warmup\": %d,\n", options.warmup);
+	fprintf(file, "  \"repetitions\": %d,\n", options.repetitions);
+	fprintf(file, "  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult& result = results[i];
+		fprintf(file, "    { \"name\": \"%s\", \"pose\": \"%s\", \"quality\": %d, \"unit\": \"%s\", \"work\": %.0f, ",
+			result.name.c_str(), result.pose.c_str(), result.quality, result.unit.c_str(), result.work);
+		fprintf(file, "\"mean_ms\": %.6f, \"stddev_ms\": %.6f, \"min_ms\": %.6f, \"median_ms\": %.6f, \"rate\": %.6g, \"samples_ms\": [",
+			result.Mean(), result.StdDev(), result.Min(), result.Median(), result.Rate());
+		for (size_t s = 0; s < result.ms.size(); s++)
+			fprintf(file, "%s%.6f", s ? ", " : "", result.ms[s]);
+		fprintf(file, "] }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "--help") == 0)
+	{
+		PrintUsage();
+		return 0;
+	}
+
+	BenchmarkOptions options;
+	if (!ParseOptions(argc, argv, options))
+		return 1;
+	SetSimdLevel(options.simd);
+
+	ThreadPool pool(options.threads);
+	printf("mandelbulb-bench: %dx%d, %s, %u threads, %d warmup + %d timed repetitions\n", options.width, options.height,
+		SimdLevelName(GetSimdLevel()), pool.GetThreadCount(), options.warmup, options.repetitions);
+	printf("%-18s %-8s %2s %13s %10s %10s\n", "case", "pose", "q", "mean", "stddev", "rate");
+
+	std::vector<BenchmarkResult> results;
+	for (const BenchmarkPose& pose : g_poses)
+		RunPose(options, pose, pool, results);
+
+	if (!options.json.empty())
+	{
+		WriteJson(options, pool, results);
+		printf("Saved %s\n", options.json.c_str());
+	}
+	return 0;
+}
@@ -0,0 +1,409 @@
+//------------------------------
+//- brickmap.cpp
+//------------------------------
+
+// Includes
+#include "brickmap.h"
+#include "kernel_simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	const int g_samplesPerEdge = BrickMap::g_brickSize + 1;
+	const int g_samplesPerBrick = g_samplesPerEdge * g_samplesPerEdge * g_samplesPerEdge;
+
+	// Cache file layout, little endian. The header is followed by the centre distances, first
+	// sample indices and samples, each starting on a page boundary so the mapped tables are aligned
+	const char g_fileMagic[8] = { 'M', 'B', 'B', 'R', 'I', 'C', 'K', 'S' };
+	const uint64_t g_sectionAlignment = 4096;
+
+	struct BrickFileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+
+		// Key, the Build arguments
+		int32_t maxIters;
+		float escape;
+		float power;
+		int32_t resolution;
+		uint64_t maxBytes;
+
+		// Layout the samples were taken with
+		int32_t brickSize;
+		float extent;
+		int32_t bricksPerAxis;
+		int32_t padding;
+		int64_t surfaceBricks;
+		int64_t droppedBricks;
+
+		uint64_t centreOffset;
+		uint64_t firstOffset;
+		uint64_t samplesOffset;
+		uint64_t sampleCount;
+
+		uint64_t centreChecksum;
+		uint64_t firstChecksum;
+		uint64_t samplesChecksum;
+		// Of the header with this field zeroed
+		uint64_t headerChecksum;
+	};
+
+	// FNV-1a over 64-bit words in four interleaved lanes so it runs at memory speed, then the tail
+	uint64_t Checksum(const void* data, size_t size)
+	{
+		const uint64_t prime = 0x100000001B3ull;
+		uint64_t lanes[4] = { 0xCBF29CE484222325ull, 0x84222325CBF29CE4ull, 0xCE484222325CBF29ull, 0x2325CBF29CE48422ull };
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32)
+		{
+			for (int lane = 0; lane < 4; lane++)
+			{
+				uint64_t word;
+				memcpy(&word, bytes + i + lane * 8, 8);
+				lanes[lane] = (lanes[lane] ^ word) * prime;
+			}
+		}
+
+		uint64_t hash = size;
+		for (int lane = 0; lane < 4; lane++)
+			hash = (hash ^ lanes[lane]) * prime;
+		for (; i < size; i++)
+			hash = (hash ^ bytes[i]) * prime;
+		return hash;
+	}
+
+	uint64_t AlignSection(uint64_t offset)
+	{
+		return (offset + g_sectionAlignment - 1) / g_sectionAlignment * g_sectionAlignment;
+	}
+
+	uint64_t HeaderChecksum(BrickFileHeader header)
+	{
+		header.headerChecksum = 0;
+		return Checksum(&header, sizeof(header));
+	}
+
+	// Whether size bytes at offset lie inside a file of fileSize bytes
+	bool InFile(uint64_t offset, uint64_t size, uint64_t fileSize)
+	{
+		return offset <= fileSize && size <= fileSize - offset;
+	}
+}
+
+const char* BrickCacheStatusName(BrickCacheStatus status)
+{
+	switch (status)
+	{
+	case BrickCacheStatus::Loaded: return "loaded";
+	case BrickCacheStatus::Missing: return "missing";
+	case BrickCacheStatus::Stale: return "stale";
+	case BrickCacheStatus::Corrupt: return "corrupt";
+	}
+	return "unknown";
+}
+
+int BrickMap::BricksPerAxis(int resolution)
+{
+	int bricksPerAxis = (resolution + g_brickSize - 1) / g_brickSize;
+	return bricksPerAxis > 1 ? bricksPerAxis : 1;
+}
+
+void BrickMap::SetLayout(int resolution)
+{
+	m_bricksPerAxis = BricksPerAxis(resolution);
+	m_brickEdge = 2.0f * g_extent / float(m_bricksPerAxis);
+	m_voxelSize = m_brickEdge / float(g_brickSize);
+	m_voxelDiagonal = m_voxelSize * sqrtf(3.0f);
+	// A couple of voxels out the exact DE only needs a few steps to reach the surface
+	m_exactDistance = 2.0f * m_voxelDiagonal;
+}
+
+float3 BrickMap::BrickCentre(int bx, int by, int bz) const
+{
+	return float3{ (float(bx) + 0.5f) * m_brickEdge - g_extent, (float(by) + 0.5f) * m_brickEdge - g_extent, (float(bz) + 0.5f) * m_brickEdge - g_extent };
+}
+
+void BrickMap::Build(ThreadPool& pool, const FractalOptions& params, int resolution, size_t maxBytes)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	m_file.Close();
+	m_params = params;
+	m_maxBytes = maxBytes;
+	SetLayout(resolution);
+
+	int n = m_bricksPerAxis;
+	size_t brickCount = size_t(n) * n * n;
+	m_builtCentreDistance.assign(brickCount, 0.0f);
+	m_builtFirstSample.assign(brickCount, -1);
+	m_builtSamples.clear();
+	m_stats = {};
+	m_stats.bricks = (long long)brickCount;
+
+	// DE at every brick centre, a row of bricks per packet
+	pool.ParallelFor(n * n, [&](int row) {
+		int by = row % n;
+		int bz = row / n;
+		std::vector<float> xs(n), ys(n), zs(n);
+		for (int bx = 0; bx < n; bx++)
+		{
+			float3 c = BrickCentre(bx, by, bz);
+			xs[bx] = c.x;
+			ys[bx] = c.y;
+			zs[bx] = c.z;
+		}
+		DistToScenePacket(xs.data(), ys.data(), zs.data(), n, m_params, &m_builtCentreDistance[size_t(row) * n]);
+	});
+
+	// Bricks whose centre bound would be loose somewhere inside them get samples, nearest first
+	float halfDiagonal = 0.5f * m_brickEdge * sqrtf(3.0f);
+	std::vector<int> surface;
+	for (size_t b = 0; b < brickCount; b++)
+	{
+		if (m_builtCentreDistance[b] < 2.0f * halfDiagonal)
+			surface.push_back(int(b));
+	}
+	std::sort(surface.begin(), surface.end(), [&](int a, int b) { return m_builtCentreDistance[a] < m_builtCentreDistance[b]; });
+
+	size_t fixedBytes = brickCount * (sizeof(float) + sizeof(int32_t));
+	size_t brickBytes = size_t(g_samplesPerBrick) * sizeof(float);
+	size_t kept = maxBytes > fixedBytes ? (maxBytes - fixedBytes) / brickBytes : 0;
+	kept = kept < surface.size() ? kept : surface.size();
+
+	m_stats.surfaceBricks = (long long)surface.size();
+	m_stats.droppedBricks = (long long)(surface.size() - kept);
+	m_builtSamples.resize(kept * g_samplesPerBrick);
+	for (size_t i = 0; i < kept; i++)
+		m_builtFirstSample[surface[i]] = int32_t(i * g_samplesPerBrick);
+
+	// Corner samples of each kept brick in one packet call
+	pool.ParallelFor(int(kept), [&](int i) {
+		int b = surface[i];
+		float3 origin = BrickCentre(b % n, (b / n) % n, b / (n * n)) - 0.5f * m_brickEdge;
+
+		std::vector<float> xs(g_samplesPerBrick), ys(g_samplesPerBrick), zs(g_samplesPerBrick);
+		for (int s = 0; s < g_samplesPerBrick; s++)
+		{
+			xs[s] = origin.x + float(s % g_samplesPerEdge) * m_voxelSize;
+			ys[s] = origin.y + float((s / g_samplesPerEdge) % g_samplesPerEdge) * m_voxelSize;
+			zs[s] = origin.z + float(s / (g_samplesPerEdge * g_samplesPerEdge)) * m_voxelSize;
+		}
+		DistToScenePacket(xs.data(), ys.data(), zs.data(), g_samplesPerBrick, m_params, &m_builtSamples[size_t(i) * g_samplesPerBrick]);
+	});
+
+	m_centreDistance = m_builtCentreDistance.data();
+	m_firstSample = m_builtFirstSample.data();
+	m_samples = m_builtSamples.data();
+	m_sampleCount = m_builtSamples.size();
+
+	m_stats.bytes = fixedBytes + m_sampleCount * sizeof(float);
+	m_stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool BrickMap::Matches(const FractalOptions& params) const
+{
+	return m_bricksPerAxis > 0 && params.power == m_params.power && params.maxIters == m_params.maxIters && params.escape == m_params.escape;
+}
+
+float BrickMap::Bound(float3 p) const
+{
+	// Position in voxels from the cube's corner
+	float3 u = (p + g_extent) / m_voxelSize;
+	int resolution = m_bricksPerAxis * g_brickSize;
+	if (!(u.x >= 0.0f && u.y >= 0.0f && u.z >= 0.0f) || u.x >= float(resolution) || u.y >= float(resolution) || u.z >= float(resolution))
+	{
+		// The fractal lies inside the cube, so outside it the distance to the cube is a bound
+		float3 outside = float3{ fmaxf(fabsf(p.x) - g_extent, 0.0f), fmaxf(fabsf(p.y) - g_extent, 0.0f), fmaxf(fabsf(p.z) - g_extent, 0.0f) };
+		return length(outside);
+	}
+
+	int vx = int(u.x), vy = int(u.y), vz = int(u.z);
+	int bx = vx / g_brickSize, by = vy / g_brickSize, bz = vz / g_brickSize;
+	size_t b = (size_t(bz) * m_bricksPerAxis + by) * m_bricksPerAxis + bx;
+
+	// Far from the surface, or dropped by the cap, the DE moves at most as far as p from the centre
+	int first = m_firstSample[b];
+	if (first < 0)
+		return m_centreDistance[b] - length(p - BrickCentre(bx, by, bz));
+
+	// Trilinear blend of the voxel's corners, each within a voxel diagonal of p
+	int x = vx - bx * g_brickSize, y = vy - by * g_brickSize, z = vz - bz * g_brickSize;
+	float fx = u.x - float(vx), fy = u.y - float(vy), fz = u.z - float(vz);
+	const float* s = &m_samples[size_t(first) + (size_t(z) * g_samplesPerEdge + y) * g_samplesPerEdge + x];
+	const int dy = g_samplesPerEdge, dz = g_samplesPerEdge * g_samplesPerEdge;
+
+	float c00 = s[0] + (s[1] - s[0]) * fx;
+	float c10 = s[dy] + (s[dy + 1] - s[dy]) * fx;
+	float c01 = s[dz] + (s[dz + 1] - s[dz]) * fx;
+	float c11 = s[dz + dy] + (s[dz + dy + 1] - s[dz + dy]) * fx;
+	float c0 = c00 + (c10 - c00) * fy;
+	float c1 = c01 + (c11 - c01) * fy;
+
+	return c0 + (c1 - c0) * fz - m_voxelDiagonal;
+}
+
+bool BrickMap::Save(const std::string& fileName) const
+{
+	if (m_bricksPerAxis <= 0)
+		return false;
+
+	size_t brickCount = size_t(m_bricksPerAxis) * m_bricksPerAxis * m_bricksPerAxis;
+
+	BrickFileHeader header = {};
+	memcpy(header.magic, g_fileMagic, sizeof(g_fileMagic));
+	header.version = g_fileVersion;
+	header.headerSize = sizeof(BrickFileHeader);
+	header.maxIters = m_params.maxIters;
+	header.escape = m_params.escape;
+	header.power = m_params.power;
+	header.resolution = GetResolution();
+	header.maxBytes = m_maxBytes;
+	header.brickSize = g_brickSize;
+	header.extent = g_extent;
+	header.bricksPerAxis = m_bricksPerAxis;
+	header.surfaceBricks = m_stats.surfaceBricks;
+	header.droppedBricks = m_stats.droppedBricks;
+	header.centreOffset = AlignSection(sizeof(BrickFileHeader));
+	header.firstOffset = AlignSection(header.centreOffset + brickCount * sizeof(float));
+	header.samplesOffset = AlignSection(header.firstOffset + brickCount * sizeof(int32_t));
+	header.sampleCount = m_sampleCount;
+	header.centreChecksum = Checksum(m_centreDistance, brickCount * sizeof(float));
+	header.firstChecksum = Checksum(m_firstSample, brickCount * sizeof(int32_t));
+	header.samplesChecksum = Checksum(m_samples, m_sampleCount * sizeof(float));
+	header.headerChecksum = HeaderChecksum(header);
+
+	// Unique per process and call, so concurrent writers of the same cache never share a file
+	std::string tempName = fileName + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+	FILE* file = fopen(tempName.c_str(), "wb");
+	if (!file)
+		return false;
+
+	// Sections are written in order, zero padding up to each one's offset
+	struct Section
+	{
+		uint64_t offset;
+		const void* data;
+		size_t size;
+	};
+	const Section sections[] = {
+		{ 0, &header, sizeof(header) },
+		{ header.centreOffset, m_centreDistance, brickCount * sizeof(float) },
+		{ header.firstOffset, m_firstSample, brickCount * sizeof(int32_t) },
+		{ header.samplesOffset, m_samples, m_sampleCount * sizeof(float) },
+	};
+	static const uint8_t zeros[g_sectionAlignment] = {};
+	uint64_t written = 0;
+	bool ok = true;
+	for (const Section& section : sections)
+	{
+		ok = ok && fwrite(zeros, 1, size_t(section.offset - written), file) == section.offset - written;
+		ok = ok && fwrite(section.data, 1, section.size, file) == section.size;
+		written = section.offset + section.size;
+	}
+	ok = fclose(file) == 0 && ok;
+
+	if (!ok || !MoveFileOver(tempName, fileName))
+	{
+		remove(tempName.c_str());
+		return false;
+	}
+	return true;
+}
+
+BrickCacheStatus BrickMap::Load(const std::string& fileName, const FractalOptions& params, int resolution, size_t maxBytes, bool verifySamples)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	MappedFile file;
+	if (!file.Open(fileName))
+		return BrickCacheStatus::Missing;
+
+	const uint8_t* data = file.GetData();
+	uint64_t fileSize = file.GetSize();
+
+	// Format
+	BrickFileHeader header;
+	if (fileSize < sizeof(header))
+		return BrickCacheStatus::Corrupt;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, g_fileMagic, sizeof(g_fileMagic)) != 0)
+		return BrickCacheStatus::Corrupt;
+	if (header.version != g_fileVersion || header.headerSize != sizeof(BrickFileHeader))
+		return BrickCacheStatus::Stale;
+	if (header.headerChecksum != HeaderChecksum(header))
+		return BrickCacheStatus::Corrupt;
+
+	// Key, a map dropping bricks is only reused under the cap that dropped them
+	int bricksPerAxis = BricksPerAxis(resolution);
+	if (header.maxIters != params.maxIters || header.escape != params.escape || header.power != params.power
+		|| header.brickSize != g_brickSize || header.extent != g_extent || header.bricksPerAxis != bricksPerAxis)
+		return BrickCacheStatus::Stale;
+
+	size_t brickCount = size_t(bricksPerAxis) * bricksPerAxis * bricksPerAxis;
+	size_t bytes = brickCount * (sizeof(float) + sizeof(int32_t)) + size_t(header.sampleCount) * sizeof(float);
+	if (bytes > maxBytes || (header.droppedBricks > 0 && header.maxBytes != maxBytes))
+		return BrickCacheStatus::Stale;
+
+	// Tables
+	if (!InFile(header.centreOffset, brickCount * sizeof(float), fileSize)
+		|| !InFile(header.firstOffset, brickCount * sizeof(int32_t), fileSize)
+		|| !InFile(header.samplesOffset, header.sampleCount * sizeof(float), fileSize)
+		|| header.sampleCount % g_samplesPerBrick != 0
+		|| header.centreOffset % g_sectionAlignment != 0 || header.firstOffset % g_sectionAlignment != 0 || header.samplesOffset % g_sectionAlignment != 0)
+		return BrickCacheStatus::Corrupt;
+
+	const float* centreDistance = reinterpret_cast<const float*>(data + header.centreOffset);
+	const int32_t* firstSample = reinterpret_cast<const int32_t*>(data + header.firstOffset);
+	const float* samples = reinterpret_cast<const float*>(data + header.samplesOffset);
+	if (Checksum(centreDistance, brickCount * sizeof(float)) != header.centreChecksum
+		|| Checksum(firstSample, brickCount * sizeof(int32_t)) != header.firstChecksum)
+		return BrickCacheStatus::Corrupt;
+	if (verifySamples && Checksum(samples, size_t(header.sampleCount) * sizeof(float)) != header.samplesChecksum)
+		return BrickCacheStatus::Corrupt;
+
+	// The tables checked out, so every index Bound can read is a whole brick inside the samples
+	for (size_t b = 0; b < brickCount; b++)
+	{
+		if (firstSample[b] < -1 || (firstSample[b] >= 0 && uint64_t(firstSample[b]) + g_samplesPerBrick > header.sampleCount))
+			return BrickCacheStatus::Corrupt;
+	}
+
+	// Adopt the mapping
+	m_file.Swap(file);
+	m_builtCentreDistance.clear();
+	m_builtFirstSample.clear();
+	m_builtSamples.clear();
+	m_centreDistance = centreDistance;
+	m_firstSample = firstSample;
+	m_samples = samples;
+	m_sampleCount = size_t(header.sampleCount);
+
+	m_params = params;
+	m_maxBytes = size_t(header.maxBytes);
+	SetLayout(resolution);
+
+	m_stats = {};
+	m_stats.bricks = (long long)brickCount;
+	m_stats.surfaceBricks = header.surfaceBricks;
+	m_stats.droppedBricks = header.droppedBricks;
+	m_stats.bytes = bytes;
+	m_stats.loaded = true;
+	m_stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return BrickCacheStatus::Loaded;
+}
+
+std::string BrickMap::CacheFileName(const FractalOptions& params, int resolution)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "bulb_p%g_i%d_e%g_r%d.bricks", params.power, params.maxIters, params.escape, resolution);
+	return name;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+//------------------------------
+//- brickmap.h
+//------------------------------
+
+// Sparse distance field cache for one fixed fractal. The cube around the bulb is split into
+// bricks of g_brickSize^3 voxels. Every brick keeps the DE at its centre, which bounds the
+// distance anywhere in it by the Lipschitz property. Bricks near the surface also keep DE samples
+// at their voxel corners, interpolated trilinearly. The march steps on these bounds and switches
+// to the exact DE once they fall below GetExactDistance. A map can be saved to a cache file and
+// mapped back in by later processes instead of being rebuilt
+
+// Includes
+#include "kernel.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What the last Build made
+struct BrickMapStats
+{
+	// Bricks per axis cubed, and how many of them hold samples
+	long long bricks = 0;
+	long long surfaceBricks = 0;
+	// Surface bricks left with only their centre distance to stay under the memory cap
+	long long droppedBricks = 0;
+	// Memory held by the map
+	size_t bytes = 0;
+	// Time to build the map, or to map and check it for one loaded from a cache file
+	double buildMs = 0.0;
+	bool loaded = false;
+};
+
+// Outcome of BrickMap::Load
+enum class BrickCacheStatus
+{
+	Loaded,
+	Missing,
+	// Another format version, fractal, resolution or memory cap
+	Stale,
+	// Truncated, or a checksum did not match
+	Corrupt,
+};
+
+const char* BrickCacheStatusName(BrickCacheStatus status);
+
+class BrickMap
+{
+public:
+	// Voxels per brick edge, samples are stored at the g_brickSize + 1 corners along each edge
+	static const int g_brickSize = 8;
+	// Half the edge of the cube the map covers, centred on the origin
+	static constexpr float g_extent = 1.5f;
+
+	// Bumped whenever the cache file layout or what Build samples changes
+	static const uint32_t g_fileVersion = 1;
+
+	// Constructor
+	BrickMap() = default;
+
+	BrickMap(const BrickMap&) = delete;
+	BrickMap& operator=(const BrickMap&) = delete;
+
+	// Sample the DE for params at resolution voxels per axis, rounded up to whole bricks. Surface
+	// bricks nearest the fractal are kept first until maxBytes is reached
+	void Build(ThreadPool& pool, const FractalOptions& params, int resolution, size_t maxBytes);
+
+	// Write the map to fileName through a temporary file, so processes loading it never see a
+	// partial one
+	bool Save(const std::string& fileName) const;
+	// Map a file written by Save for the same Build arguments. The header and brick tables are
+	// always checked, the samples only with verifySamples as that reads every page up front
+	BrickCacheStatus Load(const std::string& fileName, const FractalOptions& params, int resolution, size_t maxBytes, bool verifySamples);
+	// File name keyed by the fractal and resolution, for a directory of caches
+	static std::string CacheFileName(const FractalOptions& params, int resolution);
+
+	// Whether the map was built for params
+	bool Matches(const FractalOptions& params) const;
+
+	// A lower bound on the DE at p
+	float Bound(float3 p) const;
+	// Bounds below this are too loose to step on, use the exact DE
+	float GetExactDistance() const { return m_exactDistance; }
+
+	const BrickMapStats& GetStats() const { return m_stats; }
+	int GetResolution() const { return m_bricksPerAxis * g_brickSize; }
+	const FractalOptions& GetParams() const { return m_params; }
+private:
+	FractalOptions m_params = {};
+	int m_bricksPerAxis = 0;
+	float m_brickEdge = 0.0f;
+	float m_voxelSize = 0.0f;
+	// Furthest a point can be from the voxel corners around it
+	float m_voxelDiagonal = 0.0f;
+	float m_exactDistance = 0.0f;
+
+	// Per brick, the DE at its centre and the first of its samples or -1
+	const float* m_centreDistance = nullptr;
+	const int32_t* m_firstSample = nullptr;
+	// (g_brickSize + 1)^3 samples per surface brick, x fastest
+	const float* m_samples = nullptr;
+	size_t m_sampleCount = 0;
+
+	// What the tables point into, arrays made by Build or a cache file
+	std::vector<float> m_builtCentreDistance;
+	std::vector<int32_t> m_builtFirstSample;
+	std::vector<float> m_builtSamples;
+	MappedFile m_file;
+	// Cap the map was built under, saved so a cache made under another cap is not reused
+	size_t m_maxBytes = 0;
+
+	BrickMapStats m_stats;
+
+	// Bricks per axis for a resolution, and the sizes that follow from it
+	static int BricksPerAxis(int resolution);
+	void SetLayout(int resolution);
+	float3 BrickCentre(int bx, int by, int bz) const;
+};
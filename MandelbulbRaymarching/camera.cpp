@@ -31,69 +31,69 @@ void Camera::SetLens(float fovY, float aspect, float zn, float zf)
 	m_farWindowHeight = 2.0f * m_farZ * tanf(0.5f * m_fovY);
 
 	// Calculate new projection matrix
-	XMMATRIX P = XMMatrixPerspectiveFovLH(m_fovY, m_aspect, m_nearZ, m_farZ);
-	XMStoreFloat4x4(&m_proj, P);
+	m_proj = MatrixPerspectiveFovLH(m_fovY, m_aspect, m_nearZ, m_farZ);
 }
 
 // Transforming
 void Camera::Walk(float d, float deltaTime)
 {
 	// m_position += d * m_look
-	XMVECTOR s = XMVectorReplicate(d * deltaTime);
-	XMVECTOR l = XMLoadFloat3(&m_look);
-	XMVECTOR p = XMLoadFloat3(&m_position);
-	XMStoreFloat3(&m_position, XMVectorMultiplyAdd(s, l, p));
+	m_position += m_look * (d * deltaTime);
 }
 void Camera::Strafe(float d, float deltaTime)
 {
 	// m_position += d * m_right
-	XMVECTOR s = XMVectorReplicate(d * deltaTime);
-	XMVECTOR r = XMLoadFloat3(&m_right);
-	XMVECTOR p = XMLoadFloat3(&m_position);
-	XMStoreFloat3(&m_position, XMVectorMultiplyAdd(s, r, p));
+	m_position += m_right * (d * deltaTime);
 }
 void Camera::Pitch(float angle)
 {
 	// Rotate up and look vector about the right vector
-	XMMATRIX R = XMMatrixRotationAxis(XMLoadFloat3(&m_right), angle);
-	XMStoreFloat3(&m_up, XMVector3TransformNormal(XMLoadFloat3(&m_up),
-		R));
-	XMStoreFloat3(&m_look, XMVector3TransformNormal(XMLoadFloat3(&m_look),
-		R));
+	float4x4 R = MatrixRotationAxis(m_right, angle);
+	m_up = TransformNormal(m_up, R);
+	m_look = TransformNormal(m_look, R);
 }
 void Camera::RotateY(float angle)
 {
 	// Rotate the basis vectors about the world y-axis
-	XMMATRIX R = XMMatrixRotationY(angle);
-	XMStoreFloat3(&m_right, XMVector3TransformNormal(XMLoadFloat3(&m_right), R));
-	XMStoreFloat3(&m_up, XMVector3TransformNormal(XMLoadFloat3(&m_up), R));
-	XMStoreFloat3(&m_look, XMVector3TransformNormal(XMLoadFloat3(&m_look), R));
+	float4x4 R = MatrixRotationY(angle);
+	m_right = TransformNormal(m_right, R);
+	m_up = TransformNormal(m_up, R);
+	m_look = TransformNormal(m_look, R);
+}
+
+// Page 548
+void Camera::LookAt(float3 pos, float3 target, float3 worldUp)
+{
+	m_look = normalize(target - pos);
+	m_right = normalize(cross(worldUp, m_look));
+	m_up = cross(m_look, m_right);
+	m_position = pos;
 }
 
 // Constructing view matrix
 // Page 546
 void Camera::UpdateViewMatrix()
 {
-	XMVECTOR R = XMLoadFloat3(&m_right);
-	XMVECTOR U = XMLoadFloat3(&m_up);
-	XMVECTOR L = XMLoadFloat3(&m_look);
-	XMVECTOR P = XMLoadFloat3(&m_position);
+	float3 R = m_right;
+	float3 U = m_up;
+	float3 L = m_look;
+	float3 P = m_position;
 
 	// Keep cameras axes orthogonal to each other and of unit length
-	L = XMVector3Normalize(L);
-	U = XMVector3Normalize(XMVector3Cross(L, R));
+	L = normalize(L);
+	U = normalize(cross(L, R));
 
 	// U, L already ortho-normal, so no need to normalize cross product
-	R = XMVector3Cross(U, L);
+	R = cross(U, L);
 
 	// Fill in the view matrix entries
-	float x = -XMVectorGetX(XMVector3Dot(P, R));
-	float y = -XMVectorGetX(XMVector3Dot(P, U));
-	float z = -XMVectorGetX(XMVector3Dot(P, L));
+	float x = -dot(P, R);
+	float y = -dot(P, U);
+	float z = -dot(P, L);
 
-	XMStoreFloat3(&m_right, R);
-	XMStoreFloat3(&m_up, U);
-	XMStoreFloat3(&m_look, L);
+	m_right = R;
+	m_up = U;
+	m_look = L;
 
 	// Constructing matrix, 1st row is right then X, 2nd row up then Z, 3rd look then Z, and 4th same as identity. (Maybe column not row)
 	m_view(0, 0) = m_right.x;
@@ -5,19 +5,17 @@
 //------------------------------
 
 // Includes
-#include <DirectXMath.h>
-
-using namespace DirectX;
+#include "hlslmath.h"
 
 class Camera
 {
 public:
 	// Coords and dir
-	XMFLOAT3 m_position = { -1.3084f, 0.0610f, -2.8699f };
-	XMFLOAT3 m_right = { 0.9063f, 0.0f, -0.4226f };
-	XMFLOAT3 m_up = { 0.0221f, 0.9986f, 0.0474f };
+	float3 m_position = { -1.3084f, 0.0610f, -2.8699f };
+	float3 m_right = { 0.9063f, 0.0f, -0.4226f };
+	float3 m_up = { 0.0221f, 0.9986f, 0.0474f };
 	// Look dir
-	XMFLOAT3 m_look = { 0.422039f, -0.052336f, 0.905065f };
+	float3 m_look = { 0.422039f, -0.052336f, 0.905065f };
 
 	// Used for view frustum calculation
 	float m_nearZ = 0.0f;
@@ -28,19 +26,8 @@ public:
 	float m_farWindowHeight = 0.0f;
 
 	// View and projection matrices
-	XMFLOAT4X4 m_view = XMFLOAT4X4(
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f,
-		0.0f, 0.0f, 0.0f, 1.0f
-	);
-
-	XMFLOAT4X4 m_proj = XMFLOAT4X4(
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f,
-		0.0f, 0.0f, 0.0f, 1.0f
-	);
+	float4x4 m_view = MatrixIdentity();
+	float4x4 m_proj = MatrixIdentity();
 
 	// Constructor
 	Camera();
@@ -59,6 +46,9 @@ public:
 	void Pitch(float angle);
 	void RotateY(float angle);
 
+	// Point the camera at a target, used by the headless tools
+	void LookAt(float3 pos, float3 target, float3 worldUp);
+
 	// Rebuild view matrix
 	void UpdateViewMatrix();
 };
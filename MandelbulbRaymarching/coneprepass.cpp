@@ -0,0 +1,160 @@
+//------------------------------
+//- coneprepass.cpp
+//------------------------------
+
+// Includes
+#include "coneprepass.h"
+#include "kernel_simd.h"
+
+#include <atomic>
+#include <initializer_list>
+
+// Cones marched together, as in MarchRays
+static const int g_coneBatch = 64;
+
+// Stop once the cone's radius eats this much of the distance bound, finer levels take over
+static const float g_coneStopFraction = 0.75f;
+
+// Constructor
+ConePrepass::ConePrepass(ThreadPool& pool) : m_pool(pool)
+{
+
+}
+
+void ConePrepass::Run(const FrameConstants& constants, const FrameSetup& setup)
+{
+	int width = constants.screenWidth;
+	int height = constants.screenHeight;
+
+	m_stats = ConePrepassStats();
+	for (int l = 0; l < g_levelCount; l++)
+	{
+		Level& level = m_levels[l];
+		level.blockSize = g_coarsestBlock >> l;
+		level.width = (width + level.blockSize - 1) / level.blockSize;
+		level.height = (height + level.blockSize - 1) / level.blockSize;
+		level.depth.assign(size_t(level.width) * level.height, 0.0f);
+		level.steps.assign(size_t(level.width) * level.height, 0.0f);
+
+		int count = level.width * level.height;
+		int batches = (count + g_coneBatch - 1) / g_coneBatch;
+		std::atomic<long long> steps{ 0 };
+		m_pool.ParallelFor(batches, [&](int batch) {
+			int first = batch * g_coneBatch;
+			int last = first + g_coneBatch < count ? first + g_coneBatch : count;
+			steps += MarchCones(constants, setup, l, first, last);
+		});
+
+		m_stats.cones += count;
+		m_stats.coneSteps += steps;
+	}
+
+	// Every pixel inherits the steps of its 2x2 block and that block's ancestors
+	const Level& finest = m_levels[g_levelCount - 1];
+	for (int by = 0; by < finest.height; by++)
+	{
+		int rows = height - by * finest.blockSize < finest.blockSize ? height - by * finest.blockSize : finest.blockSize;
+		for (int bx = 0; bx < finest.width; bx++)
+		{
+			int columns = width - bx * finest.blockSize < finest.blockSize ? width - bx * finest.blockSize : finest.blockSize;
+			m_stats.inheritedSteps += (long long)(finest.steps[size_t(by) * finest.width + bx] * float(rows * columns) + 0.5f);
+		}
+	}
+}
+
+long long ConePrepass::MarchCones(const FrameConstants& constants, const FrameSetup& setup, int levelIndex, int first, int last)
+{
+	Level& level = m_levels[levelIndex];
+	const Level* parent = levelIndex > 0 ? &m_levels[levelIndex - 1] : nullptr;
+	int width = constants.screenWidth;
+	int height = constants.screenHeight;
+	int count = last - first;
+
+	float3 dir[g_coneBatch];
+	float slope[g_coneBatch], depth[g_coneBatch], steps[g_coneBatch];
+	int active[g_coneBatch];
+	float px[g_coneBatch], py[g_coneBatch], pz[g_coneBatch], dist[g_coneBatch];
+
+	for (int i = 0; i < count; i++)
+	{
+		int bx = (first + i) % level.width;
+		int by = (first + i) / level.width;
+		float x0 = float(bx * level.blockSize);
+		float y0 = float(by * level.blockSize);
+		float x1 = float((bx + 1) * level.blockSize < width ? (bx + 1) * level.blockSize : width);
+		float y1 = float((by + 1) * level.blockSize < height ? (by + 1) * level.blockSize : height);
+
+		// Centre ray of the block
+		float2 centre = { (x0 + x1) * 0.5f, (y0 + y1) * 0.5f };
+		dir[i] = CreateCamRay(PixelToUV(constants, centre), constants.projInverse, constants.viewInverse, constants.camPos).dir;
+
+		// Every ray through the block is within slope * t of the centre ray at distance t.
+		// The directions make a convex region, so checking the corners is enough
+		slope[i] = 0.0f;
+		for (float2 corner : { float2{ x0, y0 }, float2{ x1, y0 }, float2{ x0, y1 }, float2{ x1, y1 } })
+		{
+			float3 cornerDir = CreateCamRay(PixelToUV(constants, corner), constants.projInverse, constants.viewInverse, constants.camPos).dir;
+			float spread = length(cornerDir - dir[i]);
+			slope[i] = spread > slope[i] ? spread : slope[i];
+		}
+
+		// Start where the parent cone stopped
+		depth[i] = 0.0f;
+		steps[i] = 0.0f;
+		if (parent)
+		{
+			size_t p = size_t(by / 2) * parent->width + bx / 2;
+			depth[i] = parent->depth[p];
+			steps[i] = parent->steps[p];
+		}
+		active[i] = i;
+	}
+
+	long long taken = 0;
+	int activeCount = count;
+	for (int iter = 0; iter < setup.maxIters && activeCount > 0; iter++)
+	{
+		for (int k = 0; k < activeCount; k++)
+		{
+			int i = active[k];
+			float3 pos = constants.camPos + dir[i] * depth[i];
+			px[k] = pos.x;
+			py[k] = pos.y;
+			pz[k] = pos.z;
+		}
+
+		DistToScenePacket(px, py, pz, activeCount, setup.params, dist);
+		taken += activeCount;
+
+		int kept = 0;
+		for (int k = 0; k < activeCount; k++)
+		{
+			int i = active[k];
+
+			// Leaving the Mandelbulb range, every ray in the cone misses
+			float3 pos = { px[k], py[k], pz[k] };
+			if (length(pos) > 2.5f && dot(pos, dir[i]) > 0.0f)
+				continue;
+
+			// Close enough that the cone is too wide to step usefully
+			float radius = slope[i] * depth[i];
+			if (dist[k] < setup.minDist || radius > dist[k] * g_coneStopFraction)
+				continue;
+
+			// Safe for every ray in the cone. A lone ray would have stepped the whole distance
+			// bound, so this counts as the fraction of a ray step it covers
+			depth[i] += dist[k] - radius;
+			steps[i] += (dist[k] - radius) / dist[k];
+			active[kept++] = i;
+		}
+		activeCount = kept;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		level.depth[first + i] = depth[i];
+		level.steps[first + i] = steps[i];
+	}
+
+	return taken;
+}
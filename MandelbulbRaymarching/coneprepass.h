@@ -0,0 +1,72 @@
+#pragma once
+
+//------------------------------
+//- coneprepass.h
+//------------------------------
+
+// Hierarchical cone marching. A cone covering a block of pixels can step as far as the
+// distance bound minus the cone's radius, so one march over the empty space in front of the
+// fractal is shared by every pixel in the block. Blocks of 8x8, 4x4 and 2x2 pixels are marched
+// in turn, each starting at the depth its parent reached, and pixels start at their 2x2 depth
+
+// Includes
+#include "kernel.h"
+#include "threadpool.h"
+
+#include <vector>
+
+// What the prepass did for one frame
+struct ConePrepassStats
+{
+	// Cones marched over all levels
+	long long cones = 0;
+	// DistToScene evaluations spent on cones
+	long long coneSteps = 0;
+	// Estimated steps each pixel would have spent reaching its start depth, summed over pixels
+	long long inheritedSteps = 0;
+
+	// Net march steps saved this frame
+	long long SavedSteps() const { return inheritedSteps - coneSteps; }
+};
+
+class ConePrepass
+{
+public:
+	// Block edge of the coarsest level, halved for each finer level down to 2x2
+	static const int g_coarsestBlock = 8;
+	static const int g_levelCount = 3;
+
+	// Constructor
+	ConePrepass(ThreadPool& pool);
+
+	// March every level for a frame
+	void Run(const FrameConstants& constants, const FrameSetup& setup);
+
+	// Distance along pixel (x, y)'s ray known to be empty, valid after Run
+	float GetStartDepth(int x, int y) const
+	{
+		const Level& finest = m_levels[g_levelCount - 1];
+		return finest.depth[size_t(y / finest.blockSize) * finest.width + x / finest.blockSize];
+	}
+
+	// Statistics from the last Run
+	const ConePrepassStats& GetStats() const { return m_stats; }
+private:
+	// Depths for one block size
+	struct Level
+	{
+		int blockSize = 0;
+		int width = 0;
+		int height = 0;
+		std::vector<float> depth;
+		// Steps a single ray would have needed to reach the depth
+		std::vector<float> steps;
+	};
+
+	ThreadPool& m_pool;
+	Level m_levels[g_levelCount];
+	ConePrepassStats m_stats;
+
+	// March cones [first, last) of a level, returns the steps taken
+	long long MarchCones(const FrameConstants& constants, const FrameSetup& setup, int levelIndex, int first, int last);
+};
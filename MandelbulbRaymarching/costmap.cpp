@@ -0,0 +1,197 @@
+//------------------------------
+//- costmap.cpp
+//------------------------------
+
+// Includes
+#include "costmap.h"
+#include "cpurenderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// Histogram buckets per counter in the JSON
+static const int g_histogramBuckets = 32;
+
+#if defined(MANDELBULB_PIXEL_COST)
+thread_local uint32_t* t_pixelCost = nullptr;
+thread_local PixelCounter t_pixelCostSteps = PixelCounter::MarchSteps;
+thread_local PixelCounter t_pixelCostIterations = PixelCounter::MarchIterations;
+#endif
+
+const char* PixelCounterName(PixelCounter counter)
+{
+	switch (counter)
+	{
+	case PixelCounter::MarchSteps:
+		return "march_steps";
+	case PixelCounter::MarchIterations:
+		return "march_iterations";
+	case PixelCounter::NormalEvaluations:
+		return "normal_evaluations";
+	case PixelCounter::NormalIterations:
+		return "normal_iterations";
+	case PixelCounter::ShadowSteps0:
+		return "shadow_steps_light0";
+	case PixelCounter::ShadowSteps1:
+		return "shadow_steps_light1";
+	case PixelCounter::ShadowSteps2:
+		return "shadow_steps_light2";
+	case PixelCounter::ShadowIterations:
+		return "shadow_iterations";
+	default:
+		return "unknown";
+	}
+}
+
+bool PixelCostMap::IsEnabled()
+{
+#if defined(MANDELBULB_PIXEL_COST)
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool PixelCostMap::Render(ThreadPool& pool, const FrameConstants& constants, Image& image)
+{
+#if defined(MANDELBULB_PIXEL_COST)
+	m_width = constants.screenWidth;
+	m_height = constants.screenHeight;
+	m_counts.assign(size_t(m_width) * m_height * g_pixelCounterCount, 0);
+	image.Resize(m_width, m_height);
+
+	FrameSetup setup = CreateFrameSetup(constants);
+	auto start = std::chrono::steady_clock::now();
+	pool.ParallelFor(m_height, [&](int y) {
+		uint8_t* row = image.Row(y);
+		for (int x = 0; x < m_width; x++)
+		{
+			t_pixelCost = &m_counts[(size_t(y) * m_width + x) * g_pixelCounterCount];
+			StorePixel(row + size_t(x) * 3, ShadePixel(constants, setup, float2{ x + 0.5f, y + 0.5f }));
+		}
+		t_pixelCost = nullptr;
+	});
+	m_renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return true;
+#else
+	(void)pool;
+	(void)constants;
+	(void)image;
+	return false;
+#endif
+}
+
+uint64_t PixelCostMap::GetTotal(PixelCounter counter) const
+{
+	uint64_t total = 0;
+	for (size_t i = size_t(counter); i < m_counts.size(); i += g_pixelCounterCount)
+		total += m_counts[i];
+	return total;
+}
+
+std::vector<uint32_t> PixelCostMap::Sorted(PixelCounter counter) const
+{
+	std::vector<uint32_t> values;
+	values.reserve(m_counts.size() / g_pixelCounterCount);
+	for (size_t i = size_t(counter); i < m_counts.size(); i += g_pixelCounterCount)
+		values.push_back(m_counts[i]);
+	std::sort(values.begin(), values.end());
+	return values;
+}
+
+// Nearest rank percentile of sorted values
+static uint32_t Percentile(const std::vector<uint32_t>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	size_t rank = size_t(p / 100.0 * double(sorted.size()) + 0.5);
+	rank = rank > 0 ? rank - 1 : 0;
+	return sorted[rank < sorted.size() ? rank : sorted.size() - 1];
+}
+
+uint32_t PixelCostMap::GetPercentile(PixelCounter counter, double p) const
+{
+	return Percentile(Sorted(counter), p);
+}
+
+void PixelCostMap::Heatmap(PixelCounter counter, Image& image) const
+{
+	// Black, blue, red, yellow, white
+	static const float3 ramp[] = {
+		{ 0.0f, 0.0f, 0.0f },
+		{ 0.1f, 0.1f, 0.8f },
+		{ 0.9f, 0.1f, 0.1f },
+		{ 1.0f, 0.9f, 0.1f },
+		{ 1.0f, 1.0f, 1.0f },
+	};
+	const int stops = int(sizeof(ramp) / sizeof(ramp[0]));
+
+	uint32_t top = GetPercentile(counter, 99.0);
+	float scale = top > 0 ? 1.0f / float(top) : 0.0f;
+
+	image.Resize(m_width, m_height);
+	for (int y = 0; y < m_height; y++)
+	{
+		uint8_t* row = image.Row(y);
+		for (int x = 0; x < m_width; x++)
+		{
+			uint32_t count = m_counts[(size_t(y) * m_width + x) * g_pixelCounterCount + size_t(counter)];
+			float t = std::min(float(count) * scale, 1.0f) * float(stops - 1);
+			int stop = std::min(int(t), stops - 2);
+			StorePixel(row + size_t(x) * 3, lerp(ramp[stop], ramp[stop + 1], t - float(stop)));
+		}
+	}
+}
+
+bool PixelCostMap::WriteJson(const std::string& fileName) const
+{
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (!file)
+		return false;
+
+	double pixels = double(m_width) * m_height;
+	fprintf(file, "{\n");
+	fprintf(file, "  \"width\": %d,\n", m_width);
+	fprintf(file, "  \"height\": %d,\n", m_height);
+	fprintf(file, "  \"render_ms\": %.3f,\n", m_renderMs);
+
+	// Where the DE's orbit iterations, which dominate the cost, were spent
+	double march = double(GetTotal(PixelCounter::MarchIterations));
+	double normal = double(GetTotal(PixelCounter::NormalIterations));
+	double shadow = double(GetTotal(PixelCounter::ShadowIterations));
+	double iterations = std::max(march + normal + shadow, 1.0);
+	fprintf(file, "  \"iteration_share\": { \"march\": %.4f, \"normal\": %.4f, \"shadow\": %.4f },\n",
+		march / iterations, normal / iterations, shadow / iterations);
+
+	fprintf(file, "  \"counters\": {\n");
+	for (int c = 0; c < g_pixelCounterCount; c++)
+	{
+		PixelCounter counter = PixelCounter(c);
+		std::vector<uint32_t> sorted = Sorted(counter);
+		uint32_t maximum = sorted.empty() ? 0 : sorted.back();
+
+		// Equal width buckets covering 0 to the maximum
+		uint32_t bucketWidth = maximum / g_histogramBuckets + 1;
+		uint64_t histogram[g_histogramBuckets] = {};
+		for (uint32_t value : sorted)
+			histogram[value / bucketWidth]++;
+
+		fprintf(file, "    \"%s\": {\n", PixelCounterName(counter));
+		fprintf(file, "      \"total\": %llu,\n", (unsigned long long)GetTotal(counter));
+		fprintf(file, "      \"mean\": %.4f,\n", double(GetTotal(counter)) / std::max(pixels, 1.0));
+		fprintf(file, "      \"min\": %u,\n", sorted.empty() ? 0u : sorted.front());
+		fprintf(file, "      \"p50\": %u,\n", Percentile(sorted, 50.0));
+		fprintf(file, "      \"p90\": %u,\n", Percentile(sorted, 90.0));
+		fprintf(file, "      \"p99\": %u,\n", Percentile(sorted, 99.0));
+		fprintf(file, "      \"max\": %u,\n", maximum);
+		fprintf(file, "      \"histogram\": { \"bucket_width\": %u, \"counts\": [", bucketWidth);
+		for (int b = 0; b < g_histogramBuckets; b++)
+			fprintf(file, "%s%llu", b ? ", " : "", (unsigned long long)histogram[b]);
+		fprintf(file, "] }\n");
+		fprintf(file, "    }%s\n", c + 1 < g_pixelCounterCount ? "," : "");
+	}
+	fprintf(file, "  }\n}\n");
+
+	return fclose(file) == 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+//------------------------------
+//- costmap.h
+//------------------------------
+
+// Renders a frame with the pixel cost counters from pixelcost.h running and keeps every pixel's
+// counts, for heatmaps and for totals, histograms and percentiles as JSON. Only builds with
+// MANDELBULB_PIXEL_COST count anything
+
+// Includes
+#include "kernel.h"
+#include "pixelcost.h"
+#include "pngwriter.h"
+#include "threadpool.h"
+
+#include <string>
+#include <vector>
+
+class PixelCostMap
+{
+public:
+	// Constructor
+	PixelCostMap() = default;
+
+	// Whether this build has the counters compiled in
+	static bool IsEnabled();
+
+	// Shade every pixel of constants on its own through ShadePixel so each pixel's work is
+	// counted on its own, ignoring pixelStep. False when the build has no counters
+	bool Render(ThreadPool& pool, const FrameConstants& constants, Image& image);
+
+	// Sum of counter over the frame
+	uint64_t GetTotal(PixelCounter counter) const;
+	// Smallest count at or above p percent of the pixels, p in [0, 100]
+	uint32_t GetPercentile(PixelCounter counter, double p) const;
+	double GetRenderMs() const { return m_renderMs; }
+
+	// counter from black at zero through blue, red and yellow to white at the 99th percentile,
+	// so a few extreme pixels do not flatten the rest
+	void Heatmap(PixelCounter counter, Image& image) const;
+	// Totals, means, percentiles and a histogram of every counter
+	bool WriteJson(const std::string& fileName) const;
+private:
+	int m_width = 0;
+	int m_height = 0;
+	// g_pixelCounterCount counters per pixel, rows top to bottom
+	std::vector<uint32_t> m_counts;
+	double m_renderMs = 0.0;
+
+	// counter for every pixel, sorted
+	std::vector<uint32_t> Sorted(PixelCounter counter) const;
+};
@@ -0,0 +1,37 @@
+//------------------------------
+//- cpubackend.cpp
+//------------------------------
+
+// Includes
+#include "cpubackend.h"
+
+// Constructor
+CpuBackend::CpuBackend(ThreadPool& pool, int width, int height) : m_renderer(pool), m_width(width), m_height(height)
+{
+
+}
+
+void CpuBackend::UploadConstants(const FrameConstants& constants)
+{
+	m_constants = constants;
+}
+
+void CpuBackend::Draw()
+{
+	m_renderer.Render(m_constants, m_image);
+}
+
+bool CpuBackend::Readback(Image& image)
+{
+	if (m_image.pixels.empty())
+		return false;
+
+	image = m_image;
+	return true;
+}
+
+void CpuBackend::Resize(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+}
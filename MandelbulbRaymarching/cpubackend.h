@@ -0,0 +1,60 @@
+#pragma once
+
+//------------------------------
+//- cpubackend.h
+//------------------------------
+
+// Includes
+#include "backend.h"
+#include "cpurenderer.h"
+
+// Shades every frame with CpuRenderer into an in-memory image
+class CpuBackend : public RenderBackend
+{
+public:
+	// Constructor
+	CpuBackend(ThreadPool& pool, int width, int height);
+
+	const char* GetName() const override { return "cpu"; }
+	int GetWidth() const override { return m_width; }
+	int GetHeight() const override { return m_height; }
+
+	void UploadConstants(const FrameConstants& constants) override;
+	void Draw() override;
+	bool Readback(Image& image) override;
+
+	// Change the output size, takes effect on the next frame
+	void Resize(int width, int height);
+
+	// The renderer, so callers can change the tile size
+	CpuRenderer& GetRenderer() { return m_renderer; }
+private:
+	CpuRenderer m_renderer;
+	FrameConstants m_constants = {};
+	Image m_image;
+	int m_width;
+	int m_height;
+};
+
+// Accepts constants and draws nothing, isolates the per frame CPU cost of the frame loop
+class NullBackend : public RenderBackend
+{
+public:
+	// Constructor
+	NullBackend(int width, int height) : m_width(width), m_height(height) {}
+
+	const char* GetName() const override { return "null"; }
+	int GetWidth() const override { return m_width; }
+	int GetHeight() const override { return m_height; }
+
+	void UploadConstants(const FrameConstants& constants) override { m_constants = constants; }
+	void Draw() override {}
+	bool Readback(Image&) override { return false; }
+
+	// Last constants uploaded
+	const FrameConstants& GetConstants() const { return m_constants; }
+private:
+	FrameConstants m_constants = {};
+	int m_width;
+	int m_height;
+};
@@ -0,0 +1,487 @@
+//------------------------------
+//- cpurenderer.cpp
+//------------------------------
+
+// Includes
+#include "cpurenderer.h"
+#include "kernel_simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+// Neighbouring hits further apart than this fraction of the nearer one's depth, or with normals
+// whose cosine is below this, are on different surfaces
+static const float g_edgeDepthThreshold = 0.05f;
+static const float g_edgeNormalThreshold = 0.9f;
+// Largest channel difference to a neighbour, out of 1, that refines a pixel without an edge
+static const float g_edgeContrastThreshold = 0.1f;
+// Refined pixels each task traces together
+static const int g_antialiasChunk = 32;
+
+// D3D11 standard sample positions in sixteenths of a pixel, y down
+static const int g_msaaPattern4[4][2] = { { -2, -6 }, { 6, -2 }, { -6, 2 }, { 2, 6 } };
+static const int g_msaaPattern8[8][2] = { { 1, -3 }, { -1, 3 }, { 5, 1 }, { -3, -5 }, { -5, 5 }, { -7, -1 }, { 3, 7 }, { 7, -7 } };
+
+FrameConstants CreateFrameConstants(Camera& camera, int width, int height)
+{
+	FrameConstants constants = {};
+
+	camera.UpdateViewMatrix();
+
+	// Same matrices Renderer::Update hands to the shader
+	constants.projInverse = MatrixInverse(camera.m_proj);
+	constants.viewInverse = MatrixInverse(camera.m_view);
+	constants.camPos = camera.m_position;
+	constants.view = camera.m_view;
+	constants.proj = camera.m_proj;
+
+	constants.screenWidth = width;
+	constants.screenHeight = height;
+	constants.pixelStep = 1;
+
+	// Defaults match a freshly opened window
+	constants.colour1 = { 255.0f, 255.0f, 255.0f };
+	constants.colour2 = { 255.0f, 255.0f, 255.0f };
+
+	return constants;
+}
+
+// Whether two frames see the same fractal from the same camera, so only quality and pixel step differ
+static bool SameView(const FrameConstants& a, const FrameConstants& b)
+{
+	return memcmp(&a.projInverse, &b.projInverse, sizeof(a.projInverse)) == 0
+		&& memcmp(&a.viewInverse, &b.viewInverse, sizeof(a.viewInverse)) == 0
+		&& memcmp(&a.camPos, &b.camPos, sizeof(a.camPos)) == 0
+		&& memcmp(&a.colour1, &b.colour1, sizeof(a.colour1)) == 0
+		&& memcmp(&a.colour2, &b.colour2, sizeof(a.colour2)) == 0
+		&& a.screenWidth == b.screenWidth && a.screenHeight == b.screenHeight
+		&& !a.animated && !b.animated;
+}
+
+// Constructor
+CpuRenderer::CpuRenderer(ThreadPool& pool) : m_pool(pool), m_prepass(pool), m_history(pool)
+{
+
+}
+
+void CpuRenderer::Render(const FrameConstants& constants, Image& image)
+{
+	Render(constants, CreateFrameSetup(constants), image);
+}
+
+void CpuRenderer::Render(const FrameConstants& constants, const FrameSetup& setup, Image& image)
+{
+	int width = constants.screenWidth;
+	int height = constants.screenHeight;
+	int step = constants.pixelStep > 1 ? constants.pixelStep : 1;
+
+	// Refinement passes keep the pixels of the last one, so only clear the image for a new size
+	if (image.width != width || image.height != height)
+		image.Resize(width, height);
+
+	// Pixels earlier passes of this view left behind
+	bool sameView = m_refinedPixels.size() == size_t(width) * height && SameView(m_refinedConstants, constants);
+	if (m_progressive && !sameView)
+		m_refinedPixels.assign(size_t(width) * height, RefinedPixel());
+	m_refinedConstants = constants;
+	m_marchedPixels = 0;
+	m_resumedPixels = 0;
+	m_reusedPixels = 0;
+
+	// The anti-aliasing pass needs every pixel's first pass hit
+	m_antialiasStats = {};
+	m_recordEdges = (m_antialias.budget > 0.0f || m_antialias.everyPixel) && step == 1 && !m_progressive;
+	if (m_recordEdges)
+		m_edgePixels.resize(size_t(width) * height);
+
+	// Depths every tile starts from
+	m_prepassValid = m_conePrepass;
+	if (m_conePrepass)
+		m_prepass.Run(constants, setup);
+
+	m_recordHistory = m_reprojection;
+	m_historyValid = m_reprojection && m_history.Reproject(constants, setup);
+	if (m_reprojection)
+		m_history.BeginFrame(constants);
+	BeginRegions(setup);
+
+	int tilesX = (width + m_tileSize - 1) / m_tileSize;
+	int tilesY = (height + m_tileSize - 1) / m_tileSize;
+
+	m_pool.ParallelFor(tilesX * tilesY, [&](int tile) {
+		int x0 = (tile % tilesX) * m_tileSize;
+		int y0 = (tile / tilesX) * m_tileSize;
+		int x1 = x0 + m_tileSize < width ? x0 + m_tileSize : width;
+		int y1 = y0 + m_tileSize < height ? y0 + m_tileSize : height;
+		RenderRegion(constants, setup, x0, y0, x1, y1, image);
+	});
+
+	if (m_recordEdges)
+		Antialias(constants, setup, image);
+	m_recordEdges = false;
+
+	// Pixels that have never been marched take the colour of their block's marched pixel
+	if (step > 1)
+	{
+		m_pool.ParallelFor(height, [&](int y) {
+			uint8_t* row = image.Row(y);
+			const uint8_t* source = image.Row(y - y % step);
+			for (int x = 0; x < width; x++)
+			{
+				if ((x % step == 0 && y % step == 0) || (m_progressive && m_refinedPixels[size_t(y) * width + x].quality >= 0))
+					continue;
+
+				memcpy(row + size_t(x) * 3, source + size_t(x - x % step) * 3, 3);
+			}
+		});
+	}
+
+	if (m_reprojection)
+		m_history.EndFrame(constants, setup);
+	m_prepassValid = false;
+	m_recordHistory = false;
+	m_historyValid = false;
+	EndRegions();
+}
+
+void CpuRenderer::BeginRegions(const FrameSetup& setup)
+{
+	m_marchSteps = 0;
+	m_cacheSteps = 0;
+	m_shadowRays = 0;
+	m_culledShadows = 0;
+	m_shadowSteps = 0;
+	m_activeBrickMap = m_brickMap && m_brickMap->Matches(setup.params) ? m_brickMap : nullptr;
+	if (m_shadowCache)
+		m_shadowCache->BeginFrame(setup);
+}
+
+void CpuRenderer::EndRegions()
+{
+	m_activeBrickMap = nullptr;
+}
+
+ShadowStats CpuRenderer::GetShadowStats() const
+{
+	ShadowStats stats;
+	stats.rays = m_shadowRays;
+	stats.culled = m_culledShadows;
+	stats.steps = m_shadowSteps;
+	return stats;
+}
+
+void CpuRenderer::RenderRegion(const FrameConstants& constants, const FrameSetup& setup, int x0, int y0, int x1, int y1, Image& image,
+	int originX, int originY)
+{
+	int step = constants.pixelStep > 1 ? constants.pixelStep : 1;
+	int firstX = x0 + (step - x0 % step) % step;
+	int firstY = y0 + (step - y0 % step) % step;
+	int columns = firstX < x1 ? (x1 - firstX + step - 1) / step : 0;
+	int rows = firstY < y1 ? (y1 - firstY + step - 1) / step : 0;
+
+	// The whole region goes through each stage as one stream unless marched a row at a time
+	int batchRows = m_wavefront ? rows : 1;
+	int capacity = columns * (batchRows > 0 ? batchRows : 1);
+	std::vector<int> xs(capacity), ys(capacity);
+	std::vector<Ray> rays(capacity);
+	std::vector<float2> uvs(capacity);
+	std::vector<MarchResult> results(capacity);
+	std::vector<float3> colours(capacity);
+	std::vector<float3> normals(m_recordEdges ? capacity : 0);
+	std::vector<float> startDepth(capacity, 0.0f);
+	bool hasStart = m_prepassValid || m_historyValid || m_progressive;
+
+	long long steps = 0;
+	long long cacheSteps = 0;
+	ShadowStats shadowStats;
+	long long marched = 0;
+	long long resumed = 0;
+	long long reused = 0;
+
+	for (int firstRow = 0; firstRow < rows; firstRow += batchRows)
+	{
+		// Gather the pixels of these rows that need marching
+		int rayCount = 0;
+		for (int y = firstY + firstRow * step; y < y1 && y < firstY + (firstRow + batchRows) * step; y += step)
+		{
+			for (int x = firstX; x < x1; x += step)
+			{
+				float start = m_prepassValid ? m_prepass.GetStartDepth(x, y) : 0.0f;
+				if (m_historyValid && m_history.GetStartDepth(x, y) > start)
+					start = m_history.GetStartDepth(x, y);
+
+				if (m_progressive)
+				{
+					// Already at this quality, or escaped the fractal at any quality
+					RefinedPixel& refined = m_refinedPixels[size_t(y) * constants.screenWidth + x];
+					if (refined.quality == constants.quality || (refined.quality >= 0 && refined.escaped))
+					{
+						refined.quality = constants.quality;
+						if (m_recordHistory)
+							m_history.Record(x, y, refined.hit ? refined.depth : -1.0f);
+						reused++;
+						continue;
+					}
+
+					// A lower quality march stopped on the way, a higher quality one starts over
+					if (refined.quality >= 0 && refined.quality < constants.quality)
+					{
+						if (refined.depth > start)
+							start = refined.depth;
+						resumed++;
+					}
+					else
+					{
+						marched++;
+					}
+				}
+				else
+				{
+					marched++;
+				}
+
+				// SV_POSITION holds the pixel centre
+				xs[rayCount] = x;
+				ys[rayCount] = y;
+				uvs[rayCount] = PixelToUV(constants, float2{ x + 0.5f, y + 0.5f });
+				rays[rayCount] = CreateCamRay(uvs[rayCount], constants.projInverse, constants.viewInverse, constants.camPos);
+				startDepth[rayCount] = start;
+				rayCount++;
+			}
+		}
+
+		TraceRays(setup, rays.data(), uvs.data(), rayCount, hasStart ? startDepth.data() : nullptr, results.data(), colours.data(),
+			m_recordEdges ? normals.data() : nullptr, shadowStats);
+
+		// Keep what later frames and passes need
+		for (int i = 0; i < rayCount; i++)
+		{
+			steps += results[i].steps;
+			cacheSteps += results[i].cacheSteps;
+			if (m_recordHistory)
+				m_history.Record(xs[i], ys[i], results[i].hit ? results[i].totalDistance : -1.0f);
+
+			if (m_progressive)
+			{
+				RefinedPixel& refined = m_refinedPixels[size_t(ys[i]) * constants.screenWidth + xs[i]];
+				refined.quality = constants.quality;
+				refined.depth = results[i].totalDistance;
+				refined.hit = results[i].hit;
+				refined.escaped = !results[i].hit && length(results[i].pos) > setup.boundingRadius;
+			}
+
+			if (m_recordEdges)
+			{
+				EdgePixel& edge = m_edgePixels[size_t(ys[i]) * constants.screenWidth + xs[i]];
+				edge.depth = results[i].hit ? results[i].totalDistance : -1.0f;
+				edge.normal = normals[i];
+				edge.colour = saturate(colours[i]);
+			}
+
+			StorePixel(image.Row(ys[i] - originY) + size_t(xs[i] - originX) * 3, saturate(colours[i]));
+		}
+	}
+
+	m_marchSteps += steps;
+	m_cacheSteps += cacheSteps;
+	m_shadowRays += shadowStats.rays;
+	m_culledShadows += shadowStats.culled;
+	m_shadowSteps += shadowStats.steps;
+	m_marchedPixels += marched;
+	m_resumedPixels += resumed;
+	m_reusedPixels += reused;
+}
+
+void CpuRenderer::TraceRays(const FrameSetup& setup, const Ray* rays, const float2* uvs, int count, const float* startDepth,
+	MarchResult* results, float3* colours, float3* rayNormals, ShadowStats& shadowStats)
+{
+	// Queues of the hits to find normals for and shade, and of the hits whose shadows need tracing
+	std::vector<int> hitRays(count);
+	std::vector<MarchResult> hits(count);
+	std::vector<float3> normals(count);
+	std::vector<float> shadows(size_t(count) * g_lightCount);
+	std::unique_ptr<bool[]> cached(new bool[count]);
+	std::vector<int> tracedHits(m_shadowCache ? count : 0);
+	std::vector<MarchResult> traced(m_shadowCache ? count : 0);
+	std::vector<float3> tracedNormals(m_shadowCache ? count : 0);
+	std::vector<float> tracedShadows(m_shadowCache ? size_t(count) * g_lightCount : 0);
+
+	// March them all through the packet kernel, then queue the hits
+	MarchRays(rays, count, setup, results, startDepth, m_activeBrickMap);
+	int hitCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (!results[i].hit)
+			continue;
+		hitRays[hitCount] = i;
+		hits[hitCount++] = results[i];
+	}
+	HitNormals(hits.data(), hitCount, setup, normals.data());
+
+	// Take what shadows the cache has and trace the rest, keeping them for later frames
+	if (m_shadowCache)
+	{
+		m_shadowCache->Lookup(hits.data(), normals.data(), hitCount, setup, shadows.data(), cached.get());
+		int tracedCount = 0;
+		for (int h = 0; h < hitCount; h++)
+		{
+			if (cached[h])
+				continue;
+			tracedHits[tracedCount] = h;
+			traced[tracedCount] = hits[h];
+			tracedNormals[tracedCount++] = normals[h];
+		}
+		TraceShadows(traced.data(), tracedNormals.data(), tracedCount, setup, tracedShadows.data(), &shadowStats);
+		m_shadowCache->Store(traced.data(), tracedNormals.data(), tracedCount, setup, tracedShadows.data());
+		for (int k = 0; k < tracedCount; k++)
+			memcpy(&shadows[size_t(tracedHits[k]) * g_lightCount], &tracedShadows[size_t(k) * g_lightCount], sizeof(float) * g_lightCount);
+	}
+	else
+	{
+		TraceShadows(hits.data(), normals.data(), hitCount, setup, shadows.data(), &shadowStats);
+	}
+
+	// Shade the hits and fill in the misses
+	for (int i = 0; i < count; i++)
+	{
+		if (!results[i].hit)
+		{
+			colours[i] = BackgroundColour(setup, uvs[i]);
+			if (rayNormals)
+				rayNormals[i] = float3{ 0.0f, 0.0f, 0.0f };
+		}
+	}
+	for (int h = 0; h < hitCount; h++)
+	{
+		colours[hitRays[h]] = ShadeHit(hits[h], &shadows[size_t(h) * g_lightCount], setup);
+		if (rayNormals)
+			rayNormals[hitRays[h]] = normals[h];
+	}
+}
+
+float CpuRenderer::EdgeScore(const Image& image, int x, int y) const
+{
+	static const int neighbours[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+	int width = image.width;
+	const EdgePixel& centre = m_edgePixels[size_t(y) * width + x];
+	const uint8_t* colour = image.Row(y) + size_t(x) * 3;
+	bool edge = false;
+	int contrast = 0;
+	for (const int* offset : neighbours)
+	{
+		int nx = x + offset[0];
+		int ny = y + offset[1];
+		if (nx < 0 || ny < 0 || nx >= width || ny >= image.height)
+			continue;
+
+		const EdgePixel& other = m_edgePixels[size_t(ny) * width + nx];
+		if ((centre.depth < 0.0f) != (other.depth < 0.0f))
+		{
+			edge = true;
+		}
+		else if (centre.depth >= 0.0f)
+		{
+			float nearer = centre.depth < other.depth ? centre.depth : other.depth;
+			if (fabsf(centre.depth - other.depth) > g_edgeDepthThreshold * nearer || dot(centre.normal, other.normal) < g_edgeNormalThreshold)
+				edge = true;
+		}
+
+		const uint8_t* otherColour = image.Row(ny) + size_t(nx) * 3;
+		for (int c = 0; c < 3; c++)
+			contrast = std::max(contrast, abs(int(colour[c]) - int(otherColour[c])));
+	}
+
+	// Edges always qualify, and among them and the rest the most visible come first
+	return float(contrast) / (255.0f * g_edgeContrastThreshold) + (edge ? 1.0f : 0.0f);
+}
+
+void CpuRenderer::Antialias(const FrameConstants& constants, const FrameSetup& setup, Image& image)
+{
+	auto start = std::chrono::steady_clock::now();
+	int width = constants.screenWidth;
+	int height = constants.screenHeight;
+
+	std::vector<float> scores(size_t(width) * height);
+	m_pool.ParallelFor(height, [&](int y) {
+		for (int x = 0; x < width; x++)
+			scores[size_t(y) * width + x] = m_antialias.everyPixel ? 1.0f : EdgeScore(image, x, y);
+	});
+
+	std::vector<int> pixels;
+	for (size_t i = 0; i < scores.size(); i++)
+	{
+		if (scores[i] >= 1.0f)
+			pixels.push_back(int(i));
+	}
+	m_antialiasStats.candidates = (long long)pixels.size();
+
+	// Over budget, keep the highest scores, then go back to image order so chunks stay coherent
+	int samples = m_antialias.samples == 4 ? 4 : 8;
+	const int(*pattern)[2] = samples == 4 ? g_msaaPattern4 : g_msaaPattern8;
+	double budgetPixels = double(m_antialias.budget) * double(width) * double(height) / samples;
+	if (!m_antialias.everyPixel && double(pixels.size()) > budgetPixels)
+	{
+		size_t keep = size_t(budgetPixels);
+		std::nth_element(pixels.begin(), pixels.begin() + keep, pixels.end(), [&](int a, int b) { return scores[a] > scores[b]; });
+		pixels.resize(keep);
+		std::sort(pixels.begin(), pixels.end());
+	}
+	m_antialiasStats.refined = (long long)pixels.size();
+	m_antialiasStats.rays = (long long)pixels.size() * samples;
+	m_antialiasStats.detectMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Trace each chunk's samples as one stream and resolve them with the first pass's centre
+	start = std::chrono::steady_clock::now();
+	std::atomic<long long> marchSteps{ 0 };
+	std::atomic<long long> shadowSteps{ 0 };
+	int chunks = int((pixels.size() + g_antialiasChunk - 1) / g_antialiasChunk);
+	m_pool.ParallelFor(chunks, [&](int chunk) {
+		int first = chunk * g_antialiasChunk;
+		int count = std::min(g_antialiasChunk, int(pixels.size()) - first);
+		int rayCount = count * samples;
+		std::vector<Ray> rays(rayCount);
+		std::vector<float2> uvs(rayCount);
+		std::vector<MarchResult> results(rayCount);
+		std::vector<float3> colours(rayCount);
+		for (int p = 0; p < count; p++)
+		{
+			int x = pixels[first + p] % width;
+			int y = pixels[first + p] / width;
+			for (int k = 0; k < samples; k++)
+			{
+				int r = p * samples + k;
+				float2 position = { x + 0.5f + pattern[k][0] / 16.0f, y + 0.5f + pattern[k][1] / 16.0f };
+				uvs[r] = PixelToUV(constants, position);
+				rays[r] = CreateCamRay(uvs[r], constants.projInverse, constants.viewInverse, constants.camPos);
+			}
+		}
+
+		ShadowStats shadowStats;
+		TraceRays(setup, rays.data(), uvs.data(), rayCount, nullptr, results.data(), colours.data(), nullptr, shadowStats);
+
+		long long steps = 0;
+		for (int p = 0; p < count; p++)
+		{
+			int x = pixels[first + p] % width;
+			int y = pixels[first + p] / width;
+			float3 sum = m_edgePixels[pixels[first + p]].colour;
+			for (int k = 0; k < samples; k++)
+			{
+				int r = p * samples + k;
+				sum = sum + saturate(colours[r]);
+				steps += results[r].steps;
+			}
+			StorePixel(image.Row(y) + size_t(x) * 3, sum / float(samples + 1));
+		}
+
+		marchSteps += steps;
+		shadowSteps += shadowStats.steps;
+	});
+	m_antialiasStats.marchSteps = marchSteps;
+	m_antialiasStats.shadowSteps = shadowSteps;
+	m_antialiasStats.refineMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
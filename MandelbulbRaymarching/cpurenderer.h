@@ -0,0 +1,184 @@
+#pragma once
+
+//------------------------------
+//- cpurenderer.h
+//------------------------------
+
+// Includes
+#include "brickmap.h"
+#include "camera.h"
+#include "coneprepass.h"
+#include "kernel.h"
+#include "kernel_simd.h"
+#include "pngwriter.h"
+#include "reprojection.h"
+#include "shadowcache.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <vector>
+
+// Build the constants Renderer::Update uploads, from a camera with its lens already set
+FrameConstants CreateFrameConstants(Camera& camera, int width, int height);
+
+// What the last Render with CpuRenderer::m_progressive set did with its pixels
+struct RefineStats
+{
+	// Marched from the start, or from the prepass or reprojected depth
+	long long marched = 0;
+	// Continued from where a lower quality pass of the same view stopped
+	long long resumed = 0;
+	// Kept from an earlier pass at this quality, or escaped the fractal in one
+	long long reused = 0;
+};
+
+// Adaptive anti-aliasing after a frame's first pass, see CpuRenderer::m_antialias
+struct AntialiasSettings
+{
+	// Extra rays a frame may spend, as a multiple of its pixel count. 0 turns the pass off
+	float budget = 0.0f;
+	// Rays traced in each refined pixel besides its centre, 4 or 8 on D3D's standard MSAA patterns
+	int samples = 8;
+	// Refine every pixel regardless of the budget, the brute force supersampling the pass approximates
+	bool everyPixel = false;
+};
+
+// What the last Render's anti-aliasing pass did
+struct AntialiasStats
+{
+	// Pixels at a discontinuity, and the ones the budget let through with the rays they took
+	long long candidates = 0;
+	long long refined = 0;
+	long long rays = 0;
+	// DE steps the extra rays took, kept out of the frame's march and shadow totals
+	long long marchSteps = 0;
+	long long shadowSteps = 0;
+	double detectMs = 0.0;
+	double refineMs = 0.0;
+};
+
+// Renders PSMain on the CPU, one task per square tile. Each tile's rays are marched as a stream, the
+// hits queued for normals and shadows and the queue shaded, see MarchRays and TraceShadows
+class CpuRenderer
+{
+public:
+	// Tile edge in pixels
+	int m_tileSize = 16;
+	// Send each tile through the march, normal, shadow and shading stages as one stream of rays,
+	// rather than a row at a time, so the packets stay full until the whole tile is done
+	bool m_wavefront = true;
+	// Start each pixel at the depth found by the cone prepass
+	bool m_conePrepass = false;
+	// Start each pixel just short of the previous frame's reprojected hit depth
+	bool m_reprojection = false;
+	// Keep every pixel's march between frames of the same view so refinement passes build on the
+	// last one. The image passed to Render must then be the one the previous Render drew
+	bool m_progressive = false;
+	// Distance field cache to march on, used for frames with the fractal it was built for
+	const BrickMap* m_brickMap = nullptr;
+	// World space cache to take shadows from and keep traced ones in across frames
+	ShadowCache* m_shadowCache = nullptr;
+	// Supersample the pixels at hit and miss, depth, normal or colour discontinuities within a budget
+	// once the frame is drawn. Only frames at pixel step 1 without m_progressive are refined
+	AntialiasSettings m_antialias;
+
+	// Constructor
+	CpuRenderer(ThreadPool& pool);
+
+	// Render a whole frame, the image is resized to the constants' screen size
+	void Render(const FrameConstants& constants, Image& image);
+	// Render a frame with an already prepared setup
+	void Render(const FrameConstants& constants, const FrameSetup& setup, Image& image);
+	// Render the rectangle [x0, x1) x [y0, y1) into the matching rows of image, whose top left
+	// pixel is (originX, originY) of the frame so a tile can go into an image of its own
+	void RenderRegion(const FrameConstants& constants, const FrameSetup& setup, int x0, int y0, int x1, int y1, Image& image,
+		int originX = 0, int originY = 0);
+	// Clear the statistics and pick up the brick map and shadow cache for a frame drawn with
+	// RenderRegion calls alone, which may run in parallel until the matching EndRegions. Render
+	// does this itself
+	void BeginRegions(const FrameSetup& setup);
+	void EndRegions();
+
+	// Cone prepass statistics from the last Render with m_conePrepass set
+	const ConePrepassStats& GetPrepassStats() const { return m_prepass.GetStats(); }
+	// Reprojection statistics from the last Render with m_reprojection set
+	const ReprojectionStats& GetReprojectionStats() const { return m_history.GetStats(); }
+	// Drop the depth history, call on camera cuts
+	void ResetHistory() { m_history.Reset(); }
+	// Per pixel march steps in the last Render, DE evaluations and steps on the brick map
+	long long GetMarchSteps() const { return m_marchSteps; }
+	long long GetCacheSteps() const { return m_cacheSteps; }
+	// Shadow rays, lights culled behind the surface and shadow DE steps in the last Render
+	ShadowStats GetShadowStats() const;
+	// Pixel reuse in the last Render with m_progressive set
+	RefineStats GetRefineStats() const { return { m_marchedPixels, m_resumedPixels, m_reusedPixels }; }
+	// Anti-aliasing in the last Render, empty when it did not run
+	const AntialiasStats& GetAntialiasStats() const { return m_antialiasStats; }
+private:
+	// A pixel's march as the last pass of the current view left it
+	struct RefinedPixel
+	{
+		// Quality it was marched at, -1 while it only holds its block's colour
+		int quality = -1;
+		// Where the march stopped, a higher quality march of the same ray carries on from here
+		float depth = 0.0f;
+		bool hit = false;
+		// Left the bounding radius, a miss at every quality
+		bool escaped = false;
+	};
+
+	// What the first pass found at a pixel, for the anti-aliasing pass to compare with its neighbours
+	struct EdgePixel
+	{
+		// Hit distance, -1 for a miss
+		float depth;
+		float3 normal;
+		// Saturated colour before it was stored in 8 bits, what the supersamples are averaged with
+		float3 colour;
+	};
+
+	ThreadPool& m_pool;
+	ConePrepass m_prepass;
+	// True while the prepass depths match the frame being rendered
+	bool m_prepassValid = false;
+	DepthHistory m_history;
+	// True while Render is recording into the history, and when it also has reprojected depths
+	bool m_recordHistory = false;
+	bool m_historyValid = false;
+	std::atomic<long long> m_marchSteps{ 0 };
+	std::atomic<long long> m_cacheSteps{ 0 };
+	std::atomic<long long> m_shadowRays{ 0 };
+	std::atomic<long long> m_culledShadows{ 0 };
+	std::atomic<long long> m_shadowSteps{ 0 };
+	// m_brickMap when it matches the frame being rendered
+	const BrickMap* m_activeBrickMap = nullptr;
+
+	// Progressive refinement state, see m_progressive
+	std::vector<RefinedPixel> m_refinedPixels;
+	FrameConstants m_refinedConstants = {};
+	std::atomic<long long> m_marchedPixels{ 0 };
+	std::atomic<long long> m_resumedPixels{ 0 };
+	std::atomic<long long> m_reusedPixels{ 0 };
+
+	// Anti-aliasing state, see m_antialias
+	bool m_recordEdges = false;
+	std::vector<EdgePixel> m_edgePixels;
+	AntialiasStats m_antialiasStats;
+
+	// March, shadow and shade a stream of rays through the stages' queues into colours. rayNormals,
+	// when not null, receives the normal of each hit and zero for misses
+	void TraceRays(const FrameSetup& setup, const Ray* rays, const float2* uvs, int count, const float* startDepth,
+		MarchResult* results, float3* colours, float3* rayNormals, ShadowStats& shadowStats);
+	// How much a pixel of the first pass differs from its neighbours, 1 and up needs refining
+	float EdgeScore(const Image& image, int x, int y) const;
+	// Supersample the pixels with the highest edge scores the budget allows
+	void Antialias(const FrameConstants& constants, const FrameSetup& setup, Image& image);
+};
+
+// Convert a saturated colour to 8-bit the way a UNORM render target does
+inline void StorePixel(uint8_t* dst, float3 colour)
+{
+	dst[0] = uint8_t(colour.x * 255.0f + 0.5f);
+	dst[1] = uint8_t(colour.y * 255.0f + 0.5f);
+	dst[2] = uint8_t(colour.z * 255.0f + 0.5f);
+}
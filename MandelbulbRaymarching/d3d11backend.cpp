@@ -0,0 +1,660 @@
+// Includes
+#include "d3d11backend.h"
+
+#include <d3dcompiler.h>
+#include <ScreenGrab.h>
+#include <cstring>
+
+#pragma comment(lib,"d3d11.lib")
+#pragma comment(lib,"d3dcompiler.lib")
+
+// Constructor
+D3D11Backend::D3D11Backend(HWND hwnd)
+{
+	// Initializing members
+	{
+		// Get height and width
+		this->hwnd = hwnd;
+		m_width = 800;
+		m_height = 600;
+		UpdateSize();
+	}
+
+	// Device, swapchain and context creation
+	{
+		// Create Device
+		D3D_FEATURE_LEVEL lvl[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0,
+										  D3D_FEATURE_LEVEL_10_1, D3D_FEATURE_LEVEL_10_0 };
+
+		UINT createDeviceFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+
+		// https://docs.microsoft.com/en-us/windows/win32/api/d3d11/ne-d3d11-d3d11_create_device_flag
+		// "Creates a device that supports the debug layer." https://docs.microsoft.com/en-us/windows/win32/direct3d11/overviews-direct3d-11-devices-layers
+#ifdef _DEBUG
+		createDeviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
+#endif
+
+		// Swap chain desc
+		DXGI_SWAP_CHAIN_DESC swapChainDesc = { 0 };
+		swapChainDesc.BufferDesc.RefreshRate.Numerator = 0;
+		swapChainDesc.BufferDesc.RefreshRate.Denominator = 1;
+		swapChainDesc.BufferDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		swapChainDesc.SampleDesc.Count = 1;
+		swapChainDesc.SampleDesc.Quality = 0;
+		swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+		swapChainDesc.OutputWindow = hwnd;
+		swapChainDesc.Windowed = true;
+
+		// Flip sequential
+		swapChainDesc.BufferCount = 2;
+		swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+
+		m_device = nullptr;
+		m_context = nullptr;
+
+		ThrowIfFailed(D3D11CreateDeviceAndSwapChain(
+			NULL,
+			D3D_DRIVER_TYPE_HARDWARE,
+			NULL,
+			createDeviceFlags,
+			NULL,
+			0,
+			D3D11_SDK_VERSION,
+			&swapChainDesc,
+			m_swapChain.ReleaseAndGetAddressOf(),
+			m_device.ReleaseAndGetAddressOf(),
+			lvl,
+			m_context.ReleaseAndGetAddressOf())
+		);
+	}
+
+	// RTV creation
+	{
+		ComPtr<ID3D11Texture2D> framebuffer;
+		ThrowIfFailed(m_swapChain->GetBuffer(
+			0,
+			__uuidof(ID3D11Texture2D),
+			(void**)&framebuffer));
+
+		ThrowIfFailed(m_device->CreateRenderTargetView(
+			framebuffer.Get(), 0, m_rtv.ReleaseAndGetAddressOf()));
+	}
+
+	// Shader compilation and creation, and defining vertex buffer + layout
+	{
+		ComPtr<ID3DBlob> p_vsBlob;
+		ComPtr<ID3DBlob> p_reprojectVsBlob;
+		ComPtr<ID3DBlob> p_reprojectPsBlob;
+		ComPtr<ID3DBlob> p_upscalePsBlob;
+		ComPtr<ID3DBlob> p_errorBlob;
+
+		UINT flags = D3DCOMPILE_ENABLE_STRICTNESS;
+#if defined( DEBUG ) || defined( _DEBUG )
+		flags |= D3DCOMPILE_DEBUG;
+#endif
+
+		// Compiling vertex shader
+		HRESULT hr = D3DCompileFromFile(L"main.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "VSMain", "vs_5_0",
+			flags, 0, p_vsBlob.ReleaseAndGetAddressOf(), p_errorBlob.ReleaseAndGetAddressOf());
+
+		// Compiling the pixel and cone prepass shaders for every kernel variant, so each leaves out
+		// the work its quality level and power do not need
+		for (int quality = 0; quality < g_qualityVariants; quality++)
+		{
+			for (int animated = 0; animated < 2; animated++)
+			{
+				char qualityDefine[2] = { char('0' + quality), '\0' };
+				D3D_SHADER_MACRO defines[] = {
+					{ "KERNEL_QUALITY", qualityDefine },
+					{ "KERNEL_ANIMATED", animated ? "1" : "0" },
+					{ nullptr, nullptr }
+				};
+
+				ComPtr<ID3DBlob> p_psBlob;
+				ComPtr<ID3DBlob> p_conePsBlob;
+				hr = D3DCompileFromFile(L"main.hlsl", defines, D3D_COMPILE_STANDARD_FILE_INCLUDE, "PSMain", "ps_5_0",
+					flags, 0, p_psBlob.ReleaseAndGetAddressOf(), p_errorBlob.ReleaseAndGetAddressOf());
+				ThrowIfFailed(D3DCompileFromFile(L"main.hlsl", defines, D3D_COMPILE_STANDARD_FILE_INCLUDE, "ConePS", "ps_5_0",
+					flags, 0, p_conePsBlob.ReleaseAndGetAddressOf(), p_errorBlob.ReleaseAndGetAddressOf()));
+
+				ThrowIfFailed(m_device->CreatePixelShader(p_psBlob->GetBufferPointer(), p_psBlob->GetBufferSize(), NULL,
+					p_pixelShader[quality][animated].ReleaseAndGetAddressOf()));
+				ThrowIfFailed(m_device->CreatePixelShader(p_conePsBlob->GetBufferPointer(), p_conePsBlob->GetBufferSize(), NULL,
+					p_conePixelShader[quality][animated].ReleaseAndGetAddressOf()));
+			}
+		}
+
+		// Compiling reprojection shaders
+		ThrowIfFailed(D3DCompileFromFile(L"main.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "ReprojectVS", "vs_5_0",
+			flags, 0, p_reprojectVsBlob.ReleaseAndGetAddressOf(), p_errorBlob.ReleaseAndGetAddressOf()));
+		ThrowIfFailed(D3DCompileFromFile(L"main.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "ReprojectPS", "ps_5_0",
+			flags, 0, p_reprojectPsBlob.ReleaseAndGetAddressOf(), p_errorBlob.ReleaseAndGetAddressOf()));
+
+		// Compiling progressive refinement upscale shader
+		hr = D3DCompileFromFile(L"main.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "UpscalePS", "ps_5_0",
+			flags, 0, p_upscalePsBlob.ReleaseAndGetAddressOf(), p_errorBlob.ReleaseAndGetAddressOf());
+
+		// Creating shaders
+		ThrowIfFailed(m_device->CreateVertexShader(p_vsBlob->GetBufferPointer(), p_vsBlob->GetBufferSize(), NULL, p_vertexShader.ReleaseAndGetAddressOf()));
+		ThrowIfFailed(m_device->CreateVertexShader(p_reprojectVsBlob->GetBufferPointer(), p_reprojectVsBlob->GetBufferSize(), NULL, p_reprojectVertexShader.ReleaseAndGetAddressOf()));
+		ThrowIfFailed(m_device->CreatePixelShader(p_reprojectPsBlob->GetBufferPointer(), p_reprojectPsBlob->GetBufferSize(), NULL, p_reprojectPixelShader.ReleaseAndGetAddressOf()));
+		ThrowIfFailed(m_device->CreatePixelShader(p_upscalePsBlob->GetBufferPointer(), p_upscalePsBlob->GetBufferSize(), NULL, p_upscalePixelShader.ReleaseAndGetAddressOf()));
+
+		D3D11_INPUT_ELEMENT_DESC inputElementDescs[] =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 }, // Vertex position
+			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT , 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 }, // UV
+		};
+
+		ThrowIfFailed(m_device->CreateInputLayout(inputElementDescs, _countof(inputElementDescs), p_vsBlob->GetBufferPointer(),
+			p_vsBlob->GetBufferSize(), p_inputLayout.ReleaseAndGetAddressOf()));
+	}
+
+	// Creating vertex and index buffer 
+	{
+		// Initial vertex data
+		Vertex vertices[6] = {
+			{ XMFLOAT3(-1.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) },
+			{ XMFLOAT3(1.0f, -1.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
+			{ XMFLOAT3(-1.0f, -1.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) },
+			{ XMFLOAT3(1.0f, 1.0f, 0.0f), XMFLOAT2(1.0f, 1.0f) },
+			{ XMFLOAT3(1.0f, -1.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
+			{ XMFLOAT3(-1.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) }
+		};
+
+		D3D11_BUFFER_DESC vertexBufferDesc = {};
+		vertexBufferDesc.ByteWidth = sizeof(vertices);
+		vertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		D3D11_SUBRESOURCE_DATA srData = { 0 };
+		srData.pSysMem = vertices;
+
+		ThrowIfFailed(m_device->CreateBuffer(&vertexBufferDesc, &srData, m_vertexBuffer.ReleaseAndGetAddressOf()));
+	}
+
+	// Constant buffer, mapped and discarded every frame
+	{
+		D3D11_BUFFER_DESC cbDesc = {};
+		cbDesc.ByteWidth = sizeof(SHADER_CONSTANTS_BUFFER);
+		cbDesc.Usage = D3D11_USAGE_DYNAMIC;
+		cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+		ThrowIfFailed(m_device->CreateBuffer(&cbDesc, NULL, m_constantBuffer.ReleaseAndGetAddressOf()));
+
+		cbDesc.ByteWidth = sizeof(CONE_CONSTANTS_BUFFER);
+		ThrowIfFailed(m_device->CreateBuffer(&cbDesc, NULL, m_coneConstantBuffer.ReleaseAndGetAddressOf()));
+
+		cbDesc.ByteWidth = sizeof(REPROJECTION_CONSTANTS_BUFFER);
+		ThrowIfFailed(m_device->CreateBuffer(&cbDesc, NULL, m_reprojectionConstantBuffer.ReleaseAndGetAddressOf()));
+	}
+
+	// Reprojection keeps the nearest point landing on each pixel
+	{
+		D3D11_DEPTH_STENCIL_DESC depthDesc = {};
+		depthDesc.DepthEnable = TRUE;
+		depthDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+		depthDesc.DepthFunc = D3D11_COMPARISON_LESS;
+
+		ThrowIfFailed(m_device->CreateDepthStencilState(&depthDesc, m_reprojectDepthState.ReleaseAndGetAddressOf()));
+	}
+
+	// GPU frame timer
+	{
+		D3D11_QUERY_DESC queryDesc = {};
+		for (int i = 0; i < g_timerFrames; i++)
+		{
+			queryDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+			ThrowIfFailed(m_device->CreateQuery(&queryDesc, m_timerDisjoint[i].ReleaseAndGetAddressOf()));
+			queryDesc.Query = D3D11_QUERY_TIMESTAMP;
+			ThrowIfFailed(m_device->CreateQuery(&queryDesc, m_timerStart[i].ReleaseAndGetAddressOf()));
+			ThrowIfFailed(m_device->CreateQuery(&queryDesc, m_timerEnd[i].ReleaseAndGetAddressOf()));
+		}
+	}
+
+	// Cone prepass, reprojection and reduced resolution targets
+	CreateConeTargets();
+	CreateScreenTargets();
+}
+
+// Destructor
+D3D11Backend::~D3D11Backend()
+{
+	// Nothing to do upon destruction
+}
+
+int D3D11Backend::GetWidth() const
+{
+	RECT rect;
+	if (GetWindowRect(hwnd, &rect))
+		return rect.right - rect.left;
+	return int(m_width);
+}
+
+int D3D11Backend::GetHeight() const
+{
+	RECT rect;
+	if (GetWindowRect(hwnd, &rect))
+		return rect.bottom - rect.top;
+	return int(m_height);
+}
+
+void D3D11Backend::UpdateSize()
+{
+	RECT rect;
+	if (GetWindowRect(hwnd, &rect))
+	{
+		m_width = rect.right - rect.left;
+		m_height = rect.bottom - rect.top;
+	}
+}
+
+// One R32 target per cone level, sized to cover the screen constants' width and height
+void D3D11Backend::CreateConeTargets()
+{
+	for (int l = 0; l < ConePrepass::g_levelCount; l++)
+	{
+		int blockSize = ConePrepass::g_coarsestBlock >> l;
+		m_coneWidth[l] = (int(m_width) + blockSize - 1) / blockSize;
+		m_coneHeight[l] = (int(m_height) + blockSize - 1) / blockSize;
+
+		D3D11_TEXTURE2D_DESC desc = { 0 };
+		desc.Width = UINT(m_coneWidth[l] > 0 ? m_coneWidth[l] : 1);
+		desc.Height = UINT(m_coneHeight[l] > 0 ? m_coneHeight[l] : 1);
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R32_FLOAT;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+		ComPtr<ID3D11Texture2D> texture;
+		ThrowIfFailed(m_device->CreateTexture2D(&desc, NULL, texture.ReleaseAndGetAddressOf()));
+		ThrowIfFailed(m_device->CreateRenderTargetView(texture.Get(), NULL, m_coneRtv[l].ReleaseAndGetAddressOf()));
+		ThrowIfFailed(m_device->CreateShaderResourceView(texture.Get(), NULL, m_coneSrv[l].ReleaseAndGetAddressOf()));
+	}
+}
+
+// Two R32 hit depth targets the main pass alternates between, the reprojected depth and its depth
+// buffer, and the reduced resolution colour. All match the back buffer so the main pass can write a
+// history target alongside either colour target
+void D3D11Backend::CreateScreenTargets()
+{
+	ComPtr<ID3D11Texture2D> framebuffer;
+	ThrowIfFailed(m_swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&framebuffer));
+
+	D3D11_TEXTURE2D_DESC backBufferDesc = { 0 };
+	framebuffer->GetDesc(&backBufferDesc);
+	m_historyWidth = int(backBufferDesc.Width);
+	m_historyHeight = int(backBufferDesc.Height);
+
+	D3D11_TEXTURE2D_DESC desc = { 0 };
+	desc.Width = backBufferDesc.Width;
+	desc.Height = backBufferDesc.Height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_R32_FLOAT;
+	desc.SampleDesc.Count = 1;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+	ComPtr<ID3D11Texture2D> texture;
+	for (int i = 0; i < 2; i++)
+	{
+		ThrowIfFailed(m_device->CreateTexture2D(&desc, NULL, texture.ReleaseAndGetAddressOf()));
+		ThrowIfFailed(m_device->CreateRenderTargetView(texture.Get(), NULL, m_historyRtv[i].ReleaseAndGetAddressOf()));
+		ThrowIfFailed(m_device->CreateShaderResourceView(texture.Get(), NULL, m_historySrv[i].ReleaseAndGetAddressOf()));
+	}
+
+	ThrowIfFailed(m_device->CreateTexture2D(&desc, NULL, texture.ReleaseAndGetAddressOf()));
+	ThrowIfFailed(m_device->CreateRenderTargetView(texture.Get(), NULL, m_reprojectedRtv.ReleaseAndGetAddressOf()));
+	ThrowIfFailed(m_device->CreateShaderResourceView(texture.Get(), NULL, m_reprojectedSrv.ReleaseAndGetAddressOf()));
+
+	desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	ThrowIfFailed(m_device->CreateTexture2D(&desc, NULL, texture.ReleaseAndGetAddressOf()));
+	ThrowIfFailed(m_device->CreateRenderTargetView(texture.Get(), NULL, m_blockRtv.ReleaseAndGetAddressOf()));
+	ThrowIfFailed(m_device->CreateShaderResourceView(texture.Get(), NULL, m_blockSrv.ReleaseAndGetAddressOf()));
+
+	desc.Format = DXGI_FORMAT_D32_FLOAT;
+	desc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+	ThrowIfFailed(m_device->CreateTexture2D(&desc, NULL, texture.ReleaseAndGetAddressOf()));
+	ThrowIfFailed(m_device->CreateDepthStencilView(texture.Get(), NULL, m_reprojectedDsv.ReleaseAndGetAddressOf()));
+
+	// The old history was at another size
+	m_hasHistory = false;
+}
+
+void D3D11Backend::SetConeConstants(int blockSize, int hasParent, int prepass)
+{
+	CONE_CONSTANTS_BUFFER buffer = { blockSize, hasParent, prepass, 0.0f };
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	ThrowIfFailed(m_context->Map(m_coneConstantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+	memcpy(mapped.pData, &buffer, sizeof(buffer));
+	m_context->Unmap(m_coneConstantBuffer.Get(), 0);
+
+	ID3D11Buffer* p_cb = m_coneConstantBuffer.Get();
+	m_context->PSSetConstantBuffers(1, 1, &p_cb);
+}
+
+// Copy the constants into the cbuffer layout and upload them
+void D3D11Backend::UploadConstants(const FrameConstants& constants)
+{
+	m_constants = constants;
+
+	SHADER_CONSTANTS_BUFFER buffer;
+	ZeroMemory(&buffer, sizeof(buffer));
+
+	// float4x4 has the same layout as XMFLOAT4X4
+	buffer.projInverse = XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&constants.projInverse));
+	buffer.viewInverse = XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&constants.viewInverse));
+	buffer.camPos = XMFLOAT3(constants.camPos.x, constants.camPos.y, constants.camPos.z);
+	buffer.screenWidth = constants.screenWidth;
+	buffer.screenHeight = constants.screenHeight;
+	buffer.animated = constants.animated;
+	buffer.quality = constants.quality;
+	buffer.time = constants.time;
+	buffer.colour1 = XMFLOAT3(constants.colour1.x, constants.colour1.y, constants.colour1.z);
+	buffer.colour2 = XMFLOAT3(constants.colour2.x, constants.colour2.y, constants.colour2.z);
+	buffer.pixelStep = constants.pixelStep > 1 ? constants.pixelStep : 1;
+	buffer.hitEpsilon = constants.hitEpsilon;
+	buffer.marchIterations = constants.marchIterations;
+	buffer.deIterations = constants.deIterations;
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	ThrowIfFailed(m_context->Map(m_constantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+	memcpy(mapped.pData, &buffer, sizeof(buffer));
+	m_context->Unmap(m_constantBuffer.Get(), 0);
+
+	// Set the buffer.
+	ID3D11Buffer* p_cb = m_constantBuffer.Get();
+	m_context->VSSetConstantBuffers(0, 1, &p_cb);
+	m_context->PSSetConstantBuffers(0, 1, &p_cb);
+}
+
+// The power changes every frame while animated, so only a still fractal at the same size and
+// full resolution reprojects. Always uploads reprojectionConstants, with the flag telling PSMain the outcome
+bool D3D11Backend::Reproject()
+{
+	bool usable = m_reprojection && m_hasHistory && !m_constants.animated && !m_previousConstants.animated
+		&& m_constants.screenWidth == m_previousConstants.screenWidth
+		&& m_constants.screenHeight == m_previousConstants.screenHeight
+		&& m_constants.pixelStep <= 1 && m_previousConstants.pixelStep <= 1;
+
+	REPROJECTION_CONSTANTS_BUFFER buffer;
+	ZeroMemory(&buffer, sizeof(buffer));
+	buffer.prevProjInverse = XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&m_previousConstants.projInverse));
+	buffer.prevViewInverse = XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&m_previousConstants.viewInverse));
+	buffer.viewProj = XMMatrixMultiply(XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&m_constants.view)),
+		XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&m_constants.proj)));
+	buffer.prevCamPos = XMFLOAT3(m_previousConstants.camPos.x, m_previousConstants.camPos.y, m_previousConstants.camPos.z);
+	buffer.reproject = usable ? 1 : 0;
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	ThrowIfFailed(m_context->Map(m_reprojectionConstantBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+	memcpy(mapped.pData, &buffer, sizeof(buffer));
+	m_context->Unmap(m_reprojectionConstantBuffer.Get(), 0);
+
+	ID3D11Buffer* p_cb = m_reprojectionConstantBuffer.Get();
+	m_context->VSSetConstantBuffers(2, 1, &p_cb);
+	m_context->PSSetConstantBuffers(2, 1, &p_cb);
+
+	if (!usable)
+		return false;
+
+	// Negative marks pixels nothing landed on
+	const float empty[] = { -1.0f, -1.0f, -1.0f, -1.0f };
+	m_context->ClearRenderTargetView(m_reprojectedRtv.Get(), empty);
+	m_context->ClearDepthStencilView(m_reprojectedDsv.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
+
+	ID3D11ShaderResourceView* p_nullSrv = NULL;
+	m_context->PSSetShaderResources(1, 1, &p_nullSrv);
+
+	ID3D11RenderTargetView* p_rtv = m_reprojectedRtv.Get();
+	m_context->OMSetRenderTargets(1, &p_rtv, m_reprojectedDsv.Get());
+	m_context->OMSetDepthStencilState(m_reprojectDepthState.Get(), 0);
+
+	// Same viewport as the main pass so pixels line up
+	D3D11_VIEWPORT viewport = { 0.0f, 0.0f, m_width, m_height, 0.0f, 1.0f };
+	m_context->RSSetViewports(1, &viewport);
+
+	// Points generated from SV_VertexID, no vertex buffer
+	m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST);
+	m_context->IASetInputLayout(NULL);
+	m_context->VSSetShader(p_reprojectVertexShader.Get(), NULL, 0);
+	m_context->PSSetShader(p_reprojectPixelShader.Get(), NULL, 0);
+
+	ID3D11ShaderResourceView* p_previous = m_historySrv[m_historyIndex ^ 1].Get();
+	m_context->VSSetShaderResources(2, 1, &p_previous);
+
+	// Four instances splat each point onto a 2x2 block
+	m_context->DrawInstanced(UINT(m_historyWidth * m_historyHeight), 4, 0, 0);
+
+	// The history target is written again next frame
+	m_context->VSSetShaderResources(2, 1, &p_nullSrv);
+	m_context->OMSetDepthStencilState(NULL, 0);
+
+	return true;
+}
+
+void D3D11Backend::Draw()
+{
+	const float clearColour[] = { 0.0f, 0.2f, 0.4f, 1.0f };
+
+	// Collect the oldest frame's timestamps if the GPU is done with them, then reuse its queries
+	int timer = m_timerFrame;
+	if (m_timerIssued[timer])
+	{
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		UINT64 start, end;
+		if (m_context->GetData(m_timerDisjoint[timer].Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK
+			&& m_context->GetData(m_timerStart[timer].Get(), &start, sizeof(start), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK
+			&& m_context->GetData(m_timerEnd[timer].Get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK
+			&& !disjoint.Disjoint)
+		{
+			m_gpuTime = double(end - start) * 1000.0 / double(disjoint.Frequency);
+		}
+	}
+	m_context->Begin(m_timerDisjoint[timer].Get());
+	m_context->End(m_timerStart[timer].Get());
+
+	// Clear RTV
+	m_context->ClearRenderTargetView(m_rtv.Get(), clearColour);
+
+	// Update width and height
+	UpdateSize();
+
+	// Scatter last frame's hits before anything else binds its targets
+	bool reproject = Reproject();
+
+	// Kernel variant for this frame, quality levels the shader does not know use the first
+	int quality = m_constants.quality == 1 || m_constants.quality == 2 ? m_constants.quality : 0;
+	int animated = m_constants.animated == 1 ? 1 : 0;
+
+	// Input assembler
+	UINT vertexStride = sizeof(Vertex);
+	UINT vertexOffset = 0;
+
+	m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	m_context->IASetInputLayout(p_inputLayout.Get());
+	ID3D11Buffer* p_vb = m_vertexBuffer.Get();
+	m_context->IASetVertexBuffers(0, 1, &p_vb, &vertexStride, &vertexOffset);
+	m_context->VSSetShader(p_vertexShader.Get(), NULL, 0);
+
+	// Cone prepass, coarsest level first, each reading the one before
+	ID3D11ShaderResourceView* p_nullSrv = NULL;
+	if (m_conePrepass)
+	{
+		m_context->PSSetShader(p_conePixelShader[quality][animated].Get(), NULL, 0);
+		for (int l = 0; l < ConePrepass::g_levelCount; l++)
+		{
+			m_context->PSSetShaderResources(0, 1, &p_nullSrv);
+
+			ID3D11RenderTargetView* p_coneRtv = m_coneRtv[l].Get();
+			m_context->OMSetRenderTargets(1, &p_coneRtv, NULL);
+
+			D3D11_VIEWPORT coneViewport = { 0.0f, 0.0f, (float)m_coneWidth[l], (float)m_coneHeight[l], 0.0f, 1.0f };
+			m_context->RSSetViewports(1, &coneViewport);
+
+			ID3D11ShaderResourceView* p_parent = l > 0 ? m_coneSrv[l - 1].Get() : NULL;
+			m_context->PSSetShaderResources(0, 1, &p_parent);
+			SetConeConstants(ConePrepass::g_coarsestBlock >> l, l > 0, 0);
+
+			m_context->Draw(6, 0);
+		}
+	}
+
+	// Create viewport, one pixel per block at reduced resolution
+	int pixelStep = m_constants.pixelStep > 1 ? m_constants.pixelStep : 1;
+	D3D11_VIEWPORT viewport = {
+		0.0f,
+		0.0f,
+		(float)((int(m_width) + pixelStep - 1) / pixelStep),
+		(float)((int(m_height) + pixelStep - 1) / pixelStep),
+		0.0f,
+		1.0f
+	};
+	m_context->RSSetViewports(1, &viewport);
+
+	// Set RTVs, the colour and this frame's hit depths
+	ID3D11RenderTargetView* p_rtvs[] = { pixelStep > 1 ? m_blockRtv.Get() : m_rtv.Get(), m_historyRtv[m_historyIndex].Get() };
+	m_context->OMSetRenderTargets(2, p_rtvs, NULL);
+
+	// Main pass starts from the finest cone level
+	ID3D11ShaderResourceView* p_startDepth = m_conePrepass ? m_coneSrv[ConePrepass::g_levelCount - 1].Get() : NULL;
+	m_context->PSSetShaderResources(0, 1, &p_startDepth);
+	SetConeConstants(0, 0, m_conePrepass ? 1 : 0);
+	ID3D11ShaderResourceView* p_reprojected = reproject ? m_reprojectedSrv.Get() : NULL;
+	m_context->PSSetShaderResources(1, 1, &p_reprojected);
+
+	// Set shaders
+	m_context->PSSetShader(p_pixelShader[quality][animated].Get(), NULL, 0);
+
+	// Draw
+	m_context->Draw(6, 0);
+
+	// Spread each block's pixel over the whole block
+	if (pixelStep > 1)
+	{
+		D3D11_VIEWPORT fullViewport = { 0.0f, 0.0f, m_width, m_height, 0.0f, 1.0f };
+		m_context->RSSetViewports(1, &fullViewport);
+
+		ID3D11RenderTargetView* p_rtv = m_rtv.Get();
+		m_context->OMSetRenderTargets(1, &p_rtv, NULL);
+
+		ID3D11ShaderResourceView* p_block = m_blockSrv.Get();
+		m_context->PSSetShaderResources(3, 1, &p_block);
+		m_context->PSSetShader(p_upscalePixelShader.Get(), NULL, 0);
+
+		m_context->Draw(6, 0);
+		m_context->PSSetShaderResources(3, 1, &p_nullSrv);
+	}
+
+	// This frame becomes the history for the next
+	m_previousConstants = m_constants;
+	m_historyIndex ^= 1;
+	m_hasHistory = true;
+
+	m_context->End(m_timerEnd[timer].Get());
+	m_context->End(m_timerDisjoint[timer].Get());
+	m_timerIssued[timer] = true;
+	m_timerFrame = (timer + 1) % g_timerFrames;
+
+	// And finally present!
+	m_swapChain->Present(1, 0);
+}
+
+// Copy the back buffer through a staging texture
+bool D3D11Backend::Readback(Image& image)
+{
+	ComPtr<ID3D11Texture2D> framebuffer;
+	if (FAILED(m_swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&framebuffer)))
+		return false;
+
+	D3D11_TEXTURE2D_DESC desc = { 0 };
+	framebuffer->GetDesc(&desc);
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.MiscFlags = 0;
+
+	ComPtr<ID3D11Texture2D> staging;
+	if (FAILED(m_device->CreateTexture2D(&desc, NULL, staging.ReleaseAndGetAddressOf())))
+		return false;
+	m_context->CopyResource(staging.Get(), framebuffer.Get());
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(m_context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped)))
+		return false;
+
+	// B8G8R8A8 to RGB8
+	image.Resize(int(desc.Width), int(desc.Height));
+	for (UINT y = 0; y < desc.Height; y++)
+	{
+		const uint8_t* src = static_cast<const uint8_t*>(mapped.pData) + size_t(y) * mapped.RowPitch;
+		uint8_t* dst = image.Row(int(y));
+		for (UINT x = 0; x < desc.Width; x++)
+		{
+			dst[x * 3 + 0] = src[x * 4 + 2];
+			dst[x * 3 + 1] = src[x * 4 + 1];
+			dst[x * 3 + 2] = src[x * 4 + 0];
+		}
+	}
+
+	m_context->Unmap(staging.Get(), 0);
+	return true;
+}
+
+void D3D11Backend::ResizeSwapChain()
+{
+	// Get height and width
+	UpdateSize();
+
+	// Release RTV
+	m_rtv.Reset();
+
+	// Cone targets follow the window size
+	CreateConeTargets();
+
+	// Resize swap chain
+	m_swapChain->ResizeBuffers(2, 0, 0, DXGI_FORMAT_UNKNOWN, 0);
+
+	// Get back buffer and resize viewport
+	ComPtr<ID3D11Texture2D> framebuffer;
+	ThrowIfFailed(m_swapChain->GetBuffer(
+		0,
+		__uuidof(ID3D11Texture2D),
+		(void**)&framebuffer));
+
+	ThrowIfFailed(m_device->CreateRenderTargetView(
+		framebuffer.Get(), 0, m_rtv.ReleaseAndGetAddressOf()));
+
+	// History and reduced resolution targets follow the back buffer size
+	CreateScreenTargets();
+
+	D3D11_TEXTURE2D_DESC backBufferDesc = { 0 };
+	framebuffer->GetDesc(&backBufferDesc);
+
+	D3D11_VIEWPORT viewport;
+	viewport.TopLeftX = 0.0f;
+	viewport.TopLeftY = 0.0f;
+	viewport.Width = static_cast<float>(backBufferDesc.Width);
+	viewport.Height = static_cast<float>(backBufferDesc.Height);
+	viewport.MinDepth = D3D11_MIN_DEPTH;
+	viewport.MaxDepth = D3D11_MAX_DEPTH;
+
+	m_context->RSSetViewports(1, &viewport);
+}
+
+// Screenshot
+void D3D11Backend::SaveRenderToFile(LPCWSTR fileName, GUID format)
+{
+	// Get back buffer
+	ComPtr<ID3D11Texture2D> framebuffer;
+	ThrowIfFailed(m_swapChain->GetBuffer(
+		0,
+		__uuidof(ID3D11Texture2D),
+		(void**)&framebuffer));
+
+	DirectX::SaveWICTextureToFile(m_context.Get(), framebuffer.Get(), format, fileName);
+}
\ No newline at end of file
@@ -0,0 +1,198 @@
+#pragma once
+
+//------------------------------
+//- d3d11backend.h
+//------------------------------
+
+// Includes
+#include "backend.h"
+#include "coneprepass.h"
+
+#include <d3d11.h>
+#include <DirectXMath.h>
+#include <dxgi1_2.h>
+#include <wrl.h>
+#include <exception>
+
+using namespace Microsoft::WRL;
+using namespace DirectX;
+
+struct Vertex
+{
+	DirectX::XMFLOAT3 position;
+	DirectX::XMFLOAT2 uv;
+};
+
+_declspec(align(16)) struct SHADER_CONSTANTS_BUFFER
+{
+	// Projection view matrix
+	DirectX::XMMATRIX projInverse;
+	DirectX::XMMATRIX viewInverse;
+	DirectX::XMFLOAT3 camPos;
+	float padding1;
+
+	// Screen dimensions
+	int screenWidth;
+	int screenHeight;
+
+	// Animation and quality
+	int animated;
+	int quality;
+
+	// Time since execution start
+	float time;
+
+	// Colours
+	DirectX::XMFLOAT3 colour1;
+	DirectX::XMFLOAT3 colour2;
+
+	// Progressive refinement pixel step
+	int pixelStep;
+
+	// Dynamic quality overrides
+	float hitEpsilon;
+	int marchIterations;
+	int deIterations;
+	float padding4;
+};
+
+// coneConstants in main.hlsl
+_declspec(align(16)) struct CONE_CONSTANTS_BUFFER
+{
+	int coneBlockSize;
+	int coneHasParent;
+	int conePrepass;
+	float padding3;
+};
+
+// reprojectionConstants in main.hlsl
+_declspec(align(16)) struct REPROJECTION_CONSTANTS_BUFFER
+{
+	DirectX::XMMATRIX prevProjInverse;
+	DirectX::XMMATRIX prevViewInverse;
+	DirectX::XMMATRIX viewProj;
+	DirectX::XMFLOAT3 prevCamPos;
+	int reproject;
+};
+
+// Draws main.hlsl to a window's swap chain
+class D3D11Backend : public RenderBackend
+{
+public:
+	// Constructor
+	D3D11Backend(HWND hwnd);
+	// Destructor
+	~D3D11Backend();
+
+	const char* GetName() const override { return "d3d11"; }
+	int GetWidth() const override;
+	int GetHeight() const override;
+
+	void UploadConstants(const FrameConstants& constants) override;
+	void Draw() override;
+	bool Readback(Image& image) override;
+	double GetGpuTime() const override { return m_gpuTime; }
+
+	// Run the cone prepass before the main pass
+	bool m_conePrepass = false;
+	// Start rays from the previous frame's reprojected hit depths
+	bool m_reprojection = false;
+
+	// Resize swapchain to render new window size
+	void ResizeSwapChain();
+	// Screenshot
+	void SaveRenderToFile(LPCWSTR fileName, GUID format);
+private:
+	// Window hwnd
+	HWND hwnd;
+
+	// Device and context
+	ComPtr<ID3D11Device> m_device;
+	ComPtr<ID3D11DeviceContext> m_context;
+
+	// HWnd dimensions
+	float m_width;
+	float m_height;
+
+	// Swapchain presents RTV result to the screen
+	// https://learn.microsoft.com/en-us/windows/win32/api/dxgi1_2/nn-dxgi1_2-idxgiswapchain1
+	ComPtr<IDXGISwapChain> m_swapChain;
+
+	// IA related members
+	ComPtr<ID3D11InputLayout> p_inputLayout;
+	ComPtr<ID3D11Buffer> m_vertexBuffer; // Vertex buffer
+
+	// Shader views
+	ComPtr<ID3D11RenderTargetView> m_rtv; // Render target view for main image
+
+	// Shaders. PSMain and ConePS are compiled once per kernel variant, by quality level and then
+	// whether the power animates, and Draw picks the frame's. See KERNEL_QUALITY in include.hlsli
+	static const int g_qualityVariants = 3;
+	ComPtr<ID3D11VertexShader> p_vertexShader;
+	ComPtr<ID3D11PixelShader> p_pixelShader[g_qualityVariants][2];
+
+	// Dynamic constant buffer, rewritten every frame
+	ComPtr<ID3D11Buffer> m_constantBuffer;
+
+	// Cone prepass, one R32 depth target per level
+	ComPtr<ID3D11PixelShader> p_conePixelShader[g_qualityVariants][2];
+	ComPtr<ID3D11Buffer> m_coneConstantBuffer;
+	ComPtr<ID3D11RenderTargetView> m_coneRtv[ConePrepass::g_levelCount];
+	ComPtr<ID3D11ShaderResourceView> m_coneSrv[ConePrepass::g_levelCount];
+	int m_coneWidth[ConePrepass::g_levelCount] = {};
+	int m_coneHeight[ConePrepass::g_levelCount] = {};
+
+	// Temporal reprojection. The main pass writes hit depths into one history target while
+	// ReprojectVS scatters the other into m_reprojectedRtv, nearest first through the depth buffer
+	ComPtr<ID3D11VertexShader> p_reprojectVertexShader;
+	ComPtr<ID3D11PixelShader> p_reprojectPixelShader;
+	ComPtr<ID3D11Buffer> m_reprojectionConstantBuffer;
+	ComPtr<ID3D11DepthStencilState> m_reprojectDepthState;
+	ComPtr<ID3D11RenderTargetView> m_historyRtv[2];
+	ComPtr<ID3D11ShaderResourceView> m_historySrv[2];
+	ComPtr<ID3D11RenderTargetView> m_reprojectedRtv;
+	ComPtr<ID3D11ShaderResourceView> m_reprojectedSrv;
+	ComPtr<ID3D11DepthStencilView> m_reprojectedDsv;
+
+	// Reduced resolution frames are drawn here then upscaled to the back buffer
+	ComPtr<ID3D11PixelShader> p_upscalePixelShader;
+	ComPtr<ID3D11RenderTargetView> m_blockRtv;
+	ComPtr<ID3D11ShaderResourceView> m_blockSrv;
+	int m_historyWidth = 0;
+	int m_historyHeight = 0;
+	int m_historyIndex = 0;
+	bool m_hasHistory = false;
+	// Timestamp queries around each frame's passes, a few frames in flight so reading them never waits
+	static const int g_timerFrames = 3;
+	ComPtr<ID3D11Query> m_timerDisjoint[g_timerFrames];
+	ComPtr<ID3D11Query> m_timerStart[g_timerFrames];
+	ComPtr<ID3D11Query> m_timerEnd[g_timerFrames];
+	bool m_timerIssued[g_timerFrames] = {};
+	int m_timerFrame = 0;
+	double m_gpuTime = -1.0;
+
+	// Constants of the frame being drawn and the one before it
+	FrameConstants m_constants = {};
+	FrameConstants m_previousConstants = {};
+
+	// Read window size
+	void UpdateSize();
+	// (Re)create the cone targets for the current size
+	void CreateConeTargets();
+	// (Re)create the history, reprojection and reduced resolution targets at the back buffer size
+	void CreateScreenTargets();
+	// Scatter the previous frame's depths, returns whether the main pass can use them
+	bool Reproject();
+	// Upload coneConstants for the next pass
+	void SetConeConstants(int blockSize, int hasParent, int prepass);
+};
+
+// Helper functions for DirectX
+inline void ThrowIfFailed(HRESULT hr)
+{
+	if (FAILED(hr))
+	{
+		// Set a breakpoint on this line to catch Win32 API errors.
+		throw std::exception();
+	}
+}
@@ -0,0 +1,517 @@
+//------------------------------
+//- distributed.cpp
+//------------------------------
+
+// Includes
+#include "distributed.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+static double Seconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration<double>(duration).count();
+}
+
+// The kernel settings this process renders with
+static TileSettings CaptureSettings()
+{
+	TileSettings settings = {};
+	settings.simd = uint32_t(GetSimdLevel());
+	settings.normals = uint32_t(GetNormalMode());
+	for (int q = 0; q < 3; q++)
+		settings.march[q] = uint32_t(GetMarchStrategy(q));
+	settings.trigFreePower = GetTrigFreePower() ? 1 : 0;
+	settings.boundingSphere = GetBoundingSphere() ? 1 : 0;
+	settings.pixelLod = GetPixelLod() ? 1 : 0;
+	return settings;
+}
+
+// Render with the coordinator's kernel settings, false for values this build does not know
+static bool ApplySettings(const TileSettings& settings)
+{
+	if (settings.simd > uint32_t(SimdLevel::AVX512) || settings.normals > uint32_t(NormalMode::Analytic))
+		return false;
+	for (int q = 0; q < 3; q++)
+	{
+		if (settings.march[q] > uint32_t(MarchStrategy::Refined))
+			return false;
+	}
+
+	SetSimdLevel(SimdLevel(settings.simd));
+	SetNormalMode(NormalMode(settings.normals));
+	for (int q = 0; q < 3; q++)
+		SetMarchStrategy(q, MarchStrategy(settings.march[q]));
+	SetTrigFreePower(settings.trigFreePower != 0);
+	SetBoundingSphere(settings.boundingSphere != 0);
+	SetPixelLod(settings.pixelLod != 0);
+	return true;
+}
+
+bool TileCoordinator::Listen(uint16_t port)
+{
+	return m_listener.Listen(port);
+}
+
+bool TileCoordinator::Send(Worker& worker, TileMessageType type, const void* payload, uint32_t size)
+{
+	TileMessageHeader header = { uint32_t(type), size };
+	return worker.socket.SendAll(&header, sizeof(header)) && (size == 0 || worker.socket.SendAll(payload, size));
+}
+
+void TileCoordinator::DropWorker(size_t index, std::vector<Tile>& tiles, std::deque<int>& queue)
+{
+	Worker& worker = m_workers[index];
+	for (int tile : worker.tiles)
+	{
+		tiles[tile].copies--;
+		if (!tiles[tile].done && tiles[tile].copies == 0)
+		{
+			// Next in line, ahead of tiles nobody has started
+			queue.push_front(tile);
+			m_stats.reissued++;
+		}
+	}
+	if (worker.hello)
+		m_stats.workersLost++;
+	m_workers.erase(m_workers.begin() + index);
+}
+
+bool TileCoordinator::HandleMessages(Worker& worker, std::vector<Tile>& tiles, Image& image, int& done, double& tileSeconds)
+{
+	size_t offset = 0;
+	while (worker.received.size() - offset >= sizeof(TileMessageHeader))
+	{
+		TileMessageHeader header;
+		memcpy(&header, worker.received.data() + offset, sizeof(header));
+		if (worker.received.size() - offset - sizeof(header) < header.size)
+			break;
+		const uint8_t* payload = worker.received.data() + offset + sizeof(header);
+		offset += sizeof(header) + header.size;
+
+		if (header.type == uint32_t(TileMessageType::Hello))
+		{
+			TileHello hello;
+			if (header.size != sizeof(hello))
+				return false;
+			memcpy(&hello, payload, sizeof(hello));
+			if (hello.version != g_tileProtocolVersion)
+			{
+				fprintf(stderr, "Worker %d speaks protocol %u, not %u\n", worker.index, hello.version, g_tileProtocolVersion);
+				return false;
+			}
+			worker.hello = true;
+			m_stats.workers++;
+			continue;
+		}
+
+		if (header.type != uint32_t(TileMessageType::Result) || header.size < sizeof(TileRequest))
+			return false;
+
+		// A copy of a tile from an earlier frame that was still out when it finished
+		TileRequest request;
+		memcpy(&request, payload, sizeof(request));
+		if (request.job != m_job)
+			continue;
+
+		auto held = std::find(worker.tiles.begin(), worker.tiles.end(), int(request.tile));
+		if (request.tile >= tiles.size() || held == worker.tiles.end())
+			return false;
+
+		Tile& tile = tiles[request.tile];
+		const TileRequest& expected = tile.request;
+		size_t rowBytes = size_t(expected.x1 - expected.x0) * 3;
+		if (header.size != sizeof(TileRequest) + rowBytes * size_t(expected.y1 - expected.y0))
+			return false;
+
+		// The worker's usual time per tile, from how long it held this one
+		size_t slot = size_t(held - worker.tiles.begin());
+		double seconds = Seconds(Clock::now() - worker.sentAt[slot]) / double(worker.tiles.size());
+		tileSeconds = tileSeconds > 0.0 ? tileSeconds * 0.9 + seconds * 0.1 : seconds;
+		worker.tiles.erase(held);
+		worker.sentAt.erase(worker.sentAt.begin() + slot);
+		tile.copies--;
+
+		if (tile.done)
+		{
+			m_stats.duplicatesDiscarded++;
+			continue;
+		}
+
+		const uint8_t* pixels = payload + sizeof(TileRequest);
+		for (int y = expected.y0; y < expected.y1; y++)
+			memcpy(image.Row(y) + size_t(expected.x0) * 3, pixels + size_t(y - expected.y0) * rowBytes, rowBytes);
+		tile.done = true;
+		done++;
+		if (int(m_stats.tilesPerWorker.size()) <= worker.index)
+			m_stats.tilesPerWorker.resize(worker.index + 1, 0);
+		m_stats.tilesPerWorker[worker.index]++;
+	}
+
+	worker.received.erase(worker.received.begin(), worker.received.begin() + offset);
+	return true;
+}
+
+bool TileCoordinator::Render(const FrameConstants& constants, float power, Image& image)
+{
+	auto start = Clock::now();
+	m_job++;
+	int previousWorkers = m_stats.workers;
+	m_stats = {};
+	m_stats.workers = previousWorkers;
+	image.Resize(constants.screenWidth, constants.screenHeight);
+
+	// Row major tiles, all queued
+	std::vector<Tile> tiles;
+	std::deque<int> queue;
+	for (int y = 0; y < constants.screenHeight; y += m_tileSize)
+	{
+		for (int x = 0; x < constants.screenWidth; x += m_tileSize)
+		{
+			Tile tile;
+			tile.request = { m_job, uint32_t(tiles.size()), x, y, std::min(x + m_tileSize, constants.screenWidth), std::min(y + m_tileSize, constants.screenHeight) };
+			queue.push_back(int(tiles.size()));
+			tiles.push_back(tile);
+		}
+	}
+	m_stats.tiles = int(tiles.size());
+
+	// Tiles still out from the last frame are no longer tracked
+	for (Worker& worker : m_workers)
+	{
+		worker.tiles.clear();
+		worker.sentAt.clear();
+	}
+
+	TileJob job = {};
+	job.version = g_tileProtocolVersion;
+	job.job = m_job;
+	job.power = power;
+	job.settings = CaptureSettings();
+	job.constantsSize = sizeof(FrameConstants);
+	job.constants = constants;
+
+	int done = 0;
+	double tileSeconds = 0.0;
+	auto lastWorker = Clock::now();
+	std::vector<const NetSocket*> sockets;
+	std::vector<bool> ready;
+	std::vector<uint8_t> buffer(1 << 16);
+
+	while (done < int(tiles.size()))
+	{
+		auto now = Clock::now();
+
+		// Hand out work, queued tiles first, then copies of the slowest outstanding tile
+		for (size_t i = 0; i < m_workers.size(); i++)
+		{
+			Worker& worker = m_workers[i];
+			if (!worker.hello)
+				continue;
+			bool ok = true;
+			if (worker.job != m_job)
+			{
+				ok = Send(worker, TileMessageType::Job, &job, sizeof(job));
+				worker.job = m_job;
+			}
+
+			while (ok && int(worker.tiles.size()) < m_tilesPerWorker)
+			{
+				int next = -1;
+				while (!queue.empty() && next < 0)
+				{
+					next = queue.front();
+					queue.pop_front();
+					if (tiles[next].done)
+						next = -1;
+				}
+
+				bool duplicate = false;
+				if (next < 0 && worker.tiles.empty() && tileSeconds > 0.0)
+				{
+					double oldest = m_slowFactor * tileSeconds * m_tilesPerWorker;
+					for (size_t t = 0; t < tiles.size(); t++)
+					{
+						const Tile& tile = tiles[t];
+						double age = Seconds(now - tile.firstSent);
+						if (!tile.done && tile.copies == 1 && age > oldest)
+						{
+							next = int(t);
+							oldest = age;
+						}
+					}
+					duplicate = next >= 0;
+				}
+				if (next < 0)
+					break;
+
+				// The timeout runs from when a worker is given work, not from its last idle message
+				if (worker.tiles.empty())
+					worker.lastHeard = now;
+				ok = Send(worker, TileMessageType::Tile, &tiles[next].request, sizeof(TileRequest));
+				if (tiles[next].copies == 0)
+					tiles[next].firstSent = now;
+				tiles[next].copies++;
+				worker.tiles.push_back(next);
+				worker.sentAt.push_back(now);
+				if (duplicate)
+					m_stats.duplicated++;
+			}
+
+			if (!ok)
+			{
+				fprintf(stderr, "Lost worker %d while sending\n", worker.index);
+				DropWorker(i--, tiles, queue);
+			}
+		}
+
+		// Workers holding tiles that have said nothing for too long
+		for (size_t i = 0; i < m_workers.size(); i++)
+		{
+			Worker& worker = m_workers[i];
+			if (!worker.tiles.empty() && Seconds(now - worker.lastHeard) > m_workerTimeoutSeconds)
+			{
+				fprintf(stderr, "Worker %d timed out\n", worker.index);
+				DropWorker(i--, tiles, queue);
+			}
+		}
+
+		if (!m_workers.empty())
+			lastWorker = now;
+		else if (Seconds(now - lastWorker) > m_noWorkerTimeoutSeconds)
+		{
+			fprintf(stderr, "No workers for %.0f s, giving up with %d of %d tiles\n", m_noWorkerTimeoutSeconds, done, int(tiles.size()));
+			return false;
+		}
+
+		// New workers and results
+		sockets.assign(1, &m_listener);
+		for (const Worker& worker : m_workers)
+			sockets.push_back(&worker.socket);
+		if (!WaitReadable(sockets, 50, ready))
+			continue;
+
+		for (size_t i = m_workers.size(); i-- > 0;)
+		{
+			if (!ready[i + 1])
+				continue;
+			Worker& worker = m_workers[i];
+			long long received = worker.socket.Receive(buffer.data(), buffer.size());
+			if (received <= 0)
+			{
+				fprintf(stderr, "Worker %d disconnected with %d tiles\n", worker.index, int(worker.tiles.size()));
+				DropWorker(i, tiles, queue);
+				continue;
+			}
+			worker.lastHeard = Clock::now();
+			worker.received.insert(worker.received.end(), buffer.data(), buffer.data() + received);
+			if (!HandleMessages(worker, tiles, image, done, tileSeconds))
+			{
+				fprintf(stderr, "Worker %d sent a bad message\n", worker.index);
+				DropWorker(i, tiles, queue);
+			}
+		}
+
+		if (ready[0])
+		{
+			Worker worker;
+			if (m_listener.Accept(worker.socket))
+			{
+				worker.index = m_workerCount++;
+				worker.lastHeard = Clock::now();
+				m_workers.push_back(std::move(worker));
+			}
+		}
+	}
+
+	m_stats.tilesPerWorker.resize(m_workerCount, 0);
+	m_stats.totalMs = Seconds(Clock::now() - start) * 1000.0;
+	return true;
+}
+
+void TileCoordinator::Shutdown()
+{
+	for (Worker& worker : m_workers)
+		Send(worker, TileMessageType::Done, nullptr, 0);
+	m_workers.clear();
+}
+
+// Constructor
+TileWorker::TileWorker(ThreadPool& pool)
+	: m_pool(pool)
+	, m_renderer(pool)
+{
+}
+
+bool TileWorker::Connect(const std::string& host, uint16_t port, double retrySeconds)
+{
+	auto start = std::chrono::steady_clock::now();
+	while (!m_socket.Connect(host, port))
+	{
+		if (Seconds(std::chrono::steady_clock::now() - start) > retrySeconds)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	TileMessageHeader header = { uint32_t(TileMessageType::Hello), sizeof(TileHello) };
+	TileHello hello = { g_tileProtocolVersion, m_pool.GetThreadCount() };
+	return m_socket.SendAll(&header, sizeof(header)) && m_socket.SendAll(&hello, sizeof(hello));
+}
+
+bool TileWorker::Serve()
+{
+	TileJob job = {};
+	FrameSetup setup = {};
+	bool hasJob = false;
+	Image tileImage;
+	std::vector<uint8_t> result;
+
+	for (;;)
+	{
+		TileMessageHeader header;
+		if (!m_socket.ReceiveAll(&header, sizeof(header)))
+			return false;
+
+		if (header.type == uint32_t(TileMessageType::Done))
+			return true;
+
+		if (header.type == uint32_t(TileMessageType::Job))
+		{
+			if (header.size != sizeof(TileJob) || !m_socket.ReceiveAll(&job, sizeof(job)))
+				return false;
+			if (job.version != g_tileProtocolVersion || job.constantsSize != sizeof(FrameConstants))
+			{
+				fprintf(stderr, "Coordinator speaks protocol %u, not %u\n", job.version, g_tileProtocolVersion);
+				return false;
+			}
+			if (!ApplySettings(job.settings))
+			{
+				fprintf(stderr, "Job %u has settings this worker does not know\n", job.job);
+				return false;
+			}
+			setup = CreateFrameSetup(job.constants);
+			SetFramePower(setup, job.power);
+			hasJob = true;
+			continue;
+		}
+
+		TileRequest request;
+		if (header.type != uint32_t(TileMessageType::Tile) || header.size != sizeof(request) || !m_socket.ReceiveAll(&request, sizeof(request)))
+			return false;
+		if (!hasJob || request.job != job.job || request.x0 < 0 || request.y0 < 0 || request.x1 > job.constants.screenWidth
+			|| request.y1 > job.constants.screenHeight || request.x0 >= request.x1 || request.y0 >= request.y1)
+			return false;
+
+		if (m_exitAfterTiles > 0 && m_tilesRendered >= m_exitAfterTiles)
+			return true;
+		if (m_delayMs > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(m_delayMs));
+
+		// The tile in pieces over the pool, each piece writing its own columns of the tile image
+		int width = request.x1 - request.x0;
+		int height = request.y1 - request.y0;
+		tileImage.Resize(width, height);
+		int piecesX = (width + m_tileSize - 1) / m_tileSize;
+		int piecesY = (height + m_tileSize - 1) / m_tileSize;
+		m_pool.ParallelFor(piecesX * piecesY, [&](int piece) {
+			int x0 = request.x0 + (piece % piecesX) * m_tileSize;
+			int y0 = request.y0 + (piece / piecesX) * m_tileSize;
+			int x1 = std::min(x0 + m_tileSize, int(request.x1));
+			int y1 = std::min(y0 + m_tileSize, int(request.y1));
+			m_renderer.RenderRegion(job.constants, setup, x0, y0, x1, y1, tileImage, request.x0, request.y0);
+		});
+		m_tilesRendered++;
+
+		TileMessageHeader reply = { uint32_t(TileMessageType::Result), uint32_t(sizeof(request) + tileImage.pixels.size()) };
+		result.resize(sizeof(reply) + sizeof(request));
+		memcpy(result.data(), &reply, sizeof(reply));
+		memcpy(result.data() + sizeof(reply), &request, sizeof(request));
+		if (!m_socket.SendAll(result.data(), result.size()) || !m_socket.SendAll(tileImage.pixels.data(), tileImage.pixels.size()))
+			return false;
+	}
+}
+
+// Destructor
+LocalProcess::~LocalProcess()
+{
+	Wait();
+}
+
+#if defined(_WIN32)
+
+bool LocalProcess::Start(const std::string& executable, const std::vector<std::string>& args)
+{
+	std::string commandLine = "\"" + executable + "\"";
+	for (const std::string& arg : args)
+		commandLine += " \"" + arg + "\"";
+
+	STARTUPINFOA startup = {};
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION info = {};
+	if (!CreateProcessA(executable.c_str(), &commandLine[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &info))
+		return false;
+	CloseHandle(info.hThread);
+	m_process = intptr_t(info.hProcess);
+	m_running = true;
+	return true;
+}
+
+int LocalProcess::Wait()
+{
+	if (!m_running)
+		return -1;
+	m_running = false;
+
+	HANDLE process = HANDLE(m_process);
+	DWORD code = DWORD(-1);
+	WaitForSingleObject(process, INFINITE);
+	GetExitCodeProcess(process, &code);
+	CloseHandle(process);
+	return int(code);
+}
+
+#else
+
+bool LocalProcess::Start(const std::string& executable, const std::vector<std::string>& args)
+{
+	std::vector<char*> argv;
+	argv.push_back(const_cast<char*>(executable.c_str()));
+	for (const std::string& arg : args)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(nullptr);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0)
+	{
+		execv(executable.c_str(), argv.data());
+		_exit(127);
+	}
+	m_process = intptr_t(pid);
+	m_running = true;
+	return true;
+}
+
+int LocalProcess::Wait()
+{
+	if (!m_running)
+		return -1;
+	m_running = false;
+
+	int status = 0;
+	if (waitpid(pid_t(m_process), &status, 0) < 0 || !WIFEXITED(status))
+		return -1;
+	return WEXITSTATUS(status);
+}
+
+#endif
@@ -0,0 +1,221 @@
+#pragma once
+
+//------------------------------
+//- distributed.h
+//------------------------------
+
+// Renders a frame across worker processes, on this host or others. The coordinator listens for
+// workers, sends each the frame's constants, power and kernel settings, then hands out tiles as workers return
+// results so faster workers take more of them. Tiles held by a worker that disconnects or goes
+// quiet are queued again, and once the queue is empty idle workers also get copies of tiles that
+// are taking much longer than usual, the first result to arrive wins
+
+// Includes
+#include "cpurenderer.h"
+#include "kernel.h"
+#include "kernel_simd.h"
+#include "netsocket.h"
+#include "pngwriter.h"
+#include "threadpool.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Wire format, little endian. Every message is a TileMessageHeader followed by size bytes
+enum class TileMessageType : uint32_t
+{
+	// Worker to coordinator, a TileHello
+	Hello = 1,
+	// Coordinator to worker, a TileJob
+	Job = 2,
+	// Coordinator to worker, a TileRequest
+	Tile = 3,
+	// Worker to coordinator, a TileRequest then the tile's RGB rows
+	Result = 4,
+	// Coordinator to worker, no payload, the worker exits
+	Done = 5,
+};
+
+// Bumped whenever a message or FrameConstants changes
+const uint32_t g_tileProtocolVersion = 2;
+
+struct TileMessageHeader
+{
+	uint32_t type;
+	uint32_t size;
+};
+
+struct TileHello
+{
+	uint32_t version;
+	uint32_t threads;
+};
+
+// The coordinator's kernel settings, which live in globals rather than FrameConstants. Workers
+// apply them to every job so each tile is marched and shaded the way the coordinator would
+struct TileSettings
+{
+	// SimdLevel, clamped to what the worker's CPU supports
+	uint32_t simd;
+	// NormalMode
+	uint32_t normals;
+	// MarchStrategy for each quality level
+	uint32_t march[3];
+	uint32_t trigFreePower;
+	uint32_t boundingSphere;
+	uint32_t pixelLod;
+};
+
+struct TileJob
+{
+	uint32_t version;
+	uint32_t job;
+	// Power the frame is rendered with, FrameConstants only holds what the shader derives it from
+	float power;
+	TileSettings settings;
+	uint32_t constantsSize;
+	FrameConstants constants;
+};
+
+struct TileRequest
+{
+	uint32_t job;
+	uint32_t tile;
+	int32_t x0;
+	int32_t y0;
+	int32_t x1;
+	int32_t y1;
+};
+
+struct TileCoordinatorStats
+{
+	int tiles = 0;
+	// Workers that connected, and those dropped for disconnecting or going quiet
+	int workers = 0;
+	int workersLost = 0;
+	// Tiles queued again after their worker was lost
+	int reissued = 0;
+	// Extra copies of slow tiles handed out, and results that arrived after another copy's
+	int duplicated = 0;
+	int duplicatesDiscarded = 0;
+	// Tiles each worker finished first, in connection order
+	std::vector<int> tilesPerWorker;
+	double totalMs = 0.0;
+};
+
+class TileCoordinator
+{
+public:
+	// Tile edge in pixels
+	int m_tileSize = 128;
+	// Tiles sent ahead to each worker so it never waits on a round trip
+	int m_tilesPerWorker = 2;
+	// A worker holding tiles and silent for this long is treated as dead
+	double m_workerTimeoutSeconds = 30.0;
+	// A tile this many times older than the usual time per tile gets a copy on an idle worker
+	double m_slowFactor = 4.0;
+	// Give up when no worker has been connected for this long
+	double m_noWorkerTimeoutSeconds = 60.0;
+
+	// Constructor
+	TileCoordinator() = default;
+
+	// Listen on port, 0 for any free one
+	bool Listen(uint16_t port);
+	uint16_t GetPort() const { return m_listener.GetPort(); }
+
+	// Render constants with the fractal at power into image using whichever workers connect, with
+	// the kernel settings in force when it is called. Workers stay connected for the next Render
+	bool Render(const FrameConstants& constants, float power, Image& image);
+	// Tell every worker to exit
+	void Shutdown();
+
+	const TileCoordinatorStats& GetStats() const { return m_stats; }
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Worker
+	{
+		NetSocket socket;
+		int index = 0;
+		bool hello = false;
+		// Job the worker last received
+		uint32_t job = 0;
+		std::vector<uint8_t> received;
+		// Tiles sent and not yet returned, with when they were sent
+		std::vector<int> tiles;
+		std::vector<Clock::time_point> sentAt;
+		Clock::time_point lastHeard;
+	};
+
+	struct Tile
+	{
+		TileRequest request;
+		bool done = false;
+		// Workers holding a copy
+		int copies = 0;
+		Clock::time_point firstSent;
+	};
+
+	NetSocket m_listener;
+	std::vector<Worker> m_workers;
+	int m_workerCount = 0;
+	uint32_t m_job = 0;
+	TileCoordinatorStats m_stats;
+
+	// Messages in a worker's buffer, false when the worker broke the protocol
+	bool HandleMessages(Worker& worker, std::vector<Tile>& tiles, Image& image, int& done, double& tileSeconds);
+	// Drop a worker, queueing its tiles again
+	void DropWorker(size_t index, std::vector<Tile>& tiles, std::deque<int>& queue);
+	bool Send(Worker& worker, TileMessageType type, const void* payload, uint32_t size);
+};
+
+// Worker side. Connects to a coordinator and renders the tiles it is sent until told to stop
+class TileWorker
+{
+public:
+	// Testing aids, sleep before each tile or vanish after this many tiles, 0 for never
+	int m_delayMs = 0;
+	int m_exitAfterTiles = 0;
+	// Sub tile edge the pool splits each tile into
+	int m_tileSize = 16;
+
+	// Constructor
+	TileWorker(ThreadPool& pool);
+
+	// Keep trying for retrySeconds, the coordinator may still be starting
+	bool Connect(const std::string& host, uint16_t port, double retrySeconds);
+	// Serve tiles until Done or the connection drops, false on errors
+	bool Serve();
+
+	int GetTilesRendered() const { return m_tilesRendered; }
+private:
+	ThreadPool& m_pool;
+	CpuRenderer m_renderer;
+	NetSocket m_socket;
+	int m_tilesRendered = 0;
+};
+
+// A worker process started by the coordinator on this host
+class LocalProcess
+{
+public:
+	// Constructor
+	LocalProcess() = default;
+	~LocalProcess();
+
+	LocalProcess(const LocalProcess&) = delete;
+	LocalProcess& operator=(const LocalProcess&) = delete;
+
+	// Run executable with args, not including the executable itself
+	bool Start(const std::string& executable, const std::vector<std::string>& args);
+	// Wait for it to exit, returns its exit code or -1
+	int Wait();
+private:
+	// Process handle on Windows, the pid elsewhere
+	intptr_t m_process = 0;
+	bool m_running = false;
+};
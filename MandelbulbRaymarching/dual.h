@@ -0,0 +1,82 @@
+#pragma once
+
+//------------------------------
+//- dual.h
+//------------------------------
+
+// Forward mode dual numbers carrying a value and its gradient with respect to a point. Running
+// the templated iteration in mandelbulb.h on Dual3 gives the DE and its gradient in one orbit,
+// which is the surface normal without finite differences
+
+// Includes
+#include "hlslmath.h"
+
+#include <cmath>
+
+struct Dual3
+{
+	float v;
+	// d v / d (x, y, z)
+	float3 d;
+
+	// Constants have no gradient
+	Dual3(float value = 0.0f) : v(value), d{ 0.0f, 0.0f, 0.0f } {}
+	Dual3(float value, float3 gradient) : v(value), d(gradient) {}
+
+	// Dual numbers for p whose gradients are the axes
+	static void Seed(float3 p, Dual3& x, Dual3& y, Dual3& z)
+	{
+		x = { p.x, { 1.0f, 0.0f, 0.0f } };
+		y = { p.y, { 0.0f, 1.0f, 0.0f } };
+		z = { p.z, { 0.0f, 0.0f, 1.0f } };
+	}
+};
+
+inline Dual3 operator+(Dual3 a, Dual3 b) { return { a.v + b.v, a.d + b.d }; }
+inline Dual3 operator-(Dual3 a, Dual3 b) { return { a.v - b.v, a.d - b.d }; }
+inline Dual3 operator-(Dual3 a) { return { -a.v, -a.d }; }
+inline Dual3 operator*(Dual3 a, Dual3 b) { return { a.v * b.v, a.d * b.v + b.d * a.v }; }
+inline Dual3 operator/(Dual3 a, Dual3 b)
+{
+	float inv = 1.0f / b.v;
+	return { a.v * inv, (a.d - b.d * (a.v * inv)) * inv };
+}
+
+// Comparisons only look at the value, branches take no part in the derivative
+inline bool operator<(Dual3 a, Dual3 b) { return a.v < b.v; }
+inline bool operator>(Dual3 a, Dual3 b) { return a.v > b.v; }
+
+// Found by argument dependent lookup from the Mandelbulb templates
+inline Dual3 sqrt(Dual3 a)
+{
+	float s = std::sqrt(a.v);
+	// The slope is infinite at zero, where the iteration only takes it on the y axis
+	return { s, s > 0.0f ? a.d * (0.5f / s) : float3{ 0.0f, 0.0f, 0.0f } };
+}
+
+inline Dual3 log(Dual3 a) { return { std::log(a.v), a.d / a.v }; }
+inline Dual3 sin(Dual3 a) { return { std::sin(a.v), a.d * std::cos(a.v) }; }
+inline Dual3 cos(Dual3 a) { return { std::cos(a.v), a.d * -std::sin(a.v) }; }
+
+inline Dual3 acos(Dual3 a)
+{
+	float slope = 1.0f - a.v * a.v;
+	return { std::acos(a.v), slope > 0.0f ? a.d * (-1.0f / std::sqrt(slope)) : float3{ 0.0f, 0.0f, 0.0f } };
+}
+
+inline Dual3 atan2(Dual3 y, Dual3 x)
+{
+	float r2 = x.v * x.v + y.v * y.v;
+	float3 d = r2 > 0.0f ? (y.d * x.v - x.d * y.v) / r2 : float3{ 0.0f, 0.0f, 0.0f };
+	return { std::atan2(y.v, x.v), d };
+}
+
+// a^b for a > 0
+inline Dual3 pow(Dual3 a, Dual3 b)
+{
+	float value = std::pow(a.v, b.v);
+	float3 d = a.d * (b.v * std::pow(a.v, b.v - 1.0f));
+	if (a.v > 0.0f)
+		d += b.d * (value * std::log(a.v));
+	return { value, d };
+}
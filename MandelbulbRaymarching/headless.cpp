@@ -0,0 +1,1946 @@
+//------------------------------
+//- headless.cpp
+//------------------------------
+
+// Command line front end for the CPU renderer, builds without Windows or a GPU
+
+// Includes
+#include "animation.h"
+#include "costmap.h"
+#include "cpubackend.h"
+#include "distributed.h"
+#include "kernel_simd.h"
+#include "meshexport.h"
+#include "poster.h"
+#include "renderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Everything a render can be configured with from the command line
+struct HeadlessOptions
+{
+	std::string output = "mandelbulb.png";
+	int width = 1280;
+	int height = 720;
+	bool hasSize = false;
+	int quality = 0;
+	int animated = 0;
+	float time = 0.0f;
+	float3 colour1 = { 255.0f, 255.0f, 255.0f };
+	float3 colour2 = { 255.0f, 255.0f, 255.0f };
+	unsigned threads = 0;
+	int tileSize = 16;
+	SimdLevel simd = DetectSimdLevel();
+	bool polar = false;
+	NormalMode normals = NormalMode::Central;
+	bool unbounded = false;
+	bool fixedLod = false;
+	bool rowBatches = false;
+	// Adaptive anti-aliasing budget in extra rays per pixel, and rays per refined pixel
+	float aaBudget = 0.0f;
+	int aaSamples = 8;
+	// March strategy of each quality level
+	MarchStrategy march[3] = { g_qualityMarchStrategy[0], g_qualityMarchStrategy[1], g_qualityMarchStrategy[2] };
+	bool prepass = false;
+	bool reproject = false;
+	bool progressive = false;
+	int movingStep = 4;
+	double budget = 0.0;
+	std::string telemetry;
+	std::string json;
+	int brickMap = 0;
+	int brickMapMegabytes = 256;
+	std::string brickMapCache;
+	bool brickMapLazy = false;
+	int shadowCacheMegabytes = 0;
+
+	// Frame loop
+	int frames = 100;
+	int moveFrames = -1;
+	std::string backend = "null";
+	std::string record;
+	std::string replay;
+	std::string timings;
+
+	// Offline animation
+	double fps = 30.0;
+	double start = 0.0;
+	PowerCurve curve;
+	int framesInFlight = 0;
+
+	// Poster
+	int stripRows = 64;
+	int dpi = 300;
+
+	// Mesh
+	int meshDepth = 9;
+	float meshIso = 0.5f;
+
+	// Distributed rendering
+	std::string executable;
+	int listenPort = 0;
+	int spawn = 0;
+	int netTileSize = 128;
+	double workerTimeout = 30.0;
+	std::string connect;
+	int workerDelay = 0;
+	int workerExitAfter = 0;
+
+	// Camera, defaults to the pose in camera.h
+	bool hasPosition = false;
+	bool hasTarget = false;
+	float3 position = {};
+	float3 target = {};
+	float fovDegrees = 45.0f;
+};
+
+static void PrintUsage()
+{
+	printf(
+		"Usage: mandelbulb-cli render [options]\n"
+		"       mandelbulb-cli check-simd [--simd <level>]\n"
+		"       mandelbulb-cli check-power [options]\n"
+		"       mandelbulb-cli check-normals [options]\n"
+		"       mandelbulb-cli check-bounds [options]\n"
+		"       mandelbulb-cli check-lod [options]\n"
+		"       mandelbulb-cli check-march [options]\n"
+		"       mandelbulb-cli check-aa [--aa <budget>] [options]\n"
+		"       mandelbulb-cli frames [--frames <n>] [--backend null|cpu] [options]\n"
+		"       mandelbulb-cli check-progressive [--move <n>] [options]\n"
+		"       mandelbulb-cli animate [--frames <n>] [--fps <n>] [--curve <s:p,...>] [options]\n"
+		"       mandelbulb-cli poster --width <n> --height <n> --output <file.png|file.tif> [options]\n"
+		"       mandelbulb-cli mesh [--mesh-depth <n>] --output <file.ply|file.obj> [options]\n"
+		"       mandelbulb-cli check-mesh [options]\n"
+		"       mandelbulb-cli coordinate [--listen <port>] [--spawn <n>] [options]\n"
+		"       mandelbulb-cli worker --connect <host:port> [--threads <n>]\n"
+		"       mandelbulb-cli cost [--json <file>] [options]\n"
+		"\n"
+		"check-simd compares the packet distance estimator against the scalar reference\n"
+		"check-power compares the trig-free integer powers against the polar form\n"
+		"check-normals compares the tetrahedral and analytic normals against central differences\n"
+		"check-bounds renders with and without the bounding sphere and reports the evaluations it saved\n"
+		"check-lod renders wide, default and close views with the fixed and the pixel LOD hit epsilon\n"
+		"check-march marches the view with each march strategy and reports the steps each ray took\n"
+		"check-aa compares adaptive anti-aliasing with one ray per pixel and supersampling every pixel\n"
+		"frames runs Renderer's frame loop with a scripted or recorded camera and reports per frame timings\n"
+		"check-progressive moves the scripted camera, holds it still and checks refinement runs every pass\n"
+		"animate renders a clip with the power following a curve over time, several frames at once\n"
+		"poster renders an image of up to 65536x65536 in strips streamed to a PNG or TIFF file\n"
+		"mesh extracts the fractal's surface as triangles, check-mesh checks the octree's pruning finds\n"
+		"every cell a dense grid does and that the mesh is closed\n"
+		"coordinate renders one image in tiles handed to worker processes over TCP, worker serves them\n"
+		"cost counts each pixel's march, normal and shadow work and writes heatmaps beside --output,\n"
+		"it needs a build with -DMANDELBULB_PIXEL_COST\n"
+		"\n"
+		"  --output <file.png>    Output image (default mandelbulb.png)\n"
+		"  --width <n>            Image width (default 1280)\n"
+		"  --height <n>           Image height (default 720)\n"
+		"  --quality <0|1|2>      Low, medium or high march settings (default 0)\n"
+		"  --animated             Animate the power from --time like the Animation setting\n"
+		"  --time <ms>            Time since start in milliseconds (default 0)\n"
+		"  --colour1 <r,g,b>      First colour, 0-255 (default 255,255,255)\n"
+		"  --colour2 <r,g,b>      Second colour, 0-255 (default 255,255,255)\n"
+		"  --position <x,y,z>     Camera position (default matches Reset Camera)\n"
+		"  --target <x,y,z>       Point the camera looks at\n"
+		"  --fov <degrees>        Vertical field of view (default 45)\n"
+		"  --threads <n>          Worker threads, 0 for all cores (default 0)\n"
+		"  --tile <n>             Tile size in pixels (default 16)\n"
+		"  --simd <level>         scalar, avx2 or avx512 (default widest supported)\n"
+		"  --polar                Use the polar form even for integer powers\n"
+		"  --normals <mode>       central, tetrahedral or analytic (default central, as the shader)\n"
+		"  --unbounded            March from the camera and trace every light to a fixed radius\n"
+		"  --fixed-lod            Hit at the quality level's fixed epsilon with every DE iteration\n"
+		"  --row-batches          March, shade and shadow each tile a row at a time instead of as one stream\n"
+		"  --aa <budget>          Supersample edge pixels with up to budget extra rays per pixel (render,\n"
+		"                         frames, default 0 for off, 0.5 for check-aa)\n"
+		"  --aa-samples <4|8>     Rays traced in each supersampled pixel (default 8)\n"
+		"  --march <s[,s,s]>      plain, relaxed or refined for every quality level, or one per level\n"
+		"                         (default relaxed,relaxed,refined)\n"
+		"  --prepass              Start pixels from a hierarchical cone marching prepass\n"
+		"  --reproject            Start pixels from the previous frame's reprojected depths (frames)\n"
+		"  --brickmap <n>         March on a distance field cache of n voxels per axis (render, frames, poster)\n"
+		"  --brickmap-mb <n>      Memory cap for the cache in megabytes (default 256)\n"
+		"  --brickmap-cache <dir> Map the cache from a file in dir, building and saving it if missing\n"
+		"  --brickmap-lazy        Skip the cache file's sample checksum so pages load as they are used\n"
+		"  --shadow-cache <mb>    Keep traced shadows in a world space cache of this size (frames)\n"
+		"  --progressive          Refine progressively once the camera stops (frames)\n"
+		"  --moving-step <1|2|4>  Pixel step while the camera moves with --progressive (default 4)\n"
+		"  --budget <ms>          Hold frames to this time with dynamic quality (frames)\n"
+		"  --telemetry <file.csv> Write the dynamic quality controller's state every frame\n"
+		"  --json <file>          Write the cost totals, percentiles and histograms (cost)\n"
+		"  --frames <n>           Frames to run for frames or render for animate (default 100)\n"
+		"  --move <n>             Frames the scripted camera moves for before holding still (default all)\n"
+		"  --backend <name>       null draws nothing, cpu shades every frame (default null)\n"
+		"  --record <file>        Save the frames' input, settings and camera as a trace (frames)\n"
+		"  --replay <file>        Drive the camera and settings from a trace instead (frames)\n"
+		"  --timings <file.csv>   Write every frame's timings and work (frames)\n"
+		"  --fps <n>              Frames per second of the clip (default 30)\n"
+		"  --start <s>            Time of the first frame in seconds (default 0)\n"
+		"  --curve <s:p,...>      Power keys over time, linear between them (default the Animation curve)\n"
+		"  --in-flight <n>        Frames or poster strips rendered and buffered at once\n"
+		"                         (default threads + 1 frames, 3 strips)\n"
+		"  --strip-rows <n>       Rows per poster strip, rounded up to whole tiles (default 64)\n"
+		"  --dpi <n>              Print resolution a TIFF poster is tagged with (default 300)\n"
+		"  --mesh-depth <n>       Octree levels, the mesh's leaf cells are 2^n per axis, up to 16 (default 9)\n"
+		"  --mesh-iso <cells>     DE the surface is taken at, in leaf cells (default 0.5)\n"
+		"  --listen <port>        Port the coordinator listens on, 0 for any free one (default 0)\n"
+		"  --spawn <n>            Start n local workers, splitting --threads between them (default 0)\n"
+		"  --net-tile <n>         Tile size handed to workers (default 128)\n"
+		"  --worker-timeout <s>   Drop a worker holding tiles that is silent this long (default 30)\n"
+		"  --connect <host:port>  Coordinator a worker serves\n"
+		"  --delay <ms>           Worker sleeps before each tile, to test slow nodes\n"
+		"  --exit-after <n>       Worker vanishes after n tiles, to test lost nodes\n"
+		"\n"
+		"animate writes a PNG per frame when --output has a printf pattern such as frame_%%04d.png\n"
+		"(the default), or a Y4M stream when it ends in .y4m or is - for stdout\n");
+}
+
+static bool ParseFloat3(const char* text, float3& value)
+{
+	return sscanf(text, "%f,%f,%f", &value.x, &value.y, &value.z) == 3;
+}
+
+// One strategy for every quality level, or three separated by commas
+static bool ParseMarchStrategies(const char* text, MarchStrategy* strategies)
+{
+	std::vector<std::string> names;
+	std::string remaining = text;
+	for (size_t comma; (comma = remaining.find(',')) != std::string::npos; remaining.erase(0, comma + 1))
+		names.push_back(remaining.substr(0, comma));
+	names.push_back(remaining);
+	if (names.size() != 1 && names.size() != 3)
+		return false;
+
+	for (int q = 0; q < 3; q++)
+	{
+		if (!ParseMarchStrategy(names[names.size() == 1 ? 0 : q].c_str(), strategies[q]))
+			return false;
+	}
+	return true;
+}
+
+// Returns false and prints the problem for bad arguments
+static bool ParseOptions(int argc, char** argv, int first, HeadlessOptions& options)
+{
+	for (int i = first; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool ok = true;
+
+		if (arg == "--animated")
+		{
+			options.animated = 1;
+			continue;
+		}
+		if (arg == "--polar")
+		{
+			options.polar = true;
+			continue;
+		}
+		if (arg == "--unbounded")
+		{
+			options.unbounded = true;
+			continue;
+		}
+		if (arg == "--row-batches")
+		{
+			options.rowBatches = true;
+			continue;
+		}
+		if (arg == "--fixed-lod")
+		{
+			options.fixedLod = true;
+			continue;
+		}
+		if (arg == "--prepass")
+		{
+			options.prepass = true;
+			continue;
+		}
+		if (arg == "--reproject")
+		{
+			options.reproject = true;
+			continue;
+		}
+		if (arg == "--brickmap-lazy")
+		{
+			options.brickMapLazy = true;
+			continue;
+		}
+		if (arg == "--progressive")
+		{
+			options.progressive = true;
+			continue;
+		}
+
+		if (!value)
+		{
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return false;
+		}
+
+		if (arg == "--output")
+			options.output = value;
+		else if (arg == "--width" || arg == "--height")
+		{
+			(arg == "--width" ? options.width : options.height) = atoi(value);
+			options.hasSize = true;
+		}
+		else if (arg == "--quality")
+			options.quality = atoi(value);
+		else if (arg == "--time")
+			options.time = float(atof(value));
+		else if (arg == "--colour1")
+			ok = ParseFloat3(value, options.colour1);
+		else if (arg == "--colour2")
+			ok = ParseFloat3(value, options.colour2);
+		else if (arg == "--position")
+			ok = options.hasPosition = ParseFloat3(value, options.position);
+		else if (arg == "--target")
+			ok = options.hasTarget = ParseFloat3(value, options.target);
+		else if (arg == "--fov")
+			options.fovDegrees = float(atof(value));
+		else if (arg == "--threads")
+			options.threads = unsigned(atoi(value));
+		else if (arg == "--tile")
+			options.tileSize = atoi(value);
+		else if (arg == "--simd")
+			ok = ParseSimdLevel(value, options.simd);
+		else if (arg == "--frames")
+			ok = (options.frames = atoi(value)) > 0;
+		else if (arg == "--brickmap")
+			ok = (options.brickMap = atoi(value)) > 0;
+		else if (arg == "--brickmap-mb")
+			ok = (options.brickMapMegabytes = atoi(value)) > 0;
+		else if (arg == "--brickmap-cache")
+			options.brickMapCache = value;
+		else if (arg == "--shadow-cache")
+			ok = (options.shadowCacheMegabytes = atoi(value)) >= 0;
+		else if (arg == "--budget")
+			ok = (options.budget = atof(value)) > 0.0;
+		else if (arg == "--normals")
+			ok = value && ParseNormalMode(value, options.normals);
+		else if (arg == "--march")
+			ok = value && ParseMarchStrategies(value, options.march);
+		else if (arg == "--telemetry")
+			options.telemetry = value;
+		else if (arg == "--json")
+			options.json = value;
+		else if (arg == "--move")
+			ok = (options.moveFrames = atoi(value)) >= 0;
+		else if (arg == "--moving-step")
+			ok = (options.movingStep = atoi(value)) == 1 || options.movingStep == 2 || options.movingStep == 4;
+		else if (arg == "--fps")
+			ok = (options.fps = atof(value)) > 0.0;
+		else if (arg == "--start")
+			options.start = atof(value);
+		else if (arg == "--curve")
+			ok = options.curve.Parse(value);
+		else if (arg == "--in-flight")
+			ok = (options.framesInFlight = atoi(value)) > 0;
+		else if (arg == "--aa")
+			ok = (options.aaBudget = float(atof(value))) >= 0.0f;
+		else if (arg == "--aa-samples")
+			ok = (options.aaSamples = atoi(value)) == 4 || options.aaSamples == 8;
+		else if (arg == "--strip-rows")
+			ok = (options.stripRows = atoi(value)) > 0;
+		else if (arg == "--dpi")
+			ok = (options.dpi = atoi(value)) > 0;
+		else if (arg == "--mesh-depth")
+			ok = (options.meshDepth = atoi(value)) > 0 && options.meshDepth <= g_maxMeshDepth;
+		else if (arg == "--mesh-iso")
+			ok = (options.meshIso = float(atof(value))) > 0.0f;
+		else if (arg == "--listen")
+			ok = (options.listenPort = atoi(value)) >= 0 && options.listenPort <= 65535;
+		else if (arg == "--spawn")
+			ok = (options.spawn = atoi(value)) >= 0;
+		else if (arg == "--net-tile")
+			ok = (options.netTileSize = atoi(value)) > 0;
+		else if (arg == "--worker-timeout")
+			ok = (options.workerTimeout = atof(value)) > 0.0;
+		else if (arg == "--connect")
+			options.connect = value;
+		else if (arg == "--delay")
+			ok = (options.workerDelay = atoi(value)) >= 0;
+		else if (arg == "--exit-after")
+			ok = (options.workerExitAfter = atoi(value)) >= 0;
+		else if (arg == "--record")
+			options.record = value;
+		else if (arg == "--replay")
+			options.replay = value;
+		else if (arg == "--timings")
+			options.timings = value;
+		else if (arg == "--backend")
+			ok = (options.backend = value) == "null" || options.backend == "cpu";
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			return false;
+		}
+
+		if (!ok)
+		{
+			fprintf(stderr, "Bad value for %s: %s\n", arg.c_str(), value);
+			return false;
+		}
+		i++;
+	}
+
+	if (options.width <= 0 || options.height <= 0 || options.tileSize <= 0)
+	{
+		fprintf(stderr, "Width, height and tile size must be positive\n");
+		return false;
+	}
+	if (options.quality < 0 || options.quality > 2)
+	{
+		fprintf(stderr, "Quality must be 0, 1 or 2\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Set up the camera and constants the same way Renderer::Update does
+static FrameConstants BuildConstants(const HeadlessOptions& options)
+{
+	Camera camera;
+	if (options.hasPosition || options.hasTarget)
+	{
+		float3 position = options.hasPosition ? options.position : camera.m_position;
+		float3 target = options.hasTarget ? options.target : position + camera.m_look;
+		camera.LookAt(position, target, float3{ 0.0f, 1.0f, 0.0f });
+	}
+
+	float aspect = float(options.width) / float(options.height);
+	camera.SetLens(options.fovDegrees * 0.01745329252f, aspect, 0.1f, 1000.0f);
+
+	FrameConstants constants = CreateFrameConstants(camera, options.width, options.height);
+	constants.quality = options.quality;
+	constants.animated = options.animated;
+	constants.time = options.time;
+	constants.colour1 = options.colour1;
+	constants.colour2 = options.colour2;
+	return constants;
+}
+
+// Build the brick map for the constants' fractal when --brickmap asks for one
+static void BuildBrickMap(const HeadlessOptions& options, const FrameConstants& constants, ThreadPool& pool, BrickMap& bricks)
+{
+	if (options.brickMap <= 0)
+		return;
+
+	FractalOptions params = CreateFrameSetup(constants).params;
+	size_t maxBytes = size_t(options.brickMapMegabytes) << 20;
+
+	// Map a cache file when there is a good one, otherwise build and leave one for the next run
+	std::string cacheFile;
+	BrickCacheStatus status = BrickCacheStatus::Missing;
+	if (!options.brickMapCache.empty())
+	{
+		cacheFile = options.brickMapCache + "/" + BrickMap::CacheFileName(params, options.brickMap);
+		status = bricks.Load(cacheFile, params, options.brickMap, maxBytes, !options.brickMapLazy);
+		if (status != BrickCacheStatus::Loaded)
+			printf("Brick map cache %s is %s, building\n", cacheFile.c_str(), BrickCacheStatusName(status));
+	}
+	if (status != BrickCacheStatus::Loaded)
+	{
+		bricks.Build(pool, params, options.brickMap, maxBytes);
+		if (!cacheFile.empty() && !bricks.Save(cacheFile))
+			fprintf(stderr, "Failed to write %s\n", cacheFile.c_str());
+	}
+
+	const BrickMapStats& stats = bricks.GetStats();
+	printf("Brick map: %d^3 voxels, %lld of %lld bricks on the surface, %lld dropped by the cap, %.1f MB, %s in %.1f ms\n",
+		bricks.GetResolution(), stats.surfaceBricks, stats.bricks, stats.droppedBricks, double(stats.bytes) / (1 << 20),
+		stats.loaded ? "mapped" : "built", stats.buildMs);
+}
+
+static int RunRender(const HeadlessOptions& options)
+{
+	ThreadPool pool(options.threads);
+	CpuRenderer renderer(pool);
+	renderer.m_tileSize = options.tileSize;
+	renderer.m_wavefront = !options.rowBatches;
+	renderer.m_conePrepass = options.prepass;
+	renderer.m_antialias.budget = options.aaBudget;
+	renderer.m_antialias.samples = options.aaSamples;
+
+	FrameConstants constants = BuildConstants(options);
+
+	BrickMap bricks;
+	BuildBrickMap(options, constants, pool, bricks);
+	renderer.m_brickMap = options.brickMap > 0 ? &bricks : nullptr;
+
+	Image image;
+	auto start = std::chrono::steady_clock::now();
+	renderer.Render(constants, image);
+	auto end = std::chrono::steady_clock::now();
+
+	double ms = std::chrono::duration<double, std::milli>(end - start).count();
+	double mrays = double(options.width) * options.height / (ms * 1000.0);
+	printf("Rendered %dx%d in %.1f ms on %u threads, %s (%.3f Mrays/s)\n", options.width, options.height, ms, pool.GetThreadCount(),
+		SimdLevelName(GetSimdLevel()), mrays);
+	if (options.prepass)
+	{
+		const ConePrepassStats& stats = renderer.GetPrepassStats();
+		printf("Cone prepass: %lld cones, %lld steps, saved %lld pixel march steps\n", stats.cones, stats.coneSteps, stats.SavedSteps());
+	}
+	double pixels = double(options.width) * options.height;
+	printf("March: %.2f DE steps and %.2f brick map steps per pixel\n", double(renderer.GetMarchSteps()) / pixels,
+		double(renderer.GetCacheSteps()) / pixels);
+	ShadowStats shadows = renderer.GetShadowStats();
+	long long hits = (shadows.rays + shadows.culled) / g_lightCount;
+	printf("Shadows: %.2f rays and %.2f DE steps per hit, %lld lights culled behind the surface\n",
+		double(shadows.rays) / std::max(hits, 1LL), double(shadows.steps) / std::max(hits, 1LL), shadows.culled);
+	if (options.aaBudget > 0.0f)
+	{
+		const AntialiasStats& stats = renderer.GetAntialiasStats();
+		printf("Anti-aliasing: refined %lld of %lld edge pixels with %.2f extra rays per pixel, %.1f ms detecting and %.1f ms tracing\n",
+			stats.refined, stats.candidates, double(stats.rays) / pixels, stats.detectMs, stats.refineMs);
+		printf("  %.2f march and %.2f shadow DE steps per pixel on top of the first pass\n", double(stats.marchSteps) / pixels,
+			double(stats.shadowSteps) / pixels);
+	}
+
+	if (!WritePng(options.output, image))
+	{
+		fprintf(stderr, "Failed to write %s\n", options.output.c_str());
+		return 1;
+	}
+	printf("Saved %s\n", options.output.c_str());
+
+	return 0;
+}
+
+static int RunCost(const HeadlessOptions& options)
+{
+	if (!PixelCostMap::IsEnabled())
+	{
+		fprintf(stderr, "cost needs the counters, rebuild with -DMANDELBULB_PIXEL_COST\n");
+		return 1;
+	}
+
+	ThreadPool pool(options.threads);
+	FrameConstants constants = BuildConstants(options);
+
+	PixelCostMap costs;
+	Image image;
+	costs.Render(pool, constants, image);
+	printf("Rendered %dx%d with pixel cost counters in %.1f ms on %u threads\n", options.width, options.height, costs.GetRenderMs(),
+		pool.GetThreadCount());
+
+	// Heatmaps go next to the image, mandelbulb.png gives mandelbulb_march_steps.png and so on
+	std::string stem = options.output;
+	if (stem.size() > 4 && stem.compare(stem.size() - 4, 4, ".png") == 0)
+		stem.resize(stem.size() - 4);
+
+	double pixels = double(options.width) * options.height;
+	printf("%-20s %10s %8s %8s %8s %8s\n", "counter", "per pixel", "p50", "p90", "p99", "max");
+	for (int c = 0; c < g_pixelCounterCount; c++)
+	{
+		PixelCounter counter = PixelCounter(c);
+		printf("%-20s %10.2f %8u %8u %8u %8u\n", PixelCounterName(counter), double(costs.GetTotal(counter)) / pixels,
+			costs.GetPercentile(counter, 50.0), costs.GetPercentile(counter, 90.0), costs.GetPercentile(counter, 99.0),
+			costs.GetPercentile(counter, 100.0));
+
+		Image heatmap;
+		costs.Heatmap(counter, heatmap);
+		std::string fileName = stem + "_" + PixelCounterName(counter) + ".png";
+		if (!WritePng(fileName, heatmap))
+		{
+			fprintf(stderr, "Failed to write %s\n", fileName.c_str());
+			return 1;
+		}
+	}
+
+	double march = double(costs.GetTotal(PixelCounter::MarchIterations));
+	double normal = double(costs.GetTotal(PixelCounter::NormalIterations));
+	double shadow = double(costs.GetTotal(PixelCounter::ShadowIterations));
+	double iterations = march + normal + shadow > 0.0 ? march + normal + shadow : 1.0;
+	printf("DE iterations: %.1f%% march, %.1f%% normals, %.1f%% shadows\n", 100.0 * march / iterations, 100.0 * normal / iterations,
+		100.0 * shadow / iterations);
+
+	if (!WritePng(options.output, image))
+	{
+		fprintf(stderr, "Failed to write %s\n", options.output.c_str());
+		return 1;
+	}
+	printf("Saved %s and heatmaps %s_*.png\n", options.output.c_str(), stem.c_str());
+
+	if (!options.json.empty())
+	{
+		if (!costs.WriteJson(options.json))
+		{
+			fprintf(stderr, "Failed to write %s\n", options.json.c_str());
+			return 1;
+		}
+		printf("Saved %s\n", options.json.c_str());
+	}
+	return 0;
+}
+
+// Random points in the bounding box plus points sampled along rays just in front of the
+// surface, the regime the march spends most of its time in
+static void BuildSamplePoints(const FrameConstants& constants, const FrameSetup& setup, std::vector<float>& xs, std::vector<float>& ys, std::vector<float>& zs)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> box(-1.5f, 1.5f);
+	for (int i = 0; i < 20000; i++)
+	{
+		xs.push_back(box(rng));
+		ys.push_back(box(rng));
+		zs.push_back(box(rng));
+	}
+
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	for (int i = 0; i < 2000; i++)
+	{
+		Ray ray = CreateCamRay(float2{ unit(rng), unit(rng) }, constants.projInverse, constants.viewInverse, constants.camPos);
+		MarchResult march = MarchRay(ray, setup);
+		if (!march.hit)
+			continue;
+		for (float back : { 0.0f, 0.001f, 0.01f, 0.05f })
+		{
+			float3 p = march.pos - ray.dir * back;
+			xs.push_back(p.x);
+			ys.push_back(p.y);
+			zs.push_back(p.z);
+		}
+	}
+}
+
+// Prints one line comparing dist and len against the reference, returns false if out of tolerance
+static bool CompareDistances(const char* label, const std::vector<float>& refDist, const std::vector<float>& refLen,
+	const std::vector<float>& dist, const std::vector<float>& len)
+{
+	// lenZ only feeds the colour blend, so it can be looser than the distance
+	const double distTolerance = 1e-3;
+	const double lenTolerance = 1e-2;
+
+	// Orbits inside the set are chaotic, so tiny rounding differences are free to take them
+	// anywhere, and points just outside can still take hundreds of iterations to escape.
+	// Away from the surface compare relative error, close to it only require both to agree
+	// the point is within hit range
+	int count = int(refDist.size());
+	double maxDistError = 0.0, maxLenError = 0.0;
+	int outside = 0, disagree = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (refDist[i] > 0.01f)
+		{
+			double distError = fabs(double(dist[i]) - refDist[i]) / fmax(fabs(double(refDist[i])), 0.01);
+			double lenError = fabs(double(len[i]) - refLen[i]) / fmax(fabs(double(refLen[i])), 1.0);
+			maxDistError = fmax(maxDistError, distError);
+			maxLenError = fmax(maxLenError, lenError);
+			outside++;
+		}
+		else if (refDist[i] <= 0.001f && dist[i] > 0.01f)
+		{
+			disagree++;
+		}
+	}
+
+	bool ok = maxDistError < distTolerance && maxLenError < lenTolerance && disagree == 0;
+	printf("%-7s %d points outside, max distance error %.2e, max lenZ error %.2e, %d of %d inside disagree: %s\n", label,
+		outside, maxDistError, maxLenError, disagree, count - outside, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+// Compare every supported packet level against the scalar DistToScene, fails if the error is
+// out of tolerance
+static int RunCheckSimd(const HeadlessOptions& options)
+{
+	FrameConstants constants = BuildConstants(options);
+	FrameSetup setup = CreateFrameSetup(constants);
+
+	std::vector<float> xs, ys, zs;
+	BuildSamplePoints(constants, setup, xs, ys, zs);
+
+	int count = int(xs.size());
+	std::vector<float> refDist(count), refLen(count);
+	for (int i = 0; i < count; i++)
+	{
+		refDist[i] = DistToScene(float3{ xs[i], ys[i], zs[i] }, setup.params, refLen[i]);
+	}
+
+	bool passed = true;
+	SimdLevel top = options.simd;
+	for (SimdLevel level : { SimdLevel::AVX2, SimdLevel::AVX512 })
+	{
+		if (int(level) > int(top) || SetSimdLevel(level) != level)
+			continue;
+
+		std::vector<float> dist(count), len(count);
+		DistToScenePacket(xs.data(), ys.data(), zs.data(), count, setup.params, dist.data(), len.data());
+		passed = CompareDistances(SimdLevelName(level), refDist, refLen, dist, len) && passed;
+	}
+
+	SetSimdLevel(top);
+	return passed ? 0 : 1;
+}
+
+// Compare the trig-free integer power iteration against the polar form for every supported
+// power, then render the view both ways at power 8 and compare the images
+static int RunCheckPower(const HeadlessOptions& options)
+{
+	// Mean difference in 0-255 levels, a few pixels on silhouettes may flip between hit and miss
+	const double meanImageTolerance = 0.25;
+
+	FrameConstants constants = BuildConstants(options);
+	constants.animated = 0;
+	FrameSetup setup = CreateFrameSetup(constants);
+
+	std::vector<float> xs, ys, zs;
+	BuildSamplePoints(constants, setup, xs, ys, zs);
+
+	int count = int(xs.size());
+	bool passed = true;
+	for (int power = g_minIntegerPower; power <= g_maxIntegerPower; power++)
+	{
+		FractalOptions params = setup.params;
+		params.power = float(power);
+
+		std::vector<float> refDist(count), refLen(count), dist(count), len(count);
+		SetTrigFreePower(false);
+		DistToScenePacket(xs.data(), ys.data(), zs.data(), count, params, refDist.data(), refLen.data());
+		SetTrigFreePower(true);
+		DistToScenePacket(xs.data(), ys.data(), zs.data(), count, params, dist.data(), len.data());
+
+		char label[16];
+		snprintf(label, sizeof(label), "power %d", power);
+		passed = CompareDistances(label, refDist, refLen, dist, len) && passed;
+	}
+
+	ThreadPool pool(options.threads);
+	CpuRenderer renderer(pool);
+	renderer.m_tileSize = options.tileSize;
+	renderer.m_wavefront = !options.rowBatches;
+
+	Image polar, trigFree;
+	double ms[2];
+	for (int i = 0; i < 2; i++)
+	{
+		SetTrigFreePower(i == 1);
+		auto start = std::chrono::steady_clock::now();
+		renderer.Render(constants, setup, i == 1 ? trigFree : polar);
+		ms[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	int maxDiff = 0;
+	double sum = 0.0;
+	for (size_t i = 0; i < polar.pixels.size(); i++)
+	{
+		int diff = abs(int(polar.pixels[i]) - int(trigFree.pixels[i]));
+		maxDiff = diff > maxDiff ? diff : maxDiff;
+		sum += diff;
+	}
+	double mean = sum / double(polar.pixels.size());
+
+	bool imageOk = mean < meanImageTolerance;
+	passed = passed && imageOk;
+	printf("image   polar %.1f ms, trig-free %.1f ms (%.2fx), max difference %d, mean %.4f: %s\n", ms[0], ms[1], ms[0] / ms[1],
+		maxDiff, mean, imageOk ? "ok" : "FAILED");
+
+	return passed ? 0 : 1;
+}
+
+// Mean difference in 0-255 levels between the averages of each block x block pixels of a and b,
+// which leaves out the pixel sized shading noise the normal modes differ by
+static double BlockDifference(const Image& a, const Image& b, int block)
+{
+	double sum = 0.0;
+	int blocks = 0;
+	for (int by = 0; by + block <= a.height; by += block)
+	{
+		for (int bx = 0; bx + block <= a.width; bx += block)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				int difference = 0;
+				for (int y = by; y < by + block; y++)
+				{
+					for (int x = bx; x < bx + block; x++)
+						difference += int(a.Row(y)[x * 3 + c]) - int(b.Row(y)[x * 3 + c]);
+				}
+				sum += fabs(double(difference)) / double(block * block);
+			}
+			blocks++;
+		}
+	}
+	return blocks > 0 ? sum / (3.0 * blocks) : 0.0;
+}
+
+// Median and 90th percentile angle between two sets of normals, in degrees
+static void NormalAngles(const std::vector<float3>& a, const std::vector<float3>& b, double& median, double& p90)
+{
+	std::vector<double> angles(a.size());
+	for (size_t i = 0; i < a.size(); i++)
+		angles[i] = acos(clamp(dot(a[i], b[i]), -1.0f, 1.0f)) * 57.29577951;
+	std::sort(angles.begin(), angles.end());
+	median = angles[angles.size() / 2];
+	p90 = angles[size_t(0.9 * double(angles.size() - 1))];
+}
+
+// Compare each normal mode against central differences, per hit and as rendered images
+static int RunCheckNormals(const HeadlessOptions& options)
+{
+	// Median angle to the central difference normal in degrees, and mean difference of 4x4
+	// pixel averages in 0-255 levels. On a fractal the normal at a hit depends on the step, and
+	// the tetrahedral step is a share of the pixel footprint on purpose, so its normals drift from
+	// central differences as pixels grow. The angle is taken with both at the central step, about
+	// 1 degree at quality 0 and 6 to 9 at quality 2 at any size, and the image tolerance grows with
+	// the square root of the pixel footprint below 720 rows, where single-ray pixels alias more
+	const double angleTolerance = 15.0;
+	const double blockImageTolerance = 2.0 * sqrt(std::max(720.0 / double(options.height), 1.0));
+
+	FrameConstants constants = BuildConstants(options);
+	FrameSetup setup = CreateFrameSetup(constants);
+
+	// Hits on a grid of the view's rays
+	std::vector<MarchResult> hits;
+	for (int y = 0; y < 90; y++)
+	{
+		for (int x = 0; x < 160; x++)
+		{
+			float2 pixel = { (x + 0.5f) * options.width / 160.0f, (y + 0.5f) * options.height / 90.0f };
+			Ray ray = CreateCamRay(PixelToUV(constants, pixel), constants.projInverse, constants.viewInverse, constants.camPos);
+			MarchResult march = MarchRay(ray, setup);
+			if (march.hit)
+				hits.push_back(march);
+		}
+	}
+	if (hits.empty())
+	{
+		fprintf(stderr, "The view has no hits\n");
+		return 1;
+	}
+
+	std::vector<float3> reference(hits.size());
+	for (size_t i = 0; i < hits.size(); i++)
+		reference[i] = NormalEstimate(hits[i].pos, setup.params);
+
+	ThreadPool pool(options.threads);
+	CpuRenderer renderer(pool);
+	renderer.m_tileSize = options.tileSize;
+	renderer.m_wavefront = !options.rowBatches;
+
+	bool passed = true;
+	Image referenceImage;
+	double referenceMs = 0.0;
+	for (NormalMode mode : { NormalMode::Central, NormalMode::Tetrahedral, NormalMode::Analytic })
+	{
+		SetNormalMode(mode);
+
+		// Time the normals alone the way the renderer batches them, over several passes so the
+		// clock resolution does not matter
+		const int passes = 10;
+		std::vector<float3> normals(hits.size());
+		auto start = std::chrono::steady_clock::now();
+		for (int pass = 0; pass < passes; pass++)
+			HitNormals(hits.data(), int(hits.size()), setup, normals.data());
+		double normalNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (double(passes) * hits.size());
+
+		// What the renderer draws with, and the tetrahedral estimate at the central step
+		double footprintMedian, footprintP90, medianAngle, p90Angle;
+		NormalAngles(normals, reference, footprintMedian, footprintP90);
+		if (mode == NormalMode::Tetrahedral)
+		{
+			for (size_t i = 0; i < hits.size(); i++)
+				normals[i] = NormalEstimateTetrahedral(hits[i].pos, g_normalEpsilon, setup.params);
+		}
+		NormalAngles(normals, reference, medianAngle, p90Angle);
+
+		Image image;
+		start = std::chrono::steady_clock::now();
+		renderer.Render(constants, setup, image);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (mode == NormalMode::Central)
+		{
+			referenceImage = image;
+			referenceMs = ms;
+			printf("%-12s %6.0f ns per normal, render %.1f ms\n", NormalModeName(mode), normalNs, ms);
+			continue;
+		}
+
+		double mean = BlockDifference(image, referenceImage, 1);
+		double blockMean = BlockDifference(image, referenceImage, 4);
+
+		bool ok = medianAngle < angleTolerance && blockMean < blockImageTolerance;
+		passed = passed && ok;
+		printf("%-12s %6.0f ns per normal, angle median %.2f p90 %.2f degrees (as drawn %.2f, %.2f), render %.1f ms (%.2fx), "
+			"image mean difference %.3f, 4x4 %.3f of %.3f: %s\n", NormalModeName(mode), normalNs, medianAngle, p90Angle, footprintMedian,
+			footprintP90, ms, referenceMs / ms, mean, blockMean, blockImageTolerance, ok ? "ok" : "FAILED");
+	}
+	SetNormalMode(options.normals);
+
+	return passed ? 0 : 1;
+}
+
+// Render the view unbounded and bounded and report the DE evaluations the bounding sphere saved
+static int RunCheckBounds(const HeadlessOptions& options)
+{
+	FrameConstants constants = BuildConstants(options);
+	ThreadPool pool(options.threads);
+	CpuRenderer renderer(pool);
+	renderer.m_tileSize = options.tileSize;
+	renderer.m_wavefront = !options.rowBatches;
+
+	struct Pass
+	{
+		double ms;
+		long long marchSteps;
+		ShadowStats shadows;
+		Image image;
+	};
+	Pass passes[2];
+	for (int p = 0; p < 2; p++)
+	{
+		SetBoundingSphere(p == 1);
+		FrameSetup setup = CreateFrameSetup(constants);
+		auto start = std::chrono::steady_clock::now();
+		renderer.Render(constants, setup, passes[p].image);
+		passes[p].ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		passes[p].marchSteps = renderer.GetMarchSteps();
+		passes[p].shadows = renderer.GetShadowStats();
+
+		// Every hit either traces or culls each light
+		long long hits = (passes[p].shadows.rays + passes[p].shadows.culled) / g_lightCount;
+		printf("%-9s radius %.3f, %.1f ms, %.2f march steps per pixel, %lld hits, %.2f shadow rays and %.2f shadow steps per hit\n",
+			p == 1 ? "bounded" : "unbounded", setup.boundingRadius, passes[p].ms,
+			double(passes[p].marchSteps) / (double(options.width) * options.height), hits,
+			double(passes[p].shadows.rays) / std::max(hits, 1LL), double(passes[p].shadows.steps) / std::max(hits, 1LL));
+	}
+	SetBoundingSphere(!options.unbounded);
+
+	long long marchSaved = passes[0].marchSteps - passes[1].marchSteps;
+	long long shadowSaved = passes[0].shadows.steps - passes[1].shadows.steps;
+	long long before = passes[0].marchSteps + passes[0].shadows.steps;
+	printf("Saved %lld march and %lld shadow DE evaluations (%.1f%%), %lld lights culled, %.2fx faster\n", marchSaved, shadowSaved,
+		100.0 * double(marchSaved + shadowSaved) / double(std::max(before, 1LL)), passes[1].shadows.culled, passes[0].ms / passes[1].ms);
+
+	// Hits move a little with the march's starting point, which is noise on a fractal, but views
+	// from far away also regain surface the first step from the camera overshot
+	double mean = BlockDifference(passes[1].image, passes[0].image, 1);
+	double blockMean = BlockDifference(passes[1].image, passes[0].image, 4);
+	bool ok = marchSaved + shadowSaved >= 0;
+	printf("Image mean difference %.3f, 4x4 %.3f: %s\n", mean, blockMean, ok ? "ok" : "FAILED");
+
+	return ok ? 0 : 1;
+}
+
+// Render a wide view from three times as far out, the view asked for, and views 0.05 and 0.002
+// in front of where its centre ray hits, each with the fixed hit epsilon and with pixel LOD
+static int RunCheckLod(const HeadlessOptions& options)
+{
+	ThreadPool pool(options.threads);
+	CpuRenderer renderer(pool);
+	renderer.m_tileSize = options.tileSize;
+	renderer.m_wavefront = !options.rowBatches;
+
+	// Where the view's centre ray lands, the close views look at it along that ray
+	FrameConstants constants = BuildConstants(options);
+	Ray centre = CreateCamRay(float2{ 0.0f, 0.0f }, constants.projInverse, constants.viewInverse, constants.camPos);
+	MarchResult centreHit = MarchRay(centre, CreateFrameSetup(constants));
+	if (!centreHit.hit)
+	{
+		fprintf(stderr, "The centre of the view misses the fractal, nothing to look at close up\n");
+		return 1;
+	}
+
+	struct View
+	{
+		const char* name;
+		float3 position;
+		float3 target;
+	};
+	const View views[] = {
+		{ "wide", constants.camPos * 3.0f, float3{ 0.0f, 0.0f, 0.0f } },
+		{ "default", constants.camPos, centreHit.pos },
+		{ "close", centreHit.pos - centre.dir * 0.05f, centreHit.pos },
+		{ "deep", centreHit.pos - centre.dir * 0.002f, centreHit.pos },
+	};
+
+	std::string stem = options.output;
+	if (stem.size() > 4 && stem.compare(stem.size() - 4, 4, ".png") == 0)
+		stem.resize(stem.size() - 4);
+
+	bool ok = true;
+	for (const View& view : views)
+	{
+		HeadlessOptions viewOptions = options;
+		viewOptions.hasPosition = true;
+		viewOptions.hasTarget = true;
+		viewOptions.position = view.position;
+		viewOptions.target = view.target;
+		FrameConstants viewConstants = BuildConstants(viewOptions);
+
+		double ms[2];
+		long long marchSteps[2];
+		Image images[2];
+		for (int p = 0; p < 2; p++)
+		{
+			SetPixelLod(p == 1);
+			FrameSetup setup = CreateFrameSetup(viewConstants);
+			auto start = std::chrono::steady_clock::now();
+			renderer.Render(viewConstants, setup, images[p]);
+			ms[p] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			marchSteps[p] = renderer.GetMarchSteps();
+
+			std::string fileName = stem + "_" + view.name + (p == 1 ? "_lod.png" : "_fixed.png");
+			if (!WritePng(fileName, images[p]))
+			{
+				fprintf(stderr, "Failed to write %s\n", fileName.c_str());
+				return 1;
+			}
+
+			// The hit epsilon where the centre ray lands, the fixed one has no say in the iterations
+			float distance = length(view.target - view.position);
+			printf("%-8s %-6s %7.1f ms, %6.2f march steps per pixel, epsilon %.2e at the centre, %d DE iterations\n", view.name,
+				p == 1 ? "lod" : "fixed", ms[p], double(marchSteps[p]) / (double(options.width) * options.height),
+				HitEpsilon(setup, distance), setup.marchParams.maxIters);
+		}
+
+		// Views from the default distance or further must not get slower, close ones may take
+		// more steps to resolve what the fixed epsilon blurred
+		double mean = BlockDifference(images[1], images[0], 1);
+		double blockMean = BlockDifference(images[1], images[0], 4);
+		bool viewOk = length(view.position) < length(constants.camPos) || marchSteps[1] <= marchSteps[0];
+		ok = ok && viewOk;
+		printf("%-8s %.2fx, image mean difference %.3f, 4x4 %.3f: %s\n", view.name, ms[0] / ms[1], mean, blockMean,
+			viewOk ? "ok" : "FAILED");
+	}
+	SetPixelLod(!options.fixedLod);
+
+	return ok ? 0 : 1;
+}
+
+// March every pixel of the view with each strategy, reporting the steps per ray, and render it
+// with each to compare the images against plain sphere tracing
+static int RunCheckMarch(const HeadlessOptions& options)
+{
+	// Mean difference of 4x4 pixel averages in 0-255 levels. Hits land a little nearer or further
+	// along the ray than plain steps put them, which moves single pixels of fractal dust
+	const double imageTolerance = 3.0;
+
+	FrameConstants constants = BuildConstants(options);
+	ThreadPool pool(options.threads);
+	CpuRenderer renderer(pool);
+	renderer.m_tileSize = options.tileSize;
+	renderer.m_wavefront = !options.rowBatches;
+
+	std::vector<Ray> rays(size_t(options.width) * options.height);
+	for (int y = 0; y < options.height; y++)
+	{
+		for (int x = 0; x < options.width; x++)
+		{
+			float2 uv = PixelToUV(constants, float2{ x + 0.5f, y + 0.5f });
+			rays[size_t(y) * options.width + x] = CreateCamRay(uv, constants.projInverse, constants.viewInverse, constants.camPos);
+		}
+	}
+
+	const MarchStrategy strategies[] = { MarchStrategy::Plain, MarchStrategy::Relaxed, MarchStrategy::Refined };
+	std::vector<MarchResult> results(rays.size());
+	Image images[3];
+	double ms[3];
+	long long total[3];
+	bool ok = true;
+	for (int s = 0; s < 3; s++)
+	{
+		SetMarchStrategy(options.quality, strategies[s]);
+		FrameSetup setup = CreateFrameSetup(constants);
+
+		// Best of a few passes, a single one is noisy
+		ms[s] = 0.0;
+		for (int pass = 0; pass < 3; pass++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			pool.ParallelFor(options.height, [&](int y) {
+				size_t row = size_t(y) * options.width;
+				MarchRays(&rays[row], options.width, setup, &results[row]);
+			});
+			double passMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			ms[s] = pass == 0 ? passMs : std::min(ms[s], passMs);
+		}
+
+		// Steps of hits and misses apart, misses that ran out of steps are the grazing rays along
+		// silhouettes
+		std::vector<int> steps(results.size());
+		long long hits = 0, hitSteps = 0, missSteps = 0, exhausted = 0;
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			steps[i] = results[i].steps;
+			(results[i].hit ? hitSteps : missSteps) += results[i].steps;
+			hits += results[i].hit;
+			exhausted += !results[i].hit && results[i].steps >= setup.maxIters;
+		}
+		std::sort(steps.begin(), steps.end());
+		total[s] = hitSteps + missSteps;
+		long long misses = (long long)results.size() - hits;
+
+		renderer.Render(constants, setup, images[s]);
+
+		printf("%-8s %7.1f ms, %6.2f steps per ray, %6.2f per hit, %6.2f per miss, p99 %d, max %d, %lld hits, %lld out of steps\n",
+			MarchStrategyName(strategies[s]), ms[s], double(total[s]) / double(results.size()), double(hitSteps) / double(std::max(hits, 1LL)),
+			double(missSteps) / double(std::max(misses, 1LL)), steps[steps.size() * 99 / 100], steps.back(), hits, exhausted);
+	}
+
+	for (int s = 1; s < 3; s++)
+	{
+		double mean = BlockDifference(images[s], images[0], 1);
+		double blockMean = BlockDifference(images[s], images[0], 4);
+		bool strategyOk = blockMean < imageTolerance;
+		ok = ok && strategyOk;
+		printf("%-8s %.2fx the steps of plain, %.2fx faster, image mean difference %.3f, 4x4 %.3f: %s\n", MarchStrategyName(strategies[s]),
+			double(total[s]) / double(total[0]), ms[0] / ms[s], mean, blockMean, strategyOk ? "ok" : "FAILED");
+	}
+	SetMarchStrategy(options.quality, options.march[options.quality == 1 || options.quality == 2 ? options.quality : 0]);
+
+	return ok ? 0 : 1;
+}
+
+// Turns slowly and takes a step every 10 frames, forward for 60 frames then back, the same
+// movement on every run. Holds still after moveFrames frames unless it is negative
+class ScriptedInput : public InputSource
+{
+public:
+	ScriptedInput(int moveFrames) : m_moveFrames(moveFrames) {}
+
+	InputState Poll() override
+	{
+		InputState input;
+		if (m_moveFrames >= 0 && m_frame >= m_moveFrames)
+			return input;
+
+		bool step = m_frame % 10 == 0;
+		input.forward = step && (m_frame / 60) % 2 == 0;
+		input.back = step && !input.forward;
+		input.yaw = 0.002f;
+		m_frame++;
+		return input;
+	}
+private:
+	int m_moveFrames;
+	int m_frame = 0;
+};
+
+// Render the view with one ray per pixel, adaptive anti-aliasing and every pixel supersampled, and
+// compare the first two with the last
+static int RunCheckAntialias(const HeadlessOptions& options)
+{
+	FrameConstants constants = BuildConstants(options);
+	FrameSetup setup = CreateFrameSetup(constants);
+	ThreadPool pool(options.threads);
+	CpuRenderer renderer(pool);
+	renderer.m_tileSize = options.tileSize;
+	renderer.m_wavefront = !options.rowBatches;
+	renderer.m_antialias.samples = options.aaSamples;
+
+	struct Pass
+	{
+		const char* name;
+		float budget;
+		bool everyPixel;
+		double ms = 0.0;
+		AntialiasStats stats = {};
+		Image image = {};
+	};
+	Pass passes[3] = {
+		{ "single", 0.0f, false },
+		{ "adaptive", options.aaBudget > 0.0f ? options.aaBudget : 0.5f, false },
+		{ "ssaa", 0.0f, true },
+	};
+	double pixels = double(options.width) * options.height;
+	for (Pass& pass : passes)
+	{
+		renderer.m_antialias.budget = pass.budget;
+		renderer.m_antialias.everyPixel = pass.everyPixel;
+		auto start = std::chrono::steady_clock::now();
+		renderer.Render(constants, setup, pass.image);
+		pass.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		pass.stats = renderer.GetAntialiasStats();
+	}
+
+	std::string stem = options.output;
+	if (stem.size() > 4 && stem.compare(stem.size() - 4, 4, ".png") == 0)
+		stem.resize(stem.size() - 4);
+
+	// Differences from supersampling every pixel, on average and as pixels visibly off
+	const Image& reference = passes[2].image;
+	for (Pass& pass : passes)
+	{
+		long long off = 0;
+		for (int y = 0; y < reference.height; y++)
+		{
+			for (int x = 0; x < reference.width; x++)
+			{
+				const uint8_t* a = pass.image.Row(y) + x * 3;
+				const uint8_t* b = reference.Row(y) + x * 3;
+				if (abs(a[0] - b[0]) > 8 || abs(a[1] - b[1]) > 8 || abs(a[2] - b[2]) > 8)
+					off++;
+			}
+		}
+		printf("%-8s %7.1f ms, refined %7lld of %7lld pixels with %.2f extra rays per pixel, mean difference %.3f, %lld pixels off by 8+\n",
+			pass.name, pass.ms, pass.stats.refined, pass.stats.candidates, double(pass.stats.rays) / pixels,
+			BlockDifference(pass.image, reference, 1), off);
+		std::string fileName = stem + "_" + pass.name + ".png";
+		if (!WritePng(fileName, pass.image))
+			fprintf(stderr, "Failed to write %s\n", fileName.c_str());
+	}
+
+	// The budget buys the same share of pixels at any size, but smaller images have more edge
+	// pixels, so the share of the difference it can remove falls with the size. The pass is held to
+	// the best any choice of as many pixels could do, refining the ones furthest from supersampling
+	std::vector<int> singleErrors(size_t(reference.width) * reference.height);
+	long long singleError = 0, adaptiveError = 0;
+	for (int y = 0; y < reference.height; y++)
+	{
+		for (int x = 0; x < reference.width; x++)
+		{
+			const uint8_t* single = passes[0].image.Row(y) + x * 3;
+			const uint8_t* adaptive = passes[1].image.Row(y) + x * 3;
+			const uint8_t* b = reference.Row(y) + x * 3;
+			int& error = singleErrors[size_t(y) * reference.width + x];
+			error = abs(single[0] - b[0]) + abs(single[1] - b[1]) + abs(single[2] - b[2]);
+			singleError += error;
+			adaptiveError += abs(adaptive[0] - b[0]) + abs(adaptive[1] - b[1]) + abs(adaptive[2] - b[2]);
+		}
+	}
+	size_t refined = std::min(size_t(passes[1].stats.refined), singleErrors.size());
+	std::nth_element(singleErrors.begin(), singleErrors.begin() + refined, singleErrors.end(), std::greater<int>());
+	long long bestRemoved = 0;
+	for (size_t i = 0; i < refined; i++)
+		bestRemoved += singleErrors[i];
+
+	// Refining within the budget should get at least half of that for a fraction of supersampling's cost
+	long long removed = singleError - adaptiveError;
+	bool ok = removed >= bestRemoved / 2 && bestRemoved > 0 && passes[1].ms < passes[2].ms;
+	printf("Adaptive removes %.0f%% of the difference, %.0f%% of what the %zu pixels furthest off would, for %.0f%% of the "
+		"supersampling time: %s\n", 100.0 * double(removed) / double(std::max(singleError, 1LL)),
+		100.0 * double(removed) / double(std::max(bestRemoved, 1LL)), refined, 100.0 * passes[1].ms / passes[2].ms, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+// Frames drawn at one refinement pass
+struct RefinePassTotals
+{
+	int frames = 0;
+	double draw = 0.0;
+	RefineStats pixels;
+};
+
+// Largest difference between two camera poses, in position or any axis
+static float CameraDrift(const Camera& camera, const TraceFrame& frame)
+{
+	const float3 pairs[][2] = { { camera.m_position, frame.position }, { camera.m_right, frame.right }, { camera.m_up, frame.up },
+		{ camera.m_look, frame.look } };
+	float drift = 0.0f;
+	for (const auto& pair : pairs)
+	{
+		float3 d = pair[0] - pair[1];
+		drift = std::max(drift, std::max(fabsf(d.x), std::max(fabsf(d.y), fabsf(d.z))));
+	}
+	return drift;
+}
+
+// Frame time at fraction of the way through the sorted times
+static double Percentile(std::vector<double> times, double fraction)
+{
+	if (times.empty())
+		return 0.0;
+
+	std::sort(times.begin(), times.end());
+	size_t index = size_t(fraction * double(times.size() - 1) + 0.5);
+	return times[index];
+}
+
+// Run Renderer's frame loop against a headless backend. The null backend measures the CPU
+// cost of input, camera and constants alone, the cpu backend adds the shading
+static int RunFrames(const HeadlessOptions& options)
+{
+	// A replay runs the whole trace at its own size unless told otherwise
+	InputTrace replay;
+	if (!options.replay.empty() && !replay.Load(options.replay))
+	{
+		fprintf(stderr, "Failed to load the trace %s\n", options.replay.c_str());
+		return 1;
+	}
+	bool replaying = !options.replay.empty();
+	int width = replaying && !options.hasSize ? replay.m_width : options.width;
+	int height = replaying && !options.hasSize ? replay.m_height : options.height;
+	int frames = replaying ? int(replay.m_frames.size()) : options.frames;
+
+	ThreadPool pool(options.threads);
+	CpuBackend cpu(pool, width, height);
+	NullBackend null(width, height);
+	cpu.GetRenderer().m_tileSize = options.tileSize;
+	cpu.GetRenderer().m_wavefront = !options.rowBatches;
+	cpu.GetRenderer().m_conePrepass = options.prepass;
+	cpu.GetRenderer().m_reprojection = options.reproject;
+	cpu.GetRenderer().m_progressive = options.progressive;
+	cpu.GetRenderer().m_antialias.budget = options.aaBudget;
+	cpu.GetRenderer().m_antialias.samples = options.aaSamples;
+
+	// Built for the first frame's fractal, animated frames fall back to the DE
+	BrickMap bricks;
+	BuildBrickMap(options, BuildConstants(options), pool, bricks);
+	cpu.GetRenderer().m_brickMap = options.brickMap > 0 ? &bricks : nullptr;
+
+	// Shadows carried from frame to frame while the fractal stays the same
+	std::unique_ptr<ShadowCache> shadowCache;
+	if (options.shadowCacheMegabytes > 0)
+		shadowCache.reset(new ShadowCache(size_t(options.shadowCacheMegabytes) << 20));
+	cpu.GetRenderer().m_shadowCache = shadowCache.get();
+	RenderBackend& backend = options.backend == "cpu" ? static_cast<RenderBackend&>(cpu) : null;
+
+	ScriptedInput scripted(options.moveFrames);
+	TracePlayer player(replay);
+	Renderer renderer(backend, replaying ? static_cast<InputSource&>(player) : scripted);
+	renderer.m_progressive = options.progressive;
+	renderer.m_movingStep = options.movingStep;
+	renderer.m_dynamicQuality = options.budget > 0.0;
+	renderer.m_qualityController.m_budgetMs = options.budget;
+
+	FILE* telemetry = nullptr;
+	if (!options.telemetry.empty())
+	{
+		telemetry = fopen(options.telemetry.c_str(), "w");
+		if (!telemetry)
+		{
+			fprintf(stderr, "Failed to open %s\n", options.telemetry.c_str());
+			return 1;
+		}
+		fprintf(telemetry, "frame,frame_ms,average_ms,budget_ms,pixel_step,detail,march_iterations,hit_epsilon,de_iterations,action\n");
+	}
+	renderer.m_constants.quality = options.quality;
+	renderer.m_constants.animated = options.animated;
+	renderer.colour1 = uint32_t(options.colour1.x) | uint32_t(options.colour1.y) << 8 | uint32_t(options.colour1.z) << 16;
+	renderer.colour2 = uint32_t(options.colour2.x) | uint32_t(options.colour2.y) << 8 | uint32_t(options.colour2.z) << 16;
+	if (replaying)
+	{
+		Camera& camera = renderer.m_camera;
+		camera.m_position = replay.m_position;
+		camera.m_right = replay.m_right;
+		camera.m_up = replay.m_up;
+		camera.m_look = replay.m_look;
+	}
+	else if (options.hasPosition || options.hasTarget)
+	{
+		Camera& camera = renderer.m_camera;
+		float3 position = options.hasPosition ? options.position : camera.m_position;
+		float3 target = options.hasTarget ? options.target : position + camera.m_look;
+		camera.LookAt(position, target, float3{ 0.0f, 1.0f, 0.0f });
+	}
+
+	InputTrace recording;
+	if (!options.record.empty())
+		renderer.m_recording = &recording;
+
+	FILE* timingsFile = nullptr;
+	if (!options.timings.empty())
+	{
+		timingsFile = fopen(options.timings.c_str(), "w");
+		if (!timingsFile)
+		{
+			fprintf(stderr, "Failed to open %s\n", options.timings.c_str());
+			return 1;
+		}
+		fprintf(timingsFile, "frame,update_ms,upload_ms,draw_ms,total_ms,pixel_step,quality,march_steps,shadow_steps,camera_drift\n");
+	}
+
+	double update = 0.0, upload = 0.0, draw = 0.0, worst = 0.0;
+	long long steps = 0, reprojected = 0, shadowSteps = 0;
+	int overBudget = 0;
+	float maxDrift = 0.0f;
+	std::vector<double> totals;
+	std::vector<RefinePassTotals> passes(renderer.GetRefinePassCount());
+	for (int i = 0; i < frames; i++)
+	{
+		if (replaying)
+		{
+			// Everything the frame was recorded with
+			const TraceFrame& frame = replay.m_frames[i];
+			renderer.m_constants.time = frame.time;
+			renderer.m_constants.quality = frame.quality;
+			renderer.m_constants.animated = frame.animated;
+			renderer.colour1 = frame.colour1;
+			renderer.colour2 = frame.colour2;
+			renderer.Render(frame.deltaTime);
+		}
+		else
+		{
+			// 60 Hz clock so animated runs are repeatable
+			renderer.m_constants.time = options.time + float(i) * 1000.0f / 60.0f;
+			renderer.Render();
+		}
+
+		// Another build's camera code may round differently, so put the camera back on the
+		// recorded path rather than let the difference grow
+		float drift = 0.0f;
+		if (replaying)
+		{
+			const TraceFrame& frame = replay.m_frames[i];
+			drift = CameraDrift(renderer.m_camera, frame);
+			maxDrift = std::max(maxDrift, drift);
+			renderer.m_camera.m_position = frame.position;
+			renderer.m_camera.m_right = frame.right;
+			renderer.m_camera.m_up = frame.up;
+			renderer.m_camera.m_look = frame.look;
+		}
+
+		const FrameTimings& timings = renderer.GetTimings();
+		update += timings.update;
+		upload += timings.upload;
+		draw += timings.draw;
+		double total = timings.update + timings.upload + timings.draw;
+		worst = total > worst ? total : worst;
+		totals.push_back(total);
+
+		if (timingsFile)
+		{
+			const FrameConstants& drawn = renderer.GetDrawnConstants();
+			bool shaded = &backend == &cpu;
+			fprintf(timingsFile, "%d,%.3f,%.3f,%.3f,%.3f,%d,%d,%lld,%lld,%g\n", i, timings.update, timings.upload, timings.draw, total,
+				drawn.pixelStep, drawn.quality, shaded ? cpu.GetRenderer().GetMarchSteps() : 0LL,
+				shaded ? cpu.GetRenderer().GetShadowStats().steps : 0LL, drift);
+		}
+
+		if (renderer.m_dynamicQuality)
+		{
+			const QualityTelemetry& state = renderer.m_qualityController.GetTelemetry();
+			overBudget += state.frameMs > options.budget ? 1 : 0;
+			if (telemetry)
+				fprintf(telemetry, "%d,%.3f,%.3f,%.3f,%d,%.3f,%d,%.6f,%d,%s\n", i, state.frameMs, state.averageMs, state.budgetMs,
+					state.pixelStep, state.detail, state.marchIterations, state.hitEpsilon, state.deIterations, QualityActionName(state.action));
+		}
+
+		steps += cpu.GetRenderer().GetMarchSteps();
+		shadowSteps += cpu.GetRenderer().GetShadowStats().steps;
+		reprojected += options.reproject ? cpu.GetRenderer().GetReprojectionStats().reprojected : 0;
+
+		RefinePassTotals& pass = passes[renderer.GetRefinePass()];
+		RefineStats pixels = cpu.GetRenderer().GetRefineStats();
+		pass.frames++;
+		pass.draw += timings.draw;
+		pass.pixels.marched += pixels.marched;
+		pass.pixels.resumed += pixels.resumed;
+		pass.pixels.reused += pixels.reused;
+	}
+
+	if (timingsFile)
+		fclose(timingsFile);
+
+	double n = double(std::max(frames, 1));
+	printf("%d frames at %dx%d on the %s backend, %u threads, %s\n", frames, backend.GetWidth(), backend.GetHeight(),
+		backend.GetName(), pool.GetThreadCount(), SimdLevelName(GetSimdLevel()));
+	if (replaying)
+		printf("  replayed %s, recorded at %dx%d, camera off the recording by at most %g\n", options.replay.c_str(), replay.m_width,
+			replay.m_height, maxDrift);
+	printf("  update %.4f ms, upload %.4f ms, draw %.3f ms per frame, worst frame %.3f ms\n", update / n, upload / n, draw / n, worst);
+	printf("  median frame %.3f ms, 95th percentile %.3f ms, 99th percentile %.3f ms\n", Percentile(totals, 0.5),
+		Percentile(totals, 0.95), Percentile(totals, 0.99));
+	printf("  frame loop overhead %.4f ms, %.1f frames/s\n", (update + upload) / n, n * 1000.0 / (update + upload + draw));
+	if (&backend == &cpu)
+	{
+		double pixels = double(width) * height;
+		printf("  %.2f march steps and %.2f shadow steps per pixel", double(steps) / (pixels * n), double(shadowSteps) / (pixels * n));
+		if (options.reproject)
+			printf(", %.1f%% of pixels reprojected", 100.0 * double(reprojected) / (pixels * n));
+		printf("\n");
+	}
+	if (shadowCache && &backend == &cpu)
+	{
+		ShadowCacheStats stats = shadowCache->GetStats();
+		printf("  shadow cache: %.1f%% of %lld hits, %lld of %zu cells filled (%.1f MB), %lld evictions, %lld dropped, %lld invalidations\n",
+			100.0 * double(stats.hits) / double(std::max(stats.hits + stats.misses, 1LL)), stats.hits + stats.misses,
+			shadowCache->GetFilledCells(), shadowCache->GetCapacity(), double(shadowCache->GetBytes()) / (1 << 20), stats.evictions,
+			stats.dropped, stats.invalidations);
+	}
+	if (renderer.m_dynamicQuality)
+	{
+		char line[256];
+		FormatQualityTelemetry(renderer.m_qualityController.GetTelemetry(), line, sizeof(line));
+		printf("  dynamic quality: %d of %d frames over %.1f ms, %lld resolution changes\n", overBudget, frames,
+			options.budget, renderer.m_qualityController.GetTelemetry().resolutionChanges);
+		printf("  last frame: %s\n", line);
+	}
+	if (telemetry)
+		fclose(telemetry);
+	for (size_t p = 0; options.progressive && p < passes.size(); p++)
+	{
+		const RefinePassTotals& pass = passes[p];
+		if (pass.frames == 0)
+			continue;
+
+		int pixelStep, quality;
+		renderer.GetRefinePass(int(p), pixelStep, quality);
+		printf("  pass %zu, every %d pixel(s) at quality %d: %d frames, %.3f ms draw", p, pixelStep, quality, pass.frames, pass.draw / pass.frames);
+		if (&backend == &cpu)
+			printf(", %lld marched, %lld resumed, %lld reused pixels per frame", pass.pixels.marched / pass.frames,
+				pass.pixels.resumed / pass.frames, pass.pixels.reused / pass.frames);
+		printf("\n");
+	}
+
+	if (!options.record.empty())
+	{
+		if (!recording.Save(options.record))
+		{
+			fprintf(stderr, "Failed to write %s\n", options.record.c_str());
+			return 1;
+		}
+		printf("Recorded %zu frames to %s\n", recording.m_frames.size(), options.record.c_str());
+	}
+
+	// Keep the last frame when there is one
+	Image image;
+	if (backend.Readback(image))
+	{
+		if (!WritePng(options.output, image))
+		{
+			fprintf(stderr, "Failed to write %s\n", options.output.c_str());
+			return 1;
+		}
+		printf("Saved %s\n", options.output.c_str());
+	}
+
+	return 0;
+}
+
+// Move the scripted camera, hold it still and check progressive refinement starts over while it
+// moves, then works through every pass and ends on the picture a straight render draws
+static int RunCheckProgressive(const HeadlessOptions& options)
+{
+	ThreadPool pool(options.threads);
+	CpuBackend cpu(pool, options.width, options.height);
+	cpu.GetRenderer().m_tileSize = options.tileSize;
+	cpu.GetRenderer().m_wavefront = !options.rowBatches;
+	cpu.GetRenderer().m_progressive = true;
+
+	int moveFrames = options.moveFrames >= 0 ? options.moveFrames : 10;
+	ScriptedInput scripted(moveFrames);
+	Renderer renderer(cpu, scripted);
+	renderer.m_progressive = true;
+	renderer.m_movingStep = options.movingStep;
+	renderer.m_constants.quality = options.quality;
+
+	// A second of 60 Hz frames is well past the idle delay and one frame per pass
+	int passCount = renderer.GetRefinePassCount();
+	int frames = moveFrames + 60;
+	bool restarted = true;
+	int lastPass = 0;
+	RefineStats kept = {};
+	for (int i = 0; i < frames; i++)
+	{
+		renderer.Render();
+		int pass = renderer.GetRefinePass();
+		restarted = restarted && (i >= moveFrames || pass == 0);
+		if (pass > 0)
+		{
+			RefineStats pixels = cpu.GetRenderer().GetRefineStats();
+			kept.resumed += pixels.resumed;
+			kept.reused += pixels.reused;
+		}
+		lastPass = pass;
+	}
+
+	// The last pass against the same constants drawn in one go
+	Image refined, reference;
+	cpu.Readback(refined);
+	FrameConstants constants = renderer.GetDrawnConstants();
+	ThreadPool referencePool(options.threads);
+	CpuRenderer direct(referencePool);
+	direct.m_tileSize = options.tileSize;
+	direct.m_wavefront = !options.rowBatches;
+	direct.Render(constants, reference);
+	double mean = BlockDifference(refined, reference, 1);
+
+	printf("%d moving and %d still frames at %dx%d, pass %d of %d at the end, %lld resumed and %lld reused pixels after pass 0\n",
+		moveFrames, frames - moveFrames, options.width, options.height, lastPass, passCount, kept.resumed, kept.reused);
+	printf("Refined frame is every %d pixel(s) at quality %d, mean difference from a straight render %.3f\n", constants.pixelStep,
+		constants.quality, mean);
+
+	bool ok = restarted && lastPass == passCount - 1 && constants.pixelStep == 1 && constants.quality == options.quality
+		&& kept.reused > 0 && mean < 2.0;
+	printf("%s\n", ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+static bool EndsWith(const std::string& text, const char* suffix)
+{
+	size_t length = strlen(suffix);
+	return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+static int RunAnimate(const HeadlessOptions& options)
+{
+	// Progress goes to stderr as stdout may be carrying the video
+	std::string output = options.output == "mandelbulb.png" ? "frame_%04d.png" : options.output;
+	std::unique_ptr<FrameSink> sink;
+	if (output == "-" || EndsWith(output, ".y4m"))
+		sink.reset(new Y4mSink(output));
+	else if (output.find('%') != std::string::npos)
+		sink.reset(new PngSequenceSink(output));
+	else
+	{
+		fprintf(stderr, "animate needs --output with a frame number pattern, a .y4m file or -\n");
+		return 1;
+	}
+
+	ThreadPool pool(options.threads);
+	AnimationRenderer animation(pool);
+	animation.m_tileSize = options.tileSize;
+
+	AnimationSettings settings;
+	settings.frames = options.frames;
+	settings.fps = options.fps;
+	settings.startSeconds = options.start;
+	settings.framesInFlight = options.framesInFlight;
+	settings.curve = options.curve;
+
+	FrameConstants constants = BuildConstants(options);
+	if (!animation.Render(constants, settings, *sink))
+	{
+		fprintf(stderr, "Failed to write the animation to %s\n", output.c_str());
+		return 1;
+	}
+
+	const AnimationStats& stats = animation.GetStats();
+	double seconds = stats.totalMs / 1000.0;
+	fprintf(stderr, "Rendered %d frames at %dx%d in %.2f s on %u threads, %s (%.2f frames/s, %d in flight)\n", options.frames,
+		options.width, options.height, seconds, pool.GetThreadCount(), SimdLevelName(GetSimdLevel()), options.frames / seconds,
+		stats.framesInFlight);
+	fprintf(stderr, "  render %.1f ms, encode %.1f ms per frame, writer spent %.1f ms writing and %.1f ms waiting in total\n",
+		stats.renderMs / options.frames, stats.encodeMs / options.frames, stats.writeMs, stats.waitMs);
+	fprintf(stderr, "Saved %s\n", output.c_str());
+	return 0;
+}
+
+static int RunPoster(const HeadlessOptions& options)
+{
+	if (options.width > g_maxPosterSize || options.height > g_maxPosterSize)
+	{
+		fprintf(stderr, "Posters can be at most %dx%d\n", g_maxPosterSize, g_maxPosterSize);
+		return 1;
+	}
+
+	std::unique_ptr<PosterSink> sink;
+	if (EndsWith(options.output, ".tif") || EndsWith(options.output, ".tiff"))
+		sink.reset(new TiffPosterSink(options.output, options.dpi));
+	else
+		sink.reset(new PngPosterSink(options.output));
+
+	ThreadPool pool(options.threads);
+	PosterRenderer poster(pool);
+	poster.m_tileSize = options.tileSize;
+	poster.m_wavefront = !options.rowBatches;
+
+	PosterSettings settings;
+	settings.stripRows = options.stripRows;
+	settings.stripsInFlight = options.framesInFlight;
+
+	FrameConstants constants = BuildConstants(options);
+	BrickMap bricks;
+	BuildBrickMap(options, constants, pool, bricks);
+	poster.m_brickMap = options.brickMap > 0 ? &bricks : nullptr;
+
+	// Progress goes to stderr, a poster can take hours
+	auto onStrip = [&](int rows) {
+		fprintf(stderr, "\r%d of %d rows", rows, options.height);
+		fflush(stderr);
+	};
+	bool ok = poster.Render(constants, settings, *sink, onStrip);
+	fprintf(stderr, "\n");
+	if (!ok)
+	{
+		fprintf(stderr, "Failed to write the poster to %s\n", options.output.c_str());
+		return 1;
+	}
+
+	const PosterStats& stats = poster.GetStats();
+	double pixels = double(options.width) * options.height;
+	printf("Rendered %dx%d in %.2f s on %u threads, %s (%.3f Mrays/s)\n", options.width, options.height, stats.totalMs / 1000.0,
+		pool.GetThreadCount(), SimdLevelName(GetSimdLevel()), pixels / (stats.totalMs * 1000.0));
+	printf("Strips: %d of %d rows, %d in flight holding %.1f MB, writer spent %.1f ms writing and %.1f ms waiting\n",
+		stats.strips, stats.stripRows, stats.stripsInFlight, double(stats.stripBytes) / (1 << 20), stats.writeMs, stats.waitMs);
+	printf("March: %.2f DE steps per pixel\n", double(stats.marchSteps) / pixels);
+	printf("Saved %s\n", options.output.c_str());
+	return 0;
+}
+
+static void PrintMeshStats(const MeshStats& stats, int depth)
+{
+	long long cells = 0;
+	for (long long level : stats.cells)
+		cells += level;
+	double virtualCells = pow(8.0, depth);
+	printf("Octree: %d levels, %.3g virtual leaf cells, %lld cells visited, %lld leaves on the surface\n", depth, virtualCells, cells,
+		stats.surfaceLeaves);
+	for (size_t level = 0; level < stats.cells.size(); level++)
+		printf("  level %2zu: %lld cells\n", level, stats.cells[level]);
+	printf("Mesh: %lld vertices, %lld triangles, %lld DE evaluations, extracted in %.1f ms and welded in %.1f ms, %.1f MB at peak\n",
+		stats.vertices, stats.triangles, stats.evaluations, stats.extractMs, stats.weldMs, double(stats.peakBytes) / (1 << 20));
+}
+
+static int RunMesh(const HeadlessOptions& options)
+{
+	std::string output = options.output == "mandelbulb.png" ? "mandelbulb.ply" : options.output;
+	bool obj = EndsWith(output, ".obj");
+	if (!obj && !EndsWith(output, ".ply"))
+	{
+		fprintf(stderr, "mesh needs --output ending in .ply or .obj\n");
+		return 1;
+	}
+
+	ThreadPool pool(options.threads);
+	MeshExtractor extractor(pool);
+	MeshSettings settings;
+	settings.depth = options.meshDepth;
+	settings.isoCells = options.meshIso;
+
+	Mesh mesh;
+	FractalOptions params = CreateFrameSetup(BuildConstants(options)).params;
+	if (!extractor.Extract(params, settings, mesh))
+	{
+		fprintf(stderr, "Failed to extract the mesh\n");
+		return 1;
+	}
+	PrintMeshStats(extractor.GetStats(), settings.depth);
+
+	auto start = std::chrono::steady_clock::now();
+	if (!(obj ? WriteObj(output, mesh) : WritePly(output, mesh)))
+	{
+		fprintf(stderr, "Failed to write %s\n", output.c_str());
+		return 1;
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("Saved %s in %.1f ms\n", output.c_str(), ms);
+	return 0;
+}
+
+// Extract the mesh with and without pruning at a depth a dense grid can still be afforded at, and
+// check that the pruned octree loses nothing and the mesh is closed and consistently wound
+static int RunCheckMesh(const HeadlessOptions& options)
+{
+	ThreadPool pool(options.threads);
+	MeshExtractor extractor(pool);
+	MeshSettings settings;
+	settings.depth = std::min(options.meshDepth, 7);
+	settings.isoCells = options.meshIso;
+	FractalOptions params = CreateFrameSetup(BuildConstants(options)).params;
+
+	Mesh meshes[2];
+	MeshStats stats[2];
+	for (int p = 0; p < 2; p++)
+	{
+		settings.dense = p == 1;
+		if (!extractor.Extract(params, settings, meshes[p]))
+		{
+			fprintf(stderr, "Failed to extract the mesh\n");
+			return 1;
+		}
+		stats[p] = extractor.GetStats();
+		printf("%-6s %lld DE evaluations, %lld surface leaves, %lld triangles in %.1f ms\n", p == 1 ? "dense" : "octree",
+			stats[p].evaluations, stats[p].surfaceLeaves, stats[p].triangles, stats[p].extractMs + stats[p].weldMs);
+	}
+
+	// Every edge of a closed mesh is used once in each direction
+	const Mesh& mesh = meshes[0];
+	std::vector<uint64_t> directed;
+	directed.reserve(mesh.indices.size());
+	for (size_t i = 0; i < mesh.indices.size(); i += 3)
+	{
+		for (int k = 0; k < 3; k++)
+			directed.push_back(uint64_t(mesh.indices[i + k]) << 32 | mesh.indices[i + (k + 1) % 3]);
+	}
+	std::sort(directed.begin(), directed.end());
+	long long open = 0;
+	long long repeated = 0;
+	for (size_t i = 0; i < directed.size(); i++)
+	{
+		if (i > 0 && directed[i] == directed[i - 1])
+			repeated++;
+		uint64_t reverse = directed[i] << 32 | directed[i] >> 32;
+		if (!std::binary_search(directed.begin(), directed.end(), reverse))
+			open++;
+	}
+
+	// Positive when the triangles face outwards
+	double volume = 0.0;
+	for (size_t i = 0; i < mesh.indices.size(); i += 3)
+	{
+		float3 a = mesh.vertices[mesh.indices[i]];
+		float3 b = mesh.vertices[mesh.indices[i + 1]];
+		float3 c = mesh.vertices[mesh.indices[i + 2]];
+		volume += double(dot(a, cross(b, c))) / 6.0;
+	}
+
+	bool ok = stats[0].triangles == stats[1].triangles && stats[0].surfaceLeaves == stats[1].surfaceLeaves && open == 0
+		&& repeated == 0 && volume > 0.0;
+	printf("Depth %d: octree evaluated %.1f%% of the dense grid's points, %lld open and %lld repeated edges, volume %.4f: %s\n",
+		settings.depth, 100.0 * double(stats[0].evaluations) / double(stats[1].evaluations), open, repeated, volume, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+static int RunCoordinate(const HeadlessOptions& options)
+{
+	if (!NetSocket::Startup())
+	{
+		fprintf(stderr, "Failed to start networking\n");
+		return 1;
+	}
+
+	TileCoordinator coordinator;
+	coordinator.m_tileSize = options.netTileSize;
+	coordinator.m_workerTimeoutSeconds = options.workerTimeout;
+	if (!coordinator.Listen(uint16_t(options.listenPort)))
+	{
+		fprintf(stderr, "Failed to listen on port %d\n", options.listenPort);
+		return 1;
+	}
+	printf("Listening on port %u\n", coordinator.GetPort());
+	fflush(stdout);
+
+	// Local workers share this host's threads, every other setting comes with each job
+	std::vector<std::unique_ptr<LocalProcess>> workers;
+	unsigned threads = options.threads > 0 ? options.threads : std::thread::hardware_concurrency();
+	unsigned workerThreads = options.spawn > 0 && threads / options.spawn > 0 ? threads / options.spawn : 1;
+	for (int i = 0; i < options.spawn; i++)
+	{
+		std::unique_ptr<LocalProcess> worker(new LocalProcess());
+		std::vector<std::string> args = { "worker", "--connect", "127.0.0.1:" + std::to_string(coordinator.GetPort()),
+			"--threads", std::to_string(workerThreads) };
+		if (!worker->Start(options.executable, args))
+		{
+			fprintf(stderr, "Failed to start worker %d\n", i);
+			return 1;
+		}
+		workers.push_back(std::move(worker));
+	}
+
+	FrameConstants constants = BuildConstants(options);
+	float power = CreateFrameSetup(constants).params.power;
+
+	Image image;
+	bool ok = coordinator.Render(constants, power, image);
+	coordinator.Shutdown();
+	workers.clear();
+	if (!ok)
+		return 1;
+
+	const TileCoordinatorStats& stats = coordinator.GetStats();
+	printf("Rendered %dx%d in %.1f ms as %d tiles of %d pixels over %d workers\n", options.width, options.height, stats.totalMs,
+		stats.tiles, options.netTileSize, stats.workers);
+	printf("  %d workers lost, %d tiles reissued, %d slow tiles copied, %d late copies discarded\n", stats.workersLost,
+		stats.reissued, stats.duplicated, stats.duplicatesDiscarded);
+	for (size_t i = 0; i < stats.tilesPerWorker.size(); i++)
+		printf("  worker %d: %d tiles\n", int(i), stats.tilesPerWorker[i]);
+
+	if (!WritePng(options.output, image))
+	{
+		fprintf(stderr, "Failed to write %s\n", options.output.c_str());
+		return 1;
+	}
+	printf("Saved %s\n", options.output.c_str());
+	return 0;
+}
+
+static int RunWorker(const HeadlessOptions& options)
+{
+	std::string host;
+	uint16_t port = 0;
+	if (!ParseHostPort(options.connect, host, port))
+	{
+		fprintf(stderr, "worker needs --connect <host:port>\n");
+		return 1;
+	}
+	if (!NetSocket::Startup())
+	{
+		fprintf(stderr, "Failed to start networking\n");
+		return 1;
+	}
+
+	ThreadPool pool(options.threads);
+	TileWorker worker(pool);
+	worker.m_tileSize = options.tileSize;
+	worker.m_delayMs = options.workerDelay;
+	worker.m_exitAfterTiles = options.workerExitAfter;
+	if (!worker.Connect(host, port, 10.0))
+	{
+		fprintf(stderr, "Failed to connect to %s:%u\n", host.c_str(), port);
+		return 1;
+	}
+	return worker.Serve() ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || strcmp(argv[1], "--help") == 0)
+	{
+		PrintUsage();
+		return argc < 2 ? 1 : 0;
+	}
+
+	std::string command = argv[1];
+	HeadlessOptions options;
+	options.executable = argv[0];
+
+	if (!ParseOptions(argc, argv, 2, options))
+		return 1;
+	SetSimdLevel(options.simd);
+	SetTrigFreePower(!options.polar);
+	SetNormalMode(options.normals);
+	SetBoundingSphere(!options.unbounded);
+	SetPixelLod(!options.fixedLod);
+	for (int q = 0; q < 3; q++)
+		SetMarchStrategy(q, options.march[q]);
+
+	if (command == "render")
+		return RunRender(options);
+	if (command == "check-simd")
+		return RunCheckSimd(options);
+	if (command == "check-power")
+		return RunCheckPower(options);
+	if (command == "check-normals")
+		return RunCheckNormals(options);
+	if (command == "check-bounds")
+		return RunCheckBounds(options);
+	if (command == "check-lod")
+		return RunCheckLod(options);
+	if (command == "check-march")
+		return RunCheckMarch(options);
+	if (command == "check-aa")
+		return RunCheckAntialias(options);
+	if (command == "frames")
+		return RunFrames(options);
+	if (command == "check-progressive")
+		return RunCheckProgressive(options);
+	if (command == "animate")
+		return RunAnimate(options);
+	if (command == "poster")
+		return RunPoster(options);
+	if (command == "mesh")
+		return RunMesh(options);
+	if (command == "check-mesh")
+		return RunCheckMesh(options);
+	if (command == "coordinate")
+		return RunCoordinate(options);
+	if (command == "worker")
+		return RunWorker(options);
+	if (command == "cost")
+		return RunCost(options);
+
+	fprintf(stderr, "Unknown command %s\n", command.c_str());
+	PrintUsage();
+	return 1;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+//------------------------------
+//- hlslmath.h
+//------------------------------
+
+// Small portable vector library mirroring the HLSL types and intrinsics used by the shaders,
+// so the CPU path can be written line for line against include.hlsli and main.hlsl
+
+// Includes
+#include <cmath>
+
+struct float2
+{
+	float x, y;
+};
+
+struct float3
+{
+	float x, y, z;
+};
+
+struct float4
+{
+	float x, y, z, w;
+};
+
+// Stored row-major with DirectX row-vector conventions, the same bytes as an XMFLOAT4X4
+struct float4x4
+{
+	float m[4][4];
+
+	float& operator()(int row, int column) { return m[row][column]; }
+	float operator()(int row, int column) const { return m[row][column]; }
+};
+
+// float2 operators
+inline float2 operator+(float2 a, float2 b) { return { a.x + b.x, a.y + b.y }; }
+inline float2 operator-(float2 a, float2 b) { return { a.x - b.x, a.y - b.y }; }
+inline float2 operator*(float2 a, float2 b) { return { a.x * b.x, a.y * b.y }; }
+inline float2 operator/(float2 a, float2 b) { return { a.x / b.x, a.y / b.y }; }
+inline float2 operator*(float2 a, float s) { return { a.x * s, a.y * s }; }
+
+// float3 operators
+inline float3 operator+(float3 a, float3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+inline float3 operator-(float3 a, float3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+inline float3 operator*(float3 a, float3 b) { return { a.x * b.x, a.y * b.y, a.z * b.z }; }
+inline float3 operator/(float3 a, float3 b) { return { a.x / b.x, a.y / b.y, a.z / b.z }; }
+inline float3 operator+(float3 a, float s) { return { a.x + s, a.y + s, a.z + s }; }
+inline float3 operator-(float3 a, float s) { return { a.x - s, a.y - s, a.z - s }; }
+inline float3 operator*(float3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+inline float3 operator*(float s, float3 a) { return { a.x * s, a.y * s, a.z * s }; }
+inline float3 operator/(float3 a, float s) { return { a.x / s, a.y / s, a.z / s }; }
+inline float3 operator-(float3 a) { return { -a.x, -a.y, -a.z }; }
+inline float3& operator+=(float3& a, float3 b) { a = a + b; return a; }
+inline float3& operator-=(float3& a, float3 b) { a = a - b; return a; }
+inline float3& operator*=(float3& a, float s) { a = a * s; return a; }
+
+// Scalar intrinsics
+inline float saturate(float x) { return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x); }
+inline float clamp(float x, float lo, float hi) { return x < lo ? lo : (x > hi ? hi : x); }
+inline float frac(float x) { return x - floorf(x); }
+inline float lerp(float a, float b, float s) { return a + (b - a) * s; }
+
+// Vector intrinsics
+inline float dot(float2 a, float2 b) { return a.x * b.x + a.y * b.y; }
+inline float dot(float3 a, float3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline float length(float2 a) { return sqrtf(dot(a, a)); }
+inline float length(float3 a) { return sqrtf(dot(a, a)); }
+inline float3 normalize(float3 a) { return a / length(a); }
+inline float3 cross(float3 a, float3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+inline float3 saturate(float3 a) { return { saturate(a.x), saturate(a.y), saturate(a.z) }; }
+inline float3 lerp(float3 a, float3 b, float s) { return a + (b - a) * s; }
+
+// HLSL mul(M, v). Matrices reach the shader through a column_major cbuffer, so the shader
+// sees the transpose of the stored DirectX matrix and mul(M, v) equals the row-vector v * M
+inline float4 mul(const float4x4& M, float4 v)
+{
+	return {
+		v.x * M.m[0][0] + v.y * M.m[1][0] + v.z * M.m[2][0] + v.w * M.m[3][0],
+		v.x * M.m[0][1] + v.y * M.m[1][1] + v.z * M.m[2][1] + v.w * M.m[3][1],
+		v.x * M.m[0][2] + v.y * M.m[1][2] + v.z * M.m[2][2] + v.w * M.m[3][2],
+		v.x * M.m[0][3] + v.y * M.m[1][3] + v.z * M.m[2][3] + v.w * M.m[3][3]
+	};
+}
+
+// Matrix helpers matching the DirectXMath functions the camera used
+inline float4x4 MatrixIdentity()
+{
+	return { {
+		{ 1.0f, 0.0f, 0.0f, 0.0f },
+		{ 0.0f, 1.0f, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f, 0.0f },
+		{ 0.0f, 0.0f, 0.0f, 1.0f }
+	} };
+}
+
+// Row-vector product a * b
+inline float4x4 MatrixMultiply(const float4x4& a, const float4x4& b)
+{
+	float4x4 r;
+	for (int i = 0; i < 4; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+		}
+	}
+	return r;
+}
+
+// XMMatrixPerspectiveFovLH
+inline float4x4 MatrixPerspectiveFovLH(float fovY, float aspect, float zn, float zf)
+{
+	float h = 1.0f / tanf(0.5f * fovY);
+	float w = h / aspect;
+	float range = zf / (zf - zn);
+
+	return { {
+		{ w, 0.0f, 0.0f, 0.0f },
+		{ 0.0f, h, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, range, 1.0f },
+		{ 0.0f, 0.0f, -range * zn, 0.0f }
+	} };
+}
+
+// XMMatrixRotationAxis, axis need not be normalized
+inline float4x4 MatrixRotationAxis(float3 axis, float angle)
+{
+	float3 n = normalize(axis);
+	float s = sinf(angle);
+	float c = cosf(angle);
+	float t = 1.0f - c;
+
+	return { {
+		{ t * n.x * n.x + c, t * n.x * n.y + s * n.z, t * n.x * n.z - s * n.y, 0.0f },
+		{ t * n.x * n.y - s * n.z, t * n.y * n.y + c, t * n.y * n.z + s * n.x, 0.0f },
+		{ t * n.x * n.z + s * n.y, t * n.y * n.z - s * n.x, t * n.z * n.z + c, 0.0f },
+		{ 0.0f, 0.0f, 0.0f, 1.0f }
+	} };
+}
+
+// XMMatrixRotationY
+inline float4x4 MatrixRotationY(float angle)
+{
+	return MatrixRotationAxis({ 0.0f, 1.0f, 0.0f }, angle);
+}
+
+// XMVector3TransformNormal, ignores translation
+inline float3 TransformNormal(float3 v, const float4x4& M)
+{
+	return {
+		v.x * M.m[0][0] + v.y * M.m[1][0] + v.z * M.m[2][0],
+		v.x * M.m[0][1] + v.y * M.m[1][1] + v.z * M.m[2][1],
+		v.x * M.m[0][2] + v.y * M.m[1][2] + v.z * M.m[2][2]
+	};
+}
+
+// XMVector3TransformCoord, applies translation and divides by w
+inline float3 TransformCoord(float3 v, const float4x4& M)
+{
+	float4 r = mul(M, float4{ v.x, v.y, v.z, 1.0f });
+	return { r.x / r.w, r.y / r.w, r.z / r.w };
+}
+
+// General 4x4 inverse by cofactor expansion, returns identity for singular matrices
+inline float4x4 MatrixInverse(const float4x4& M)
+{
+	const float* a = &M.m[0][0];
+	float inv[16];
+
+	inv[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] + a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+	inv[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] - a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+	inv[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] + a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+	inv[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] - a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+	inv[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] - a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+	inv[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] + a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+	inv[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] - a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+	inv[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] + a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+	inv[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] + a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+	inv[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] - a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+	inv[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] + a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+	inv[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] - a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+	inv[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] - a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+	inv[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] + a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+	inv[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] - a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+	inv[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] + a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+	float det = a[0] * inv[0] + a[1] * inv[4] + a[2] * inv[8] + a[3] * inv[12];
+	if (det == 0.0f)
+		return MatrixIdentity();
+
+	float4x4 r;
+	float invDet = 1.0f / det;
+	for (int i = 0; i < 16; i++)
+	{
+		(&r.m[0][0])[i] = inv[i] * invDet;
+	}
+	return r;
+}
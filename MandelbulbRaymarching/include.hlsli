@@ -2,6 +2,16 @@
 //- include.hlsli
 //------------------------------
 
+// Kernel variant, defined by D3D11Backend for each permutation it compiles. KERNEL_QUALITY is
+// the quality level GetQuality specialises for and KERNEL_ANIMATED whether the power animates,
+// otherwise it is fixed at 8
+#ifndef KERNEL_QUALITY
+#define KERNEL_QUALITY 0
+#endif
+#ifndef KERNEL_ANIMATED
+#define KERNEL_ANIMATED 0
+#endif
+
 // Camera ray
 struct Ray
 {
@@ -34,6 +44,47 @@ Ray CreateCamRay(float2 uv, float4x4 projInverse, float4x4 viewInverse, float3 c
     return ray;
 }
 
+// (re + i im)^8 by squaring three times
+float2 ComplexPow8(float2 c)
+{
+    c = float2(c.x * c.x - c.y * c.y, 2.0 * c.x * c.y);
+    c = float2(c.x * c.x - c.y * c.y, 2.0 * c.x * c.y);
+    return float2(c.x * c.x - c.y * c.y, 2.0 * c.x * c.y);
+}
+
+// z^8 without trig, see mandelbulb.h for the derivation
+float3 TriplexPow8(float3 z)
+{
+    float rho = length(z.xz);
+    float2 a = ComplexPow8(float2(z.y, rho));
+    float2 b = rho > 0.0 ? ComplexPow8(float2(z.z, z.x) / rho) : float2(1.0, 0.0);
+    return float3(a.y * b.y, a.x, a.y * b.x);
+}
+
+// One iteration of z = z^n + c, with dz = n r^(n-1) dz + 1
+float3 MandelbulbStep(float3 z, float3 c, float power, inout float dz)
+{
+    float r = length(z);
+    
+#if KERNEL_ANIMATED
+    dz = power * pow(r, power - 1.0) * dz + 1.0;
+    
+    // Integer power 8 is the common case and needs no trig
+    if (power == 8.0)
+        return c + TriplexPow8(z);
+    
+    float b = power * acos(z.y / r);
+    float a = power * atan2(z.x, z.z);
+    return c + pow(r, power) * float3(sin(b) * sin(a), cos(b), sin(b) * cos(a));
+#else
+    // The power is always 8, so r^7 is three multiplies rather than a pow
+    float r2 = r * r;
+    float r4 = r2 * r2;
+    dz = 8.0 * r4 * r2 * r * dz + 1.0;
+    return c + TriplexPow8(z);
+#endif
+}
+
 // https://iquilezles.org/articles/mandelbulb/
 float DistToScene(float3 pos, FractalOptions params)
 {
@@ -42,16 +93,10 @@ float DistToScene(float3 pos, FractalOptions params)
     float m = dot(pos, pos);
     
     float dz = 1.0;
-    float r = 0.0;
     for (int i = 0; i < params.maxIters; i++)
     {
-        dz = 8.0 * pow(m, 3.5) * dz + 1.0;
-      
-        // z = z^8+c
-        float r = length(z);
-        float b = params.power * acos(z.y / r);
-        float a = params.power * atan2(z.x, z.z);
-        z = pos.xzy + pow(r, 8.0) * float3(sin(b) * sin(a), cos(b), sin(b) * cos(a));
+        // z = z^n+c
+        z = MandelbulbStep(z, pos.xzy, params.power, dz);
         
         m = dot(z, z);
         if (m > params.escape)
@@ -61,33 +106,27 @@ float DistToScene(float3 pos, FractalOptions params)
     return 0.25 * log(m) * sqrt(m) / dz;
 }
 
-// Same as above, but return the highest value of length(z) before escape
+// Same as above, but return the highest value of length(z) before escape. PSMain only needs it
+// at the hit, the march steps use the overload above
 float DistToScene(float3 pos, FractalOptions params, out float lenZ)
 {
     float3 z = pos;
     z.xyz = z.xzy;
     float m = dot(pos, pos);
-    lenZ = length(z);
+    lenZ = sqrt(m);
     
     float dz = 1.0;
-    float r = 0.0;
     for (int i = 0; i < params.maxIters; i++)
     {   
-        dz = 8.0f * pow(m, 3.5f) * dz + 1.0f;
-      
-        // z = z^8+c
-        float r = length(z);
-        float b = params.power * acos(z.y / r);
-        float a = params.power * atan2(z.x, z.z);
-        z = pos.xzy + pow(r, 8.0f) * float3(sin(b) * sin(a), cos(b), sin(b) * cos(a));
+        // z = z^n+c
+        z = MandelbulbStep(z, pos.xzy, params.power, dz);
         
         m = dot(z, z);
         
         if (m > params.escape)
             break;
         
-        if (length(z) > lenZ)
-            lenZ = length(z);
+        lenZ = max(lenZ, sqrt(m));
     }
         
     return 0.25 * log(m) * sqrt(m) / dz;
@@ -102,8 +141,8 @@ float SoftShadow(in float3 hit, in float3 lightDir, float mint, float maxt, floa
     float t = 0.0f;
     for (int i = 0; i < params.maxIters; i++)
     {
-        // Out of Mandelbulb range
-        if (length(hit + lightDir * t) > 3.0f)
+        // Out of Mandelbulb range, or past the end of the ray
+        if (length(hit + lightDir * t) > 3.0f || t > maxt)
             break;
         
         float h = DistToScene(hit + lightDir * t, params);
@@ -118,6 +157,27 @@ float SoftShadow(in float3 hit, in float3 lightDir, float mint, float maxt, floa
     return res;
 }
 
+// Radius of a sphere around the origin the fractal at power lies inside, see kernel.h
+float FractalBoundingRadius(float power)
+{
+    if (power <= 1.0f)
+        return 2.5f;
+    return min(pow(2.0f, 1.0f / (power - 1.0f)) + 0.02f, 2.5f);
+}
+
+// Distances along ray to where it enters and leaves the sphere of radius around the origin, false
+// when it misses
+bool IntersectSphere(Ray ray, float radius, out float entry, out float exit)
+{
+    float b = dot(ray.pos, ray.dir);
+    float c = dot(ray.pos, ray.pos) - radius * radius;
+    float discriminant = b * b - c;
+    float root = sqrt(max(discriminant, 0.0f));
+    entry = -b - root;
+    exit = -b + root;
+    return discriminant >= 0.0f && exit > 0.0f;
+}
+
 // Normal estimate which compares distance with respect to dy,dx,dz to get normal
 float3 NormalEstimate(float3 p, FractalOptions params)
 {
@@ -0,0 +1,190 @@
+//------------------------------
+//- inputtrace.cpp
+//------------------------------
+
+// Includes
+#include "inputtrace.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	// Trace file layout, little endian. The header is followed by frameCount records
+	const char g_fileMagic[8] = { 'M', 'B', 'T', 'R', 'A', 'C', 'E', 'S' };
+	const uint32_t g_fileVersion = 1;
+
+	struct TraceFileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+		uint32_t recordSize;
+		uint32_t frameCount;
+
+		int32_t width;
+		int32_t height;
+		float camera[12];
+
+		uint64_t recordsChecksum;
+		// Of the header with this field zeroed
+		uint64_t headerChecksum;
+	};
+
+	// InputState flags
+	const uint8_t g_forward = 1;
+	const uint8_t g_back = 2;
+	const uint8_t g_left = 4;
+	const uint8_t g_right = 8;
+
+	struct TraceRecord
+	{
+		uint8_t keys;
+		uint8_t quality;
+		uint8_t animated;
+		uint8_t padding;
+		float yaw;
+		float pitch;
+		float deltaTime;
+		float time;
+		uint32_t colour1;
+		uint32_t colour2;
+		float camera[12];
+	};
+	static_assert(sizeof(TraceRecord) == 76, "trace records are packed");
+
+	// FNV-1a, traces are small
+	uint64_t Checksum(const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (size_t i = 0; i < size; i++)
+			hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+		return hash;
+	}
+
+	uint64_t HeaderChecksum(TraceFileHeader header)
+	{
+		header.headerChecksum = 0;
+		return Checksum(&header, sizeof(header));
+	}
+
+	void StoreCamera(float* camera, float3 position, float3 right, float3 up, float3 look)
+	{
+		const float3 vectors[] = { position, right, up, look };
+		for (int i = 0; i < 4; i++)
+		{
+			camera[i * 3] = vectors[i].x;
+			camera[i * 3 + 1] = vectors[i].y;
+			camera[i * 3 + 2] = vectors[i].z;
+		}
+	}
+
+	void LoadCamera(const float* camera, float3& position, float3& right, float3& up, float3& look)
+	{
+		float3* vectors[] = { &position, &right, &up, &look };
+		for (int i = 0; i < 4; i++)
+			*vectors[i] = float3{ camera[i * 3], camera[i * 3 + 1], camera[i * 3 + 2] };
+	}
+}
+
+bool InputTrace::Save(const std::string& fileName) const
+{
+	std::vector<TraceRecord> records(m_frames.size());
+	for (size_t i = 0; i < m_frames.size(); i++)
+	{
+		const TraceFrame& frame = m_frames[i];
+		TraceRecord& record = records[i];
+		record = {};
+		record.keys = (frame.input.forward ? g_forward : 0) | (frame.input.back ? g_back : 0) | (frame.input.left ? g_left : 0)
+			| (frame.input.right ? g_right : 0);
+		record.quality = uint8_t(frame.quality);
+		record.animated = uint8_t(frame.animated);
+		record.yaw = frame.input.yaw;
+		record.pitch = frame.input.pitch;
+		record.deltaTime = frame.deltaTime;
+		record.time = frame.time;
+		record.colour1 = frame.colour1;
+		record.colour2 = frame.colour2;
+		StoreCamera(record.camera, frame.position, frame.right, frame.up, frame.look);
+	}
+
+	TraceFileHeader header = {};
+	memcpy(header.magic, g_fileMagic, sizeof(g_fileMagic));
+	header.version = g_fileVersion;
+	header.headerSize = sizeof(TraceFileHeader);
+	header.recordSize = sizeof(TraceRecord);
+	header.frameCount = uint32_t(records.size());
+	header.width = m_width;
+	header.height = m_height;
+	StoreCamera(header.camera, m_position, m_right, m_up, m_look);
+	header.recordsChecksum = Checksum(records.data(), records.size() * sizeof(TraceRecord));
+	header.headerChecksum = HeaderChecksum(header);
+
+	FILE* file = fopen(fileName.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(records.data(), sizeof(TraceRecord), records.size(), file) == records.size();
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+		remove(fileName.c_str());
+	return ok;
+}
+
+bool InputTrace::Load(const std::string& fileName)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if (!file)
+		return false;
+
+	TraceFileHeader header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, g_fileMagic, sizeof(g_fileMagic)) == 0
+		&& header.version == g_fileVersion && header.headerSize == sizeof(TraceFileHeader) && header.recordSize == sizeof(TraceRecord)
+		&& header.headerChecksum == HeaderChecksum(header);
+
+	std::vector<TraceRecord> records;
+	if (ok)
+	{
+		records.resize(header.frameCount);
+		ok = fread(records.data(), sizeof(TraceRecord), records.size(), file) == records.size()
+			&& Checksum(records.data(), records.size() * sizeof(TraceRecord)) == header.recordsChecksum;
+	}
+	fclose(file);
+	if (!ok)
+		return false;
+
+	m_width = header.width;
+	m_height = header.height;
+	LoadCamera(header.camera, m_position, m_right, m_up, m_look);
+
+	m_frames.resize(records.size());
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const TraceRecord& record = records[i];
+		TraceFrame& frame = m_frames[i];
+		frame.input.forward = (record.keys & g_forward) != 0;
+		frame.input.back = (record.keys & g_back) != 0;
+		frame.input.left = (record.keys & g_left) != 0;
+		frame.input.right = (record.keys & g_right) != 0;
+		frame.input.yaw = record.yaw;
+		frame.input.pitch = record.pitch;
+		frame.deltaTime = record.deltaTime;
+		frame.time = record.time;
+		frame.quality = record.quality;
+		frame.animated = record.animated;
+		frame.colour1 = record.colour1;
+		frame.colour2 = record.colour2;
+		LoadCamera(record.camera, frame.position, frame.right, frame.up, frame.look);
+	}
+	return true;
+}
+
+InputState TracePlayer::Poll()
+{
+	if (m_frame >= int(m_trace.m_frames.size()))
+		return InputState();
+
+	return m_trace.m_frames[m_frame++].input;
+}
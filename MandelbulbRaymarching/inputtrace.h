@@ -0,0 +1,72 @@
+#pragma once
+
+//------------------------------
+//- inputtrace.h
+//------------------------------
+
+// Recorded navigation sessions. Renderer appends the input, step, settings and resulting camera of
+// every frame it draws while recording, and TracePlayer feeds the input back so a replay moves the
+// camera through the same code. The recorded camera shows whether a replay has drifted
+
+// Includes
+#include "backend.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One recorded frame
+struct TraceFrame
+{
+	InputState input;
+	// Seconds the camera moved for
+	float deltaTime = 0.0f;
+
+	// Settings the frame was drawn with, colours as in Renderer
+	float time = 0.0f;
+	int quality = 0;
+	int animated = 0;
+	uint32_t colour1 = 0;
+	uint32_t colour2 = 0;
+
+	// Camera once the input was applied
+	float3 position = {};
+	float3 right = {};
+	float3 up = {};
+	float3 look = {};
+};
+
+class InputTrace
+{
+public:
+	// Output size and camera when recording started
+	int m_width = 0;
+	int m_height = 0;
+	float3 m_position = {};
+	float3 m_right = {};
+	float3 m_up = {};
+	float3 m_look = {};
+
+	std::vector<TraceFrame> m_frames;
+
+	// Write the trace, 76 bytes a frame. False if the file could not be written
+	bool Save(const std::string& fileName) const;
+	// Read a trace written by Save, false for missing, truncated or corrupt files
+	bool Load(const std::string& fileName);
+};
+
+// Replays a trace's input one frame per Poll, then holds still
+class TracePlayer : public InputSource
+{
+public:
+	// Constructor
+	TracePlayer(const InputTrace& trace) : m_trace(trace) {}
+
+	InputState Poll() override;
+
+	// Frame the next Poll returns
+	int GetFrame() const { return m_frame; }
+private:
+	const InputTrace& m_trace;
+	int m_frame = 0;
+};
@@ -0,0 +1,645 @@
+//------------------------------
+//- kernel.cpp
+//------------------------------
+
+// Includes
+#include "kernel.h"
+#include "dual.h"
+#include "kernel_simd.h"
+#include "mandelbulb.h"
+#include "pixelcost.h"
+
+#include <array>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+
+// Scene constants
+static const float3 g_lightColours[g_lightCount] = {
+	{ 0.809f, 0.878f, 1.0f }, // Sky blue
+	{ 1.0f, 0.945f, 0.878f }, // Lightbulb orange
+	{ 0.796f, 0.765f, 0.890f } // Purple
+};
+
+// https://sibaku.github.io/computer-graphics/2017/01/10/Camera-Ray-Generation.html
+Ray CreateCamRay(float2 uv, const float4x4& projInverse, const float4x4& viewInverse, float3 camPos)
+{
+	Ray ray;
+
+	float4 ndsh = { uv.x, uv.y, -1.0f, 1.0f };
+	float4 dirEye = mul(projInverse, ndsh);
+	dirEye.w = 0;
+
+	float4 dirWorld = mul(viewInverse, dirEye);
+
+	ray.pos = camPos;
+	ray.dir = normalize(float3{ dirWorld.x, dirWorld.y, dirWorld.z });
+
+	return ray;
+}
+
+// Whether integer powers use the trig-free iteration
+static bool g_trigFreePower = true;
+static NormalMode g_normalMode = NormalMode::Central;
+static bool g_boundingSphere = true;
+static bool g_pixelLod = true;
+static MarchStrategy g_marchStrategy[3] = { g_qualityMarchStrategy[0], g_qualityMarchStrategy[1], g_qualityMarchStrategy[2] };
+
+// Quality levels past the three GetQualitySettings knows use the first
+static int QualityLevel(int quality)
+{
+	return quality == 1 || quality == 2 ? quality : 0;
+}
+
+typedef float (*DistFunction)(float, float, float, int, float, float*);
+
+// Trig-free iterations for powers g_minIntegerPower onwards
+template <bool TrackLenZ, int... N>
+static constexpr std::array<DistFunction, sizeof...(N)> MakeIntegerPowerTable(std::integer_sequence<int, N...>)
+{
+	return { { &Mandelbulb::DistToScene<N + g_minIntegerPower, TrackLenZ, float>... } };
+}
+
+static const auto g_integerPower = MakeIntegerPowerTable<false>(std::make_integer_sequence<int, g_maxIntegerPower - g_minIntegerPower + 1>());
+static const auto g_integerPowerLenZ = MakeIntegerPowerTable<true>(std::make_integer_sequence<int, g_maxIntegerPower - g_minIntegerPower + 1>());
+
+typedef Dual3 (*DualDistFunction)(Dual3, Dual3, Dual3, int, Dual3, Dual3*);
+
+// The same iterations on dual numbers for NormalEstimateAnalytic
+template <int... N>
+static std::array<DualDistFunction, sizeof...(N)> MakeDualPowerTable(std::integer_sequence<int, N...>)
+{
+	return { { &Mandelbulb::DistToScene<N + g_minIntegerPower, false, Dual3>... } };
+}
+
+static const auto g_integerPowerDual = MakeDualPowerTable(std::make_integer_sequence<int, g_maxIntegerPower - g_minIntegerPower + 1>());
+
+void SetTrigFreePower(bool enabled)
+{
+	g_trigFreePower = enabled;
+}
+
+bool GetTrigFreePower()
+{
+	return g_trigFreePower;
+}
+
+int IntegerPower(float power)
+{
+	int n = int(power);
+	if (!g_trigFreePower || float(n) != power || n < g_minIntegerPower || n > g_maxIntegerPower)
+		return 0;
+	return n;
+}
+
+void SetNormalMode(NormalMode mode)
+{
+	g_normalMode = mode;
+}
+
+NormalMode GetNormalMode()
+{
+	return g_normalMode;
+}
+
+void SetBoundingSphere(bool enabled)
+{
+	g_boundingSphere = enabled;
+}
+
+bool GetBoundingSphere()
+{
+	return g_boundingSphere;
+}
+
+void SetPixelLod(bool enabled)
+{
+	g_pixelLod = enabled;
+}
+
+bool GetPixelLod()
+{
+	return g_pixelLod;
+}
+
+float FractalBoundingRadius(float power)
+{
+	// Past the escape bound |z^n + c| > |z| whenever |z| >= |c|, so nothing there stays bounded.
+	// The margin covers the hit epsilon and the DE's rounding right at the bound
+	if (power <= 1.0f)
+		return g_escapeRadius;
+	return fminf(powf(2.0f, 1.0f / (power - 1.0f)) + 0.02f, g_escapeRadius);
+}
+
+bool IntersectSphere(const Ray& ray, float radius, float& entry, float& exit)
+{
+	float b = dot(ray.pos, ray.dir);
+	float c = dot(ray.pos, ray.pos) - radius * radius;
+	float discriminant = b * b - c;
+	if (discriminant < 0.0f)
+		return false;
+
+	float root = sqrtf(discriminant);
+	entry = -b - root;
+	exit = -b + root;
+	return exit > 0.0f;
+}
+
+const char* NormalModeName(NormalMode mode)
+{
+	switch (mode)
+	{
+	case NormalMode::Tetrahedral:
+		return "tetrahedral";
+	case NormalMode::Analytic:
+		return "analytic";
+	default:
+		return "central";
+	}
+}
+
+bool ParseNormalMode(const char* name, NormalMode& mode)
+{
+	for (NormalMode m : { NormalMode::Central, NormalMode::Tetrahedral, NormalMode::Analytic })
+	{
+		if (strcmp(name, NormalModeName(m)) == 0)
+		{
+			mode = m;
+			return true;
+		}
+	}
+	return false;
+}
+
+void SetMarchStrategy(int quality, MarchStrategy strategy)
+{
+	g_marchStrategy[QualityLevel(quality)] = strategy;
+}
+
+MarchStrategy GetMarchStrategy(int quality)
+{
+	return g_marchStrategy[QualityLevel(quality)];
+}
+
+const char* MarchStrategyName(MarchStrategy strategy)
+{
+	switch (strategy)
+	{
+	case MarchStrategy::Relaxed:
+		return "relaxed";
+	case MarchStrategy::Refined:
+		return "refined";
+	default:
+		return "plain";
+	}
+}
+
+bool ParseMarchStrategy(const char* name, MarchStrategy& strategy)
+{
+	for (MarchStrategy s : { MarchStrategy::Plain, MarchStrategy::Relaxed, MarchStrategy::Refined })
+	{
+		if (strcmp(name, MarchStrategyName(s)) == 0)
+		{
+			strategy = s;
+			return true;
+		}
+	}
+	return false;
+}
+
+MarchState BeginMarch(const FrameSetup& setup)
+{
+	MarchState state;
+	state.relaxation = setup.marchStrategy == MarchStrategy::Plain ? 1.0f : g_marchRelaxation;
+	state.lastDist = 0.0f;
+	state.lastStep = 0.0f;
+	return state;
+}
+
+float NextMarchStep(MarchState& state, float dist, bool& overshot)
+{
+	// Enhanced sphere tracing, Keinert et al. 2014. The ray is safe within lastDist of where the
+	// last step left from and within dist of here, a gap between the two may hide surface
+	overshot = state.relaxation > 1.0f && dist + state.lastDist < state.lastStep;
+	if (overshot)
+	{
+		float back = state.lastDist - state.lastStep;
+		state.relaxation = 1.0f;
+		state.lastStep = 0.0f;
+		return back;
+	}
+
+	state.lastDist = dist;
+	state.lastStep = dist * state.relaxation;
+	return state.lastStep;
+}
+
+// https://iquilezles.org/articles/mandelbulb/
+float DistToScene(float3 pos, const FractalOptions& params)
+{
+	PIXEL_COST_STEP();
+
+	int n = IntegerPower(params.power);
+	if (n > 0)
+		return g_integerPower[n - g_minIntegerPower](pos.x, pos.y, pos.z, params.maxIters, params.escape, nullptr);
+
+	return Mandelbulb::DistToScenePolar<false>(pos.x, pos.y, pos.z, params.power, params.maxIters, params.escape, (float*)nullptr);
+}
+
+// Same as above, but return the highest value of length(z) before escape
+float DistToScene(float3 pos, const FractalOptions& params, float& lenZ)
+{
+	PIXEL_COST_STEP();
+
+	int n = IntegerPower(params.power);
+	if (n > 0)
+		return g_integerPowerLenZ[n - g_minIntegerPower](pos.x, pos.y, pos.z, params.maxIters, params.escape, &lenZ);
+
+	return Mandelbulb::DistToScenePolar<true>(pos.x, pos.y, pos.z, params.power, params.maxIters, params.escape, &lenZ);
+}
+
+// https://iquilezles.org/articles/rmshadows/
+float SoftShadow(float3 hit, float3 lightDir, float mint, float maxt, float k, const FractalOptions& params)
+{
+	// Passing nearby an object but missing will result in a penumbra
+	// Use the closest distance before hit to create a soft shadow
+	float res = 1.0f;
+	float t = 0.0f;
+	for (int i = 0; i < params.maxIters; i++)
+	{
+		// Out of Mandelbulb range, or past the end of the ray
+		if (length(hit + lightDir * t) > 3.0f || t > maxt)
+			break;
+
+		float h = DistToScene(hit + lightDir * t, params);
+		if (h < 0.001f)
+		{
+			// Hit an object, in complete shadow
+			return 0.0f;
+		}
+		res = fminf(res, k * h / t);
+		t += h;
+	}
+	return res;
+}
+
+// Normal estimate which compares distance with respect to dy,dx,dz to get normal
+float3 NormalEstimate(float3 p, const FractalOptions& params)
+{
+	PIXEL_COST_STAGE(NormalEvaluations, NormalIterations);
+
+	// The shader offsets and differences in double, then narrows back to float
+	double EPS = g_normalEpsilon;
+	float xs[6] = { float(p.x + EPS), float(p.x - EPS), p.x, p.x, p.x, p.x };
+	float ys[6] = { p.y, p.y, float(p.y + EPS), float(p.y - EPS), p.y, p.y };
+	float zs[6] = { p.z, p.z, p.z, p.z, float(p.z + EPS), float(p.z - EPS) };
+
+	// All six samples go through the packet kernel as one call
+	float d[6];
+	DistToScenePacket(xs, ys, zs, 6, params, d);
+
+	double xDiff = double(d[0]) - double(d[1]);
+	double yDiff = double(d[2]) - double(d[3]);
+	double zDiff = double(d[4]) - double(d[5]);
+	return normalize(float3{ float(xDiff), float(yDiff), float(zDiff) });
+}
+
+// https://iquilezles.org/articles/normalsSDF/
+// The corners of a tetrahedron sum to zero, so weighting each by its sample cancels the centre
+// value and leaves the gradient from four samples instead of six
+float3 NormalEstimateTetrahedral(float3 p, float epsilon, const FractalOptions& params)
+{
+	PIXEL_COST_STAGE(NormalEvaluations, NormalIterations);
+
+	float xs[4], ys[4], zs[4];
+	for (int i = 0; i < 4; i++)
+	{
+		float3 q = p + g_tetrahedron[i] * epsilon;
+		xs[i] = q.x;
+		ys[i] = q.y;
+		zs[i] = q.z;
+	}
+
+	float d[4];
+	DistToScenePacket(xs, ys, zs, 4, params, d);
+
+	float3 gradient = g_tetrahedron[0] * d[0] + g_tetrahedron[1] * d[1] + g_tetrahedron[2] * d[2] + g_tetrahedron[3] * d[3];
+	return normalize(gradient);
+}
+
+// The DE's own gradient, exact for the estimate rather than a difference of two noisy samples
+float3 NormalEstimateAnalytic(float3 p, const FractalOptions& params)
+{
+	PIXEL_COST_STAGE(NormalEvaluations, NormalIterations);
+	PIXEL_COST_STEP();
+
+	Dual3 x, y, z;
+	Dual3::Seed(p, x, y, z);
+
+	Dual3 d;
+	int n = IntegerPower(params.power);
+	if (n > 0)
+		d = g_integerPowerDual[n - g_minIntegerPower](x, y, z, params.maxIters, Dual3(params.escape), nullptr);
+	else
+		d = Mandelbulb::DistToScenePolar<false>(x, y, z, Dual3(params.power), params.maxIters, Dual3(params.escape), (Dual3*)nullptr);
+
+	return normalize(d.d);
+}
+
+float3 HitNormal(const MarchResult& march, const FrameSetup& setup)
+{
+	switch (g_normalMode)
+	{
+	case NormalMode::Tetrahedral:
+		return NormalEstimateTetrahedral(march.pos, HitNormalEpsilon(march, setup), setup.marchParams);
+	case NormalMode::Analytic:
+		return NormalEstimateAnalytic(march.pos, setup.marchParams);
+	default:
+		return NormalEstimate(march.pos, setup.marchParams);
+	}
+}
+
+float HitNormalEpsilon(const MarchResult& march, const FrameSetup& setup)
+{
+	// Float rounding swamps differences taken much closer than the minimum
+	float epsilon = g_normalFootprint * setup.pixelFootprint * march.totalDistance;
+	return epsilon > g_minNormalEpsilon ? epsilon : g_minNormalEpsilon;
+}
+
+float HitEpsilon(const FrameSetup& setup, float totalDistance)
+{
+	if (!setup.pixelLod)
+		return setup.minDist;
+	return fmaxf(setup.hitFootprint * totalDistance, setup.minHitEpsilon);
+}
+
+// GetQuality in main.hlsl
+void GetQualitySettings(int quality, float& minDist, int& maxIters, float& hitPixels)
+{
+	switch (quality)
+	{
+	case 1:
+		minDist = 0.0005f;
+		maxIters = 128;
+		hitPixels = g_hitPixels[1];
+		break;
+	case 2:
+		minDist = 0.0001f;
+		maxIters = 160;
+		hitPixels = g_hitPixels[2];
+		break;
+	default:
+		minDist = 0.001f;
+		maxIters = 80;
+		hitPixels = g_hitPixels[0];
+		break;
+	}
+}
+
+FrameSetup CreateFrameSetup(const FrameConstants& constants)
+{
+	FrameSetup setup;
+
+	// Fractal parameters
+	setup.params.maxIters = constants.deIterations > 0 ? constants.deIterations : g_deIterations;
+	setup.params.escape = 256.0f;
+
+	if (constants.animated == 1)
+	{
+		// Animate power from 5-9
+		float interval = frac(constants.time * 0.00025f);
+		setup.params.power = 7.0f + (sinf(interval * 6.28f) * 2.0f);
+	}
+	else
+	{
+		setup.params.power = 8.0f;
+	}
+
+	// Quality, an overridden epsilon scales the pixel LOD epsilon by as much
+	float hitPixels;
+	GetQualitySettings(constants.quality, setup.minDist, setup.maxIters, hitPixels);
+	if (constants.hitEpsilon > 0.0f)
+	{
+		hitPixels *= constants.hitEpsilon / setup.minDist;
+		setup.minDist = constants.hitEpsilon;
+	}
+	if (constants.marchIterations > 0)
+		setup.maxIters = constants.marchIterations;
+
+	setup.marchStrategy = GetMarchStrategy(constants.quality);
+
+	setup.colour1 = constants.colour1;
+	setup.colour2 = constants.colour2;
+
+	// Bounds
+	setup.bounded = g_boundingSphere;
+	SetFramePower(setup, setup.params.power);
+
+	// Rays through the middle pixel and the one below it
+	setup.pixelFootprint = 0.0f;
+	if (constants.screenHeight > 0)
+	{
+		float3 centre = CreateCamRay(float2{ 0.0f, 0.0f }, constants.projInverse, constants.viewInverse, constants.camPos).dir;
+		float2 below = { 0.0f, 2.0f / float(constants.screenHeight) };
+		setup.pixelFootprint = length(CreateCamRay(below, constants.projInverse, constants.viewInverse, constants.camPos).dir - centre);
+	}
+
+	// Pixel LOD
+	setup.pixelLod = g_pixelLod;
+	float lines = float(constants.screenHeight > g_hitReferenceLines ? constants.screenHeight : g_hitReferenceLines);
+	setup.hitFootprint = hitPixels * setup.pixelFootprint * float(constants.screenHeight) / lines;
+	setup.minHitEpsilon = g_hitPrecision * fmaxf(length(constants.camPos), setup.boundingRadius);
+	setup.marchParams = setup.params;
+	if (setup.pixelLod)
+	{
+		// No surface is nearer than the fractal's bounding sphere, so no hit needs a finer epsilon
+		float nearest = fmaxf(length(constants.camPos) - FractalBoundingRadius(setup.params.power), 0.0f);
+		float epsilon = fmaxf(setup.hitFootprint * nearest, setup.minHitEpsilon);
+		int iterations = int(ceilf(logf(1.0f / epsilon) / logf(fmaxf(setup.params.power, 2.0f)))) + g_lodIterationMargin;
+		iterations = iterations > g_minLodIterations ? iterations : g_minLodIterations;
+		setup.marchParams.maxIters = iterations < setup.params.maxIters ? iterations : setup.params.maxIters;
+	}
+
+	return setup;
+}
+
+void SetFramePower(FrameSetup& setup, float power)
+{
+	setup.params.power = power;
+	setup.marchParams.power = power;
+	setup.boundingRadius = setup.bounded ? FractalBoundingRadius(power) : g_escapeRadius;
+}
+
+float2 PixelToUV(const FrameConstants& constants, float2 pixel)
+{
+	// Get UV coordinates from pixel centre
+	float2 uv = pixel / float2{ float(constants.screenWidth), float(constants.screenHeight) };
+
+	// Change UV to -1 to 1 range
+	uv = (uv - float2{ 0.5f, 0.5f }) * 2.0f;
+	// Flip V
+	uv.y *= -1;
+
+	return uv;
+}
+
+float3 BackgroundColour(const FrameSetup& setup, float2 uv)
+{
+	// Vignette background
+	return ((setup.colour1 + setup.colour2) / 2.0f / 255.0f) - (float3{ length(uv), length(uv), length(uv) } / 2.0f);
+}
+
+MarchResult MarchRay(Ray ray, const FrameSetup& setup, float startDepth)
+{
+	MarchResult result = {};
+	PIXEL_COST_STAGE(MarchSteps, MarchIterations);
+
+	// Start where the ray enters the bounding sphere, a ray that misses it misses the fractal
+	if (setup.bounded)
+	{
+		float entry, exit;
+		if (!IntersectSphere(ray, setup.boundingRadius, entry, exit) || exit <= startDepth)
+		{
+			result.pos = ray.pos + ray.dir * startDepth;
+			result.totalDistance = startDepth;
+			return result;
+		}
+		startDepth = fmaxf(startDepth, entry);
+	}
+
+	// Skip space already known to be empty. Positions are taken from the camera each step rather
+	// than added up, so rounding does not build up along the ray and neighbouring pixels agree
+	float3 pos = ray.pos + ray.dir * startDepth;
+
+	float totalDistance = startDepth; // Total distance travelled
+	float distFromScene = DistToScene(pos, setup.marchParams); // The distance we can safely move the ray without collision
+
+	// The march strategy decides how far each step goes
+	MarchState state = BeginMarch(setup);
+	bool overshot;
+	float step = NextMarchStep(state, distFromScene, overshot);
+	// Where the last step forward left from, a step back returns towards it
+	float from = totalDistance;
+
+	// Raymarching
+	for (int iter = 0; iter < setup.maxIters; iter++)
+	{
+		if (step > 0.0f)
+			from = totalDistance;
+		totalDistance += step; // Move the ray forward as far as we are sure no collisions occur
+		pos = ray.pos + ray.dir * totalDistance;
+		distFromScene = DistToScene(pos, setup.marchParams); // Update distance to scene
+		result.steps = iter + 1;
+
+		// A step past what the DE allowed goes back before anything else
+		step = NextMarchStep(state, distFromScene, overshot);
+		if (overshot)
+			continue;
+
+		// Out of Mandelbulb range
+		if (length(pos) > setup.boundingRadius)
+			break;
+
+		if (distFromScene < HitEpsilon(setup, totalDistance))
+		{
+			result.hit = true;
+
+			// The surface is between here and where the last step left from
+			if (setup.marchStrategy == MarchStrategy::Refined)
+			{
+				float near = from;
+				for (int i = 0; i < g_refineSteps; i++)
+				{
+					float middle = (near + totalDistance) * 0.5f;
+					float dist = DistToScene(ray.pos + ray.dir * middle, setup.marchParams);
+					result.steps++;
+					if (dist < HitEpsilon(setup, middle))
+						totalDistance = middle;
+					else
+						near = middle;
+				}
+				pos = ray.pos + ray.dir * totalDistance;
+			}
+
+			// Only the hit needs the orbit value, so the steps leave it out of the DE
+			DistToScene(pos, setup.marchParams, result.lenZ);
+			break;
+		}
+	}
+
+	result.pos = pos;
+	result.totalDistance = totalDistance;
+
+	return result;
+}
+
+float3 ShadeHit(const MarchResult& march, const FrameSetup& setup)
+{
+	// Normal estimate
+	return ShadeHit(march, HitNormal(march, setup), setup);
+}
+
+float3 ShadeHit(const MarchResult& march, float3 normal, const FrameSetup& setup)
+{
+	// Shadows
+	float shadows[g_lightCount];
+	for (int i = 0; i < g_lightCount; i++)
+	{
+		PIXEL_COST_SHADOW_STAGE(i);
+		Ray ray;
+		float maxt;
+		shadows[i] = ShadowRay(march, normal, i, setup, ray, maxt)
+			? SoftShadow(ray.pos, ray.dir, setup.minDist, maxt, g_shadowSoftness, setup.params) : 0.0f;
+	}
+
+	return ShadeHit(march, shadows, setup);
+}
+
+float3 ShadeHit(const MarchResult& march, const float* shadows, const FrameSetup& setup)
+{
+	// Hit mandelbulb, shade
+	float3 colour = (setup.colour1 + setup.colour2) / 255.0f / 20.0f; // Ambient
+
+	float3 diffuse = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < g_lightCount; i++)
+		diffuse += shadows[i] * g_lightColours[i];
+
+	colour += saturate(diffuse) * (lerp(setup.colour1, setup.colour2, saturate(march.lenZ / 10.0f)) / 255.0f);
+
+	return colour;
+}
+
+bool ShadowRay(const MarchResult& march, float3 normal, int light, const FrameSetup& setup, Ray& ray, float& maxt)
+{
+	ray.pos = march.pos + g_shadowOffset * normal;
+	ray.dir = normalize(g_lights[light] - march.pos);
+	maxt = g_shadowDistance;
+	if (!setup.bounded)
+		return true;
+
+	// Well behind the surface, it shadows itself
+	if (dot(normal, ray.dir) < g_shadowCullCosine)
+		return false;
+
+	// Nothing past the bounding sphere casts a shadow
+	float entry, exit;
+	maxt = IntersectSphere(ray, setup.boundingRadius, entry, exit) ? exit : 0.0f;
+	return true;
+}
+
+float3 ShadePixel(const FrameConstants& constants, const FrameSetup& setup, float2 pixel)
+{
+	float2 uv = PixelToUV(constants, pixel);
+
+	// Initialize variables and create camera ray
+	Ray ray = CreateCamRay(uv, constants.projInverse, constants.viewInverse, constants.camPos);
+
+	// Default colour
+	float3 colour = BackgroundColour(setup, uv);
+
+	MarchResult march = MarchRay(ray, setup);
+	if (march.hit)
+		colour = ShadeHit(march, setup);
+
+	return saturate(colour); // Clamp to 0-1 range
+}
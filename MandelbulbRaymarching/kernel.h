@@ -0,0 +1,279 @@
+#pragma once
+
+//------------------------------
+//- kernel.h
+//------------------------------
+
+// CPU port of include.hlsli and PSMain in main.hlsl. Keep the two in step when changing either
+
+// Includes
+#include "hlslmath.h"
+
+#include <cfloat>
+
+// Camera ray
+struct Ray
+{
+	float3 pos;
+	float3 dir;
+};
+
+// Fractal options
+struct FractalOptions
+{
+	int maxIters;
+	float escape;
+	float power;
+};
+
+// Portable mirror of SHADER_CONSTANTS_BUFFER, without the cbuffer padding
+struct FrameConstants
+{
+	// Projection view matrix
+	float4x4 projInverse;
+	float4x4 viewInverse;
+	float3 camPos;
+
+	// Screen dimensions
+	int screenWidth;
+	int screenHeight;
+
+	// Animation and quality
+	int animated;
+	int quality;
+
+	// Time since execution start
+	float time;
+
+	// Colours, 0-255 per channel
+	float3 colour1;
+	float3 colour2;
+
+	// Only every pixelStep-th pixel in x and y is marched and fills its block, 0 or 1 for all of them
+	int pixelStep;
+
+	// Dynamic quality overrides of the hit epsilon, march iteration cap and DE iterations, 0 keeps
+	// the quality level's
+	float hitEpsilon;
+	int marchIterations;
+	int deIterations;
+
+	// Camera::m_view and m_proj the inverses came from, for reprojecting into this frame
+	float4x4 view;
+	float4x4 proj;
+};
+
+// How MarchRay moves a ray on from the DE at each position
+enum class MarchStrategy
+{
+	// Sphere tracing, every step as long as the DE, what the shader did
+	Plain,
+	// Steps g_marchRelaxation times the DE until the unbounding spheres of two positions stop
+	// overlapping, then steps back to where Plain would have gone and continues as Plain
+	Relaxed,
+	// Relaxed, with the hit bisected between the last two positions onto the hit epsilon
+	Refined,
+};
+
+// Everything PSMain derives from the constants before marching
+struct FrameSetup
+{
+	FractalOptions params;
+	float minDist;
+	int maxIters;
+	float3 colour1;
+	float3 colour2;
+	// Width of a pixel one unit in front of the camera
+	float pixelFootprint;
+	// Rays are clipped to a sphere of boundingRadius around the origin: primary rays start where
+	// they enter it and shadow rays stop where they leave it, and lights behind the surface cast
+	// none. Unbounded, rays start at the camera and leave at the fixed radius of 2.5
+	bool bounded;
+	float boundingRadius;
+	// Under pixel LOD a ray has hit once the DE is below hitFootprint times the distance it has
+	// come, a share of a pixel's width there, but never below minHitEpsilon, where float spacing
+	// around the camera and the surface makes the DE too noisy to resolve more. Otherwise minDist
+	bool pixelLod;
+	float hitFootprint;
+	float minHitEpsilon;
+	// params with only the DE iterations the finest hit epsilon of the frame needs, what the march
+	// and the hit normals evaluate. Shadows, the brick map and the caches keep params
+	FractalOptions marchParams;
+	MarchStrategy marchStrategy;
+};
+
+// How ShadeHit estimates the surface normal
+enum class NormalMode
+{
+	// Six sample central differences at a fixed epsilon, what the shader does
+	Central,
+	// Four samples on a tetrahedron, the epsilon scaled to the pixel footprint at the hit
+	Tetrahedral,
+	// Gradient of the DE carried through one orbit in dual numbers, no epsilon
+	Analytic,
+};
+
+// Result of marching a single camera ray
+struct MarchResult
+{
+	bool hit;
+	float3 pos;
+	float totalDistance;
+	// Orbit value ShadeHit colours by, only evaluated for hits
+	float lenZ;
+	// DE evaluations, including the ones a strategy stepped back from or refined the hit with
+	int steps;
+	// Steps taken on a brick map's bound rather than the DE, see brickmap.h
+	int cacheSteps;
+};
+
+// What a march strategy keeps of a ray between steps
+struct MarchState
+{
+	float relaxation;
+	// DE at the last position a step left from, and how far that step went
+	float lastDist;
+	float lastStep;
+};
+
+// Offsets NormalMode::Tetrahedral samples at, they sum to zero
+const float3 g_tetrahedron[4] = {
+	{ 1.0f, -1.0f, -1.0f },
+	{ -1.0f, -1.0f, 1.0f },
+	{ -1.0f, 1.0f, -1.0f },
+	{ 1.0f, 1.0f, 1.0f },
+};
+
+// Lights ShadeHit shades with
+const int g_lightCount = 3;
+const float3 g_lights[g_lightCount] = {
+	{ 10.0f, 10.0f, -10.0f },
+	{ -10.0f, 10.0f, -10.0f },
+	{ 0.0f, 0.0f, 10.0f }
+};
+
+// SoftShadow's penumbra factor and how far off the surface ShadeHit starts shadow rays
+const float g_shadowSoftness = 3.0f;
+const float g_shadowOffset = 0.01f;
+// Bounded frames trace no shadow ray to a light further behind the surface than this cosine of the
+// angle between the normal and the light. Fractal normals are rough and the shadow ray starts off
+// the surface, so lights just below the horizon still light much of it
+const float g_shadowCullCosine = -0.5f;
+// SoftShadow's maxt for unbounded frames. The shader used to pass 4 and SoftShadow never read it,
+// so these rays have no end and stop only once they leave the Mandelbulb's range, as they always did
+const float g_shadowDistance = FLT_MAX;
+
+// Radius primary rays leave the fractal at when unbounded
+const float g_escapeRadius = 2.5f;
+
+// Central difference step of NormalEstimate, and the smallest tetrahedral one
+const float g_normalEpsilon = 0.0001f;
+const float g_minNormalEpsilon = 2e-5f;
+// Share of the pixel footprint at a hit the tetrahedral step covers. A step near a whole pixel
+// smooths away the fine self shadowing the shader shows, this keeps the default view at 1280x720
+// close to the shader's fixed step while close-ups get finer steps and distant views coarser ones
+const float g_normalFootprint = 1.0f / 32.0f;
+
+// DE iterations unless FrameConstants::deIterations overrides them
+const int g_deIterations = 25;
+
+// Hit epsilon in pixel widths at the hit for each quality level under pixel LOD. The default view
+// at 1280x720 hits about 2.4 units out where a pixel is 0.0028 across, so these match the fixed
+// minDist there, and surfaces further out or nearer get a coarser or finer epsilon. The epsilon
+// decides how much of the fractal's dust shows rather than converging as it shrinks, so frames of
+// fewer lines than g_hitReferenceLines keep the epsilon a frame of that many would have
+const float g_hitPixels[3] = { 0.4f, 0.2f, 0.04f };
+const int g_hitReferenceLines = 720;
+// Smallest hit epsilon relative to the distance of the camera or surface from the origin,
+// whichever is further. A few float spacings, below that the march stalls on rounding
+const float g_hitPrecision = 4.0f * 1.1920929e-7f;
+// Each DE iteration magnifies the orbit about power times, so resolving an epsilon needs about
+// log(1 / epsilon) / log(power) iterations. Escaping to the DE's accuracy takes this many more,
+// and pixel LOD never runs fewer than g_minLodIterations
+const int g_lodIterationMargin = 8;
+const int g_minLodIterations = 10;
+
+// Over-relaxation of MarchStrategy::Relaxed. Fractal DEs are not strict bounds, so this stays
+// below the 1.6 or so smooth scenes take
+const float g_marchRelaxation = 1.3f;
+// Bisections MarchStrategy::Refined runs on a hit, each halving the interval it lies in
+const int g_refineSteps = 4;
+// Strategy each quality level starts with
+const MarchStrategy g_qualityMarchStrategy[3] = { MarchStrategy::Relaxed, MarchStrategy::Relaxed, MarchStrategy::Refined };
+
+// Integer powers in this range use the trig-free iteration from mandelbulb.h
+const int g_minIntegerPower = 2;
+const int g_maxIntegerPower = 12;
+
+// Switch integer powers between the trig-free iteration and the polar form
+void SetTrigFreePower(bool enabled);
+bool GetTrigFreePower();
+// The power as an integer when the trig-free iteration handles it, otherwise 0
+int IntegerPower(float power);
+
+// Clip rays to the fractal's bounding sphere, on by default like the shader
+void SetBoundingSphere(bool enabled);
+bool GetBoundingSphere();
+// Scale the hit epsilon and DE iterations to each pixel's footprint, on by default like the shader.
+// Off, every hit uses the quality level's fixed minDist and all the DE iterations
+void SetPixelLod(bool enabled);
+bool GetPixelLod();
+// Radius of a sphere around the origin the fractal at power lies inside, with a margin for the
+// hit epsilon. Outside 2^(1 / (power - 1)) every orbit escapes
+float FractalBoundingRadius(float power);
+// Distances along ray to where it enters and leaves the sphere of radius around the origin, false
+// when it misses. entry is negative when the ray starts inside
+bool IntersectSphere(const Ray& ray, float radius, float& entry, float& exit);
+
+// Normal estimate ShadeHit uses, Central by default so the CPU matches the shader
+void SetNormalMode(NormalMode mode);
+NormalMode GetNormalMode();
+const char* NormalModeName(NormalMode mode);
+bool ParseNormalMode(const char* name, NormalMode& mode);
+
+// March strategy of each quality level, g_qualityMarchStrategy by default
+void SetMarchStrategy(int quality, MarchStrategy strategy);
+MarchStrategy GetMarchStrategy(int quality);
+const char* MarchStrategyName(MarchStrategy strategy);
+bool ParseMarchStrategy(const char* name, MarchStrategy& strategy);
+// State of a ray about to take its first step
+MarchState BeginMarch(const FrameSetup& setup);
+// Signed distance to move on from a position where the DE is dist. overshot is set when the
+// step there went past what the DE allows, the step is then back and the hit test must skip the
+// position
+float NextMarchStep(MarchState& state, float dist, bool& overshot);
+
+// Shader functions
+Ray CreateCamRay(float2 uv, const float4x4& projInverse, const float4x4& viewInverse, float3 camPos);
+float DistToScene(float3 pos, const FractalOptions& params);
+float DistToScene(float3 pos, const FractalOptions& params, float& lenZ);
+float SoftShadow(float3 hit, float3 lightDir, float mint, float maxt, float k, const FractalOptions& params);
+float3 NormalEstimate(float3 p, const FractalOptions& params);
+float3 NormalEstimateTetrahedral(float3 p, float epsilon, const FractalOptions& params);
+float3 NormalEstimateAnalytic(float3 p, const FractalOptions& params);
+// Normal at a march hit with the current NormalMode
+float3 HitNormal(const MarchResult& march, const FrameSetup& setup);
+// Tetrahedral step at a hit, scaled to its pixel footprint
+float HitNormalEpsilon(const MarchResult& march, const FrameSetup& setup);
+// DE value below which a ray that has come totalDistance has hit
+float HitEpsilon(const FrameSetup& setup, float totalDistance);
+
+// PSMain broken into stages
+void GetQualitySettings(int quality, float& minDist, int& maxIters, float& hitPixels);
+FrameSetup CreateFrameSetup(const FrameConstants& constants);
+// Change a setup's power along with the bounding radius that depends on it
+void SetFramePower(FrameSetup& setup, float power);
+float2 PixelToUV(const FrameConstants& constants, float2 pixel);
+float3 BackgroundColour(const FrameSetup& setup, float2 uv);
+MarchResult MarchRay(Ray ray, const FrameSetup& setup, float startDepth = 0.0f);
+float3 ShadeHit(const MarchResult& march, const FrameSetup& setup);
+// ShadeHit with the normal already estimated
+float3 ShadeHit(const MarchResult& march, float3 normal, const FrameSetup& setup);
+// ShadeHit with the SoftShadow towards each light already traced
+float3 ShadeHit(const MarchResult& march, const float* shadows, const FrameSetup& setup);
+// Direction, start and maxt of the shadow ray from a hit towards light. False for a light behind
+// the surface of a bounded frame, which is in shadow without tracing
+bool ShadowRay(const MarchResult& march, float3 normal, int light, const FrameSetup& setup, Ray& ray, float& maxt);
+
+// Full PSMain for one pixel centre, returns a saturated colour
+float3 ShadePixel(const FrameConstants& constants, const FrameSetup& setup, float2 pixel);
@@ -0,0 +1,89 @@
+//------------------------------
+//- kernel_avx2.cpp
+//------------------------------
+
+// 8 wide AVX2 + FMA distance estimator. Only called after DetectSimdLevel has checked the CPU
+
+// Includes
+#include "kernel_simd.h"
+
+#include <array>
+#include <immintrin.h>
+#include <utility>
+
+// Everything below is compiled for AVX2, standard headers stay above so none of their
+// inline functions get AVX2 code that could be shared with the rest of the program
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+namespace
+{
+	struct VecF { __m256 v; };
+	struct Mask { __m256 v; };
+
+	const int g_lanes = 8;
+
+	inline VecF Set1(float f) { return { _mm256_set1_ps(f) }; }
+	inline VecF Load(const float* p) { return { _mm256_loadu_ps(p) }; }
+	inline void Store(float* p, VecF a) { _mm256_storeu_ps(p, a.v); }
+
+	inline VecF operator+(VecF a, VecF b) { return { _mm256_add_ps(a.v, b.v) }; }
+	inline VecF operator-(VecF a, VecF b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	inline VecF operator*(VecF a, VecF b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	inline VecF operator/(VecF a, VecF b) { return { _mm256_div_ps(a.v, b.v) }; }
+	inline VecF MulAdd(VecF a, VecF b, VecF c) { return { _mm256_fmadd_ps(a.v, b.v, c.v) }; }
+	inline VecF Sqrt(VecF a) { return { _mm256_sqrt_ps(a.v) }; }
+	inline VecF Abs(VecF a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+	inline VecF Floor(VecF a) { return { _mm256_floor_ps(a.v) }; }
+	inline VecF Min(VecF a, VecF b) { return { _mm256_min_ps(a.v, b.v) }; }
+	inline VecF Max(VecF a, VecF b) { return { _mm256_max_ps(a.v, b.v) }; }
+
+	// Flip the sign of a wherever s is negative
+	inline VecF XorSign(VecF a, VecF s) { return { _mm256_xor_ps(a.v, _mm256_and_ps(s.v, _mm256_set1_ps(-0.0f))) }; }
+
+	inline Mask operator<(VecF a, VecF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Mask operator>(VecF a, VecF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask operator==(VecF a, VecF b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ) }; }
+	inline Mask operator&(Mask a, Mask b) { return { _mm256_and_ps(a.v, b.v) }; }
+	inline Mask operator|(Mask a, Mask b) { return { _mm256_or_ps(a.v, b.v) }; }
+	// a and not b
+	inline Mask AndNot(Mask a, Mask b) { return { _mm256_andnot_ps(b.v, a.v) }; }
+	inline bool Any(Mask m) { return _mm256_movemask_ps(m.v) != 0; }
+
+	// m ? a : b
+	inline VecF Select(Mask m, VecF a, VecF b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+
+	// Split positive normal x into mantissa in [0.5, 1) and exponent
+	inline VecF Frexp(VecF x, VecF& e)
+	{
+		__m256i bits = _mm256_castps_si256(x.v);
+		__m256i exponent = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xFF)), _mm256_set1_epi32(126));
+		e = { _mm256_cvtepi32_ps(exponent) };
+		__m256i mantissa = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x807FFFFF)), _mm256_set1_epi32(0x3F000000));
+		return { _mm256_castsi256_ps(mantissa) };
+	}
+
+	// y * 2^n for integral n in the normal exponent range
+	inline VecF Ldexp(VecF y, VecF n)
+	{
+		__m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23);
+		return { _mm256_mul_ps(y.v, _mm256_castsi256_ps(bits)) };
+	}
+
+#include "kernel_simd.inl"
+}
+
+void DistToScenePacketAVX2(const float* x, const float* y, const float* z, int count, const FractalOptions& params, float* dist, float* lenZ)
+{
+	DistToSceneBlocks(x, y, z, count, params, dist, lenZ);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
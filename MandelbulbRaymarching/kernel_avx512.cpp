@@ -0,0 +1,91 @@
+//------------------------------
+//- kernel_avx512.cpp
+//------------------------------
+
+// 16 wide AVX-512F distance estimator. Only called after DetectSimdLevel has checked the CPU
+
+// Includes
+#include "kernel_simd.h"
+
+#include <array>
+#include <immintrin.h>
+#include <utility>
+
+// See kernel_avx2.cpp for why the target switch comes after the includes
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// GCC's own AVX-512 headers trip this through _mm512_undefined_ps
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace
+{
+	struct VecF { __m512 v; };
+	struct Mask { __mmask16 v; };
+
+	const int g_lanes = 16;
+
+	inline __m512 SignMask() { return _mm512_castsi512_ps(_mm512_set1_epi32(int(0x80000000u))); }
+
+	inline VecF Set1(float f) { return { _mm512_set1_ps(f) }; }
+	inline VecF Load(const float* p) { return { _mm512_loadu_ps(p) }; }
+	inline void Store(float* p, VecF a) { _mm512_storeu_ps(p, a.v); }
+
+	inline VecF operator+(VecF a, VecF b) { return { _mm512_add_ps(a.v, b.v) }; }
+	inline VecF operator-(VecF a, VecF b) { return { _mm512_sub_ps(a.v, b.v) }; }
+	inline VecF operator*(VecF a, VecF b) { return { _mm512_mul_ps(a.v, b.v) }; }
+	inline VecF operator/(VecF a, VecF b) { return { _mm512_div_ps(a.v, b.v) }; }
+	inline VecF MulAdd(VecF a, VecF b, VecF c) { return { _mm512_fmadd_ps(a.v, b.v, c.v) }; }
+	inline VecF Sqrt(VecF a) { return { _mm512_sqrt_ps(a.v) }; }
+	inline VecF Abs(VecF a) { return { _mm512_abs_ps(a.v) }; }
+	inline VecF Floor(VecF a) { return { _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC) }; }
+	inline VecF Min(VecF a, VecF b) { return { _mm512_min_ps(a.v, b.v) }; }
+	inline VecF Max(VecF a, VecF b) { return { _mm512_max_ps(a.v, b.v) }; }
+
+	// Flip the sign of a wherever s is negative, integer ops since float xor needs AVX-512DQ
+	inline VecF XorSign(VecF a, VecF s)
+	{
+		__m512i sign = _mm512_and_si512(_mm512_castps_si512(s.v), _mm512_castps_si512(SignMask()));
+		return { _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.v), sign)) };
+	}
+
+	inline Mask operator<(VecF a, VecF b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Mask operator>(VecF a, VecF b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask operator==(VecF a, VecF b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ) }; }
+	inline Mask operator&(Mask a, Mask b) { return { __mmask16(a.v & b.v) }; }
+	inline Mask operator|(Mask a, Mask b) { return { __mmask16(a.v | b.v) }; }
+	// a and not b
+	inline Mask AndNot(Mask a, Mask b) { return { __mmask16(a.v & ~b.v) }; }
+	inline bool Any(Mask m) { return m.v != 0; }
+
+	// m ? a : b
+	inline VecF Select(Mask m, VecF a, VecF b) { return { _mm512_mask_blend_ps(m.v, b.v, a.v) }; }
+
+	// Split positive normal x into mantissa in [0.5, 1) and exponent
+	inline VecF Frexp(VecF x, VecF& e)
+	{
+		e = { _mm512_add_ps(_mm512_getexp_ps(x.v), _mm512_set1_ps(1.0f)) };
+		return { _mm512_getmant_ps(x.v, _MM_MANT_NORM_p5_1, _MM_MANT_SIGN_src) };
+	}
+
+	// y * 2^n
+	inline VecF Ldexp(VecF y, VecF n) { return { _mm512_scalef_ps(y.v, n.v) }; }
+
+#include "kernel_simd.inl"
+}
+
+void DistToScenePacketAVX512(const float* x, const float* y, const float* z, int count, const FractalOptions& params, float* dist, float* lenZ)
+{
+	DistToSceneBlocks(x, y, z, count, params, dist, lenZ);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
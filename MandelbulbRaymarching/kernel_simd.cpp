@@ -0,0 +1,688 @@
+//------------------------------
+//- kernel_simd.cpp
+//------------------------------
+
+// Includes
+#include "kernel_simd.h"
+#include "brickmap.h"
+
+#include <cstring>
+#include <initializer_list>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// Rays MarchRays keeps in flight
+static const int g_marchBatch = 64;
+// Hits MarchRays gathers before evaluating their orbit values together
+static const int g_orbitBatch = 2 * g_marchBatch;
+// Brick map steps allowed per ray on top of setup.maxIters DE steps
+static const int g_maxCacheSteps = 256;
+// Hits whose normal samples go to DistToScenePacket together, 96 central or 64 tetrahedral samples
+static const int g_normalBatch = 16;
+// Shadow rays TraceShadows keeps in flight
+static const int g_shadowBatch = 64;
+
+static bool CpuSupports(SimdLevel level)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	if (!osxsave)
+		return false;
+
+	// The OS must save the wider registers on context switches
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	if (level == SimdLevel::AVX2)
+		return fma && (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+	if (level == SimdLevel::AVX512)
+		return (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+	return true;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (level == SimdLevel::AVX2)
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	if (level == SimdLevel::AVX512)
+		return __builtin_cpu_supports("avx512f");
+	return true;
+#else
+	return level == SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel DetectSimdLevel()
+{
+	if (CpuSupports(SimdLevel::AVX512))
+		return SimdLevel::AVX512;
+	if (CpuSupports(SimdLevel::AVX2))
+		return SimdLevel::AVX2;
+	return SimdLevel::Scalar;
+}
+
+static SimdLevel g_level = DetectSimdLevel();
+
+SimdLevel GetSimdLevel()
+{
+	return g_level;
+}
+
+SimdLevel SetSimdLevel(SimdLevel level)
+{
+	while (level != SimdLevel::Scalar && !CpuSupports(level))
+	{
+		level = SimdLevel(int(level) - 1);
+	}
+	g_level = level;
+	return g_level;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return "avx2";
+	case SimdLevel::AVX512:
+		return "avx512";
+	default:
+		return "scalar";
+	}
+}
+
+bool ParseSimdLevel(const char* name, SimdLevel& level)
+{
+	for (SimdLevel l : { SimdLevel::Scalar, SimdLevel::AVX2, SimdLevel::AVX512 })
+	{
+		if (strcmp(name, SimdLevelName(l)) == 0)
+		{
+			level = l;
+			return true;
+		}
+	}
+	return false;
+}
+
+int SimdWidth(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return 8;
+	case SimdLevel::AVX512:
+		return 16;
+	default:
+		return 1;
+	}
+}
+
+void DistToScenePacket(const float* x, const float* y, const float* z, int count, const FractalOptions& params, float* dist, float* lenZ)
+{
+	SimdLevel level = g_level;
+#if defined(MANDELBULB_PIXEL_COST)
+	// Only the scalar DE counts its orbit iterations
+	level = SimdLevel::Scalar;
+#endif
+	if (level == SimdLevel::Scalar)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			float3 p = { x[i], y[i], z[i] };
+			dist[i] = lenZ ? DistToScene(p, params, lenZ[i]) : DistToScene(p, params);
+		}
+		return;
+	}
+
+	auto kernel = level == SimdLevel::AVX512 ? DistToScenePacketAVX512 : DistToScenePacketAVX2;
+	int width = SimdWidth(level);
+
+	// Whole vectors straight from the caller's arrays
+	int whole = count - count % width;
+	if (whole > 0)
+		kernel(x, y, z, whole, params, dist, lenZ);
+
+	// Pad the tail by repeating the last point
+	int tail = count - whole;
+	if (tail > 0)
+	{
+		float tx[16], ty[16], tz[16], td[16], tl[16];
+		for (int i = 0; i < width; i++)
+		{
+			int src = whole + (i < tail ? i : tail - 1);
+			tx[i] = x[src];
+			ty[i] = y[src];
+			tz[i] = z[src];
+		}
+		kernel(tx, ty, tz, width, params, td, lenZ ? tl : nullptr);
+		for (int i = 0; i < tail; i++)
+		{
+			dist[whole + i] = td[i];
+			if (lenZ)
+				lenZ[whole + i] = tl[i];
+		}
+	}
+}
+
+namespace
+{
+	// What an in-flight ray of MarchRays is doing
+	enum class MarchLaneMode : uint8_t
+	{
+		// Waiting for the DE at its starting point
+		Starting,
+		Marching,
+		// Bisecting its hit, see MarchStrategy::Refined
+		Refining,
+	};
+
+	// Rays MarchRays has in flight, one array per field so each step runs down contiguous memory.
+	// Finished rays are compacted out after every step and the free lanes refilled from the queue
+	struct MarchLanes
+	{
+		int ray[g_marchBatch];
+		MarchLaneMode mode[g_marchBatch];
+		float ox[g_marchBatch], oy[g_marchBatch], oz[g_marchBatch];
+		float dx[g_marchBatch], dy[g_marchBatch], dz[g_marchBatch];
+		// Distance along the ray, the last DE or bound there, and the strategy's next step
+		float t[g_marchBatch];
+		float dist[g_marchBatch];
+		float step[g_marchBatch];
+		// Where the last step forward left from, and the point being bisected while refining
+		float from[g_marchBatch];
+		float middle[g_marchBatch];
+		int steps[g_marchBatch];
+		int cacheSteps[g_marchBatch];
+		int refineLeft[g_marchBatch];
+		MarchState state[g_marchBatch];
+
+		float3 Position(int lane) const
+		{
+			return { ox[lane] + dx[lane] * t[lane], oy[lane] + dy[lane] * t[lane], oz[lane] + dz[lane] * t[lane] };
+		}
+
+		void Move(int to, int from)
+		{
+			ray[to] = ray[from];
+			mode[to] = mode[from];
+			ox[to] = ox[from];
+			oy[to] = oy[from];
+			oz[to] = oz[from];
+			dx[to] = dx[from];
+			dy[to] = dy[from];
+			dz[to] = dz[from];
+			t[to] = t[from];
+			dist[to] = dist[from];
+			step[to] = step[from];
+			this->from[to] = this->from[from];
+			middle[to] = middle[from];
+			steps[to] = steps[from];
+			cacheSteps[to] = cacheSteps[from];
+			refineLeft[to] = refineLeft[from];
+			state[to] = state[from];
+		}
+
+		void Retire(int lane, bool hit, MarchResult* results) const
+		{
+			MarchResult& result = results[ray[lane]];
+			result.hit = hit;
+			result.pos = Position(lane);
+			result.totalDistance = t[lane];
+			result.steps = steps[lane];
+			result.cacheSteps = cacheSteps[lane];
+		}
+	};
+
+	// Hits waiting for lenZ, the orbit value ShadeHit colours by. The march steps run the DE
+	// without it, and the hits get theirs from one packet rather than on every step
+	struct OrbitQueue
+	{
+		int ray[g_orbitBatch];
+		float x[g_orbitBatch], y[g_orbitBatch], z[g_orbitBatch];
+		int count = 0;
+
+		void Push(int r, float3 p)
+		{
+			ray[count] = r;
+			x[count] = p.x;
+			y[count] = p.y;
+			z[count] = p.z;
+			count++;
+		}
+
+		void Flush(const FrameSetup& setup, MarchResult* results)
+		{
+			float dist[g_orbitBatch], lenZ[g_orbitBatch];
+			DistToScenePacket(x, y, z, count, setup.marchParams, dist, lenZ);
+			for (int k = 0; k < count; k++)
+				results[ray[k]].lenZ = lenZ[k];
+			count = 0;
+		}
+	};
+}
+
+void MarchRays(const Ray* rays, int count, const FrameSetup& setup, MarchResult* results, const float* startDepth, const BrickMap* bricks)
+{
+	MarchLanes lanes;
+	bool retired[g_marchBatch];
+	int packed[g_marchBatch];
+	float px[g_marchBatch], py[g_marchBatch], pz[g_marchBatch], pd[g_marchBatch];
+	int laneCount = 0;
+	int next = 0;
+	// A step retires at most g_marchBatch more hits
+	OrbitQueue hits;
+
+	for (;;)
+	{
+		// Refill the free lanes from the queue
+		for (; laneCount < g_marchBatch && next < count; next++)
+		{
+			int i = next;
+			const Ray& ray = rays[i];
+			float start = startDepth ? startDepth[i] : 0.0f;
+
+			// Start where the ray enters the bounding sphere, a ray that misses it is done
+			float entry, exit;
+			bool clipped = setup.bounded && (!IntersectSphere(ray, setup.boundingRadius, entry, exit) || exit <= start);
+			if (setup.bounded && !clipped && entry > start)
+				start = entry;
+
+			results[i] = {};
+			results[i].pos = ray.pos + ray.dir * start;
+			results[i].totalDistance = start;
+			if (clipped || setup.maxIters <= 0)
+				continue;
+
+			int l = laneCount++;
+			lanes.ray[l] = i;
+			lanes.mode[l] = MarchLaneMode::Starting;
+			lanes.ox[l] = ray.pos.x;
+			lanes.oy[l] = ray.pos.y;
+			lanes.oz[l] = ray.pos.z;
+			lanes.dx[l] = ray.dir.x;
+			lanes.dy[l] = ray.dir.y;
+			lanes.dz[l] = ray.dir.z;
+			lanes.t[l] = start;
+			lanes.dist[l] = 0.0f;
+			lanes.from[l] = start;
+			lanes.steps[l] = 0;
+			lanes.cacheSteps[l] = 0;
+			lanes.state[l] = BeginMarch(setup);
+		}
+		if (laneCount == 0)
+			break;
+		if (hits.count > g_orbitBatch - g_marchBatch)
+			hits.Flush(setup, results);
+
+		// Move every ray on by its strategy's step, taking the bound where it is good enough, and
+		// pack the points that need the DE
+		int packedCount = 0;
+		for (int l = 0; l < laneCount; l++)
+		{
+			retired[l] = false;
+			if (lanes.mode[l] == MarchLaneMode::Starting && bricks)
+			{
+				// Far enough out to start on the bound without the DE
+				lanes.dist[l] = bricks->Bound(lanes.Position(l));
+				if (lanes.dist[l] >= bricks->GetExactDistance())
+				{
+					lanes.step[l] = lanes.dist[l];
+					lanes.mode[l] = MarchLaneMode::Marching;
+				}
+			}
+
+			if (lanes.mode[l] == MarchLaneMode::Marching)
+			{
+				if (lanes.step[l] > 0.0f)
+					lanes.from[l] = lanes.t[l];
+				lanes.t[l] += lanes.step[l];
+
+				// Keep stepping on the bound while it is good enough, so every packet is full of rays
+				// that need the DE. After a DE step of d the DE is at most 2d, so on the final approach
+				// the bound is known to be too small without looking it up
+				bool nearSurface = bricks && lanes.steps[l] > 0 && 2.0f * lanes.dist[l] < bricks->GetExactDistance();
+				while (bricks && !nearSurface)
+				{
+					float3 p = lanes.Position(l);
+					lanes.dist[l] = bricks->Bound(p);
+					if (lanes.dist[l] < bricks->GetExactDistance())
+						break;
+
+					// The bound is below the DE, so when it shows the last step's spheres overlapping so
+					// would the DE. Otherwise the DE decides whether the step overshot
+					if (lanes.dist[l] + lanes.state[l].lastDist < lanes.state[l].lastStep)
+						break;
+
+					// Out of Mandelbulb range, or too many cheap steps along a grazing ray
+					if (length(p) > setup.boundingRadius || ++lanes.cacheSteps[l] >= g_maxCacheSteps)
+					{
+						retired[l] = true;
+						break;
+					}
+					lanes.from[l] = lanes.t[l];
+					lanes.t[l] += lanes.dist[l];
+					lanes.state[l].lastStep = 0.0f;
+				}
+				if (retired[l])
+				{
+					lanes.Retire(l, false, results);
+					continue;
+				}
+			}
+
+			float3 p = lanes.Position(l);
+			if (lanes.mode[l] == MarchLaneMode::Refining)
+			{
+				lanes.middle[l] = (lanes.from[l] + lanes.t[l]) * 0.5f;
+				p = float3{ lanes.ox[l], lanes.oy[l], lanes.oz[l] } + float3{ lanes.dx[l], lanes.dy[l], lanes.dz[l] } * lanes.middle[l];
+			}
+			px[packedCount] = p.x;
+			py[packedCount] = p.y;
+			pz[packedCount] = p.z;
+			packed[packedCount++] = l;
+		}
+
+		DistToScenePacket(px, py, pz, packedCount, setup.marchParams, pd);
+
+		// Retire rays that left the Mandelbulb range, hit it or ran out of steps
+		for (int k = 0; k < packedCount; k++)
+		{
+			int l = packed[k];
+			bool overshot;
+			switch (lanes.mode[l])
+			{
+			case MarchLaneMode::Starting:
+				// The DE at the start sets the first step, it counts as no step of its own
+				lanes.dist[l] = pd[k];
+				lanes.step[l] = NextMarchStep(lanes.state[l], pd[k], overshot);
+				lanes.mode[l] = MarchLaneMode::Marching;
+				break;
+
+			case MarchLaneMode::Marching:
+				lanes.dist[l] = pd[k];
+				lanes.steps[l]++;
+
+				// A step past what the DE allowed goes back before anything else
+				lanes.step[l] = NextMarchStep(lanes.state[l], pd[k], overshot);
+				if (!overshot)
+				{
+					if (length(lanes.Position(l)) > setup.boundingRadius)
+					{
+						retired[l] = true;
+						lanes.Retire(l, false, results);
+						break;
+					}
+
+					if (pd[k] < HitEpsilon(setup, lanes.t[l]))
+					{
+						// The surface is between here and where the last step left from
+						if (setup.marchStrategy == MarchStrategy::Refined)
+						{
+							lanes.mode[l] = MarchLaneMode::Refining;
+							lanes.refineLeft[l] = g_refineSteps;
+							break;
+						}
+						retired[l] = true;
+						lanes.Retire(l, true, results);
+						hits.Push(lanes.ray[l], lanes.Position(l));
+						break;
+					}
+				}
+
+				if (lanes.steps[l] >= setup.maxIters)
+				{
+					retired[l] = true;
+					lanes.Retire(l, false, results);
+				}
+				break;
+
+			case MarchLaneMode::Refining:
+				lanes.steps[l]++;
+				if (pd[k] < HitEpsilon(setup, lanes.middle[l]))
+					lanes.t[l] = lanes.middle[l];
+				else
+					lanes.from[l] = lanes.middle[l];
+
+				if (--lanes.refineLeft[l] == 0)
+				{
+					retired[l] = true;
+					lanes.Retire(l, true, results);
+					hits.Push(lanes.ray[l], lanes.Position(l));
+				}
+				break;
+			}
+		}
+
+		// Compact the rays still in flight to the front
+		int kept = 0;
+		for (int l = 0; l < laneCount; l++)
+		{
+			if (retired[l])
+				continue;
+			if (kept != l)
+				lanes.Move(kept, l);
+			kept++;
+		}
+		laneCount = kept;
+	}
+
+	if (hits.count > 0)
+		hits.Flush(setup, results);
+}
+
+void HitNormals(const MarchResult* results, int count, const FrameSetup& setup, float3* normals)
+{
+	NormalMode mode = GetNormalMode();
+	if (mode == NormalMode::Analytic)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (results[i].hit)
+				normals[i] = NormalEstimateAnalytic(results[i].pos, setup.marchParams);
+		}
+		return;
+	}
+
+	const int taps = mode == NormalMode::Central ? 6 : 4;
+	int hits[g_normalBatch];
+	float xs[g_normalBatch * 6], ys[g_normalBatch * 6], zs[g_normalBatch * 6], d[g_normalBatch * 6];
+
+	int i = 0;
+	while (i < count)
+	{
+		// Gather the samples of the next batch of hits
+		int hitCount = 0;
+		for (; i < count && hitCount < g_normalBatch; i++)
+		{
+			if (!results[i].hit)
+				continue;
+
+			float3 p = results[i].pos;
+			float* x = xs + hitCount * taps;
+			float* y = ys + hitCount * taps;
+			float* z = zs + hitCount * taps;
+			if (mode == NormalMode::Central)
+			{
+				// Same samples as NormalEstimate, so the normals match it exactly
+				double eps = g_normalEpsilon;
+				float px[6] = { float(p.x + eps), float(p.x - eps), p.x, p.x, p.x, p.x };
+				float py[6] = { p.y, p.y, float(p.y + eps), float(p.y - eps), p.y, p.y };
+				float pz[6] = { p.z, p.z, p.z, p.z, float(p.z + eps), float(p.z - eps) };
+				memcpy(x, px, sizeof(px));
+				memcpy(y, py, sizeof(py));
+				memcpy(z, pz, sizeof(pz));
+			}
+			else
+			{
+				float epsilon = HitNormalEpsilon(results[i], setup);
+				for (int t = 0; t < 4; t++)
+				{
+					float3 q = p + g_tetrahedron[t] * epsilon;
+					x[t] = q.x;
+					y[t] = q.y;
+					z[t] = q.z;
+				}
+			}
+			hits[hitCount++] = i;
+		}
+
+		DistToScenePacket(xs, ys, zs, hitCount * taps, setup.marchParams, d);
+
+		for (int h = 0; h < hitCount; h++)
+		{
+			const float* s = d + h * taps;
+			if (mode == NormalMode::Central)
+			{
+				double xDiff = double(s[0]) - double(s[1]);
+				double yDiff = double(s[2]) - double(s[3]);
+				double zDiff = double(s[4]) - double(s[5]);
+				normals[hits[h]] = normalize(float3{ float(xDiff), float(yDiff), float(zDiff) });
+			}
+			else
+			{
+				normals[hits[h]] = normalize(g_tetrahedron[0] * s[0] + g_tetrahedron[1] * s[1] + g_tetrahedron[2] * s[2] + g_tetrahedron[3] * s[3]);
+			}
+		}
+	}
+}
+
+void TraceShadows(const MarchResult* results, const float3* normals, int count, const FrameSetup& setup, float* shadows, ShadowStats* stats)
+{
+	// One shadow ray per hit and light, traced like SoftShadow. Rays in flight are kept one array
+	// per field, and after every step the finished ones are compacted out and the free lanes
+	// refilled from the hits not yet started
+	float ox[g_shadowBatch], oy[g_shadowBatch], oz[g_shadowBatch];
+	float dx[g_shadowBatch], dy[g_shadowBatch], dz[g_shadowBatch];
+	float maxt[g_shadowBatch], t[g_shadowBatch], res[g_shadowBatch];
+	int steps[g_shadowBatch], slot[g_shadowBatch], packed[g_shadowBatch];
+	bool done[g_shadowBatch];
+	float px[g_shadowBatch], py[g_shadowBatch], pz[g_shadowBatch], pd[g_shadowBatch];
+	ShadowStats totals;
+
+	int laneCount = 0;
+	int i = 0;
+	int light = 0;
+	for (;;)
+	{
+		// Start the next rays, lights behind the surface need none
+		for (; i < count && laneCount < g_shadowBatch; light = 0, i++)
+		{
+			if (!results[i].hit)
+				continue;
+
+			for (; light < g_lightCount && laneCount < g_shadowBatch; light++)
+			{
+				int s = i * g_lightCount + light;
+				shadows[s] = 0.0f;
+				Ray ray;
+				float rayMaxt;
+				if (!ShadowRay(results[i], normals[i], light, setup, ray, rayMaxt))
+				{
+					totals.culled++;
+					continue;
+				}
+				totals.rays++;
+
+				// Nothing to step with
+				if (setup.params.maxIters <= 0)
+				{
+					shadows[s] = 1.0f;
+					continue;
+				}
+
+				int l = laneCount++;
+				ox[l] = ray.pos.x;
+				oy[l] = ray.pos.y;
+				oz[l] = ray.pos.z;
+				dx[l] = ray.dir.x;
+				dy[l] = ray.dir.y;
+				dz[l] = ray.dir.z;
+				maxt[l] = rayMaxt;
+				t[l] = 0.0f;
+				res[l] = 1.0f;
+				steps[l] = 0;
+				slot[l] = s;
+			}
+			if (light < g_lightCount)
+				break;
+		}
+		if (laneCount == 0)
+			break;
+
+		// Rays out of Mandelbulb range or past their end keep what they have
+		int packedCount = 0;
+		for (int l = 0; l < laneCount; l++)
+		{
+			float3 p = { ox[l] + dx[l] * t[l], oy[l] + dy[l] * t[l], oz[l] + dz[l] * t[l] };
+			done[l] = length(p) > 3.0f || t[l] > maxt[l];
+			if (done[l])
+			{
+				shadows[slot[l]] = res[l];
+				continue;
+			}
+			px[packedCount] = p.x;
+			py[packedCount] = p.y;
+			pz[packedCount] = p.z;
+			packed[packedCount++] = l;
+		}
+
+		DistToScenePacket(px, py, pz, packedCount, setup.params, pd);
+		totals.steps += packedCount;
+
+		for (int k = 0; k < packedCount; k++)
+		{
+			int l = packed[k];
+			float h = pd[k];
+			if (h < 0.001f)
+			{
+				// Hit an object, in complete shadow
+				shadows[slot[l]] = 0.0f;
+				done[l] = true;
+				continue;
+			}
+			res[l] = fminf(res[l], g_shadowSoftness * h / t[l]);
+			t[l] += h;
+
+			if (++steps[l] >= setup.params.maxIters)
+			{
+				shadows[slot[l]] = res[l];
+				done[l] = true;
+			}
+		}
+
+		// Compact the rays still in flight to the front
+		int kept = 0;
+		for (int l = 0; l < laneCount; l++)
+		{
+			if (done[l])
+				continue;
+			ox[kept] = ox[l];
+			oy[kept] = oy[l];
+			oz[kept] = oz[l];
+			dx[kept] = dx[l];
+			dy[kept] = dy[l];
+			dz[kept] = dz[l];
+			maxt[kept] = maxt[l];
+			t[kept] = t[l];
+			res[kept] = res[l];
+			steps[kept] = steps[l];
+			slot[kept] = slot[l];
+			kept++;
+		}
+		laneCount = kept;
+	}
+
+	if (stats)
+	{
+		stats->rays += totals.rays;
+		stats->culled += totals.culled;
+		stats->steps += totals.steps;
+	}
+}
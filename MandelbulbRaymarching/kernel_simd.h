@@ -0,0 +1,68 @@
+#pragma once
+
+//------------------------------
+//- kernel_simd.h
+//------------------------------
+
+// Packet versions of the distance estimator, evaluating 8 (AVX2) or 16 (AVX-512) points
+// per call with polynomial approximations of the transcendentals. The widest level the CPU
+// supports is picked at runtime, scalar falls back to the reference DistToScene
+
+// Includes
+#include "kernel.h"
+
+enum class SimdLevel
+{
+	Scalar,
+	AVX2,
+	AVX512
+};
+
+// Widest level supported by this CPU and OS
+SimdLevel DetectSimdLevel();
+// Level used by the packet functions, defaults to the detected level
+SimdLevel GetSimdLevel();
+// Force a level, anything wider than the CPU supports is clamped. Returns the level in use
+SimdLevel SetSimdLevel(SimdLevel level);
+
+const char* SimdLevelName(SimdLevel level);
+bool ParseSimdLevel(const char* name, SimdLevel& level);
+// Points per vector at a level
+int SimdWidth(SimdLevel level);
+
+// Evaluate DistToScene at count points given as separate x, y and z arrays. When lenZ is
+// not null it also receives the orbit value of the lenZ overload
+void DistToScenePacket(const float* x, const float* y, const float* z, int count, const FractalOptions& params, float* dist, float* lenZ = nullptr);
+
+class BrickMap;
+
+// Same as MarchRay for a stream of rays. A window of rays is stepped together so each step is one
+// packet call, finished rays are compacted out after every step and their lanes refilled from the
+// rest of the stream. startDepth optionally gives a distance along each ray that is known to be
+// empty, and bricks a distance field cache built for setup.params to step on away from the surface.
+// The steps run the DE without lenZ, the hits get theirs from one packet at the end
+void MarchRays(const Ray* rays, int count, const FrameSetup& setup, MarchResult* results, const float* startDepth = nullptr, const BrickMap* bricks = nullptr);
+
+// HitNormal for every result that hit, misses are left alone. The difference modes pack the
+// samples of many hits into each packet rather than one hit's few samples into a whole vector
+void HitNormals(const MarchResult* results, int count, const FrameSetup& setup, float3* normals);
+
+// Work done by TraceShadows
+struct ShadowStats
+{
+	// Shadow rays traced, and lights behind the surface that needed none
+	long long rays = 0;
+	long long culled = 0;
+	// DE evaluations along the rays
+	long long steps = 0;
+};
+
+// SoftShadow towards every light from each result that hit, as ShadeHit traces them, with the
+// rays of many hits stepped together through the packet kernel and refilled as they finish, like
+// MarchRays. shadows gets g_lightCount factors per result for ShadeHit, misses are left alone.
+// Adds the work done to stats when not null
+void TraceShadows(const MarchResult* results, const float3* normals, int count, const FrameSetup& setup, float* shadows, ShadowStats* stats = nullptr);
+
+// Kernels for each instruction set, count must be a multiple of the vector width
+void DistToScenePacketAVX2(const float* x, const float* y, const float* z, int count, const FractalOptions& params, float* dist, float* lenZ);
+void DistToScenePacketAVX512(const float* x, const float* y, const float* z, int count, const FractalOptions& params, float* dist, float* lenZ);
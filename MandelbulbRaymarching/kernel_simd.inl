@@ -0,0 +1,331 @@
+//------------------------------
+//- kernel_simd.inl
+//------------------------------
+
+// Instruction set independent part of the packet kernels. Included by kernel_avx2.cpp and
+// kernel_avx512.cpp after they define VecF, Mask, g_lanes and the primitives below:
+// Set1, Load, Store, arithmetic and comparison operators, MulAdd, Sqrt, Abs, Floor,
+// Select, Any, AndNot, XorSign, Frexp and Ldexp. Polynomials are the Cephes single precision ones
+
+// Natural log for x > 0
+static inline VecF Log(VecF x)
+{
+	// x = m * 2^e with m in [sqrt(0.5), sqrt(2))
+	VecF e;
+	VecF m = Frexp(x, e);
+	Mask small = m < Set1(0.707106781186547524f);
+	e = Select(small, e - Set1(1.0f), e);
+	VecF f = Select(small, m + m, m) - Set1(1.0f);
+
+	VecF z = f * f;
+	VecF y = Set1(7.0376836292E-2f);
+	y = MulAdd(y, f, Set1(-1.1514610310E-1f));
+	y = MulAdd(y, f, Set1(1.1676998740E-1f));
+	y = MulAdd(y, f, Set1(-1.2420140846E-1f));
+	y = MulAdd(y, f, Set1(1.4249322787E-1f));
+	y = MulAdd(y, f, Set1(-1.6668057665E-1f));
+	y = MulAdd(y, f, Set1(2.0000714765E-1f));
+	y = MulAdd(y, f, Set1(-2.4999993993E-1f));
+	y = MulAdd(y, f, Set1(3.3333331174E-1f));
+	y = y * f * z;
+
+	y = MulAdd(e, Set1(-2.12194440e-4f), y);
+	y = MulAdd(z, Set1(-0.5f), y);
+	return MulAdd(e, Set1(0.693359375f), f + y);
+}
+
+// e^x, inputs are clamped to the normal float range
+static inline VecF Exp(VecF x)
+{
+	x = Min(Max(x, Set1(-87.0f)), Set1(88.0f));
+
+	// x = n ln2 + f with |f| <= ln2 / 2
+	VecF n = Floor(MulAdd(x, Set1(1.44269504088896341f), Set1(0.5f)));
+	x = MulAdd(n, Set1(-0.693359375f), x);
+	x = MulAdd(n, Set1(2.12194440e-4f), x);
+
+	VecF z = x * x;
+	VecF y = Set1(1.9875691500E-4f);
+	y = MulAdd(y, x, Set1(1.3981999507E-3f));
+	y = MulAdd(y, x, Set1(8.3334519073E-3f));
+	y = MulAdd(y, x, Set1(4.1665795894E-2f));
+	y = MulAdd(y, x, Set1(1.6666665459E-1f));
+	y = MulAdd(y, x, Set1(5.0000001201E-1f));
+	y = MulAdd(y, z, x + Set1(1.0f));
+	return Ldexp(y, n);
+}
+
+// asin on [-0.5, 0.5]
+static inline VecF AsinSmall(VecF x)
+{
+	VecF z = x * x;
+	VecF p = Set1(4.2163199048E-2f);
+	p = MulAdd(p, z, Set1(2.4181311049E-2f));
+	p = MulAdd(p, z, Set1(4.5470025998E-2f));
+	p = MulAdd(p, z, Set1(7.4953002686E-2f));
+	p = MulAdd(p, z, Set1(1.6666752422E-1f));
+	return MulAdd(x * z, p, x);
+}
+
+// acos on [-1, 1]
+static inline VecF Acos(VecF x)
+{
+	const VecF halfPi = Set1(1.57079632679489661923f);
+	const VecF pi = Set1(3.14159265358979323846f);
+
+	VecF a = Abs(x);
+	Mask large = a > Set1(0.5f);
+
+	// Near +-1 use acos(a) = 2 asin(sqrt((1 - a) / 2))
+	VecF s = Sqrt((Set1(1.0f) - a) * Set1(0.5f));
+	VecF t = AsinSmall(Select(large, s, x));
+
+	VecF nearOne = t + t;
+	nearOne = Select(x < Set1(0.0f), pi - nearOne, nearOne);
+	return Select(large, nearOne, halfPi - t);
+}
+
+// atan2 with the same quadrant and signed zero behaviour as atan2f
+static inline VecF Atan2(VecF y, VecF x)
+{
+	const VecF quarterPi = Set1(0.785398163397448309616f);
+	const VecF halfPi = Set1(1.57079632679489661923f);
+	const VecF pi = Set1(3.14159265358979323846f);
+
+	VecF ax = Abs(x);
+	VecF ay = Abs(y);
+	VecF hi = Max(ax, ay);
+	VecF lo = Min(ax, ay);
+	VecF q = Select(hi > Set1(0.0f), lo / hi, Set1(0.0f));
+
+	// Reduce to [0, tan(pi/8)]
+	Mask reduce = q > Set1(0.414213562373095f);
+	VecF z = Select(reduce, (q - Set1(1.0f)) / (q + Set1(1.0f)), q);
+
+	VecF z2 = z * z;
+	VecF p = Set1(8.05374449538e-2f);
+	p = MulAdd(p, z2, Set1(-1.38776856032E-1f));
+	p = MulAdd(p, z2, Set1(1.99777106478E-1f));
+	p = MulAdd(p, z2, Set1(-3.33329491539E-1f));
+	VecF r = MulAdd(p * z2, z, z);
+	r = Select(reduce, r + quarterPi, r);
+
+	// Undo the octant folding
+	r = Select(ay > ax, halfPi - r, r);
+	Mask negativeZero = (x == Set1(0.0f)) & (XorSign(Set1(1.0f), x) < Set1(0.0f));
+	r = Select((x < Set1(0.0f)) | negativeZero, pi - r, r);
+	return XorSign(r, y);
+}
+
+// Sine and cosine together, accurate for the |x| < 100 range the iteration produces
+static inline void SinCos(VecF x, VecF& s, VecF& c)
+{
+	const VecF fourOverPi = Set1(1.27323954473516f);
+
+	VecF ax = Abs(x);
+
+	// Octant index j, rounded up to even
+	VecF j = Floor(ax * fourOverPi);
+	j = j + Set1(1.0f);
+	j = Floor(j * Set1(0.5f)) * Set1(2.0f);
+
+	// Extended precision reduction
+	VecF r = MulAdd(j, Set1(-0.78515625f), ax);
+	r = MulAdd(j, Set1(-2.4187564849853515625e-4f), r);
+	r = MulAdd(j, Set1(-3.77489497744594108e-8f), r);
+
+	// Bits 2 and 4 of j choose polynomial and sign
+	VecF half = j * Set1(0.5f);
+	VecF bit2 = half - Floor(half * Set1(0.5f)) * Set1(2.0f);
+	VecF quarter = Floor(j * Set1(0.25f));
+	VecF bit4 = quarter - Floor(quarter * Set1(0.5f)) * Set1(2.0f);
+	VecF jm2 = Floor((j - Set1(2.0f)) * Set1(0.25f));
+	VecF cosBit4 = jm2 - Floor(jm2 * Set1(0.5f)) * Set1(2.0f);
+
+	VecF z = r * r;
+	VecF cp = Set1(2.443315711809948E-005f);
+	cp = MulAdd(cp, z, Set1(-1.388731625493765E-003f));
+	cp = MulAdd(cp, z, Set1(4.166664568298827E-002f));
+	VecF cosPoly = MulAdd(z * z, cp, MulAdd(z, Set1(-0.5f), Set1(1.0f)));
+
+	VecF sp = Set1(-1.9515295891E-4f);
+	sp = MulAdd(sp, z, Set1(8.3321608736E-3f));
+	sp = MulAdd(sp, z, Set1(-1.6666654611E-1f));
+	VecF sinPoly = MulAdd(sp * z, r, r);
+
+	Mask swap = bit2 > Set1(0.5f);
+	s = Select(swap, cosPoly, sinPoly);
+	c = Select(swap, sinPoly, cosPoly);
+
+	// Sine is odd, so it also takes the sign of x
+	s = XorSign(s, Select(bit4 > Set1(0.5f), Set1(-1.0f), Set1(1.0f)));
+	s = XorSign(s, x);
+	c = XorSign(c, Select(cosBit4 > Set1(0.5f), Set1(1.0f), Set1(-1.0f)));
+}
+
+// x^N by squaring
+template <int N>
+static inline VecF IntPowLanes(VecF x)
+{
+	if constexpr (N == 0)
+	{
+		return Set1(1.0f);
+	}
+	else if constexpr (N == 1)
+	{
+		return x;
+	}
+	else
+	{
+		VecF half = IntPowLanes<N / 2>(x);
+		if constexpr (N % 2 == 0)
+			return half * half;
+		else
+			return half * half * x;
+	}
+}
+
+// (re + i im)^N by squaring, see mandelbulb.h
+template <int N>
+static inline void ComplexPowLanes(VecF re, VecF im, VecF& outRe, VecF& outIm)
+{
+	if constexpr (N == 1)
+	{
+		outRe = re;
+		outIm = im;
+	}
+	else
+	{
+		VecF hRe, hIm;
+		ComplexPowLanes<N / 2>(re, im, hRe, hIm);
+		VecF sRe = hRe * hRe - hIm * hIm;
+		VecF sIm = Set1(2.0f) * hRe * hIm;
+		if constexpr (N % 2 == 0)
+		{
+			outRe = sRe;
+			outIm = sIm;
+		}
+		else
+		{
+			outRe = sRe * re - sIm * im;
+			outIm = sRe * im + sIm * re;
+		}
+	}
+}
+
+// DistToScene for one vector of points, mirrors the scalar loop with a per lane escape mask.
+// Power is the compile time integer power for the trig-free iteration, or 0 for the polar form.
+// Orbit also tracks the lenZ orbit value, without it nothing of it is left in the loop
+template <int Power, bool Orbit>
+static inline VecF DistToSceneLanes(VecF px, VecF py, VecF pz, const FractalOptions& params, VecF& lenZ)
+{
+	const VecF power = Set1(params.power);
+	const VecF escape = Set1(params.escape);
+
+	// z = pos.xzy
+	VecF cx = px, cy = pz, cz = py;
+	VecF zx = cx, zy = cy, zz = cz;
+	VecF m = MulAdd(px, px, MulAdd(py, py, pz * pz));
+	VecF dz = Set1(1.0f);
+	if constexpr (Orbit)
+		lenZ = Sqrt(m);
+
+	Mask active = m == m;
+	for (int i = 0; i < params.maxIters && Any(active); i++)
+	{
+		VecF r = Sqrt(m);
+		VecF nx, ny, nz, rPowMinusOne;
+
+		if constexpr (Power > 0)
+		{
+			// Trig-free z^n
+			rPowMinusOne = IntPowLanes<Power - 1>(r);
+
+			VecF rho2 = MulAdd(zx, zx, zz * zz);
+			VecF rho = Sqrt(rho2);
+			VecF aRe, aIm, bRe, bIm;
+			ComplexPowLanes<Power>(zy, rho, aRe, aIm);
+
+			// atan2(0, 0) is 0 on the y axis
+			Mask offAxis = rho2 > Set1(0.0f);
+			VecF inv = Select(offAxis, Set1(1.0f) / rho, Set1(0.0f));
+			ComplexPowLanes<Power>(Select(offAxis, zz * inv, Set1(1.0f)), zx * inv, bRe, bIm);
+
+			nx = MulAdd(aIm, bIm, cx);
+			ny = aRe + cy;
+			nz = MulAdd(aIm, bRe, cz);
+		}
+		else
+		{
+			// Polar z^n with r^(n-1) from exp and log
+			rPowMinusOne = Exp((power - Set1(1.0f)) * Log(r));
+			VecF rn = rPowMinusOne * r;
+
+			VecF b = power * Acos(zy / r);
+			VecF a = power * Atan2(zx, zz);
+			VecF sb, cb, sa, ca;
+			SinCos(b, sb, cb);
+			SinCos(a, sa, ca);
+			nx = MulAdd(rn, sb * sa, cx);
+			ny = MulAdd(rn, cb, cy);
+			nz = MulAdd(rn, sb * ca, cz);
+		}
+
+		// dz = n r^(n-1) dz + 1
+		VecF newDz = MulAdd(power * rPowMinusOne, dz, Set1(1.0f));
+		VecF newM = MulAdd(nx, nx, MulAdd(ny, ny, nz * nz));
+
+		// Escaped lanes keep the values from the iteration they escaped on
+		zx = Select(active, nx, zx);
+		zy = Select(active, ny, zy);
+		zz = Select(active, nz, zz);
+		m = Select(active, newM, m);
+		dz = Select(active, newDz, dz);
+
+		Mask escaped = newM > escape;
+		if constexpr (Orbit)
+		{
+			VecF len = Sqrt(newM);
+			lenZ = Select(AndNot(active, escaped) & (len > lenZ), len, lenZ);
+		}
+		active = AndNot(active, escaped);
+	}
+
+	return Set1(0.25f) * Log(m) * Sqrt(m) / dz;
+}
+
+template <int Power, bool Orbit>
+static void DistToSceneBlocksFor(const float* x, const float* y, const float* z, int count, const FractalOptions& params, float* dist, float* lenZ)
+{
+	for (int i = 0; i < count; i += g_lanes)
+	{
+		VecF len = Set1(0.0f);
+		VecF d = DistToSceneLanes<Power, Orbit>(Load(x + i), Load(y + i), Load(z + i), params, len);
+		Store(dist + i, d);
+		if constexpr (Orbit)
+			Store(lenZ + i, len);
+	}
+}
+
+typedef void (*BlockFunction)(const float*, const float*, const float*, int, const FractalOptions&, float*, float*);
+
+// Entry 0 is the polar form, the rest the trig-free powers in order
+template <bool Orbit, int... N>
+static std::array<BlockFunction, sizeof...(N) + 1> MakeBlockTable(std::integer_sequence<int, N...>)
+{
+	return { { &DistToSceneBlocksFor<0, Orbit>, &DistToSceneBlocksFor<N + g_minIntegerPower, Orbit>... } };
+}
+
+// Shared loop over whole vectors, with the variant for the power and whether lenZ is wanted
+static inline void DistToSceneBlocks(const float* x, const float* y, const float* z, int count, const FractalOptions& params, float* dist, float* lenZ)
+{
+	static const auto table = MakeBlockTable<false>(std::make_integer_sequence<int, g_maxIntegerPower - g_minIntegerPower + 1>());
+	static const auto orbitTable = MakeBlockTable<true>(std::make_integer_sequence<int, g_maxIntegerPower - g_minIntegerPower + 1>());
+
+	int n = IntegerPower(params.power);
+	int variant = n > 0 ? n - g_minIntegerPower + 1 : 0;
+	if (lenZ)
+		orbitTable[variant](x, y, z, count, params, dist, lenZ);
+	else
+		table[variant](x, y, z, count, params, dist, nullptr);
+}
@@ -8,6 +8,7 @@
 // Also includes
 #include <Windows.h>
 #include <chrono>
+#include <cstdio>
 
 int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPSTR lpCmdLine, _In_ int nCmdShow) 
 {
@@ -23,10 +24,11 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 	mouse = std::make_unique<Mouse>();
 	mouse->SetWindow(window.hwnd);
 
-	window.m_renderer->mouse = &(*mouse); // Look into alternative to this
+	window.m_input->mouse = &(*mouse); // Look into alternative to this
 	ShowWindow(window.hwnd, nCmdShow);
 
 	MSG msg;
+	int frame = 0;
 	while (true)
 	{
 		// Updating delta time
@@ -43,6 +45,16 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 		{
 			// Render and present the scene
 			window.m_renderer->Render();
+
+			// Show what dynamic quality is doing a few times a second
+			if (window.m_renderer->m_dynamicQuality && ++frame % 30 == 0)
+			{
+				char telemetry[256];
+				char title[300];
+				FormatQualityTelemetry(window.m_renderer->m_qualityController.GetTelemetry(), telemetry, sizeof(telemetry));
+				snprintf(title, sizeof(title), "Mandelbulb - %s", telemetry);
+				SetWindowTextA(window.hwnd, title);
+			}
 		}
 
 		if (msg.message == WM_QUIT)
@@ -17,7 +17,7 @@ cbuffer constants : register(b0)
     int screenWidth;
     int screenHeight;
     
-    // Animation and quality
+    // Animation and quality, the backend picks the kernel variant from these
     int animated;
     int quality;
 
@@ -27,9 +27,63 @@ cbuffer constants : register(b0)
 	// Colours
     float3 colour1;
     float3 colour2;
-    float padding2;
+    
+    // Progressive refinement marches one pixel per pixelStep x pixelStep block
+    int pixelStep;
+    
+    // Dynamic quality overrides, 0 keeps the quality level's
+    float hitEpsilon;
+    int marchIterations;
+    int deIterations;
+    float padding4;
 }; 
 
+// Per pass settings for the cone prepass, see coneprepass.h
+cbuffer coneConstants : register(b1)
+{
+    // Block edge in pixels of the cone level being drawn
+    int coneBlockSize;
+    // Cone levels below the coarsest start from parentDepth
+    int coneHasParent;
+    // Main pass starts each pixel at the 2x2 level's depth
+    int conePrepass;
+    float padding3;
+};
+
+// Depths of the previous cone level, or the 2x2 level in the main pass
+Texture2D<float> parentDepth : register(t0);
+
+// Temporal reprojection of the previous frame's hit depths, see reprojection.h
+cbuffer reprojectionConstants : register(b2)
+{
+    // Camera the previous frame was rendered with
+    float4x4 prevProjInverse;
+    float4x4 prevViewInverse;
+    // This frame's view then projection
+    float4x4 viewProj;
+    float3 prevCamPos;
+    // Main pass starts each pixel from reprojectedDepth
+    int reproject;
+};
+
+// Nearest reprojected distance per pixel, negative where nothing landed
+Texture2D<float> reprojectedDepth : register(t1);
+// Previous frame's hit distances, negative for a miss, read by ReprojectVS
+Texture2D<float> previousDepth : register(t2);
+
+// Reduced resolution frame UpscalePS fills the screen from
+Texture2D<float4> blockColour : register(t3);
+
+// Rays start this fraction of the reprojected depth short of it
+static const float reprojectMargin = 0.02f;
+
+// March strategies, see MarchStrategy in kernel.h
+static const int marchPlain = 0;
+static const int marchRelaxed = 1;
+static const int marchRefined = 2;
+static const float marchRelaxation = 1.3f;
+static const int refineSteps = 4;
+
 struct PSInput
 {
     float4 position : SV_POSITION;
@@ -46,100 +100,349 @@ PSInput VSMain(float4 position : POSITION, float2 uv : TEXCOORD0)
     return result;
 }
 
-float4 PSMain(PSInput input) : SV_TARGET
+// Fractal parameters
+FractalOptions GetFractalOptions()
 {
-    // Scene constants
-    float3 light1 = float3(10.0f, 10.0f, -10.0f);
-    float3 light2 = float3(-10.0f, 10.0f, -10.0f);
-    float3 light3 = float3(0.0f, 0.0f, 10.0f);
-        
-    // Fractal parameters
     FractalOptions params;
-    params.maxIters = 25;
+    params.maxIters = deIterations > 0 ? deIterations : 25;
     params.escape = 256.0f;
     
-    if (animated == 1)
-    {
-        // Animate power from 5-9
-        float interval = frac(time * 0.00025f);
-        params.power = 7.0f + (sin(interval * 6.28f) * 2.0f);
-    }
-    else
-    {
-        params.power = 8.0f;
-    }
-        
-    // Get UV coordinates. input.position.xy stores PIXEL coords
-    float2 uv = input.position.xy / float2(screenWidth, screenHeight);
+#if KERNEL_ANIMATED
+    // Animate power from 5-9
+    float interval = frac(time * 0.00025f);
+    params.power = 7.0f + (sin(interval * 6.28f) * 2.0f);
+#else
+    params.power = 8.0f;
+#endif
+    
+    return params;
+}
+
+// Get UV coordinates from PIXEL coords
+float2 PixelToUV(float2 pixel)
+{
+    float2 uv = pixel / float2(screenWidth, screenHeight);
     
     // Change UV to -1 to 1 range
     uv = (uv - float2(0.5f, 0.5f)) * 2.0f;
     // Flip V
     uv.y *= -1;
-                
-    // Initialize variables and create camera ray
-    Ray ray = CreateCamRay(uv, projInverse, viewInverse, camPos);
     
-    float minDist;
-    int maxIters;
-    // Quality 
-    switch (quality)
+    return uv;
+}
+
+// Quality, hitPixels is the pixel LOD hit epsilon in pixel widths at the hit. The level is the
+// variant's, so the settings and the march strategy are compile time constants
+void GetQuality(out float minDist, out int maxIters, out float hitPixels, out int marchStrategy)
+{
+    switch (KERNEL_QUALITY)
     {
         case 0:
             minDist = 0.001f;
             maxIters = 80;
+            hitPixels = 0.4f;
+            marchStrategy = marchRelaxed;
             break;
         case 1:
             minDist = 0.0005f;
             maxIters = 128;
+            hitPixels = 0.2f;
+            marchStrategy = marchRelaxed;
             break;
         case 2:
             minDist = 0.0001f;
             maxIters = 160;
+            hitPixels = 0.04f;
+            marchStrategy = marchRefined;
+            break;
+        default:
+            minDist = 0.001f;
+            maxIters = 80;
+            hitPixels = 0.4f;
+            marchStrategy = marchRelaxed;
             break;
     }
+    
+    if (hitEpsilon > 0.0f)
+    {
+        hitPixels *= hitEpsilon / minDist;
+        minDist = hitEpsilon;
+    }
+    if (marchIterations > 0)
+        maxIters = marchIterations;
+}
+
+// Width of a pixel one unit in front of the camera, from the middle pixel and the one below it
+float PixelFootprint()
+{
+    float3 centre = CreateCamRay(float2(0.0f, 0.0f), projInverse, viewInverse, camPos).dir;
+    return length(CreateCamRay(float2(0.0f, 2.0f / screenHeight), projInverse, viewInverse, camPos).dir - centre);
+}
+
+// Pixel LOD, see FrameSetup::hitFootprint in kernel.h. A hit is within hitFootprint times the
+// distance along the ray, never below minHitEpsilon, and the march runs only the DE iterations
+// the finest epsilon the fractal's bounding sphere allows needs
+void GetPixelLod(float hitPixels, float boundingRadius, inout FractalOptions params, out float hitFootprint, out float minHitEpsilon)
+{
+    hitFootprint = hitPixels * PixelFootprint() * screenHeight / max(screenHeight, 720);
+    minHitEpsilon = 4.0f * 1.1920929e-7f * max(length(camPos), boundingRadius);
+    
+    float nearest = max(length(camPos) - FractalBoundingRadius(params.power), 0.0f);
+    float epsilon = max(hitFootprint * nearest, minHitEpsilon);
+    int iterations = max(int(ceil(log(1.0f / epsilon) / log(max(params.power, 2.0f)))) + 8, 10);
+    params.maxIters = min(iterations, params.maxIters);
+}
+
+// One cone per block of coneBlockSize pixels, outputs the depth every ray in the block can skip
+float ConePS(PSInput input) : SV_TARGET
+{
+    FractalOptions params = GetFractalOptions();
+    float minDist;
+    int maxIters;
+    float hitPixels;
+    int marchStrategy;
+    GetQuality(minDist, maxIters, hitPixels, marchStrategy);
+    
+    // Block corners in pixels
+    int2 block = int2(input.position.xy);
+    float2 p0 = float2(block * coneBlockSize);
+    float2 p1 = min(p0 + coneBlockSize, float2(screenWidth, screenHeight));
+    
+    // Every ray through the block is within slope * depth of the centre ray
+    float3 dir = CreateCamRay(PixelToUV((p0 + p1) * 0.5f), projInverse, viewInverse, camPos).dir;
+    float slope = 0.0f;
+    slope = max(slope, length(CreateCamRay(PixelToUV(float2(p0.x, p0.y)), projInverse, viewInverse, camPos).dir - dir));
+    slope = max(slope, length(CreateCamRay(PixelToUV(float2(p1.x, p0.y)), projInverse, viewInverse, camPos).dir - dir));
+    slope = max(slope, length(CreateCamRay(PixelToUV(float2(p0.x, p1.y)), projInverse, viewInverse, camPos).dir - dir));
+    slope = max(slope, length(CreateCamRay(PixelToUV(float2(p1.x, p1.y)), projInverse, viewInverse, camPos).dir - dir));
+    
+    // Start where the parent cone stopped
+    float depth = coneHasParent ? parentDepth.Load(int3(block / 2, 0)) : 0.0f;
+    
+    for (int iter = 0; iter < maxIters; iter++)
+    {
+        float3 pos = camPos + dir * depth;
+        float dist = DistToScene(pos, params);
+        
+        // Leaving the Mandelbulb range, every ray in the cone misses
+        if (length(pos) > 2.5f && dot(pos, dir) > 0.0f)
+            break;
+        
+        // Close enough that the cone is too wide to step usefully
+        float radius = slope * depth;
+        if (dist < minDist || radius > dist * 0.75f)
+            break;
+        
+        depth += dist - radius;
+    }
+    
+    return depth;
+}
+
+struct ReprojectOutput
+{
+    float4 position : SV_POSITION;
+    float distance : TEXCOORD0;
+};
+
+// One point per previous pixel and instance, splatting each hit onto the four pixel centres
+// around where it lands this frame. The depth test keeps the nearest
+ReprojectOutput ReprojectVS(uint id : SV_VertexID, uint instance : SV_InstanceID)
+{
+    ReprojectOutput output;
+    
+    uint width, height;
+    previousDepth.GetDimensions(width, height);
+    int2 pixel = int2(id % width, id / width);
+    float depth = previousDepth.Load(int3(pixel, 0));
+    
+    // Rebuild last frame's hit point from its ray
+    Ray ray = CreateCamRay(PixelToUV(float2(pixel) + 0.5f), prevProjInverse, prevViewInverse, prevCamPos);
+    float3 hit = ray.pos + ray.dir * depth;
+    
+    float4 clip = mul(viewProj, float4(hit, 1.0f));
+    float2 offset = float2(instance & 1, instance >> 1) - 0.5f;
+    clip.xy += offset * float2(2.0f / screenWidth, -2.0f / screenHeight) * clip.w;
+    
+    // Misses are pushed behind the near plane and clipped
+    output.position = depth < 0.0f ? float4(0.0f, 0.0f, -1.0f, 1.0f) : clip;
+    output.distance = length(hit - camPos);
+    
+    return output;
+}
+
+float ReprojectPS(ReprojectOutput input) : SV_TARGET
+{
+    return input.distance;
+}
+
+// Nearest reprojected depth in the 3x3 around pixel, 0 unless something landed on the pixel itself
+float ReprojectedStart(int2 pixel)
+{
+    if (reprojectedDepth.Load(int3(pixel, 0)) < 0.0f)
+        return 0.0f;
+    
+    float nearest = 1.#INF;
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            float depth = reprojectedDepth.Load(int3(pixel + int2(x, y), 0));
+            if (depth >= 0.0f)
+                nearest = min(nearest, depth);
+        }
+    }
+    
+    return nearest * (1.0f - reprojectMargin);
+}
+
+struct PSOutput
+{
+    float4 colour : SV_TARGET0;
+    // Hit distance for next frame's reprojection, negative for a miss
+    float depth : SV_TARGET1;
+};
+
+// SoftShadow from a hit towards light, stopping where the ray leaves the bounding sphere. A light
+// well behind the surface is in shadow without tracing, see g_shadowCullCosine in kernel.h
+float LightShadow(float3 hit, float3 normal, float3 light, float minDist, float boundingRadius, FractalOptions params)
+{
+    Ray ray;
+    ray.pos = hit + 0.01f * normal;
+    ray.dir = normalize(light - hit);
+    if (dot(normal, ray.dir) < -0.5f)
+        return 0.0f;
+    
+    float entry, exit;
+    float maxt = IntersectSphere(ray, boundingRadius, entry, exit) ? exit : 0.0f;
+    return SoftShadow(ray.pos, ray.dir, minDist, maxt, 3.0f, params);
+}
+
+PSOutput PSMain(PSInput input)
+{
+    // Scene constants
+    float3 light1 = float3(10.0f, 10.0f, -10.0f);
+    float3 light2 = float3(-10.0f, 10.0f, -10.0f);
+    float3 light3 = float3(0.0f, 0.0f, 10.0f);
+        
+    // Fractal parameters
+    FractalOptions params = GetFractalOptions();
+    
+    // At reduced resolution each pixel stands for the top left pixel of its block
+    float2 pixel = floor(input.position.xy) * pixelStep + 0.5f;
+    float2 uv = PixelToUV(pixel);
+                
+    // Initialize variables and create camera ray
+    Ray ray = CreateCamRay(uv, projInverse, viewInverse, camPos);
+    
+    float minDist;
+    int maxIters;
+    float hitPixels;
+    int marchStrategy;
+    GetQuality(minDist, maxIters, hitPixels, marchStrategy);
+    
+    // The march and normals run the DE iterations the pixel footprint needs, shadows all of them
+    float boundingRadius = FractalBoundingRadius(params.power);
+    FractalOptions marchParams = params;
+    float hitFootprint, minHitEpsilon;
+    GetPixelLod(hitPixels, boundingRadius, marchParams, hitFootprint, minHitEpsilon);
         
     float totalDistance = 0; // Total distance travelled
-    float distFromScene = DistToScene(ray.pos, params); // The distance we can safely move the ray without collision
-    float closestDistance = 1.#INF;
+    
+    // Skip the empty space found by the cone prepass
+    if (conePrepass)
+        totalDistance = parentDepth.Load(int3(int2(pixel) / 2, 0));
+    
+    // And past where last frame's surface reprojects to
+    if (reproject)
+        totalDistance = max(totalDistance, ReprojectedStart(int2(pixel)));
+    
+    // Start where the ray enters the bounding sphere, a ray that misses it misses the fractal
+    float entry, exit;
+    if (!IntersectSphere(ray, boundingRadius, entry, exit))
+        maxIters = 0;
+    else
+        totalDistance = max(totalDistance, entry);
+    
+    // Positions are taken from the camera each step rather than added up, so rounding does not
+    // build up along the ray
+    float3 pos = ray.pos + ray.dir * totalDistance;
+    float distFromScene = maxIters > 0 ? DistToScene(pos, marchParams) : 0.0f; // The distance we can safely move the ray without collision
     
     // Default colour (Vignette background)
     float3 colour = ((colour1 + colour2) / 2.0f / 255.0f) - (float3(length(uv), length(uv), length(uv)) / 2.0f);
     
     float lenZ = 0;
+    float hitDepth = -1.0f;
+    
+    // Over-relaxed steps until the unbounding spheres of two positions stop overlapping, see
+    // NextMarchStep in kernel.cpp. from is where the last step forward left
+    float relaxation = marchStrategy == marchPlain ? 1.0f : marchRelaxation;
+    float lastDist = distFromScene;
+    float lastStep = distFromScene * relaxation;
+    float step = lastStep;
+    float from = totalDistance;
     
     // Raymarching
     for (int iter = 0; iter < maxIters; iter++)
     {
-        ray.pos += ray.dir * distFromScene; // Move the ray forward as far as we are sure no collisions occur
-        totalDistance += distFromScene;
-        distFromScene = DistToScene(ray.pos, params, lenZ); // Update distance to scene
+        if (step > 0.0f)
+            from = totalDistance;
+        totalDistance += step; // Move the ray forward as far as we are sure no collisions occur
+        pos = ray.pos + ray.dir * totalDistance;
+        distFromScene = DistToScene(pos, marchParams); // Update distance to scene
         
-        if (distFromScene < closestDistance)
+        // A step past what the DE allowed goes back to where a plain step would have gone
+        if (relaxation > 1.0f && distFromScene + lastDist < lastStep)
         {
-            closestDistance = distFromScene;
+            step = lastDist - lastStep;
+            relaxation = 1.0f;
+            lastStep = 0.0f;
+            continue;
         }
+        lastDist = distFromScene;
+        lastStep = distFromScene * relaxation;
+        step = lastStep;
         
         // Out of Mandelbulb range
-        if (length(ray.pos) > 2.5f)
+        if (length(pos) > boundingRadius)
             break;
         
-        if (distFromScene < minDist)
+        if (distFromScene < max(hitFootprint * totalDistance, minHitEpsilon))
         {
+            // Bisect the hit between here and where the last step left from
+            if (marchStrategy == marchRefined)
+            {
+                float near = from;
+                for (int i = 0; i < refineSteps; i++)
+                {
+                    float middle = (near + totalDistance) * 0.5f;
+                    if (DistToScene(ray.pos + ray.dir * middle, marchParams) < max(hitFootprint * middle, minHitEpsilon))
+                        totalDistance = middle;
+                    else
+                        near = middle;
+                }
+                pos = ray.pos + ray.dir * totalDistance;
+            }
+            
+            // Orbit value for the colour, only the hit needs it
+            DistToScene(pos, marchParams, lenZ);
+            
             // Hit mandelbulb, shade
+            hitDepth = totalDistance;
             colour = (colour1 + colour2) / 255.0f / 20.0f; // Ambient
             
             // Normal estimate
-            float3 normal = NormalEstimate(ray.pos, params);
+            float3 normal = NormalEstimate(pos, marchParams);
             
             // Shadows
-            float3 diffuse1 = SoftShadow(ray.pos + 0.01f * normal, normalize(light1 - ray.pos), minDist, 4.0f, 3.0f, params) // Light 1 
+            float3 diffuse1 = LightShadow(pos, normal, light1, minDist, boundingRadius, params) // Light 1
             * float3(0.809f, 0.878f, 1.0f); // Sky blue
             
-            float3 diffuse2 = SoftShadow(ray.pos + 0.01f * normal, normalize(light2 - ray.pos), minDist, 4.0f, 3.0f, params) // Light 2 
+            float3 diffuse2 = LightShadow(pos, normal, light2, minDist, boundingRadius, params) // Light 2
             * float3(1.0f, 0.945f, 0.878f); // Lightbulb orange
             
-            float3 diffuse3 = SoftShadow(ray.pos + 0.01f * normal, normalize(light3 - ray.pos), minDist, 4.0f, 3.0f, params) // Light 3
+            float3 diffuse3 = LightShadow(pos, normal, light3, minDist, boundingRadius, params) // Light 3
             * float3(0.796f, 0.765f, 0.890f); // Purple
             
             colour += saturate(diffuse1 + diffuse2 + diffuse3) * (lerp(colour1, colour2, saturate(lenZ / 10.0f)) / 255.0f);
@@ -148,7 +451,15 @@ float4 PSMain(PSInput input) : SV_TARGET
         }
     }
                 
-    colour = saturate(colour); // Clamp to 0-1 range
+    PSOutput output;
+    output.colour = float4(saturate(colour), 1.0f); // Clamp to 0-1 range
+    output.depth = hitDepth;
 
-    return float4(colour, 1.0f);
+    return output;
+}
+
+// Nearest neighbour upscale of a reduced resolution frame
+float4 UpscalePS(PSInput input) : SV_TARGET
+{
+    return blockColour.Load(int3(int2(input.position.xy) / pixelStep, 0));
 }
\ No newline at end of file
@@ -0,0 +1,194 @@
+#pragma once
+
+//------------------------------
+//- mandelbulb.h
+//------------------------------
+
+// Mandelbulb iteration with the power fixed at compile time. For an integer power n the
+// triplex power needs no trig: with theta = acos(y / r) and phi = atan2(x, z),
+//   (y + i rho)^n = r^n (cos n theta + i sin n theta)      rho = sqrt(x^2 + z^2)
+//   ((z + i x) / rho)^n = cos n phi + i sin n phi
+// so both angle multiples come from complex powers by repeated squaring. Templated on the
+// scalar type so the same code can run on other number types
+
+// Includes
+#include "pixelcost.h"
+
+#include <cmath>
+
+namespace Mandelbulb
+{
+	// Float overloads from the standard library, other scalar types are found by ADL
+	using std::acos;
+	using std::atan2;
+	using std::cos;
+	using std::log;
+	using std::pow;
+	using std::sin;
+	using std::sqrt;
+
+	// x^N by squaring, unrolled at compile time
+	template <int N, typename T>
+	inline T IntPow(T x)
+	{
+		static_assert(N >= 0, "negative powers are not supported");
+		if constexpr (N == 0)
+		{
+			return T(1.0f);
+		}
+		else if constexpr (N == 1)
+		{
+			return x;
+		}
+		else
+		{
+			T half = IntPow<N / 2>(x);
+			if constexpr (N % 2 == 0)
+				return half * half;
+			else
+				return half * half * x;
+		}
+	}
+
+	// (re + i im)^N by squaring
+	template <int N, typename T>
+	inline void ComplexPow(T re, T im, T& outRe, T& outIm)
+	{
+		if constexpr (N == 1)
+		{
+			outRe = re;
+			outIm = im;
+		}
+		else
+		{
+			T hRe, hIm;
+			ComplexPow<N / 2>(re, im, hRe, hIm);
+
+			// Square the half power
+			T sRe = hRe * hRe - hIm * hIm;
+			T sIm = T(2.0f) * hRe * hIm;
+
+			if constexpr (N % 2 == 0)
+			{
+				outRe = sRe;
+				outIm = sIm;
+			}
+			else
+			{
+				outRe = sRe * re - sIm * im;
+				outIm = sRe * im + sIm * re;
+			}
+		}
+	}
+
+	// z = z^Power in the shader's axis convention
+	template <int Power, typename T>
+	inline void TriplexPow(T& x, T& y, T& z)
+	{
+		T rho2 = x * x + z * z;
+		T rho = sqrt(rho2);
+
+		// r^n (cos n theta, sin n theta)
+		T aRe, aIm;
+		ComplexPow<Power>(y, rho, aRe, aIm);
+
+		// cos n phi, sin n phi. On the y axis atan2(0, 0) is 0
+		T bRe = T(1.0f), bIm = T(0.0f);
+		if (rho2 > T(0.0f))
+		{
+			T inv = T(1.0f) / rho;
+			ComplexPow<Power>(z * inv, x * inv, bRe, bIm);
+		}
+
+		x = aIm * bIm;
+		y = aRe;
+		z = aIm * bRe;
+	}
+
+	// DistToScene for a compile time integer power, optionally tracking the lenZ orbit value
+	template <int Power, bool TrackLenZ, typename T>
+	inline T DistToScene(T px, T py, T pz, int maxIters, T escape, T* lenZ)
+	{
+		static_assert(Power >= 2, "power must be at least 2");
+
+		// z = pos.xzy
+		T cx = px, cy = pz, cz = py;
+		T x = cx, y = cy, z = cz;
+		T m = px * px + py * py + pz * pz;
+		T dz = T(1.0f);
+
+		if constexpr (TrackLenZ)
+			*lenZ = sqrt(m);
+
+		for (int i = 0; i < maxIters; i++)
+		{
+			PIXEL_COST_ITERATION();
+
+			// Running derivative, dz = n r^(n-1) dz + 1
+			T r = sqrt(m);
+			dz = T(float(Power)) * IntPow<Power - 1>(r) * dz + T(1.0f);
+
+			// z = z^n + c
+			TriplexPow<Power>(x, y, z);
+			x = x + cx;
+			y = y + cy;
+			z = z + cz;
+
+			m = x * x + y * y + z * z;
+			if (m > escape)
+				break;
+
+			if constexpr (TrackLenZ)
+			{
+				T len = sqrt(m);
+				if (len > *lenZ)
+					*lenZ = len;
+			}
+		}
+
+		return T(0.25f) * log(m) * sqrt(m) / dz;
+	}
+
+	// Polar form for any power, used when the power is fractional
+	template <bool TrackLenZ, typename T>
+	inline T DistToScenePolar(T px, T py, T pz, T power, int maxIters, T escape, T* lenZ)
+	{
+		T cx = px, cy = pz, cz = py;
+		T x = cx, y = cy, z = cz;
+		T m = px * px + py * py + pz * pz;
+		T dz = T(1.0f);
+
+		if constexpr (TrackLenZ)
+			*lenZ = sqrt(m);
+
+		for (int i = 0; i < maxIters; i++)
+		{
+			PIXEL_COST_ITERATION();
+
+			T r = sqrt(m);
+			dz = power * pow(r, power - T(1.0f)) * dz + T(1.0f);
+
+			// z = z^n + c
+			T b = power * acos(y / r);
+			T a = power * atan2(x, z);
+			T rn = pow(r, power);
+			T sb = sin(b);
+			x = cx + rn * sb * sin(a);
+			y = cy + rn * cos(b);
+			z = cz + rn * sb * cos(a);
+
+			m = x * x + y * y + z * z;
+			if (m > escape)
+				break;
+
+			if constexpr (TrackLenZ)
+			{
+				T len = sqrt(m);
+				if (len > *lenZ)
+					*lenZ = len;
+			}
+		}
+
+		return T(0.25f) * log(m) * sqrt(m) / dz;
+	}
+}
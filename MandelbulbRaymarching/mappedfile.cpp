@@ -0,0 +1,133 @@
+//------------------------------
+//- mappedfile.cpp
+//------------------------------
+
+// Includes
+#include "mappedfile.h"
+
+#include <utility>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+
+// Destructor
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+void MappedFile::Swap(MappedFile& other)
+{
+	std::swap(m_data, other.m_data);
+	std::swap(m_size, other.m_size);
+	std::swap(m_file, other.m_file);
+	std::swap(m_mapping, other.m_mapping);
+	std::swap(m_descriptor, other.m_descriptor);
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::string& fileName)
+{
+	Close();
+
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	m_file = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0)
+	{
+		Close();
+		return false;
+	}
+
+	m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping)
+	{
+		Close();
+		return false;
+	}
+
+	m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data)
+	{
+		Close();
+		return false;
+	}
+	m_size = size_t(size.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file)
+		CloseHandle(m_file);
+	m_data = nullptr;
+	m_size = 0;
+	m_mapping = nullptr;
+	m_file = nullptr;
+}
+
+bool MoveFileOver(const std::string& tempName, const std::string& fileName)
+{
+	return MoveFileExA(tempName.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& fileName)
+{
+	Close();
+
+	m_descriptor = open(fileName.c_str(), O_RDONLY);
+	if (m_descriptor < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(m_descriptor, &info) != 0 || info.st_size <= 0)
+	{
+		Close();
+		return false;
+	}
+
+	void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, m_descriptor, 0);
+	if (data == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	m_data = static_cast<const uint8_t*>(data);
+	m_size = size_t(info.st_size);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data)
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+	if (m_descriptor >= 0)
+		close(m_descriptor);
+	m_data = nullptr;
+	m_size = 0;
+	m_descriptor = -1;
+}
+
+bool MoveFileOver(const std::string& tempName, const std::string& fileName)
+{
+	return rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+#endif
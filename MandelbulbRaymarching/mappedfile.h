@@ -0,0 +1,44 @@
+#pragma once
+
+//------------------------------
+//- mappedfile.h
+//------------------------------
+
+// Read-only view of a whole file mapped into memory. Pages are read in as they are first touched
+// and come from the OS page cache, so every process mapping the same file shares one copy
+
+// Includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile
+{
+public:
+	// Constructor
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Map fileName, fails for missing or empty files
+	bool Open(const std::string& fileName);
+	void Close();
+	// Exchange mappings with other
+	void Swap(MappedFile& other);
+
+	const uint8_t* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+private:
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+
+	// File and mapping handles on Windows, the descriptor elsewhere
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+	int m_descriptor = -1;
+};
+
+// Replace fileName with tempName in one step, so readers see the old file or the new one
+bool MoveFileOver(const std::string& tempName, const std::string& fileName);
@@ -0,0 +1,484 @@
+//------------------------------
+//- meshexport.cpp
+//------------------------------
+
+// Includes
+#include "meshexport.h"
+#include "kernel_simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+// Levels subdivided on the calling thread before the subtrees below them are shared out
+static const int g_meshTaskDepth = 4;
+// Room left around the bounding sphere so the surface never reaches the root cell's faces
+static const float g_meshRootMargin = 1.05f;
+// The DE is only an estimate, so a cell is dropped when the surface is this many of its radii
+// away. Outside it can miss thin features, inside it can overstate the distance several times
+static const float g_meshOutsideBound = 2.0f;
+static const float g_meshInsideBound = 8.0f;
+// Bytes the writers gather before each fwrite
+static const size_t g_meshWriteBuffer = size_t(1) << 20;
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Marching cubes cases derived from the cube's faces rather than a fixed table. On every face
+// the surface cuts off each run of inside corners separately, so two cells sharing a face always
+// agree and the mesh is closed. The face segments then chain into loops that are fanned into
+// triangles. Corners are numbered by their x, y and z bits
+struct MarchingCubesTable
+{
+	// Corners each edge joins, the lower one first
+	int edges[12][2];
+	// Triangles per case as edge triples
+	int triangleCount[256];
+	int triangles[256][30];
+
+	MarchingCubesTable()
+	{
+		int edgeIndex[8][8];
+		int edgeCount = 0;
+		for (int a = 0; a < 8; a++)
+		{
+			for (int bit = 1; bit < 8; bit <<= 1)
+			{
+				if (a & bit)
+					continue;
+				edges[edgeCount][0] = a;
+				edges[edgeCount][1] = a | bit;
+				edgeIndex[a][a | bit] = edgeIndex[a | bit][a] = edgeCount++;
+			}
+		}
+
+		// Each face's corners counter-clockwise seen from outside the cube
+		int faces[6][4];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int u = 1 << ((axis + 1) % 3);
+			int v = 1 << ((axis + 2) % 3);
+			int* low = faces[axis * 2];
+			int* high = faces[axis * 2 + 1];
+			int base = 1 << axis;
+			high[0] = base;
+			high[1] = base | u;
+			high[2] = base | u | v;
+			high[3] = base | v;
+			low[0] = 0;
+			low[1] = v;
+			low[2] = u | v;
+			low[3] = u;
+		}
+
+		for (int mask = 0; mask < 256; mask++)
+		{
+			// Each cut edge is left by the segment of one face and entered by the next face's
+			int next[12];
+			for (int e = 0; e < 12; e++)
+				next[e] = -1;
+			for (const int* face : faces)
+			{
+				bool inside[4];
+				for (int k = 0; k < 4; k++)
+					inside[k] = (mask >> face[k]) & 1;
+				for (int k = 0; k < 4; k++)
+				{
+					if (!inside[k] || inside[(k + 1) % 4])
+						continue;
+
+					// Back to the start of this run of inside corners
+					int first = k;
+					while (inside[(first + 3) % 4])
+						first = (first + 3) % 4;
+					int leave = edgeIndex[face[(first + 3) % 4]][face[first]];
+					int enter = edgeIndex[face[k]][face[(k + 1) % 4]];
+					next[leave] = enter;
+				}
+			}
+
+			int count = 0;
+			bool used[12] = {};
+			for (int start = 0; start < 12; start++)
+			{
+				if (next[start] < 0 || used[start])
+					continue;
+
+				int loop[12];
+				int length = 0;
+				for (int e = start; !used[e]; e = next[e])
+				{
+					used[e] = true;
+					loop[length++] = e;
+				}
+
+				// Fan from an edge whose diagonals all cross the cube's interior. A diagonal lying in a
+				// face could be chosen by the cell across it too, leaving one edge on four triangles
+				int origin = 0;
+				for (; origin < length; origin++)
+				{
+					bool interior = true;
+					for (int i = 2; i + 1 < length; i++)
+						interior = interior && !ShareFace(loop[origin], loop[(origin + i) % length]);
+					if (interior)
+						break;
+				}
+				origin %= length;
+				for (int i = 1; i + 1 < length; i++)
+				{
+					triangles[mask][count * 3] = loop[origin];
+					triangles[mask][count * 3 + 1] = loop[(origin + i) % length];
+					triangles[mask][count * 3 + 2] = loop[(origin + i + 1) % length];
+					count++;
+				}
+			}
+			triangleCount[mask] = count;
+		}
+	}
+
+	// Whether two edges lie on a common face, their four corners agreeing on some axis
+	bool ShareFace(int a, int b) const
+	{
+		int corners[4] = { edges[a][0], edges[a][1], edges[b][0], edges[b][1] };
+		for (int bit = 1; bit < 8; bit <<= 1)
+		{
+			bool same = true;
+			for (int c : corners)
+				same = same && (c & bit) == (corners[0] & bit);
+			if (same)
+				return true;
+		}
+		return false;
+	}
+};
+
+// A cell by its integer position at its level
+struct MeshCell
+{
+	uint32_t x, y, z;
+};
+
+// What one subtree's extraction produced, vertices keyed by the edge they lie on
+struct MeshPiece
+{
+	std::vector<uint64_t> keys;
+	std::vector<float3> positions;
+	std::vector<uint32_t> indices;
+	std::vector<long long> cells;
+	long long surfaceLeaves = 0;
+	long long evaluations = 0;
+
+	size_t Bytes() const
+	{
+		return keys.capacity() * sizeof(uint64_t) + positions.capacity() * sizeof(float3) + indices.capacity() * sizeof(uint32_t);
+	}
+};
+
+// Where the octree sits, and the surface's DE
+struct MeshGrid
+{
+	float rootMin;
+	float rootSize;
+	int depth;
+	float iso;
+	bool dense;
+
+	float CellSize(int level) const { return rootSize / float(1u << level); }
+	// Leaf corners per axis
+	uint64_t Corners() const { return (uint64_t(1) << depth) + 1; }
+};
+
+// Replace cells at level with their children that may hold the surface, until they reach target
+static void Subdivide(std::vector<MeshCell>& cells, int level, int target, const FractalOptions& params, const MeshGrid& grid,
+	MeshPiece& piece)
+{
+	std::vector<MeshCell> children;
+	std::vector<float> xs, ys, zs, dist;
+	for (; level < target; level++)
+	{
+		float size = grid.CellSize(level + 1);
+		float radius = size * 0.8660254f;
+		size_t count = cells.size() * 8;
+		children.resize(count);
+		xs.resize(count);
+		ys.resize(count);
+		zs.resize(count);
+		dist.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			const MeshCell& parent = cells[i / 8];
+			int child = int(i % 8);
+			MeshCell& cell = children[i];
+			cell.x = parent.x * 2 + (child & 1);
+			cell.y = parent.y * 2 + ((child >> 1) & 1);
+			cell.z = parent.z * 2 + ((child >> 2) & 1);
+			xs[i] = grid.rootMin + (float(cell.x) + 0.5f) * size;
+			ys[i] = grid.rootMin + (float(cell.y) + 0.5f) * size;
+			zs[i] = grid.rootMin + (float(cell.z) + 0.5f) * size;
+		}
+		DistToScenePacket(xs.data(), ys.data(), zs.data(), int(count), params, dist.data());
+		piece.evaluations += (long long)count;
+		piece.cells[level + 1] += (long long)count;
+
+		// A cell is dropped once the DE puts the surface beyond its corners, NaN at the centre is kept
+		cells.clear();
+		for (size_t i = 0; i < count; i++)
+		{
+			bool outside = dist[i] - grid.iso > radius * g_meshOutsideBound;
+			bool inside = grid.iso - dist[i] > radius * g_meshInsideBound;
+			if (grid.dense || !(outside || inside))
+				cells.push_back(children[i]);
+		}
+	}
+}
+
+// Marching cubes over the leaves below one cell of the task level
+static void ExtractPiece(const MeshCell& root, int rootLevel, const FractalOptions& params, const MeshGrid& grid, MeshPiece& piece)
+{
+	static const MarchingCubesTable table;
+
+	std::vector<MeshCell> leaves(1, root);
+	Subdivide(leaves, rootLevel, grid.depth, params, grid, piece);
+	if (leaves.empty())
+		return;
+
+	// Each corner is shared by up to eight leaves, evaluate it once
+	uint64_t corners = grid.Corners();
+	auto cornerKey = [corners](uint64_t x, uint64_t y, uint64_t z) { return (z * corners + y) * corners + x; };
+	std::vector<uint64_t> keys;
+	keys.reserve(leaves.size() * 8);
+	for (const MeshCell& leaf : leaves)
+	{
+		for (int c = 0; c < 8; c++)
+			keys.push_back(cornerKey(leaf.x + (c & 1), leaf.y + ((c >> 1) & 1), leaf.z + ((c >> 2) & 1)));
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	float leafSize = grid.CellSize(grid.depth);
+	std::vector<float> xs(keys.size()), ys(keys.size()), zs(keys.size()), values(keys.size());
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		xs[i] = grid.rootMin + float(keys[i] % corners) * leafSize;
+		ys[i] = grid.rootMin + float(keys[i] / corners % corners) * leafSize;
+		zs[i] = grid.rootMin + float(keys[i] / corners / corners) * leafSize;
+	}
+	DistToScenePacket(xs.data(), ys.data(), zs.data(), int(keys.size()), params, values.data());
+	piece.evaluations += (long long)keys.size();
+
+	std::unordered_map<uint64_t, uint32_t> vertexOf;
+	for (const MeshCell& leaf : leaves)
+	{
+		// Corners below the iso level are inside, as are NaNs deep in the set
+		size_t corner[8];
+		int mask = 0;
+		for (int c = 0; c < 8; c++)
+		{
+			uint64_t key = cornerKey(leaf.x + (c & 1), leaf.y + ((c >> 1) & 1), leaf.z + ((c >> 2) & 1));
+			corner[c] = size_t(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+			if (!(values[corner[c]] >= grid.iso))
+				mask |= 1 << c;
+		}
+		if (table.triangleCount[mask] == 0)
+			continue;
+		piece.surfaceLeaves++;
+
+		for (int i = 0; i < table.triangleCount[mask] * 3; i++)
+		{
+			// Edges are keyed by their lower corner and axis, so neighbouring leaves share vertices
+			int edge = table.triangles[mask][i];
+			size_t a = corner[table.edges[edge][0]];
+			size_t b = corner[table.edges[edge][1]];
+			int bit = table.edges[edge][0] ^ table.edges[edge][1];
+			uint64_t key = keys[a] * 3 + (bit == 1 ? 0 : (bit == 2 ? 1 : 2));
+
+			auto found = vertexOf.find(key);
+			if (found == vertexOf.end())
+			{
+				float t = (grid.iso - values[a]) / (values[b] - values[a]);
+				t = t >= 0.0f && t <= 1.0f ? t : 0.5f;
+				float3 pa = { xs[a], ys[a], zs[a] };
+				float3 pb = { xs[b], ys[b], zs[b] };
+				found = vertexOf.emplace(key, uint32_t(piece.keys.size())).first;
+				piece.keys.push_back(key);
+				piece.positions.push_back(pa + (pb - pa) * t);
+			}
+			piece.indices.push_back(found->second);
+		}
+	}
+}
+
+// Constructor
+MeshExtractor::MeshExtractor(ThreadPool& pool)
+	: m_pool(pool)
+{
+}
+
+bool MeshExtractor::Extract(const FractalOptions& params, const MeshSettings& settings, Mesh& mesh)
+{
+	auto start = std::chrono::steady_clock::now();
+	m_stats = {};
+	mesh = {};
+	if (settings.depth < 1 || settings.depth > g_maxMeshDepth)
+		return false;
+
+	MeshGrid grid;
+	float radius = FractalBoundingRadius(params.power) * g_meshRootMargin;
+	grid.rootMin = -radius;
+	grid.rootSize = radius * 2.0f;
+	grid.depth = settings.depth;
+	grid.iso = settings.isoCells * grid.CellSize(settings.depth);
+	grid.dense = settings.dense;
+
+	// The first levels on this thread, then a task per remaining cell
+	MeshPiece top;
+	top.cells.assign(settings.depth + 1, 0);
+	top.cells[0] = 1;
+	int taskLevel = std::min(settings.depth, g_meshTaskDepth);
+	std::vector<MeshCell> roots(1, MeshCell{ 0, 0, 0 });
+	Subdivide(roots, 0, taskLevel, params, grid, top);
+
+	std::vector<MeshPiece> pieces(roots.size());
+	m_pool.ParallelFor(int(roots.size()), [&](int i) {
+		pieces[i].cells.assign(settings.depth + 1, 0);
+		ExtractPiece(roots[i], taskLevel, params, grid, pieces[i]);
+	});
+
+	m_stats.cells = top.cells;
+	m_stats.evaluations = top.evaluations;
+	size_t pieceBytes = 0;
+	for (const MeshPiece& piece : pieces)
+	{
+		for (int level = 0; level <= settings.depth; level++)
+			m_stats.cells[level] += piece.cells[level];
+		m_stats.surfaceLeaves += piece.surfaceLeaves;
+		m_stats.evaluations += piece.evaluations;
+		pieceBytes += piece.Bytes();
+	}
+	m_stats.extractMs = ElapsedMs(start);
+
+	// Weld the pieces, vertices on the faces between subtrees appear in both
+	start = std::chrono::steady_clock::now();
+	std::vector<uint64_t> keys;
+	for (const MeshPiece& piece : pieces)
+		keys.insert(keys.end(), piece.keys.begin(), piece.keys.end());
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	if (keys.size() > size_t(UINT32_MAX))
+		return false;
+
+	std::vector<size_t> firstIndex(pieces.size() + 1, 0);
+	for (size_t i = 0; i < pieces.size(); i++)
+		firstIndex[i + 1] = firstIndex[i] + pieces[i].indices.size();
+	mesh.vertices.resize(keys.size());
+	mesh.indices.resize(firstIndex.back());
+	m_stats.peakBytes = pieceBytes + keys.capacity() * sizeof(uint64_t) + mesh.vertices.size() * sizeof(float3)
+		+ mesh.indices.size() * sizeof(uint32_t);
+
+	m_pool.ParallelFor(int(pieces.size()), [&](int i) {
+		MeshPiece& piece = pieces[i];
+		std::vector<uint32_t> global(piece.keys.size());
+		for (size_t v = 0; v < piece.keys.size(); v++)
+		{
+			global[v] = uint32_t(std::lower_bound(keys.begin(), keys.end(), piece.keys[v]) - keys.begin());
+			mesh.vertices[global[v]] = piece.positions[v];
+		}
+		for (size_t k = 0; k < piece.indices.size(); k++)
+			mesh.indices[firstIndex[i] + k] = global[piece.indices[k]];
+		piece = MeshPiece();
+	});
+
+	m_stats.vertices = (long long)mesh.vertices.size();
+	m_stats.triangles = (long long)mesh.indices.size() / 3;
+	m_stats.weldMs = ElapsedMs(start);
+	return true;
+}
+
+// Buffered binary and text output, the meshes run to hundreds of megabytes
+class MeshFile
+{
+public:
+	explicit MeshFile(const std::string& fileName) : m_file(fopen(fileName.c_str(), "wb")) { m_buffer.reserve(g_meshWriteBuffer); }
+	~MeshFile()
+	{
+		if (m_file)
+			fclose(m_file);
+	}
+
+	bool IsOpen() const { return m_file != nullptr; }
+
+	void Write(const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+		if (m_buffer.size() >= g_meshWriteBuffer)
+			Flush();
+	}
+
+	bool Close()
+	{
+		Flush();
+		bool ok = ferror(m_file) == 0;
+		ok = fclose(m_file) == 0 && ok;
+		m_file = nullptr;
+		return ok;
+	}
+private:
+	FILE* m_file;
+	std::vector<uint8_t> m_buffer;
+
+	void Flush()
+	{
+		fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+		m_buffer.clear();
+	}
+};
+
+bool WritePly(const std::string& fileName, const Mesh& mesh)
+{
+	MeshFile file(fileName);
+	if (!file.IsOpen())
+		return false;
+
+	char header[256];
+	int length = snprintf(header, sizeof(header),
+		"ply\nformat binary_little_endian 1.0\nelement vertex %zu\nproperty float x\nproperty float y\nproperty float z\n"
+		"element face %zu\nproperty list uchar int vertex_indices\nend_header\n",
+		mesh.vertices.size(), mesh.indices.size() / 3);
+	file.Write(header, size_t(length));
+
+	// x86 is little endian already
+	file.Write(mesh.vertices.data(), mesh.vertices.size() * sizeof(float3));
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		uint8_t face[13];
+		face[0] = 3;
+		memcpy(face + 1, &mesh.indices[i], 12);
+		file.Write(face, sizeof(face));
+	}
+	return file.Close();
+}
+
+bool WriteObj(const std::string& fileName, const Mesh& mesh)
+{
+	MeshFile file(fileName);
+	if (!file.IsOpen())
+		return false;
+
+	char line[128];
+	for (const float3& v : mesh.vertices)
+		file.Write(line, size_t(snprintf(line, sizeof(line), "v %.7g %.7g %.7g\n", v.x, v.y, v.z)));
+
+	// OBJ counts vertices from 1
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		int length = snprintf(line, sizeof(line), "f %u %u %u\n", mesh.indices[i] + 1, mesh.indices[i + 1] + 1, mesh.indices[i + 2] + 1);
+		file.Write(line, size_t(length));
+	}
+	return file.Close();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+//------------------------------
+//- meshexport.h
+//------------------------------
+
+// Mesh extraction of the fractal for other tools. A sparse octree over the bounding sphere is only
+// subdivided where the DE at a cell's centre leaves room for the surface inside it, down to leaves
+// 2^depth to the side, and marching cubes runs on those leaves. The subtrees below the first few
+// levels are extracted in parallel on the pool, each with vertices of its own, and welded by edge
+// at the end, so memory follows the surface rather than the grid
+
+// Includes
+#include "hlslmath.h"
+#include "kernel.h"
+#include "threadpool.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Deepest octree, keeps every edge's key within 64 bits
+static const int g_maxMeshDepth = 16;
+
+struct MeshSettings
+{
+	// Leaf cells per axis are 2^depth
+	int depth = 9;
+	// The surface is taken where the DE equals this many leaf cells, so it closes at the leaves' scale
+	float isoCells = 0.5f;
+	// Keep every cell instead of pruning by the DE, to check the pruning against
+	bool dense = false;
+};
+
+struct MeshStats
+{
+	// Cells whose centre the DE was evaluated at per level, and leaves the surface passes through
+	std::vector<long long> cells;
+	long long surfaceLeaves = 0;
+	// DE evaluations at cell centres and leaf corners
+	long long evaluations = 0;
+	long long vertices = 0;
+	long long triangles = 0;
+	double extractMs = 0.0;
+	double weldMs = 0.0;
+	// Most memory the cells and mesh buffers held at once
+	size_t peakBytes = 0;
+};
+
+struct Mesh
+{
+	std::vector<float3> vertices;
+	// Three vertex indices per triangle, counter-clockwise seen from outside
+	std::vector<uint32_t> indices;
+};
+
+class MeshExtractor
+{
+public:
+	// Constructor
+	MeshExtractor(ThreadPool& pool);
+
+	// Extract the surface of the fractal params describe
+	bool Extract(const FractalOptions& params, const MeshSettings& settings, Mesh& mesh);
+
+	const MeshStats& GetStats() const { return m_stats; }
+private:
+	ThreadPool& m_pool;
+	MeshStats m_stats;
+};
+
+// Binary little endian PLY, and Wavefront OBJ
+bool WritePly(const std::string& fileName, const Mesh& mesh);
+bool WriteObj(const std::string& fileName, const Mesh& mesh);
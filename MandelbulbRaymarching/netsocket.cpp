@@ -0,0 +1,235 @@
+//------------------------------
+//- netsocket.cpp
+//------------------------------
+
+// Includes
+#include "netsocket.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET NativeSocket;
+typedef int SocketLength;
+#define CloseNativeSocket closesocket
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int NativeSocket;
+typedef socklen_t SocketLength;
+#define CloseNativeSocket close
+#endif
+
+static NativeSocket Native(intptr_t handle)
+{
+	return NativeSocket(handle);
+}
+
+// Destructor
+NetSocket::~NetSocket()
+{
+	Close();
+}
+
+NetSocket::NetSocket(NetSocket&& other) noexcept
+	: m_handle(other.m_handle)
+{
+	other.m_handle = g_invalid;
+}
+
+NetSocket& NetSocket::operator=(NetSocket&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		m_handle = other.m_handle;
+		other.m_handle = g_invalid;
+	}
+	return *this;
+}
+
+bool NetSocket::Startup()
+{
+#if defined(_WIN32)
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+	return true;
+#endif
+}
+
+bool NetSocket::Listen(uint16_t port)
+{
+	Close();
+	NativeSocket handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (handle == NativeSocket(g_invalid))
+		return false;
+	m_handle = intptr_t(handle);
+
+	// Restarting a coordinator should not wait out the old socket's TIME_WAIT
+	int reuse = 1;
+	setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(handle, SOMAXCONN) != 0)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool NetSocket::Accept(NetSocket& client)
+{
+	NativeSocket handle = accept(Native(m_handle), nullptr, nullptr);
+	if (handle == NativeSocket(g_invalid))
+		return false;
+	client.Close();
+	client.m_handle = intptr_t(handle);
+
+	// Tile requests are small and latency bound
+	int noDelay = 1;
+	setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+	return true;
+}
+
+bool NetSocket::Connect(const std::string& host, uint16_t port)
+{
+	Close();
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	addrinfo* addresses = nullptr;
+	std::string service = std::to_string(port);
+	if (getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses) != 0)
+		return false;
+
+	for (addrinfo* address = addresses; address; address = address->ai_next)
+	{
+		NativeSocket handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (handle == NativeSocket(g_invalid))
+			continue;
+		if (connect(handle, address->ai_addr, SocketLength(address->ai_addrlen)) == 0)
+		{
+			m_handle = intptr_t(handle);
+			break;
+		}
+		CloseNativeSocket(handle);
+	}
+	freeaddrinfo(addresses);
+
+	if (!IsOpen())
+		return false;
+	int noDelay = 1;
+	setsockopt(Native(m_handle), IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+	return true;
+}
+
+void NetSocket::Close()
+{
+	if (IsOpen())
+		CloseNativeSocket(Native(m_handle));
+	m_handle = g_invalid;
+}
+
+bool NetSocket::SendAll(const void* data, size_t size)
+{
+	const char* bytes = static_cast<const char*>(data);
+	while (size > 0)
+	{
+		// Chunked so the length fits an int on Windows
+		int chunk = size < (1u << 30) ? int(size) : (1 << 30);
+#if defined(_WIN32)
+		int sent = send(Native(m_handle), bytes, chunk, 0);
+#else
+		// A dead peer must fail the send rather than raise SIGPIPE
+		long sent = send(Native(m_handle), bytes, size_t(chunk), MSG_NOSIGNAL);
+#endif
+		if (sent <= 0)
+			return false;
+		bytes += sent;
+		size -= size_t(sent);
+	}
+	return true;
+}
+
+long long NetSocket::Receive(void* data, size_t size)
+{
+	int chunk = size < (1u << 30) ? int(size) : (1 << 30);
+	return (long long)recv(Native(m_handle), static_cast<char*>(data), chunk, 0);
+}
+
+bool NetSocket::ReceiveAll(void* data, size_t size)
+{
+	char* bytes = static_cast<char*>(data);
+	while (size > 0)
+	{
+		long long received = Receive(bytes, size);
+		if (received <= 0)
+			return false;
+		bytes += received;
+		size -= size_t(received);
+	}
+	return true;
+}
+
+uint16_t NetSocket::GetPort() const
+{
+	sockaddr_in address = {};
+	SocketLength length = sizeof(address);
+	if (getsockname(Native(m_handle), reinterpret_cast<sockaddr*>(&address), &length) != 0)
+		return 0;
+	return ntohs(address.sin_port);
+}
+
+bool WaitReadable(const std::vector<const NetSocket*>& sockets, int timeoutMs, std::vector<bool>& ready)
+{
+	fd_set readable;
+	FD_ZERO(&readable);
+	NativeSocket highest = 0;
+	for (const NetSocket* socket : sockets)
+	{
+		NativeSocket handle = Native(socket->m_handle);
+		FD_SET(handle, &readable);
+		highest = handle > highest ? handle : highest;
+	}
+
+	timeval timeout;
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_usec = (timeoutMs % 1000) * 1000;
+	int count = select(int(highest) + 1, &readable, nullptr, nullptr, &timeout);
+
+	ready.assign(sockets.size(), false);
+	if (count <= 0)
+		return false;
+	for (size_t i = 0; i < sockets.size(); i++)
+		ready[i] = FD_ISSET(Native(sockets[i]->m_handle), &readable) != 0;
+	return true;
+}
+
+bool ParseHostPort(const std::string& text, std::string& host, uint16_t& port)
+{
+	size_t colon = text.rfind(':');
+	host = colon == std::string::npos ? "127.0.0.1" : text.substr(0, colon);
+	std::string number = colon == std::string::npos ? text : text.substr(colon + 1);
+
+	char* end;
+	long value = strtol(number.c_str(), &end, 10);
+	if (number.empty() || *end || value <= 0 || value > 65535 || host.empty())
+		return false;
+	port = uint16_t(value);
+	return true;
+}
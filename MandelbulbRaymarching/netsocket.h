@@ -0,0 +1,58 @@
+#pragma once
+
+//------------------------------
+//- netsocket.h
+//------------------------------
+
+// Minimal blocking TCP sockets over Winsock or BSD sockets, enough for the tile protocol
+
+// Includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class NetSocket
+{
+public:
+	// Constructor
+	NetSocket() = default;
+	~NetSocket();
+
+	NetSocket(const NetSocket&) = delete;
+	NetSocket& operator=(const NetSocket&) = delete;
+	NetSocket(NetSocket&& other) noexcept;
+	NetSocket& operator=(NetSocket&& other) noexcept;
+
+	// Once per process before any socket is made, a no-op outside Windows
+	static bool Startup();
+
+	// Listen on every interface, port 0 picks a free one that GetPort then returns
+	bool Listen(uint16_t port);
+	bool Accept(NetSocket& client);
+	// host is a name or dotted address
+	bool Connect(const std::string& host, uint16_t port);
+	void Close();
+
+	// Send everything or fail
+	bool SendAll(const void* data, size_t size);
+	// Bytes received, 0 once the peer has closed, negative on errors
+	long long Receive(void* data, size_t size);
+	// Receive exactly size bytes or fail
+	bool ReceiveAll(void* data, size_t size);
+
+	bool IsOpen() const { return m_handle != g_invalid; }
+	uint16_t GetPort() const;
+private:
+	friend bool WaitReadable(const std::vector<const NetSocket*>& sockets, int timeoutMs, std::vector<bool>& ready);
+
+	static const intptr_t g_invalid = -1;
+	intptr_t m_handle = g_invalid;
+};
+
+// Wait up to timeoutMs for any of sockets to have data or a pending connection. ready gets one
+// entry per socket, false if the wait timed out
+bool WaitReadable(const std::vector<const NetSocket*>& sockets, int timeoutMs, std::vector<bool>& ready);
+
+// Split "host:port", the host defaults to 127.0.0.1 when only a port is given
+bool ParseHostPort(const std::string& text, std::string& host, uint16_t& port);
@@ -0,0 +1,60 @@
+#pragma once
+
+//------------------------------
+//- pixelcost.h
+//------------------------------
+
+// Per pixel work counters, for finding out whether frame time goes on primary rays, normals,
+// shadows or the DE itself. They only exist when the build defines MANDELBULB_PIXEL_COST,
+// otherwise every PIXEL_COST macro expands to nothing and the kernels are exactly as before.
+// Every DE evaluation counts one step against the current stage, and every orbit iteration
+// inside it one iteration
+
+// Includes
+#include <cstdint>
+
+enum class PixelCounter : int
+{
+	// DE evaluations of the primary march and their orbit iterations
+	MarchSteps,
+	MarchIterations,
+	// NormalEstimate's DE evaluations and their orbit iterations
+	NormalEvaluations,
+	NormalIterations,
+	// SoftShadow steps towards each light, and the orbit iterations of all of them
+	ShadowSteps0,
+	ShadowSteps1,
+	ShadowSteps2,
+	ShadowIterations,
+	Count
+};
+
+const int g_pixelCounterCount = int(PixelCounter::Count);
+
+// Name used in file names and reports, e.g. march_steps
+const char* PixelCounterName(PixelCounter counter);
+
+#if defined(MANDELBULB_PIXEL_COST)
+
+// Counters of the pixel the calling thread is shading, null while nothing is being counted
+extern thread_local uint32_t* t_pixelCost;
+// Where the calling thread's DE evaluations and orbit iterations are counted
+extern thread_local PixelCounter t_pixelCostSteps;
+extern thread_local PixelCounter t_pixelCostIterations;
+
+// Count the DE evaluations that follow against a stage
+#define PIXEL_COST_STAGE(steps, iterations) (t_pixelCostSteps = PixelCounter::steps, t_pixelCostIterations = PixelCounter::iterations)
+#define PIXEL_COST_SHADOW_STAGE(light) \
+	(t_pixelCostSteps = PixelCounter(int(PixelCounter::ShadowSteps0) + (light)), t_pixelCostIterations = PixelCounter::ShadowIterations)
+// One DE evaluation, and one orbit iteration within it
+#define PIXEL_COST_STEP() do { if (t_pixelCost) t_pixelCost[int(t_pixelCostSteps)]++; } while (0)
+#define PIXEL_COST_ITERATION() do { if (t_pixelCost) t_pixelCost[int(t_pixelCostIterations)]++; } while (0)
+
+#else
+
+#define PIXEL_COST_STAGE(steps, iterations) ((void)0)
+#define PIXEL_COST_SHADOW_STAGE(light) ((void)0)
+#define PIXEL_COST_STEP() ((void)0)
+#define PIXEL_COST_ITERATION() ((void)0)
+
+#endif
@@ -0,0 +1,405 @@
+//------------------------------
+//- pngwriter.cpp
+//------------------------------
+
+// Self contained PNG encoder using fixed Huffman deflate blocks with LZ77 matching,
+// so the headless renderer has no dependency on zlib or WIC
+
+// Includes
+#include "pngwriter.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// Deflate length and distance code tables, RFC 1951 section 3.2.5
+static const int g_lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const int g_lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const int g_distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const int g_distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// LZ77 search limits
+static const int g_windowSize = 32768;
+static const int g_hashBits = 15;
+static const int g_maxChain = 32;
+static const int g_maxMatch = 258;
+
+struct Crc32Table
+{
+	uint32_t entries[256];
+
+	Crc32Table()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+			{
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			entries[i] = c;
+		}
+	}
+};
+
+static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+	// Built once on first use, safe with several images being written at once
+	static const Crc32Table crcTable;
+	const uint32_t* table = crcTable.entries;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+	{
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static uint32_t Adler32(uint32_t adler, const uint8_t* data, size_t size)
+{
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (size > 0)
+	{
+		// Largest block before the sums can overflow
+		size_t block = size < 5552 ? size : 5552;
+		size -= block;
+		for (size_t i = 0; i < block; i++)
+		{
+			a += data[i];
+			b += a;
+		}
+		data += block;
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+static void PutBigEndian(uint8_t* p, uint32_t value)
+{
+	p[0] = uint8_t(value >> 24);
+	p[1] = uint8_t(value >> 16);
+	p[2] = uint8_t(value >> 8);
+	p[3] = uint8_t(value);
+}
+
+static int Paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	if (pb <= pc)
+		return b;
+	return c;
+}
+
+// Destructor
+PngWriter::~PngWriter()
+{
+	if (m_file)
+		fclose(m_file);
+}
+
+bool PngWriter::Open(const std::string& fileName, int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		return false;
+
+	m_file = fopen(fileName.c_str(), "wb");
+	if (!m_file)
+		return false;
+
+	m_width = width;
+	m_height = height;
+	m_rowsWritten = 0;
+	m_compressedSize = 0;
+	m_adler = 1;
+	m_bitBuffer = 0;
+	m_bitCount = 0;
+	m_headerWritten = false;
+	m_prevRow.assign(size_t(width) * 3, 0);
+
+	// Signature
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, 1, sizeof(signature), m_file);
+
+	// Header, 8-bit truecolour, no interlace
+	uint8_t ihdr[13];
+	PutBigEndian(ihdr, uint32_t(width));
+	PutBigEndian(ihdr + 4, uint32_t(height));
+	ihdr[8] = 8;
+	ihdr[9] = 2;
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	WriteChunk("IHDR", ihdr, sizeof(ihdr));
+
+	return ferror(m_file) == 0;
+}
+
+bool PngWriter::WriteRows(const uint8_t* rows, int rowCount)
+{
+	if (!m_file || rowCount <= 0 || m_rowsWritten + rowCount > m_height)
+		return false;
+
+	size_t stride = size_t(m_width) * 3;
+	m_filtered.resize((stride + 1) * size_t(rowCount));
+
+	// Pick the filter with the smallest sum of absolute residuals per row
+	std::vector<uint8_t> candidate[4];
+	for (int f = 0; f < 4; f++)
+	{
+		candidate[f].resize(stride);
+	}
+
+	for (int y = 0; y < rowCount; y++)
+	{
+		const uint8_t* row = rows + stride * size_t(y);
+		const uint8_t* up = m_prevRow.data();
+
+		int best = 0;
+		uint64_t bestScore = UINT64_MAX;
+		for (int f = 0; f < 4; f++)
+		{
+			uint8_t* out = candidate[f].data();
+			uint64_t score = 0;
+			for (size_t i = 0; i < stride; i++)
+			{
+				int a = i >= 3 ? row[i - 3] : 0;
+				int b = up[i];
+				int c = i >= 3 ? up[i - 3] : 0;
+				int predictor = 0;
+				switch (f)
+				{
+				case 1: predictor = a; break;
+				case 2: predictor = b; break;
+				case 3: predictor = Paeth(a, b, c); break;
+				}
+				out[i] = uint8_t(row[i] - predictor);
+				score += uint64_t(abs(int(int8_t(out[i]))));
+			}
+			if (score < bestScore)
+			{
+				bestScore = score;
+				best = f;
+			}
+		}
+
+		// Filter type 3 in our numbering is Paeth, which is type 4 in the PNG spec
+		uint8_t* dst = m_filtered.data() + (stride + 1) * size_t(y);
+		dst[0] = uint8_t(best == 3 ? 4 : best);
+		memcpy(dst + 1, candidate[best].data(), stride);
+		memcpy(m_prevRow.data(), row, stride);
+	}
+
+	m_rowsWritten += rowCount;
+
+	// zlib header before the first block
+	if (!m_headerWritten)
+	{
+		m_out.push_back(0x78);
+		m_out.push_back(0x01);
+		m_headerWritten = true;
+	}
+
+	m_adler = Adler32(m_adler, m_filtered.data(), m_filtered.size());
+	Deflate(m_filtered.data(), m_filtered.size(), false);
+
+	// Flush whole bytes, a partial byte stays in the bit buffer for the next block
+	WriteChunk("IDAT", m_out.data(), m_out.size());
+	m_compressedSize += m_out.size();
+	m_out.clear();
+
+	return ferror(m_file) == 0;
+}
+
+bool PngWriter::Close()
+{
+	if (!m_file)
+		return false;
+
+	bool complete = m_rowsWritten == m_height;
+	if (complete)
+	{
+		// Empty final block, then pad to a byte and append the checksum
+		PutBits(1, 1);
+		PutBits(1, 2);
+		PutHuffman(0, 7);
+		if (m_bitCount > 0)
+			PutBits(0, 8 - m_bitCount);
+
+		uint8_t adler[4];
+		PutBigEndian(adler, m_adler);
+		m_out.insert(m_out.end(), adler, adler + 4);
+
+		WriteChunk("IDAT", m_out.data(), m_out.size());
+		m_compressedSize += m_out.size();
+		m_out.clear();
+
+		WriteChunk("IEND", nullptr, 0);
+	}
+
+	complete = complete && ferror(m_file) == 0;
+	complete = fclose(m_file) == 0 && complete;
+	m_file = nullptr;
+	return complete;
+}
+
+void PngWriter::WriteChunk(const char* type, const uint8_t* data, size_t size)
+{
+	uint8_t header[8];
+	PutBigEndian(header, uint32_t(size));
+	memcpy(header + 4, type, 4);
+	fwrite(header, 1, 8, m_file);
+	if (size > 0)
+		fwrite(data, 1, size, m_file);
+
+	uint32_t crc = Crc32(0, header + 4, 4);
+	crc = Crc32(crc, data, size);
+	uint8_t footer[4];
+	PutBigEndian(footer, crc);
+	fwrite(footer, 1, 4, m_file);
+}
+
+// Deflate packs bits least significant first
+void PngWriter::PutBits(uint32_t bits, int count)
+{
+	m_bitBuffer |= uint64_t(bits) << m_bitCount;
+	m_bitCount += count;
+	while (m_bitCount >= 8)
+	{
+		m_out.push_back(uint8_t(m_bitBuffer));
+		m_bitBuffer >>= 8;
+		m_bitCount -= 8;
+	}
+}
+
+// Huffman codes are packed most significant bit first
+void PngWriter::PutHuffman(uint32_t code, int length)
+{
+	uint32_t reversed = 0;
+	for (int i = 0; i < length; i++)
+	{
+		reversed = (reversed << 1) | ((code >> i) & 1);
+	}
+	PutBits(reversed, length);
+}
+
+// Fixed literal/length code, RFC 1951 section 3.2.6
+void PngWriter::PutLiteral(int literal)
+{
+	if (literal < 144)
+		PutHuffman(0x30 + literal, 8);
+	else if (literal < 256)
+		PutHuffman(0x190 + (literal - 144), 9);
+	else if (literal < 280)
+		PutHuffman(literal - 256, 7);
+	else
+		PutHuffman(0xC0 + (literal - 280), 8);
+}
+
+void PngWriter::PutMatch(int length, int distance)
+{
+	int code = 28;
+	while (g_lengthBase[code] > length)
+		code--;
+	PutLiteral(257 + code);
+	PutBits(length - g_lengthBase[code], g_lengthExtra[code]);
+
+	int distCode = 29;
+	while (g_distBase[distCode] > distance)
+		distCode--;
+	PutHuffman(distCode, 5);
+	PutBits(distance - g_distBase[distCode], g_distExtra[distCode]);
+}
+
+// One fixed Huffman block covering the whole buffer, greedy matching over hash chains
+void PngWriter::Deflate(const uint8_t* data, size_t size, bool final)
+{
+	PutBits(final ? 1 : 0, 1);
+	PutBits(1, 2);
+
+	std::vector<int> head(size_t(1) << g_hashBits, -1);
+	std::vector<int> prev(g_windowSize, -1);
+
+	auto hash = [data](size_t i) {
+		uint32_t v = uint32_t(data[i]) | (uint32_t(data[i + 1]) << 8) | (uint32_t(data[i + 2]) << 16);
+		return (v * 2654435761u) >> (32 - g_hashBits);
+	};
+	auto insert = [&](size_t i) {
+		uint32_t h = hash(i);
+		prev[i & (g_windowSize - 1)] = head[h];
+		head[h] = int(i);
+	};
+
+	size_t i = 0;
+	while (i < size)
+	{
+		int bestLength = 0;
+		int bestDistance = 0;
+
+		if (i + 3 <= size)
+		{
+			size_t maxLength = size - i < size_t(g_maxMatch) ? size - i : size_t(g_maxMatch);
+			int candidate = head[hash(i)];
+			for (int chain = 0; candidate >= 0 && chain < g_maxChain; chain++)
+			{
+				size_t distance = i - size_t(candidate);
+				if (distance > size_t(g_windowSize))
+					break;
+
+				const uint8_t* a = data + candidate;
+				const uint8_t* b = data + i;
+				size_t length = 0;
+				while (length < maxLength && a[length] == b[length])
+					length++;
+
+				if (int(length) > bestLength)
+				{
+					bestLength = int(length);
+					bestDistance = int(distance);
+					if (length == maxLength)
+						break;
+				}
+				candidate = prev[size_t(candidate) & (g_windowSize - 1)];
+			}
+		}
+
+		if (bestLength >= 3)
+		{
+			PutMatch(bestLength, bestDistance);
+			for (int k = 0; k < bestLength; k++, i++)
+			{
+				if (i + 3 <= size)
+					insert(i);
+			}
+		}
+		else
+		{
+			PutLiteral(data[i]);
+			if (i + 3 <= size)
+				insert(i);
+			i++;
+		}
+	}
+
+	// End of block
+	PutLiteral(256);
+}
+
+bool WritePng(const std::string& fileName, const Image& image)
+{
+	PngWriter writer;
+	if (!writer.Open(fileName, image.width, image.height))
+		return false;
+	if (!writer.WriteRows(image.pixels.data(), image.height))
+	{
+		writer.Close();
+		return false;
+	}
+	return writer.Close();
+}
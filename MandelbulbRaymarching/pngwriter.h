@@ -0,0 +1,77 @@
+#pragma once
+
+//------------------------------
+//- pngwriter.h
+//------------------------------
+
+// Includes
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// 8-bit RGB image, rows top to bottom
+struct Image
+{
+	int width = 0;
+	int height = 0;
+	std::vector<uint8_t> pixels;
+
+	void Resize(int w, int h)
+	{
+		width = w;
+		height = h;
+		pixels.assign(size_t(w) * size_t(h) * 3, 0);
+	}
+
+	uint8_t* Row(int y) { return pixels.data() + size_t(y) * size_t(width) * 3; }
+	const uint8_t* Row(int y) const { return pixels.data() + size_t(y) * size_t(width) * 3; }
+};
+
+// Streaming PNG encoder. Rows can be written in any number of batches, each batch is
+// filtered, deflated and flushed as its own IDAT chunk so memory stays at one batch
+class PngWriter
+{
+public:
+	PngWriter() = default;
+	~PngWriter();
+
+	PngWriter(const PngWriter&) = delete;
+	PngWriter& operator=(const PngWriter&) = delete;
+
+	// Write the signature and header for an 8-bit RGB image
+	bool Open(const std::string& fileName, int width, int height);
+	// Append rows, 3 bytes per pixel
+	bool WriteRows(const uint8_t* rows, int rowCount);
+	// Finish the stream, fails if fewer rows than the header promised were written
+	bool Close();
+
+	// Bytes of compressed image data written so far
+	uint64_t GetCompressedSize() const { return m_compressedSize; }
+private:
+	FILE* m_file = nullptr;
+	int m_width = 0;
+	int m_height = 0;
+	int m_rowsWritten = 0;
+	uint64_t m_compressedSize = 0;
+
+	// Running zlib state
+	uint32_t m_adler = 1;
+	uint64_t m_bitBuffer = 0;
+	int m_bitCount = 0;
+	bool m_headerWritten = false;
+
+	std::vector<uint8_t> m_prevRow;
+	std::vector<uint8_t> m_filtered;
+	std::vector<uint8_t> m_out;
+
+	void WriteChunk(const char* type, const uint8_t* data, size_t size);
+	void PutBits(uint32_t bits, int count);
+	void PutHuffman(uint32_t code, int length);
+	void PutLiteral(int literal);
+	void PutMatch(int length, int distance);
+	void Deflate(const uint8_t* data, size_t size, bool final);
+};
+
+// Convenience wrapper writing a whole image
+bool WritePng(const std::string& fileName, const Image& image);
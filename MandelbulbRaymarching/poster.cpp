@@ -0,0 +1,126 @@
+//------------------------------
+//- poster.cpp
+//------------------------------
+
+// Includes
+#include "poster.h"
+
+#include <chrono>
+#include <vector>
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Constructor
+PosterRenderer::PosterRenderer(ThreadPool& pool)
+	: m_pool(pool), m_renderer(pool)
+{
+}
+
+bool PosterRenderer::Render(const FrameConstants& constants, const PosterSettings& settings, PosterSink& sink,
+	const std::function<void(int rows)>& onStrip)
+{
+	auto start = std::chrono::steady_clock::now();
+	m_stats = {};
+
+	int width = constants.screenWidth;
+	int height = constants.screenHeight;
+	if (width <= 0 || height <= 0 || width > g_maxPosterSize || height > g_maxPosterSize)
+		return false;
+
+	// Whole tiles per strip so no tile straddles two
+	int stripRows = settings.stripRows > m_tileSize ? settings.stripRows : m_tileSize;
+	stripRows = (stripRows + m_tileSize - 1) / m_tileSize * m_tileSize;
+	stripRows = stripRows < height ? stripRows : height;
+	int strips = (height + stripRows - 1) / stripRows;
+	int inFlight = settings.stripsInFlight > 0 ? settings.stripsInFlight : 3;
+	inFlight = inFlight < strips ? inFlight : strips;
+	m_stats.stripRows = stripRows;
+	m_stats.strips = strips;
+	m_stats.stripsInFlight = inFlight;
+
+	// A slot holds one strip from render to write, strip i uses slot i % inFlight. Strip rows go
+	// to the top of the slot's image
+	struct Slot
+	{
+		TaskGroup group;
+		Image image;
+	};
+	std::vector<Slot> slots(inFlight);
+	for (Slot& slot : slots)
+	{
+		slot.image.Resize(width, stripRows);
+		m_stats.stripBytes += slot.image.pixels.size();
+	}
+
+	m_renderer.m_tileSize = m_tileSize;
+	m_renderer.m_wavefront = m_wavefront;
+	m_renderer.m_brickMap = m_brickMap;
+	FrameSetup setup = CreateFrameSetup(constants);
+	m_renderer.BeginRegions(setup);
+
+	if (!sink.Begin(width, height))
+	{
+		m_renderer.EndRegions();
+		return false;
+	}
+
+	int tilesX = (width + m_tileSize - 1) / m_tileSize;
+	auto submit = [&](int strip) {
+		Slot& slot = slots[strip % inFlight];
+		int y0 = strip * stripRows;
+		int y1 = y0 + stripRows < height ? y0 + stripRows : height;
+		int tilesY = (y1 - y0 + m_tileSize - 1) / m_tileSize;
+		for (int tile = 0; tile < tilesX * tilesY; tile++)
+		{
+			m_pool.Run(slot.group, [&, tile, y0, y1]() {
+				int x0 = (tile % tilesX) * m_tileSize;
+				int ty0 = y0 + (tile / tilesX) * m_tileSize;
+				int x1 = x0 + m_tileSize < width ? x0 + m_tileSize : width;
+				int ty1 = ty0 + m_tileSize < y1 ? ty0 + m_tileSize : y1;
+				m_renderer.RenderRegion(constants, setup, x0, ty0, x1, ty1, slot.image, 0, y0);
+			});
+		}
+	};
+
+	bool ok = true;
+	int submitted = 0;
+	for (int strip = 0; strip < strips; strip++)
+	{
+		// Keep every slot busy, the slot of a strip is free once the strip before it was written
+		while (submitted < strips && submitted < strip + inFlight)
+			submit(submitted++);
+
+		// Renders tiles of this and later strips while this one finishes
+		Slot& slot = slots[strip % inFlight];
+		auto waitStart = std::chrono::steady_clock::now();
+		m_pool.Wait(slot.group);
+		m_stats.waitMs += ElapsedMs(waitStart);
+
+		// The pool carries on with the later strips meanwhile
+		auto writeStart = std::chrono::steady_clock::now();
+		int rows = strip + 1 < strips ? stripRows : height - strip * stripRows;
+		if (!sink.WriteStrip(slot.image, rows))
+		{
+			ok = false;
+			// Let the strips already queued finish before their slots go away
+			for (Slot& other : slots)
+				m_pool.Wait(other.group);
+			break;
+		}
+		m_stats.writeMs += ElapsedMs(writeStart);
+
+		if (onStrip)
+			onStrip(strip * stripRows + rows);
+	}
+
+	m_renderer.EndRegions();
+	m_stats.marchSteps = m_renderer.GetMarchSteps();
+	m_stats.shadows = m_renderer.GetShadowStats();
+
+	ok = sink.End() && ok;
+	m_stats.totalMs = ElapsedMs(start);
+	return ok;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+//------------------------------
+//- poster.h
+//------------------------------
+
+// Poster rendering for images far bigger than memory. The frame is cut into horizontal strips,
+// each rendered with its tiles spread over the pool and handed to a sink in order by the calling
+// thread. A fixed number of strips are in flight, so later strips render while the sink compresses
+// earlier ones, and memory stays at those strips however big the poster is
+
+// Includes
+#include "cpurenderer.h"
+#include "kernel.h"
+#include "pngwriter.h"
+#include "threadpool.h"
+#include "tiffwriter.h"
+
+#include <functional>
+#include <string>
+
+// Largest poster edge, 64k pixels
+static const int g_maxPosterSize = 65536;
+
+// Where finished strips go, in order from the top
+class PosterSink
+{
+public:
+	virtual ~PosterSink() = default;
+
+	virtual bool Begin(int width, int height) = 0;
+	virtual bool WriteStrip(const Image& strip, int rowCount) = 0;
+	virtual bool End() = 0;
+};
+
+// Deflated PNG, each strip its own IDAT chunk
+class PngPosterSink : public PosterSink
+{
+public:
+	explicit PngPosterSink(const std::string& fileName) : m_fileName(fileName) {}
+
+	bool Begin(int width, int height) override { return m_writer.Open(m_fileName, width, height); }
+	bool WriteStrip(const Image& strip, int rowCount) override { return m_writer.WriteRows(strip.pixels.data(), rowCount); }
+	bool End() override { return m_writer.Close(); }
+private:
+	std::string m_fileName;
+	PngWriter m_writer;
+};
+
+// Uncompressed TIFF, BigTIFF past 4 GB, one TIFF strip per poster strip
+class TiffPosterSink : public PosterSink
+{
+public:
+	TiffPosterSink(const std::string& fileName, int dpi) : m_fileName(fileName), m_dpi(dpi) {}
+
+	bool Begin(int width, int height) override { return m_writer.Open(m_fileName, width, height, m_dpi); }
+	bool WriteStrip(const Image& strip, int rowCount) override { return m_writer.WriteRows(strip.pixels.data(), rowCount); }
+	bool End() override { return m_writer.Close(); }
+
+	bool IsBigTiff() const { return m_writer.IsBigTiff(); }
+private:
+	std::string m_fileName;
+	int m_dpi;
+	TiffWriter m_writer;
+};
+
+struct PosterSettings
+{
+	// Rows per strip, rounded up to whole tiles
+	int stripRows = 64;
+	// Strips being rendered or waiting to be written at once, 0 for the default of 3
+	int stripsInFlight = 0;
+};
+
+struct PosterStats
+{
+	double totalMs = 0.0;
+	// Time the calling thread spent handing strips to the sink, and waiting for the next strip
+	double writeMs = 0.0;
+	double waitMs = 0.0;
+	int stripRows = 0;
+	int strips = 0;
+	int stripsInFlight = 0;
+	// Memory held by the strips in flight
+	size_t stripBytes = 0;
+	// DE work over the whole poster
+	long long marchSteps = 0;
+	ShadowStats shadows;
+};
+
+class PosterRenderer
+{
+public:
+	// Settings the strips' CpuRenderer gets
+	int m_tileSize = 16;
+	bool m_wavefront = true;
+	const BrickMap* m_brickMap = nullptr;
+
+	// Constructor
+	PosterRenderer(ThreadPool& pool);
+
+	// Render the constants' view at their screen size, which may be up to g_maxPosterSize on each
+	// side, and stream it to sink. onStrip, when set, is called on the calling thread after each
+	// strip is written with the rows written so far
+	bool Render(const FrameConstants& constants, const PosterSettings& settings, PosterSink& sink,
+		const std::function<void(int rows)>& onStrip = nullptr);
+
+	const PosterStats& GetStats() const { return m_stats; }
+private:
+	ThreadPool& m_pool;
+	CpuRenderer m_renderer;
+	PosterStats m_stats;
+};
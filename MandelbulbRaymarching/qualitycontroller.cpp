@@ -0,0 +1,164 @@
+//------------------------------
+//- qualitycontroller.cpp
+//------------------------------
+
+// Includes
+#include "qualitycontroller.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+	// Detail 0, detail 1 is the selected quality level with the full DE iterations
+	const int g_cheapMarchIterations = 48;
+	const float g_cheapHitEpsilon = 0.004f;
+	const int g_cheapDeIterations = 12;
+
+	// Shortest and longest wait before trying a resolution raise again, in frames
+	const int g_minRaiseBackoff = 60;
+	const int g_maxRaiseBackoff = 960;
+}
+
+const char* QualityActionName(QualityAction action)
+{
+	switch (action)
+	{
+	case QualityAction::Settle: return "settle";
+	case QualityAction::RaiseDetail: return "raise detail";
+	case QualityAction::LowerDetail: return "lower detail";
+	case QualityAction::RaiseResolution: return "raise resolution";
+	case QualityAction::LowerResolution: return "lower resolution";
+	default: return "hold";
+	}
+}
+
+// Constructor
+QualityController::QualityController()
+{
+	Reset();
+}
+
+void QualityController::Reset()
+{
+	m_pixelStep = 1;
+	m_detail = 1.0f;
+	m_averageMs = 0.0;
+	m_hasAverage = false;
+	m_settle = 0;
+	m_raiseBlocked = 0;
+	m_raiseBackoff = g_minRaiseBackoff;
+	m_raisePending = false;
+	m_sinceRaise = 0;
+	m_telemetry = QualityTelemetry();
+}
+
+void QualityController::ChangeResolution(int pixelStep, QualityAction action)
+{
+	m_pixelStep = pixelStep;
+	m_settle = m_settleFrames;
+	m_hasAverage = false;
+	m_telemetry.action = action;
+	m_telemetry.resolutionChanges++;
+}
+
+void QualityController::Update(double frameMs)
+{
+	m_telemetry.frameMs = frameMs;
+	m_telemetry.budgetMs = m_budgetMs;
+	m_telemetry.action = QualityAction::Hold;
+
+	m_averageMs = m_hasAverage ? m_averageMs + m_smoothing * (frameMs - m_averageMs) : frameMs;
+	m_hasAverage = true;
+	m_telemetry.averageMs = m_averageMs;
+
+	m_sinceRaise++;
+	if (m_raiseBlocked > 0)
+		m_raiseBlocked--;
+
+	// Frames still in flight from before a resolution change say nothing about it, the average
+	// starts again from the last of them
+	if (m_settle > 0)
+	{
+		m_settle--;
+		m_hasAverage = m_settle == 0;
+		m_telemetry.action = QualityAction::Settle;
+		return;
+	}
+
+	// Detail moves by the log of how far off the budget the average is
+	float step = m_gain * float(std::log2(m_budgetMs / m_averageMs));
+
+	if (m_averageMs > m_budgetMs * m_upperBand)
+	{
+		// The first judgement after a raise undoes it, and the next try waits twice as long
+		if (m_raisePending)
+		{
+			m_detail = 1.0f;
+			m_raisePending = false;
+			m_raiseBlocked = m_raiseBackoff;
+			m_raiseBackoff = m_raiseBackoff * 2 < g_maxRaiseBackoff ? m_raiseBackoff * 2 : g_maxRaiseBackoff;
+			ChangeResolution(m_pixelStep + 1, QualityAction::LowerResolution);
+		}
+		else if (m_detail > 0.0f)
+		{
+			m_detail = m_detail + step > 0.0f ? m_detail + step : 0.0f;
+			m_telemetry.action = QualityAction::LowerDetail;
+		}
+		else if (m_pixelStep < m_maxPixelStep)
+		{
+			ChangeResolution(m_pixelStep + 1, QualityAction::LowerResolution);
+		}
+	}
+	else if (m_averageMs < m_budgetMs * m_lowerBand)
+	{
+		if (m_detail < 1.0f)
+		{
+			m_detail = m_detail + step < 1.0f ? m_detail + step : 1.0f;
+			m_telemetry.action = QualityAction::RaiseDetail;
+		}
+		else if (m_pixelStep > 1 && m_raiseBlocked == 0)
+		{
+			// Four times the pixels at most, start them at the lowest detail
+			m_detail = 0.0f;
+			m_raisePending = true;
+			m_sinceRaise = 0;
+			ChangeResolution(m_pixelStep - 1, QualityAction::RaiseResolution);
+		}
+	}
+
+	// A raise that held past its first judgements was right, try the next one sooner
+	if (m_raisePending && m_sinceRaise > m_settleFrames * 2)
+	{
+		m_raisePending = false;
+		m_raiseBackoff = g_minRaiseBackoff;
+	}
+}
+
+void QualityController::Apply(FrameConstants& constants)
+{
+	float minDist;
+	int maxIters;
+	float hitPixels;
+	GetQualitySettings(constants.quality, minDist, maxIters, hitPixels);
+
+	// Iterations blend linearly, the epsilon geometrically since the levels are factors apart
+	float detail = m_detail;
+	constants.pixelStep = m_pixelStep;
+	constants.marchIterations = int(float(g_cheapMarchIterations) + float(maxIters - g_cheapMarchIterations) * detail + 0.5f);
+	constants.hitEpsilon = g_cheapHitEpsilon * std::pow(minDist / g_cheapHitEpsilon, detail);
+	constants.deIterations = int(float(g_cheapDeIterations) + float(g_deIterations - g_cheapDeIterations) * detail + 0.5f);
+
+	m_telemetry.pixelStep = constants.pixelStep;
+	m_telemetry.detail = detail;
+	m_telemetry.marchIterations = constants.marchIterations;
+	m_telemetry.hitEpsilon = constants.hitEpsilon;
+	m_telemetry.deIterations = constants.deIterations;
+}
+
+void FormatQualityTelemetry(const QualityTelemetry& telemetry, char* buffer, size_t size)
+{
+	snprintf(buffer, size, "%.1f/%.1f ms, 1/%d res, detail %.2f (%d steps, epsilon %.5f, %d DE iterations), %s",
+		telemetry.averageMs, telemetry.budgetMs, telemetry.pixelStep, telemetry.detail, telemetry.marchIterations,
+		telemetry.hitEpsilon, telemetry.deIterations, QualityActionName(telemetry.action));
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+//------------------------------
+//- qualitycontroller.h
+//------------------------------
+
+// Holds frames to a time budget instead of a fixed quality level. Two knobs are steered from the
+// smoothed frame time. Detail is continuous and blends the march iteration cap, hit epsilon and DE
+// iterations from cheap settings up to the selected quality level's. Resolution is the pixel step
+// and only moves once detail is at an end. Frames inside a band around the budget change nothing,
+// and a resolution raise that overshoots is undone and backed off for longer each time
+
+// Includes
+#include "kernel.h"
+
+// What the controller did after a frame
+enum class QualityAction
+{
+	Hold,
+	// Waiting for frames drawn after a resolution change
+	Settle,
+	RaiseDetail,
+	LowerDetail,
+	RaiseResolution,
+	LowerResolution,
+};
+
+const char* QualityActionName(QualityAction action);
+
+// The controller's state after a frame, for logs and overlays
+struct QualityTelemetry
+{
+	// Time of the last frame, the smoothed time the controller acts on and the target
+	double frameMs = 0.0;
+	double averageMs = 0.0;
+	double budgetMs = 0.0;
+
+	// Settings the frame was drawn with
+	int pixelStep = 1;
+	float detail = 1.0f;
+	int marchIterations = 0;
+	float hitEpsilon = 0.0f;
+	int deIterations = 0;
+
+	QualityAction action = QualityAction::Hold;
+	// Resolution changes since Reset
+	long long resolutionChanges = 0;
+};
+
+class QualityController
+{
+public:
+	// Target frame time in milliseconds
+	double m_budgetMs = 16.6;
+	// No change while the smoothed time is within these fractions of the budget
+	double m_lowerBand = 0.8;
+	double m_upperBand = 1.05;
+	// Weight of the newest frame in the smoothed time
+	double m_smoothing = 0.2;
+	// Detail change per frame for a frame time twice or half the budget
+	float m_gain = 0.25f;
+	// Coarsest pixel step, 1 keeps the full resolution
+	int m_maxPixelStep = 4;
+	// Frames after a resolution change before judging it
+	int m_settleFrames = 4;
+
+	// Constructor
+	QualityController();
+
+	// Start again from full resolution and detail
+	void Reset();
+
+	// Feed the time of the frame just drawn
+	void Update(double frameMs);
+	// Write the settings for the next frame into constants, capped at constants.quality
+	void Apply(FrameConstants& constants);
+
+	const QualityTelemetry& GetTelemetry() const { return m_telemetry; }
+private:
+	int m_pixelStep;
+	float m_detail;
+	double m_averageMs;
+	bool m_hasAverage;
+	int m_settle;
+
+	// Backoff after a resolution raise had to be undone
+	int m_raiseBlocked;
+	int m_raiseBackoff;
+	// A resolution raise still being judged and how long ago it was, one that lasts resets the backoff
+	bool m_raisePending;
+	int m_sinceRaise;
+
+	QualityTelemetry m_telemetry;
+
+	void ChangeResolution(int pixelStep, QualityAction action);
+};
+
+// One line summary of the telemetry
+void FormatQualityTelemetry(const QualityTelemetry& telemetry, char* buffer, size_t size);
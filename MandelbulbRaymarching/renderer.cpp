@@ -1,146 +1,21 @@
 // Includes
 #include "renderer.h"
+#include "cpurenderer.h"
 
-#include <d3dcompiler.h>
-#include <ScreenGrab.h>
+#include <chrono>
+#include <cstring>
 
-#pragma comment(lib,"d3d11.lib")
-#pragma comment(lib,"d3dcompiler.lib")
+// Milliseconds between two steady_clock points
+static double ElapsedMs(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
 
 // Constructor
-Renderer::Renderer(HWND hwnd)
+Renderer::Renderer(RenderBackend& backend, InputSource& input) : m_backend(backend), m_input(input)
 {
-	// Initializing members
-	{
-		// Get height and width
-		this->hwnd = hwnd;
-		RECT rect;
-		m_width = 800;
-		m_height = 600;
-		if (GetWindowRect(hwnd, &rect))
-		{
-			m_width = rect.right - rect.left;
-			m_height = rect.bottom - rect.top;
-		}
-
-		// Allocate space for constants
-		ZeroMemory(&m_constants, sizeof(m_constants));
-	}
-
-	// Device, swapchain and context creation
-	{
-		// Create Device
-		D3D_FEATURE_LEVEL lvl[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0,
-										  D3D_FEATURE_LEVEL_10_1, D3D_FEATURE_LEVEL_10_0 };
-
-		UINT createDeviceFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
-
-		// https://docs.microsoft.com/en-us/windows/win32/api/d3d11/ne-d3d11-d3d11_create_device_flag
-		// "Creates a device that supports the debug layer." https://docs.microsoft.com/en-us/windows/win32/direct3d11/overviews-direct3d-11-devices-layers
-#ifdef _DEBUG
-		createDeviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
-#endif
-
-		// Swap chain desc
-		DXGI_SWAP_CHAIN_DESC swapChainDesc = { 0 };
-		swapChainDesc.BufferDesc.RefreshRate.Numerator = 0;
-		swapChainDesc.BufferDesc.RefreshRate.Denominator = 1;
-		swapChainDesc.BufferDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-		swapChainDesc.SampleDesc.Count = 1;
-		swapChainDesc.SampleDesc.Quality = 0;
-		swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-		swapChainDesc.OutputWindow = hwnd;
-		swapChainDesc.Windowed = true;
-
-		// Flip sequential
-		swapChainDesc.BufferCount = 2;
-		swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
-
-		m_device = nullptr;
-		m_context = nullptr;
-
-		ThrowIfFailed(D3D11CreateDeviceAndSwapChain(
-			NULL,
-			D3D_DRIVER_TYPE_HARDWARE,
-			NULL,
-			createDeviceFlags,
-			NULL,
-			0,
-			D3D11_SDK_VERSION,
-			&swapChainDesc,
-			m_swapChain.ReleaseAndGetAddressOf(),
-			m_device.ReleaseAndGetAddressOf(),
-			lvl,
-			m_context.ReleaseAndGetAddressOf())
-		);
-	}
-
-	// RTV creation
-	{
-		ComPtr<ID3D11Texture2D> framebuffer;
-		ThrowIfFailed(m_swapChain->GetBuffer(
-			0,
-			__uuidof(ID3D11Texture2D),
-			(void**)&framebuffer));
-
-		ThrowIfFailed(m_device->CreateRenderTargetView(
-			framebuffer.Get(), 0, m_rtv.ReleaseAndGetAddressOf()));
-	}
-
-	// Shader compilation and creation, and defining vertex buffer + layout
-	{
-		ComPtr<ID3DBlob> p_vsBlob;
-		ComPtr<ID3DBlob> p_psBlob;
-		ComPtr<ID3DBlob> p_errorBlob;
-
-		UINT flags = D3DCOMPILE_ENABLE_STRICTNESS;
-#if defined( DEBUG ) || defined( _DEBUG )
-		flags |= D3DCOMPILE_DEBUG;
-#endif
-
-		// Compiling vertex shader
-		HRESULT hr = D3DCompileFromFile(L"main.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "VSMain", "vs_5_0",
-			flags, 0, p_vsBlob.ReleaseAndGetAddressOf(), p_errorBlob.ReleaseAndGetAddressOf());
-
-		// Compiling pixel shader
-		hr = D3DCompileFromFile(L"main.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "PSMain", "ps_5_0",
-			flags, 0, p_psBlob.ReleaseAndGetAddressOf(), p_errorBlob.ReleaseAndGetAddressOf());
-
-		// Creating shaders
-		ThrowIfFailed(m_device->CreateVertexShader(p_vsBlob->GetBufferPointer(), p_vsBlob->GetBufferSize(), NULL, p_vertexShader.ReleaseAndGetAddressOf()));
-		ThrowIfFailed(m_device->CreatePixelShader(p_psBlob->GetBufferPointer(), p_psBlob->GetBufferSize(), NULL, p_pixelShader.ReleaseAndGetAddressOf()));
-
-		D3D11_INPUT_ELEMENT_DESC inputElementDescs[] =
-		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 }, // Vertex position
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT , 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 }, // UV
-		};
-
-		ThrowIfFailed(m_device->CreateInputLayout(inputElementDescs, _countof(inputElementDescs), p_vsBlob->GetBufferPointer(),
-			p_vsBlob->GetBufferSize(), p_inputLayout.ReleaseAndGetAddressOf()));
-	}
-
-	// Creating vertex and index buffer 
-	{
-		// Initial vertex data
-		Vertex vertices[6] = {
-			{ XMFLOAT3(-1.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) },
-			{ XMFLOAT3(1.0f, -1.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
-			{ XMFLOAT3(-1.0f, -1.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) },
-			{ XMFLOAT3(1.0f, 1.0f, 0.0f), XMFLOAT2(1.0f, 1.0f) },
-			{ XMFLOAT3(1.0f, -1.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
-			{ XMFLOAT3(-1.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) }
-		};
-
-		D3D11_BUFFER_DESC vertexBufferDesc = {};
-		vertexBufferDesc.ByteWidth = sizeof(vertices);
-		vertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-		vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		D3D11_SUBRESOURCE_DATA srData = { 0 };
-		srData.pSysMem = vertices;
-
-		ThrowIfFailed(m_device->CreateBuffer(&vertexBufferDesc, &srData, m_vertexBuffer.ReleaseAndGetAddressOf()));
-	}
+	// Allocate space for constants
+	m_constants = {};
 }
 
 // Destructor
@@ -149,212 +24,172 @@ Renderer::~Renderer()
 	// Nothing to do upon destruction
 }
 
-void Renderer::Render()
+void Renderer::Render(float deltaTime)
 {
-	// First constants buffer
-	Update(1.0f / 60.0f);
-
-	const float clearColour[] = { 0.0f, 0.2f, 0.4f, 1.0f };
-
-	// Clear RTV
-	m_context->ClearRenderTargetView(m_rtv.Get(), clearColour);
-
-	// Update width and height
-	RECT rect;
-	if (GetWindowRect(hwnd, &rect))
-	{
-		m_width = rect.right - rect.left;
-		m_height = rect.bottom - rect.top;
-	}
+	auto start = std::chrono::steady_clock::now();
 
-	// Create viewport
-	D3D11_VIEWPORT viewport = {
-		0.0f,
-		0.0f,
-		(float)(m_width),
-		(float)(m_height),
-		0.0f,
-		1.0f
-	};
-	m_context->RSSetViewports(1, &viewport);
-
-	// Set RTV
-	ID3D11RenderTargetView* p_rtv = m_rtv.Get();
-	m_context->OMSetRenderTargets(1, &p_rtv, NULL);
+	// First constants buffer
+	Update(deltaTime);
 
-	// Input assembler
-	UINT vertexStride = sizeof(Vertex);
-	UINT vertexOffset = 0;
+	// Draw the controller's settings or the refinement pass rather than the selected quality
+	m_drawn = m_constants;
+	if (m_dynamicQuality)
+		m_qualityController.Apply(m_drawn);
+	else if (m_progressive)
+		GetRefinePass(m_refinePass, m_drawn.pixelStep, m_drawn.quality);
 
-	m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	m_context->IASetInputLayout(p_inputLayout.Get());
-	ID3D11Buffer* p_vb = m_vertexBuffer.Get();
-	m_context->IASetVertexBuffers(0, 1, &p_vb, &vertexStride, &vertexOffset);
+	auto updated = std::chrono::steady_clock::now();
+	m_backend.UploadConstants(m_drawn);
 
-	// Set shaders
-	m_context->VSSetShader(p_vertexShader.Get(), NULL, 0);
-	m_context->PSSetShader(p_pixelShader.Get(), NULL, 0);
+	auto uploaded = std::chrono::steady_clock::now();
+	m_backend.Draw();
 
-	// Draw
-	m_context->Draw(6, 0);
+	auto drawn = std::chrono::steady_clock::now();
+	m_timings.update = ElapsedMs(start, updated);
+	m_timings.upload = ElapsedMs(updated, uploaded);
+	m_timings.draw = ElapsedMs(uploaded, drawn);
 
-	// And finally present!
-	m_swapChain->Present(1, 0);
+	// The GPU's own time when the backend measures it, Draw only waits for vsync
+	if (m_dynamicQuality)
+	{
+		double gpuTime = m_backend.GetGpuTime();
+		m_qualityController.Update(gpuTime >= 0.0 ? gpuTime : m_timings.update + m_timings.upload + m_timings.draw);
+	}
 }
 
 // Updates for frame to frame basis
 void Renderer::Update(float deltaTime)
 {
+	int width = m_backend.GetWidth();
+	int height = m_backend.GetHeight();
+
 	// Set camera lens to account for aspect changes
-	float aspect = m_width / m_height;
+	float aspect = float(width) / float(height);
 	m_camera.SetLens(0.78539816339f /*pi/4*/, aspect, m_camNear, m_camFar);
 
 	float step = 10.0f;
 
+	// A new recording starts from this frame's size and camera
+	if (m_recording && m_recording->m_frames.empty())
+	{
+		m_recording->m_width = width;
+		m_recording->m_height = height;
+		m_recording->m_position = m_camera.m_position;
+		m_recording->m_right = m_camera.m_right;
+		m_recording->m_up = m_camera.m_up;
+		m_recording->m_look = m_camera.m_look;
+	}
+
 	// For any movement, update sample as well
-	// W
-	if (GetAsyncKeyState(0x57) & 0x8000)
+	InputState input = m_input.Poll();
+	if (input.forward)
 	{
 		m_camera.Walk(step, deltaTime);
 	}
-	// S
-	if (GetAsyncKeyState(0x53) & 0x8000)
+	if (input.back)
 	{
 		m_camera.Walk(-step, deltaTime);
 	}
-	// A
-	if (GetAsyncKeyState(0x41) & 0x8000)
+	if (input.left)
 	{
 		m_camera.Strafe(-step, deltaTime);
 	}
-	// D
-	if (GetAsyncKeyState(0x44) & 0x8000)
+	if (input.right)
 	{
 		m_camera.Strafe(step, deltaTime);
 	}
 
 	// Camera
-	auto state = mouse->GetState();
-	m_tracker.Update(state);
-	mouse->SetMode(state.leftButton ? Mouse::MODE_RELATIVE : Mouse::MODE_ABSOLUTE);
-
-	if (state.positionMode == Mouse::MODE_RELATIVE)
+	if (input.pitch != 0.0f || input.yaw != 0.0f)
 	{
-		float dx = XMConvertToRadians(1.0f * static_cast<float>(state.x));
-		float dy = XMConvertToRadians(1.0f * static_cast<float>(state.y));
-
-		m_camera.Pitch(dy);
-		m_camera.RotateY(dx);
+		m_camera.Pitch(input.pitch);
+		m_camera.RotateY(input.yaw);
 	}
 
-	m_camera.UpdateViewMatrix();
-
-	// Set shader-side matrix
-	XMMATRIX world = XMMatrixIdentity();
-	XMMATRIX view = XMLoadFloat4x4(&m_camera.m_view);
-	XMMATRIX proj = XMLoadFloat4x4(&m_camera.m_proj);
+	// Re-orthonormalising the camera's axes changes their low bits every time, so an unchanged
+	// camera keeps the last frame's matrices and only a real change of view starts refinement over
+	bool moved = width != m_constants.screenWidth || height != m_constants.screenHeight
+		|| memcmp(&m_camera.m_position, &m_viewCamera.m_position, sizeof(m_camera.m_position)) != 0
+		|| memcmp(&m_camera.m_right, &m_viewCamera.m_right, sizeof(m_camera.m_right)) != 0
+		|| memcmp(&m_camera.m_up, &m_viewCamera.m_up, sizeof(m_camera.m_up)) != 0
+		|| memcmp(&m_camera.m_look, &m_viewCamera.m_look, sizeof(m_camera.m_look)) != 0;
+	if (moved)
+	{
+		// Set shader-side matrices, also updates the view matrix and screen size
+		FrameConstants camera = CreateFrameConstants(m_camera, width, height);
+		m_viewCamera = m_camera;
+
+		m_constants.projInverse = camera.projInverse;
+		m_constants.viewInverse = camera.viewInverse;
+		m_constants.camPos = camera.camPos;
+		m_constants.view = camera.view;
+		m_constants.proj = camera.proj;
+		m_constants.screenWidth = camera.screenWidth;
+		m_constants.screenHeight = camera.screenHeight;
+		m_constants.pixelStep = camera.pixelStep;
+	}
 
-	m_constants.projInverse = DirectX::XMMatrixInverse(nullptr, proj);
-	m_constants.viewInverse = DirectX::XMMatrixInverse(nullptr, view);
-	m_constants.camPos = m_camera.m_position;
+	// The camera as the view matrix left it
+	if (m_recording)
+	{
+		TraceFrame frame;
+		frame.input = input;
+		frame.deltaTime = deltaTime;
+		frame.time = m_constants.time;
+		frame.quality = m_constants.quality;
+		frame.animated = m_constants.animated;
+		frame.colour1 = colour1;
+		frame.colour2 = colour2;
+		frame.position = m_camera.m_position;
+		frame.right = m_camera.m_right;
+		frame.up = m_camera.m_up;
+		frame.look = m_camera.m_look;
+		m_recording->m_frames.push_back(frame);
+	}
 
-	// Also update screen size
-	m_constants.screenHeight = m_height;
-	m_constants.screenWidth = m_width;
+	if (moved)
+	{
+		m_idleTime = 0.0f;
+		m_refinePass = 0;
+	}
+	else
+	{
+		m_idleTime += deltaTime;
+		if (m_idleTime >= m_idleDelay && m_refinePass + 1 < GetRefinePassCount())
+			m_refinePass++;
+	}
 
 	// Update constants
-	ThrowIfFailed(UpdateConstants());
+	UpdateConstants();
 }
 
-// Update constants buffer
-HRESULT Renderer::UpdateConstants()
+// Update constants from the settings
+void Renderer::UpdateConstants()
 {
 	// Set colour float3s to colour COLOURREFS
-	m_constants.colour1 = XMFLOAT3(GetRValue(colour1), GetGValue(colour1), GetBValue(colour1));
-	m_constants.colour2 = XMFLOAT3(GetRValue(colour2), GetGValue(colour2), GetBValue(colour2));
-
-	// Fill in a buffer description
-	D3D11_BUFFER_DESC cbDesc;
-	cbDesc.ByteWidth = sizeof(SHADER_CONSTANTS_BUFFER);
-	cbDesc.Usage = D3D11_USAGE_DYNAMIC;
-	cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	cbDesc.MiscFlags = 0;
-	cbDesc.StructureByteStride = 0;
-
-	// Fill in the subresource data.
-	D3D11_SUBRESOURCE_DATA InitData;
-	ZeroMemory(&InitData, sizeof(InitData));
-
-	InitData.pSysMem = &m_constants;
-	InitData.SysMemPitch = 0;
-	InitData.SysMemSlicePitch = 0;
-
-	// Create the buffer.
-	HRESULT hr = m_device->CreateBuffer(&cbDesc, &InitData,
-		&p_constantBuffer);
-
-	if (FAILED(hr))
-		return hr;
-
-	// Set the buffer.
-	m_context->VSSetConstantBuffers(0, 1, &p_constantBuffer);
-	m_context->PSSetConstantBuffers(0, 1, &p_constantBuffer);
+	m_constants.colour1 = float3{ float(colour1 & 0xFF), float((colour1 >> 8) & 0xFF), float((colour1 >> 16) & 0xFF) };
+	m_constants.colour2 = float3{ float(colour2 & 0xFF), float((colour2 >> 8) & 0xFF), float((colour2 >> 16) & 0xFF) };
+}
 
-	p_constantBuffer->Release();
+// Halve the moving step down to every pixel at low quality, then raise the quality
+int Renderer::GetRefinePassCount() const
+{
+	int count = 1;
+	for (int step = m_movingStep; step > 1; step /= 2)
+		count++;
 
-	return hr;
+	return count + (m_constants.quality > 0 ? m_constants.quality : 0);
 }
 
-void Renderer::ResizeSwapChain()
+void Renderer::GetRefinePass(int pass, int& pixelStep, int& quality) const
 {
-	// Get height and width
-	RECT rect;
-	if (GetWindowRect(hwnd, &rect))
+	pixelStep = m_movingStep > 1 ? m_movingStep : 1;
+	quality = 0;
+	for (int i = 0; i < pass; i++)
 	{
-		m_width = rect.right - rect.left;
-		m_height = rect.bottom - rect.top;
+		if (pixelStep > 1)
+			pixelStep /= 2;
+		else if (quality < m_constants.quality)
+			quality++;
 	}
-
-	// Release RTV
-	m_rtv.Reset();
-
-	// Resize swap chain
-	m_swapChain->ResizeBuffers(2, 0, 0, DXGI_FORMAT_UNKNOWN, 0);
-
-	// Get back buffer and resize viewport
-	ComPtr<ID3D11Texture2D> framebuffer;
-	ThrowIfFailed(m_swapChain->GetBuffer(
-		0,
-		__uuidof(ID3D11Texture2D),
-		(void**)&framebuffer));
-
-	ThrowIfFailed(m_device->CreateRenderTargetView(
-		framebuffer.Get(), 0, m_rtv.ReleaseAndGetAddressOf()));
-
-	D3D11_TEXTURE2D_DESC backBufferDesc = { 0 };
-	framebuffer->GetDesc(&backBufferDesc);
-
-	D3D11_VIEWPORT viewport;
-	viewport.TopLeftX = 0.0f;
-	viewport.TopLeftY = 0.0f;
-	viewport.Width = static_cast<float>(backBufferDesc.Width);
-	viewport.Height = static_cast<float>(backBufferDesc.Height);
-	viewport.MinDepth = D3D11_MIN_DEPTH;
-	viewport.MaxDepth = D3D11_MAX_DEPTH;
-
-	m_context->RSSetViewports(1, &viewport);
 }
-
-// Screenshot
-void Renderer::SaveRenderToFile(LPCWSTR fileName, GUID format)
-{
-	// Get back buffer
-	ComPtr<ID3D11Texture2D> framebuffer;
-	ThrowIfFailed(m_swapChain->GetBuffer(
-		0,
-		__uuidof(ID3D11Texture2D),
-		(void**)&framebuffer));
-
-	DirectX::SaveWICTextureToFile(m_context.Get(), framebuffer.Get(), format, fileName);
-}
\ No newline at end of file
@@ -5,119 +5,88 @@
 //------------------------------
 
 // Includes
+#include "backend.h"
 #include "camera.h"
+#include "inputtrace.h"
+#include "qualitycontroller.h"
 
-#include <d3d11.h>
-#include <dxgi1_2.h>
-#include <wrl.h>
-#include <exception>
-#include <Mouse.h>
+#include <cstdint>
 
-using namespace Microsoft::WRL;
-using namespace DirectX;
-
-struct Vertex
+// Time spent in each part of the last frame, in milliseconds
+struct FrameTimings
 {
-	DirectX::XMFLOAT3 position;
-	DirectX::XMFLOAT2 uv;
-};
-
-_declspec(align(16)) struct SHADER_CONSTANTS_BUFFER
-{
-	// Projection view matrix
-	DirectX::XMMATRIX projInverse;
-	DirectX::XMMATRIX viewInverse;
-	DirectX::XMFLOAT3 camPos;
-	float padding1;
-
-	// Screen dimensions
-	int screenWidth;
-	int screenHeight;
-
-	// Animation and quality
-	int animated;
-	int quality;
-
-	// Time since execution start
-	float time;
-
-	// Colours
-	DirectX::XMFLOAT3 colour1;
-	DirectX::XMFLOAT3 colour2;
-	float padding2;
+	// Input, camera and constants on the CPU
+	double update = 0.0;
+	// Handing the constants to the backend
+	double upload = 0.0;
+	// Drawing and presenting
+	double draw = 0.0;
 };
 
 class Renderer
 {
 public:
-	// Pointer to mouse singleton
-	Mouse* mouse;
 	// Constants
-	SHADER_CONSTANTS_BUFFER m_constants;
-	// Mandelbulb colours
-	COLORREF colour1 = RGB(255, 255, 255);
-	COLORREF colour2 = RGB(255, 255, 255);
+	FrameConstants m_constants;
+	// Mandelbulb colours, 0x00BBGGRR like a Win32 COLORREF
+	uint32_t colour1 = 0xFFFFFF;
+	uint32_t colour2 = 0xFFFFFF;
 	// Scene camera
 	Camera m_camera;
 
+	// Progressive refinement. While the camera moves only every m_movingStep-th pixel is marched,
+	// at low quality. Once it has been still for m_idleDelay seconds each frame goes one pass
+	// further, halving the step down to every pixel and then raising the quality to m_constants.quality
+	bool m_progressive = false;
+	// 1, 2 or 4
+	int m_movingStep = 4;
+	float m_idleDelay = 0.15f;
+
+	// Dynamic quality. m_qualityController picks resolution and march settings from the frame
+	// times, up to m_constants.quality, instead of progressive refinement or the fixed level
+	bool m_dynamicQuality = false;
+	QualityController m_qualityController;
+
+	// Session every frame's input, step, settings and camera are added to, null when not recording
+	InputTrace* m_recording = nullptr;
+
 	// Constructor
-	Renderer(HWND hwnd);
+	Renderer(RenderBackend& backend, InputSource& input);
 	// Destructor
 	~Renderer();
 
-	// Render to RTV and present
-	void Render();
-	// Resize swapchain to render new window size
-	void ResizeSwapChain();
-	// Screenshot
-	void SaveRenderToFile(LPCWSTR fileName, GUID format);
+	// Update, upload constants, draw and present, moving the camera for deltaTime seconds
+	void Render(float deltaTime = 1.0f / 60.0f);
+
+	// Backend frames are drawn with
+	RenderBackend& GetBackend() { return m_backend; }
+	// Breakdown of the last Render call
+	const FrameTimings& GetTimings() const { return m_timings; }
+	// Constants the last frame was drawn with, m_constants with the refinement pass applied
+	const FrameConstants& GetDrawnConstants() const { return m_drawn; }
+	// Refinement pass of the last frame, 0 while moving, and the number of passes there are
+	int GetRefinePass() const { return m_refinePass; }
+	int GetRefinePassCount() const;
+	// Pixel step and quality of refinement pass
+	void GetRefinePass(int pass, int& pixelStep, int& quality) const;
 private:
 	// Camera near and far dist
 	float m_camNear = 0.1f;
 	float m_camFar = 1000.0f;
-	// Mouse tracker
-	Mouse::ButtonStateTracker m_tracker;
-
-	// Window hwnd
-	HWND hwnd;
-
-	// Device and context
-	ComPtr<ID3D11Device> m_device;
-	ComPtr<ID3D11DeviceContext> m_context;
-
-	// HWnd dimensions
-	float m_width;
-	float m_height;
-
-	// Swapchain presents RTV result to the screen
-	// https://learn.microsoft.com/en-us/windows/win32/api/dxgi1_2/nn-dxgi1_2-idxgiswapchain1
-	ComPtr<IDXGISwapChain> m_swapChain;
 
-	// IA related members
-	ComPtr<ID3D11InputLayout> p_inputLayout;
-	ComPtr<ID3D11Buffer> m_vertexBuffer; // Vertex buffer
+	RenderBackend& m_backend;
+	InputSource& m_input;
+	FrameTimings m_timings;
 
-	// Shader views
-	ComPtr<ID3D11RenderTargetView> m_rtv; // Render target view for main image
-
-	// Shaders
-	ComPtr<ID3D11VertexShader> p_vertexShader;
-	ComPtr<ID3D11PixelShader> p_pixelShader;
-
-	ID3D11Buffer* p_constantBuffer = NULL;
+	// Seconds the camera has been still and how far refinement has got
+	float m_idleTime = 0.0f;
+	int m_refinePass = 0;
+	// Camera as the current matrices were built from it
+	Camera m_viewCamera;
+	FrameConstants m_drawn = {};
 
 	// General updates for a frame to frame basis
 	void Update(float deltaTime);
 	// Update constants
-	HRESULT UpdateConstants();
+	void UpdateConstants();
 };
-
-// Helper functions for DirectX
-inline void ThrowIfFailed(HRESULT hr)
-{
-	if (FAILED(hr))
-	{
-		// Set a breakpoint on this line to catch Win32 API errors.
-		throw std::exception();
-	}
-}
\ No newline at end of file
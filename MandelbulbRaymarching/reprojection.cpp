@@ -0,0 +1,162 @@
+//------------------------------
+//- reprojection.cpp
+//------------------------------
+
+// Includes
+#include "reprojection.h"
+
+#include <cstring>
+
+// Scatter value for pixels nothing landed on
+static const uint32_t g_empty = 0xFFFFFFFFu;
+
+static uint32_t FloatBits(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static float BitsFloat(uint32_t bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static void AtomicMin(std::atomic<uint32_t>& target, uint32_t value)
+{
+	uint32_t current = target.load(std::memory_order_relaxed);
+	while (value < current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+// Constructor
+DepthHistory::DepthHistory(ThreadPool& pool) : m_pool(pool)
+{
+
+}
+
+void DepthHistory::Reset()
+{
+	m_hasPrevious = false;
+}
+
+void DepthHistory::BeginFrame(const FrameConstants& constants)
+{
+	// A new size invalidates the history
+	if (constants.screenWidth != m_width || constants.screenHeight != m_height)
+	{
+		m_width = constants.screenWidth;
+		m_height = constants.screenHeight;
+		m_hasPrevious = false;
+	}
+	m_current.assign(size_t(m_width) * m_height, -1.0f);
+}
+
+void DepthHistory::EndFrame(const FrameConstants& constants, const FrameSetup& setup)
+{
+	m_previous.swap(m_current);
+	m_previousConstants = constants;
+	m_previousParams = setup.params;
+	m_hasPrevious = true;
+}
+
+bool DepthHistory::Reproject(const FrameConstants& constants, const FrameSetup& setup)
+{
+	m_stats = ReprojectionStats();
+
+	// A different fractal has different surfaces
+	bool sameFractal = m_previousParams.power == setup.params.power && m_previousParams.maxIters == setup.params.maxIters &&
+		m_previousParams.escape == setup.params.escape;
+	if (!m_hasPrevious || !sameFractal || constants.screenWidth != m_width || constants.screenHeight != m_height)
+		return false;
+
+	size_t pixels = size_t(m_width) * m_height;
+	if (m_scatterSize != pixels)
+	{
+		m_scatter.reset(new std::atomic<uint32_t>[pixels]);
+		m_scatterSize = pixels;
+	}
+	for (size_t i = 0; i < pixels; i++)
+	{
+		m_scatter[i].store(g_empty, std::memory_order_relaxed);
+	}
+
+	// World space hit -> current clip space
+	const FrameConstants& previous = m_previousConstants;
+	float4x4 viewProj = MatrixMultiply(constants.view, constants.proj);
+	float width = float(m_width);
+	float height = float(m_height);
+
+	// Every hit splats onto the four pixel centres around where it lands, so small forward
+	// moves that spread the samples out still cover every pixel
+	m_pool.ParallelFor(m_height, [&](int y) {
+		for (int x = 0; x < m_width; x++)
+		{
+			float depth = m_previous[size_t(y) * m_width + x];
+			if (depth < 0.0f)
+				continue;
+
+			float2 uv = PixelToUV(previous, float2{ x + 0.5f, y + 0.5f });
+			Ray ray = CreateCamRay(uv, previous.projInverse, previous.viewInverse, previous.camPos);
+			float3 hit = ray.pos + ray.dir * depth;
+
+			float4 clip = mul(viewProj, float4{ hit.x, hit.y, hit.z, 1.0f });
+			if (clip.w <= 0.0f)
+				continue;
+
+			// Inverse of PixelToUV
+			float px = (clip.x / clip.w * 0.5f + 0.5f) * width - 0.5f;
+			float py = (0.5f - clip.y / clip.w * 0.5f) * height - 0.5f;
+			if (!(px > -1.0f && px < width && py > -1.0f && py < height))
+				continue;
+
+			uint32_t bits = FloatBits(length(hit - constants.camPos));
+			int sx = int(floorf(px));
+			int sy = int(floorf(py));
+			for (int dy = 0; dy < 2; dy++)
+			{
+				for (int dx = 0; dx < 2; dx++)
+				{
+					int tx = sx + dx;
+					int ty = sy + dy;
+					if (tx >= 0 && tx < m_width && ty >= 0 && ty < m_height)
+						AtomicMin(m_scatter[size_t(ty) * m_width + tx], bits);
+				}
+			}
+		}
+	});
+
+	// Start short of the nearest depth around each covered pixel, the neighbours catch thin
+	// foreground that only just missed this pixel
+	m_start.assign(pixels, 0.0f);
+	std::atomic<long long> reprojected{ 0 };
+	m_pool.ParallelFor(m_height, [&](int y) {
+		long long count = 0;
+		for (int x = 0; x < m_width; x++)
+		{
+			if (m_scatter[size_t(y) * m_width + x].load(std::memory_order_relaxed) == g_empty)
+				continue;
+
+			uint32_t nearest = g_empty;
+			for (int ny = y > 0 ? y - 1 : 0; ny <= y + 1 && ny < m_height; ny++)
+			{
+				for (int nx = x > 0 ? x - 1 : 0; nx <= x + 1 && nx < m_width; nx++)
+				{
+					uint32_t bits = m_scatter[size_t(ny) * m_width + nx].load(std::memory_order_relaxed);
+					nearest = bits < nearest ? bits : nearest;
+				}
+			}
+
+			m_start[size_t(y) * m_width + x] = BitsFloat(nearest) * (1.0f - m_margin);
+			count++;
+		}
+		reprojected += count;
+	});
+
+	m_stats.reprojected = reprojected;
+	m_stats.disoccluded = (long long)pixels - m_stats.reprojected;
+	return true;
+}
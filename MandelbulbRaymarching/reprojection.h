@@ -0,0 +1,77 @@
+#pragma once
+
+//------------------------------
+//- reprojection.h
+//------------------------------
+
+// Temporal reprojection of hit depths. Each frame's hit points are scattered into the next
+// frame's view with the previous and current camera matrices, keeping the nearest per pixel, and
+// a pixel's ray starts just short of the nearest depth around it. Pixels nothing landed on were
+// hidden or off screen last frame and march from the start
+
+// Includes
+#include "kernel.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// What reprojection did for one frame
+struct ReprojectionStats
+{
+	// Pixels that started from a reprojected depth
+	long long reprojected = 0;
+	// Pixels nothing landed on, newly visible, off screen or background last frame
+	long long disoccluded = 0;
+};
+
+class DepthHistory
+{
+public:
+	// Rays start this fraction of the reprojected depth short of it
+	float m_margin = 0.02f;
+
+	// Constructor
+	DepthHistory(ThreadPool& pool);
+
+	// Forget the stored frame, for camera cuts or scene changes
+	void Reset();
+
+	// Scatter the stored frame into this frame's view. Returns false when there is no usable
+	// history, for example after a resize or when the power has changed
+	bool Reproject(const FrameConstants& constants, const FrameSetup& setup);
+	// Start depth for pixel (x, y) after Reproject, 0 where the pixel was disoccluded
+	float GetStartDepth(int x, int y) const { return m_start[size_t(y) * m_width + x]; }
+
+	// Size the record buffer for the frame about to be rendered
+	void BeginFrame(const FrameConstants& constants);
+	// Hit distance along pixel (x, y)'s ray, or a negative value for a miss
+	void Record(int x, int y, float depth) { m_current[size_t(y) * m_width + x] = depth; }
+	// Keep the recorded frame as the history for the next one
+	void EndFrame(const FrameConstants& constants, const FrameSetup& setup);
+
+	// Statistics from the last Reproject
+	const ReprojectionStats& GetStats() const { return m_stats; }
+private:
+	ThreadPool& m_pool;
+	int m_width = 0;
+	int m_height = 0;
+
+	// Depths being recorded this frame and the last complete frame
+	std::vector<float> m_current;
+	std::vector<float> m_previous;
+	bool m_hasPrevious = false;
+
+	// Camera and fractal the previous frame was rendered with
+	FrameConstants m_previousConstants = {};
+	FractalOptions m_previousParams = {};
+
+	// Nearest reprojected distance per pixel as float bits, positive floats order like integers
+	std::unique_ptr<std::atomic<uint32_t>[]> m_scatter;
+	size_t m_scatterSize = 0;
+	std::vector<float> m_start;
+
+	ReprojectionStats m_stats;
+};
@@ -0,0 +1,413 @@
+//------------------------------
+//- shadowcache.cpp
+//------------------------------
+
+// Includes
+#include "shadowcache.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// Slots a key may be stored in, from its hash onwards
+static const int g_probeLength = 8;
+// Hits whose cells Lookup requests from memory together
+static const int g_lookupBatch = 8;
+// Least cosine between a hit's normal and a cell's for the cell to be blended in. Pixel sized
+// cells in a crevice often hold another sheet of the surface, shadowed quite differently
+static const float g_normalCosine = 0.9f;
+// Finest cell edge, 2^-20, well under a pixel of any close-up
+static const int g_minLevel = -20;
+
+// splitmix64 finaliser
+static uint64_t Mix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ull;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBull;
+	return h ^ (h >> 31);
+}
+
+// Start loading a cell so the misses of several lookups overlap
+static void Prefetch(const void* address)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#elif defined(__GNUC__) || defined(__clang__)
+	__builtin_prefetch(address);
+#else
+	(void)address;
+#endif
+}
+
+static uint32_t PackNormal(float3 n)
+{
+	auto quantise = [](float v) { return uint32_t((v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v)) * 511.0f + 511.5f); };
+	return quantise(n.x) | quantise(n.y) << 10 | quantise(n.z) << 20;
+}
+
+static float3 UnpackNormal(uint32_t bits)
+{
+	auto expand = [](uint32_t v) { return (float(v & 1023) - 511.0f) / 511.0f; };
+	return { expand(bits), expand(bits >> 10), expand(bits >> 20) };
+}
+
+// Changes whenever anything SoftShadow is traced with besides the fractal does
+static uint64_t LightSignature()
+{
+	const float values[] = { g_shadowSoftness, g_shadowOffset, g_shadowCullCosine, g_shadowDistance };
+	uint64_t h = 0;
+	for (const float3& light : g_lights)
+	{
+		uint32_t bits[3];
+		memcpy(bits, &light, sizeof(bits));
+		for (uint32_t b : bits)
+			h = Mix(h ^ b);
+	}
+	for (float value : values)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		h = Mix(h ^ bits);
+	}
+	return h;
+}
+
+// Constructor
+ShadowCache::ShadowCache(size_t maxBytes)
+{
+	// Largest power of two that fits
+	size_t capacity = g_regionSlots;
+	while (capacity * 2 * sizeof(Cell) <= maxBytes)
+		capacity *= 2;
+
+	m_regions.reset(new Region[capacity / g_regionSlots]);
+	m_mask = capacity - 1;
+	Clear();
+}
+
+void ShadowCache::Clear()
+{
+	for (size_t i = 0; i <= m_mask; i++)
+	{
+		GetCell(i).tag.store(0, std::memory_order_relaxed);
+		GetCell(i).frame.store(0, std::memory_order_relaxed);
+	}
+	m_filled = 0;
+}
+
+void ShadowCache::BeginFrame(const FrameSetup& setup)
+{
+	m_frame++;
+
+	uint64_t lights = LightSignature();
+	bool same = m_valid && m_params.maxIters == setup.params.maxIters && m_params.escape == setup.params.escape
+		&& m_params.power == setup.params.power && m_bounded == setup.bounded && m_boundingRadius == setup.boundingRadius
+		&& m_normalMode == GetNormalMode() && m_lightSignature == lights;
+	if (same)
+		return;
+
+	if (m_valid)
+		m_invalidations++;
+	Clear();
+	m_valid = true;
+	m_params = setup.params;
+	m_bounded = setup.bounded;
+	m_boundingRadius = setup.boundingRadius;
+	m_normalMode = GetNormalMode();
+	m_lightSignature = lights;
+}
+
+ShadowCache::CellCoords ShadowCache::Locate(const MarchResult& march, float3 normal, const FrameSetup& setup) const
+{
+	CellCoords coords;
+
+	// A power of two edge of at least m_cellScale pixels at the hit, so zooming only changes level
+	float edge = setup.pixelFootprint * march.totalDistance * m_cellScale;
+	frexpf(edge > 0.0f ? edge : 1.0f, &coords.level);
+	coords.level = coords.level < g_minLevel ? g_minLevel : (coords.level > 0 ? 0 : coords.level);
+
+	// Axis and side the normal faces most
+	float3 a = { fabsf(normal.x), fabsf(normal.y), fabsf(normal.z) };
+	int axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+	float component = axis == 0 ? normal.x : (axis == 1 ? normal.y : normal.z);
+	coords.bucket = axis * 2 + (component < 0.0f ? 1 : 0);
+
+	coords.position = march.pos * ldexpf(1.0f, -coords.level);
+	return coords;
+}
+
+uint64_t ShadowCache::RegionHash(int level, int bucket, int x, int y, int z)
+{
+	uint64_t h = Mix(uint64_t(uint32_t(level - g_minLevel)) << 3 | uint64_t(bucket));
+	h = Mix(h ^ uint32_t(x >> g_regionShift));
+	h = Mix(h ^ uint32_t(y >> g_regionShift));
+	return Mix(h ^ uint32_t(z >> g_regionShift));
+}
+
+ShadowCache::CellAddress ShadowCache::Address(uint64_t region, int x, int y, int z) const
+{
+	const int edge = (1 << g_regionShift) - 1;
+	int local = (x & edge) | (y & edge) << g_regionShift | (z & edge) << (2 * g_regionShift);
+
+	CellAddress address;
+	address.slot = (size_t(region) * g_regionSlots + local) & m_mask;
+
+	// The top bit makes room for the filled flag, and 0 marks an empty cell
+	address.key = Mix(region ^ uint64_t(local)) >> 1;
+	if (address.key == 0)
+		address.key = 1;
+	return address;
+}
+
+size_t ShadowCache::ProbeSlot(size_t slot, int i)
+{
+	return (slot & ~size_t(g_regionSlots - 1)) | ((slot + i) & (g_regionSlots - 1));
+}
+
+bool ShadowCache::Read(const CellAddress& address, float* shadows, float3& normal)
+{
+	uint64_t filled = address.key << 1 | 1;
+	for (int i = 0; i < g_probeLength; i++)
+	{
+		Cell& cell = GetCell(ProbeSlot(address.slot, i));
+		uint64_t tag = cell.tag.load(std::memory_order_acquire);
+		if (tag == 0)
+			return false;
+		if (tag != filled)
+			continue;
+
+		normal = UnpackNormal(cell.normal.load(std::memory_order_relaxed));
+		for (int l = 0; l < g_lightCount; l++)
+			shadows[l] = cell.shadows[l].load(std::memory_order_relaxed);
+
+		// A Store taking the cell over while it was read changes the tag
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (cell.tag.load(std::memory_order_relaxed) != filled)
+			return false;
+
+		if (cell.frame.load(std::memory_order_relaxed) != m_frame)
+			cell.frame.store(m_frame, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+float3 ShadowCache::Corners(const MarchResult& march, float3 normal, const FrameSetup& setup, CellAddress* corners, int& ownCorner) const
+{
+	CellCoords coords = Locate(march, normal, setup);
+	int ox = int(floorf(coords.position.x));
+	int oy = int(floorf(coords.position.y));
+	int oz = int(floorf(coords.position.z));
+
+	float3 g = coords.position - float3{ 0.5f, 0.5f, 0.5f };
+	int bx = int(floorf(g.x));
+	int by = int(floorf(g.y));
+	int bz = int(floorf(g.z));
+
+	// The corners span at most two regions along each axis, and usually one, so each region is
+	// hashed once
+	int crossX = (bx >> g_regionShift) != ((bx + 1) >> g_regionShift) ? 1 : 0;
+	int crossY = (by >> g_regionShift) != ((by + 1) >> g_regionShift) ? 2 : 0;
+	int crossZ = (bz >> g_regionShift) != ((bz + 1) >> g_regionShift) ? 4 : 0;
+	uint64_t regions[8];
+	int hashed = 0;
+
+	ownCorner = 0;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		int x = bx + (corner & 1);
+		int y = by + ((corner >> 1) & 1);
+		int z = bz + (corner >> 2);
+		int region = corner & (crossX | crossY | crossZ);
+		if (!(hashed & (1 << region)))
+		{
+			regions[region] = RegionHash(coords.level, coords.bucket, x, y, z);
+			hashed |= 1 << region;
+		}
+		corners[corner] = Address(regions[region], x, y, z);
+		Prefetch(&GetCell(corners[corner].slot));
+		if (x == ox && y == oy && z == oz)
+			ownCorner = corner;
+	}
+
+	return { g.x - float(bx), g.y - float(by), g.z - float(bz) };
+}
+
+int ShadowCache::Lookup(const MarchResult* results, const float3* normals, int count, const FrameSetup& setup, float* shadows, bool* cached)
+{
+	// Every cell read is likely a cache miss, so the slots of a few hits are requested before
+	// any of them is read
+	CellAddress corners[g_lookupBatch][8];
+	int ownCorners[g_lookupBatch];
+	float3 fractions[g_lookupBatch];
+	int hits[g_lookupBatch];
+
+	int found = 0;
+	int missed = 0;
+	int i = 0;
+	while (i < count)
+	{
+		int hitCount = 0;
+		for (; i < count && hitCount < g_lookupBatch; i++)
+		{
+			cached[i] = false;
+			if (!results[i].hit)
+				continue;
+			fractions[hitCount] = Corners(results[i], normals[i], setup, corners[hitCount], ownCorners[hitCount]);
+			hits[hitCount++] = i;
+		}
+
+		for (int h = 0; h < hitCount; h++)
+		{
+			// Only hits whose own cell is filled are shaded from the cache, so the rest fill it
+			float own[g_lightCount];
+			float3 ownNormal;
+			int ownCorner = ownCorners[h];
+			if (!Read(corners[h][ownCorner], own, ownNormal))
+			{
+				missed++;
+				continue;
+			}
+
+			// Blend the filled ones facing the same way as the hit
+			float3 normal = normals[hits[h]];
+			float3 f = fractions[h];
+			float sum[g_lightCount] = {};
+			float weightSum = 0.0f;
+			for (int corner = 0; corner < 8; corner++)
+			{
+				float weight = ((corner & 1) ? f.x : 1.0f - f.x) * (((corner >> 1) & 1) ? f.y : 1.0f - f.y) * ((corner >> 2) ? f.z : 1.0f - f.z);
+				if (weight <= 0.0f)
+					continue;
+
+				float cell[g_lightCount];
+				float3 cellNormal = ownNormal;
+				if (corner == ownCorner)
+					memcpy(cell, own, sizeof(cell));
+				else if (!Read(corners[h][corner], cell, cellNormal))
+					continue;
+				if (dot(cellNormal, normal) < g_normalCosine)
+					continue;
+
+				for (int l = 0; l < g_lightCount; l++)
+					sum[l] += weight * cell[l];
+				weightSum += weight;
+			}
+
+			if (weightSum <= 0.0f)
+			{
+				missed++;
+				continue;
+			}
+
+			float* out = shadows + size_t(hits[h]) * g_lightCount;
+			for (int l = 0; l < g_lightCount; l++)
+				out[l] = sum[l] / weightSum;
+			cached[hits[h]] = true;
+			found++;
+		}
+	}
+
+	m_hits.fetch_add(found, std::memory_order_relaxed);
+	m_misses.fetch_add(missed, std::memory_order_relaxed);
+	return found;
+}
+
+void ShadowCache::Fill(Cell& cell, uint64_t pending, float3 normal, const float* shadows)
+{
+	cell.normal.store(PackNormal(normal), std::memory_order_relaxed);
+	for (int l = 0; l < g_lightCount; l++)
+		cell.shadows[l].store(shadows[l], std::memory_order_relaxed);
+	cell.frame.store(m_frame, std::memory_order_relaxed);
+	cell.tag.store(pending | 1, std::memory_order_release);
+}
+
+void ShadowCache::Store(const MarchResult* results, const float3* normals, int count, const FrameSetup& setup, const float* shadows)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (results[i].hit)
+			StoreHit(results[i], normals[i], setup, shadows + size_t(i) * g_lightCount);
+	}
+}
+
+void ShadowCache::StoreHit(const MarchResult& march, float3 normal, const FrameSetup& setup, const float* shadows)
+{
+	CellCoords coords = Locate(march, normal, setup);
+	int x = int(floorf(coords.position.x));
+	int y = int(floorf(coords.position.y));
+	int z = int(floorf(coords.position.z));
+	CellAddress address = Address(RegionHash(coords.level, coords.bucket, x, y, z), x, y, z);
+	uint64_t key = address.key;
+	uint64_t pending = key << 1;
+
+	// Claim the first empty slot, remembering the filled one used longest ago
+	Cell* stale = nullptr;
+	uint64_t staleTag = 0;
+	uint32_t staleAge = 0;
+	for (int i = 0; i < g_probeLength; i++)
+	{
+		Cell& cell = GetCell(ProbeSlot(address.slot, i));
+		uint64_t tag = cell.tag.load(std::memory_order_acquire);
+		if (tag == 0)
+		{
+			if (cell.tag.compare_exchange_strong(tag, pending, std::memory_order_acq_rel))
+			{
+				Fill(cell, pending, normal, shadows);
+				m_stores.fetch_add(1, std::memory_order_relaxed);
+				m_filled.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			// Another thread claimed it first, tag now holds its key
+		}
+
+		// Already filled, or being filled by another thread
+		if ((tag >> 1) == key)
+			return;
+
+		uint32_t age = m_frame - cell.frame.load(std::memory_order_relaxed);
+		if ((tag & 1) && age > staleAge)
+		{
+			stale = &cell;
+			staleTag = tag;
+			staleAge = age;
+		}
+	}
+
+	// Cells read or filled this frame are kept
+	if (stale && stale->tag.compare_exchange_strong(staleTag, pending, std::memory_order_acq_rel))
+	{
+		Fill(*stale, pending, normal, shadows);
+		m_evictions.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	m_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+ShadowCacheStats ShadowCache::GetStats() const
+{
+	ShadowCacheStats stats;
+	stats.hits = m_hits;
+	stats.misses = m_misses;
+	stats.stores = m_stores;
+	stats.evictions = m_evictions;
+	stats.dropped = m_dropped;
+	stats.invalidations = m_invalidations;
+	return stats;
+}
+
+void ShadowCache::ResetStats()
+{
+	m_hits = 0;
+	m_misses = 0;
+	m_stores = 0;
+	m_evictions = 0;
+	m_dropped = 0;
+	m_invalidations = 0;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+//------------------------------
+//- shadowcache.h
+//------------------------------
+
+// World space cache of the SoftShadow towards each light. The lights never move, so the shadows
+// at a surface point do not depend on the camera and can be kept from frame to frame. The cells
+// of a hash grid keep the shadows traced at the first hit that landed in each, and a later hit
+// whose cell is filled blends the cells around it trilinearly instead of tracing. Cells are sized
+// to about a pixel's footprint at the hit, so near and far surfaces get detail to match, and are
+// split by the axis the normal faces so the two sides of a thin feature stay apart. Each 4x4x4
+// region of cells hashes to its own block of slots, so the cells a lookup blends mostly share
+// pages and cache lines. The table never grows: once a probe finds no free slot the cell used
+// longest ago makes room
+
+// Includes
+#include "kernel.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// What the cache did since the last ResetStats
+struct ShadowCacheStats
+{
+	// Hits shaded from the cache, and hits that had to trace
+	long long hits = 0;
+	long long misses = 0;
+	// Cells filled, filled in place of a stale cell, and traced shadows not kept because every
+	// slot of the probe was used this frame
+	long long stores = 0;
+	long long evictions = 0;
+	long long dropped = 0;
+	// Times the cache was emptied for another fractal or light setup
+	long long invalidations = 0;
+};
+
+class ShadowCache
+{
+public:
+	// Cell edge in pixel footprints at the hit, rounded to a power of two
+	float m_cellScale = 1.0f;
+
+	// Constructor, the table takes at most maxBytes
+	ShadowCache(size_t maxBytes);
+
+	ShadowCache(const ShadowCache&) = delete;
+	ShadowCache& operator=(const ShadowCache&) = delete;
+
+	// Start a frame, emptying the cache when it was filled for another fractal or light setup.
+	// Lookup and Store may then be called from any thread until the next BeginFrame
+	void BeginFrame(const FrameSetup& setup);
+	// g_lightCount shadows for every result that hit, interpolated between the filled cells
+	// around it. cached is set for the hits whose own cell was filled, their shadows are written
+	// and the rest left alone. Returns how many were found
+	int Lookup(const MarchResult* results, const float3* normals, int count, const FrameSetup& setup, float* shadows, bool* cached);
+	// Keep the shadows traced at every result that hit in its cell
+	void Store(const MarchResult* results, const float3* normals, int count, const FrameSetup& setup, const float* shadows);
+
+	ShadowCacheStats GetStats() const;
+	void ResetStats();
+	// Cells holding shadows, out of GetCapacity
+	long long GetFilledCells() const { return m_filled; }
+	size_t GetCapacity() const { return m_mask + 1; }
+	size_t GetBytes() const { return GetCapacity() * sizeof(Cell); }
+private:
+	// Cells along each edge of a region, and slots in the block a region hashes to
+	static const int g_regionShift = 2;
+	static const int g_regionSlots = 1 << (3 * g_regionShift);
+
+	// Aligned so no cell spans two cache lines
+	struct alignas(32) Cell
+	{
+		// Key shifted up, with the low bit set once the shadows are written. 0 when empty
+		std::atomic<uint64_t> tag;
+		// Frame the cell was last filled or read in
+		std::atomic<uint32_t> frame;
+		// Normal of the hit that filled it, 10 bits per component
+		std::atomic<uint32_t> normal;
+		std::atomic<float> shadows[g_lightCount];
+	};
+
+	// Aligned so a block stays within a page
+	struct alignas(g_regionSlots * sizeof(Cell)) Region
+	{
+		Cell cells[g_regionSlots];
+	};
+
+	// A cell's key, and the slot its probe starts from
+	struct CellAddress
+	{
+		uint64_t key;
+		size_t slot;
+	};
+
+	// Where a hit falls in the grid
+	struct CellCoords
+	{
+		int level;
+		int bucket;
+		// Grid position in cells, cell i spans [i, i + 1)
+		float3 position;
+	};
+
+	std::unique_ptr<Region[]> m_regions;
+	size_t m_mask = 0;
+	uint32_t m_frame = 0;
+
+	// What the cells were filled for
+	bool m_valid = false;
+	FractalOptions m_params = {};
+	bool m_bounded = false;
+	float m_boundingRadius = 0.0f;
+	NormalMode m_normalMode = NormalMode::Central;
+	uint64_t m_lightSignature = 0;
+
+	std::atomic<long long> m_filled{ 0 };
+	std::atomic<long long> m_hits{ 0 };
+	std::atomic<long long> m_misses{ 0 };
+	std::atomic<long long> m_stores{ 0 };
+	std::atomic<long long> m_evictions{ 0 };
+	std::atomic<long long> m_dropped{ 0 };
+	long long m_invalidations = 0;
+
+	void Clear();
+	CellCoords Locate(const MarchResult& march, float3 normal, const FrameSetup& setup) const;
+	Cell& GetCell(size_t slot) const { return m_regions[slot / g_regionSlots].cells[slot % g_regionSlots]; }
+	// Hash of the region of cells holding (x, y, z) at a level
+	static uint64_t RegionHash(int level, int bucket, int x, int y, int z);
+	// Address of the cell at (x, y, z) in the region with hash region
+	CellAddress Address(uint64_t region, int x, int y, int z) const;
+	// Slot i of the probe starting at slot, wrapping around within its region's block
+	static size_t ProbeSlot(size_t slot, int i);
+	// Cells whose centres surround a hit, one of them its own, with their slots requested from
+	// memory. Returns the trilinear fractions
+	float3 Corners(const MarchResult& march, float3 normal, const FrameSetup& setup, CellAddress* corners, int& ownCorner) const;
+	// Copy the shadows of the filled cell and the normal they were traced at, false when there is none
+	bool Read(const CellAddress& address, float* shadows, float3& normal);
+	void StoreHit(const MarchResult& march, float3 normal, const FrameSetup& setup, const float* shadows);
+	// Write shadows into a cell claimed with pending and mark it filled
+	void Fill(Cell& cell, uint64_t pending, float3 normal, const float* shadows);
+};
@@ -0,0 +1,328 @@
+//------------------------------
+//- tests.cpp
+//------------------------------
+
+// Accuracy tests for the CPU port, a separate executable like the benchmarks. Every test prints
+// a line per case and the process exits with 1 if any case failed, so a build can run it straight
+// after compiling. The frames are small so the whole run takes seconds
+
+// Includes
+#include "cpurenderer.h"
+#include "kernel.h"
+#include "kernel_simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+struct TestOptions
+{
+	int width = 160;
+	int height = 90;
+	unsigned threads = 0;
+	// Only tests whose name contains this run
+	std::string filter;
+};
+
+struct TestCase
+{
+	const char* name;
+	bool (*run)(const TestOptions& options);
+};
+
+static void PrintUsage()
+{
+	printf(
+		"Usage: mandelbulb-tests [options]\n"
+		"\n"
+		"  --width <n>            Frame width for the image tests (default 160)\n"
+		"  --height <n>           Frame height (default 90)\n"
+		"  --threads <n>          Worker threads, 0 for all cores (default 0)\n"
+		"  --filter <text>        Only run tests whose name contains text\n");
+}
+
+static bool ParseOptions(int argc, char** argv, TestOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const char* value = argv[++i];
+
+		bool ok = true;
+		if (arg == "--width")
+			ok = (options.width = atoi(value)) > 0;
+		else if (arg == "--height")
+			ok = (options.height = atoi(value)) > 0;
+		else if (arg == "--threads")
+			options.threads = unsigned(atoi(value));
+		else if (arg == "--filter")
+			options.filter = value;
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			return false;
+		}
+
+		if (!ok)
+		{
+			fprintf(stderr, "Bad value for %s: %s\n", arg.c_str(), value);
+			return false;
+		}
+	}
+	return true;
+}
+
+// The window's starting view at the test size
+static FrameConstants TestConstants(const TestOptions& options)
+{
+	Camera camera;
+	camera.SetLens(0.78539816339f /*pi/4*/, float(options.width) / float(options.height), 0.1f, 1000.0f);
+	return CreateFrameConstants(camera, options.width, options.height);
+}
+
+// Random points in the bounding box and points along the view's rays just in front of the
+// surface, where the march spends most of its evaluations
+static void SamplePoints(const FrameConstants& constants, const FrameSetup& setup, std::vector<float>& xs, std::vector<float>& ys,
+	std::vector<float>& zs)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> box(-1.5f, 1.5f);
+	for (int i = 0; i < 5000; i++)
+	{
+		xs.push_back(box(rng));
+		ys.push_back(box(rng));
+		zs.push_back(box(rng));
+	}
+
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	for (int i = 0; i < 1000; i++)
+	{
+		Ray ray = CreateCamRay(float2{ unit(rng), unit(rng) }, constants.projInverse, constants.viewInverse, constants.camPos);
+		MarchResult march = MarchRay(ray, setup);
+		if (!march.hit)
+			continue;
+		for (float back : { 0.0f, 0.001f, 0.01f, 0.05f })
+		{
+			float3 p = march.pos - ray.dir * back;
+			xs.push_back(p.x);
+			ys.push_back(p.y);
+			zs.push_back(p.z);
+		}
+	}
+}
+
+// Every packet level the CPU supports against the scalar DistToScene, the port of the shader's,
+// at power 8 with and without the trig-free iteration and at the animated power
+static bool TestPacketDistance(const TestOptions& options)
+{
+	// Relative error away from the surface, lenZ only feeds the colour blend
+	const double distTolerance = 1e-3;
+	const double lenTolerance = 1e-2;
+
+	FrameConstants constants = TestConstants(options);
+	FrameSetup setup = CreateFrameSetup(constants);
+	std::vector<float> xs, ys, zs;
+	SamplePoints(constants, setup, xs, ys, zs);
+	int count = int(xs.size());
+
+	struct Case
+	{
+		const char* name;
+		float power;
+		bool trigFree;
+	};
+	const Case cases[] = {
+		{ "power 8 trig-free", 8.0f, true },
+		{ "power 8 polar", 8.0f, false },
+		{ "power 7.3", 7.3f, true },
+	};
+
+	bool trigFree = GetTrigFreePower();
+	SimdLevel top = GetSimdLevel();
+	bool passed = true;
+	for (const Case& test : cases)
+	{
+		FractalOptions params = setup.params;
+		params.power = test.power;
+		SetTrigFreePower(test.trigFree);
+
+		std::vector<float> refDist(count), refLen(count);
+		for (int i = 0; i < count; i++)
+			refDist[i] = DistToScene(float3{ xs[i], ys[i], zs[i] }, params, refLen[i]);
+
+		for (SimdLevel level : { SimdLevel::AVX2, SimdLevel::AVX512 })
+		{
+			if (int(level) > int(top) || SetSimdLevel(level) != level)
+				continue;
+
+			std::vector<float> dist(count), len(count);
+			DistToScenePacket(xs.data(), ys.data(), zs.data(), count, params, dist.data(), len.data());
+
+			// Orbits inside the set are chaotic, so near the surface only require both to agree
+			// the point is within hit range
+			double maxDistError = 0.0, maxLenError = 0.0;
+			int disagree = 0;
+			for (int i = 0; i < count; i++)
+			{
+				if (refDist[i] > 0.01f)
+				{
+					maxDistError = fmax(maxDistError, fabs(double(dist[i]) - refDist[i]) / fmax(fabs(double(refDist[i])), 0.01));
+					maxLenError = fmax(maxLenError, fabs(double(len[i]) - refLen[i]) / fmax(fabs(double(refLen[i])), 1.0));
+				}
+				else if (refDist[i] <= 0.001f && dist[i] > 0.01f)
+				{
+					disagree++;
+				}
+			}
+
+			bool ok = maxDistError < distTolerance && maxLenError < lenTolerance && disagree == 0;
+			passed = passed && ok;
+			printf("  %-18s %-7s max distance error %.2e, max lenZ error %.2e, %d near the surface disagree: %s\n", test.name,
+				SimdLevelName(level), maxDistError, maxLenError, disagree, ok ? "ok" : "FAILED");
+		}
+		SetSimdLevel(top);
+	}
+
+	SetTrigFreePower(trigFree);
+	return passed;
+}
+
+// Mean difference in 0-255 levels between the averages of each 4x4 pixels of a and b
+static double BlockDifference(const Image& a, const Image& b)
+{
+	const int block = 4;
+	double sum = 0.0;
+	int blocks = 0;
+	for (int by = 0; by + block <= a.height; by += block)
+	{
+		for (int bx = 0; bx + block <= a.width; bx += block)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				int difference = 0;
+				for (int y = by; y < by + block; y++)
+				{
+					for (int x = bx; x < bx + block; x++)
+						difference += int(a.Row(y)[x * 3 + c]) - int(b.Row(y)[x * 3 + c]);
+				}
+				sum += fabs(double(difference)) / double(block * block);
+			}
+			blocks++;
+		}
+	}
+	return blocks > 0 ? sum / (3.0 * blocks) : 0.0;
+}
+
+// The tetrahedral and analytic normals against central differences at every pixel's hit, with the
+// tetrahedral estimate taken at the central step, and the frames each draws against the central one.
+// The tolerances are check-normals', which hold at any image size
+static bool TestNormals(const TestOptions& options)
+{
+	const double angleTolerance = 15.0;
+	const double blockImageTolerance = 2.0 * sqrt(std::max(720.0 / double(options.height), 1.0));
+
+	ThreadPool pool(options.threads);
+	CpuRenderer renderer(pool);
+	NormalMode normalMode = GetNormalMode();
+	bool passed = true;
+	for (int quality : { 0, 2 })
+	{
+		FrameConstants constants = TestConstants(options);
+		constants.quality = quality;
+		FrameSetup setup = CreateFrameSetup(constants);
+
+		std::vector<MarchResult> hits;
+		for (int y = 0; y < options.height; y++)
+		{
+			for (int x = 0; x < options.width; x++)
+			{
+				float2 pixel = { x + 0.5f, y + 0.5f };
+				Ray ray = CreateCamRay(PixelToUV(constants, pixel), constants.projInverse, constants.viewInverse, constants.camPos);
+				MarchResult march = MarchRay(ray, setup);
+				if (march.hit)
+					hits.push_back(march);
+			}
+		}
+		if (hits.empty())
+		{
+			printf("  quality %d: the view has no hits: FAILED\n", quality);
+			passed = false;
+			continue;
+		}
+
+		Image reference;
+		SetNormalMode(NormalMode::Central);
+		renderer.Render(constants, setup, reference);
+		for (NormalMode mode : { NormalMode::Tetrahedral, NormalMode::Analytic })
+		{
+			SetNormalMode(mode);
+			std::vector<double> angles(hits.size());
+			std::vector<float3> normals(hits.size());
+			HitNormals(hits.data(), int(hits.size()), setup, normals.data());
+			for (size_t i = 0; i < hits.size(); i++)
+			{
+				float3 normal = mode == NormalMode::Tetrahedral ? NormalEstimateTetrahedral(hits[i].pos, g_normalEpsilon, setup.params) : normals[i];
+				angles[i] = acos(clamp(dot(normal, NormalEstimate(hits[i].pos, setup.params)), -1.0f, 1.0f)) * 57.29577951;
+			}
+			std::sort(angles.begin(), angles.end());
+			double medianAngle = angles[angles.size() / 2];
+
+			Image image;
+			renderer.Render(constants, setup, image);
+			double blockMean = BlockDifference(image, reference);
+
+			bool ok = medianAngle < angleTolerance && blockMean < blockImageTolerance;
+			passed = passed && ok;
+			printf("  quality %d %-12s angle median %.2f degrees, 4x4 image difference %.3f of %.3f: %s\n", quality,
+				NormalModeName(mode), medianAngle, blockMean, blockImageTolerance, ok ? "ok" : "FAILED");
+		}
+	}
+
+	SetNormalMode(normalMode);
+	return passed;
+}
+
+static const TestCase g_tests[] = {
+	{ "packet-distance", TestPacketDistance },
+	{ "normals", TestNormals },
+};
+
+int main(int argc, char** argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "--help") == 0)
+	{
+		PrintUsage();
+		return 0;
+	}
+
+	TestOptions options;
+	if (!ParseOptions(argc, argv, options))
+		return 1;
+
+	printf("mandelbulb-tests: %dx%d, %s\n", options.width, options.height, SimdLevelName(GetSimdLevel()));
+	int failed = 0, run = 0;
+	for (const TestCase& test : g_tests)
+	{
+		if (!options.filter.empty() && strstr(test.name, options.filter.c_str()) == nullptr)
+			continue;
+
+		printf("%s\n", test.name);
+		bool ok = test.run(options);
+		printf("%s: %s\n", test.name, ok ? "ok" : "FAILED");
+		failed += ok ? 0 : 1;
+		run++;
+	}
+
+	printf("%d of %d tests passed\n", run - failed, run);
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+//------------------------------
+//- threadpool.cpp
+//------------------------------
+
+// Includes
+#include "threadpool.h"
+
+#include <chrono>
+
+// Index of the queue owned by the current thread, external threads share the last queue
+static thread_local int t_queueIndex = -1;
+static thread_local const ThreadPool* t_pool = nullptr;
+
+// Constructor
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if (threadCount == 0)
+		threadCount = 1;
+
+	// The calling thread counts as one of the threads, it helps while waiting
+	unsigned workerCount = threadCount - 1;
+	for (unsigned i = 0; i < workerCount + 1; i++)
+	{
+		m_queues.push_back(std::make_unique<WorkQueue>());
+	}
+
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+// Destructor
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+
+	for (std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::Run(TaskGroup& group, std::function<void()> task)
+{
+	group.m_pending.fetch_add(1, std::memory_order_relaxed);
+
+	// Workers push to their own queue, everyone else spreads work round robin
+	unsigned queue;
+	if (t_pool == this && t_queueIndex >= 0)
+		queue = unsigned(t_queueIndex);
+	else
+		queue = m_nextExternal.fetch_add(1, std::memory_order_relaxed) % unsigned(m_queues.size());
+
+	{
+		std::lock_guard<std::mutex> lock(m_queues[queue]->mutex);
+		m_queues[queue]->tasks.push_back({ std::move(task), &group });
+	}
+	m_queued.fetch_add(1, std::memory_order_release);
+	m_wake.notify_one();
+}
+
+void ThreadPool::Wait(TaskGroup& group)
+{
+	unsigned home = (t_pool == this && t_queueIndex >= 0) ? unsigned(t_queueIndex) : unsigned(m_queues.size() - 1);
+
+	while (!group.Done())
+	{
+		if (!RunOne(home))
+		{
+			// Remaining tasks are running on other threads
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& task)
+{
+	TaskGroup group;
+	for (int i = 0; i < count; i++)
+	{
+		Run(group, [&task, i]() { task(i); });
+	}
+	Wait(group);
+}
+
+void ThreadPool::WorkerLoop(unsigned index)
+{
+	t_queueIndex = int(index);
+	t_pool = this;
+
+	while (!m_stop)
+	{
+		if (RunOne(index))
+			continue;
+
+		// Nothing to run or steal, sleep until new work is queued
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_wake.wait_for(lock, std::chrono::milliseconds(10), [this]() {
+			return m_stop || m_queued.load(std::memory_order_acquire) > 0;
+		});
+	}
+}
+
+bool ThreadPool::RunOne(unsigned home)
+{
+	Task task;
+
+	// Own queue first, newest task for cache locality
+	bool found = Pop(home, true, task);
+
+	// Then steal the oldest task from the others
+	for (unsigned i = 1; !found && i < m_queues.size(); i++)
+	{
+		found = Pop((home + i) % unsigned(m_queues.size()), false, task);
+	}
+
+	if (!found)
+		return false;
+
+	task.fn();
+	task.group->m_pending.fetch_sub(1, std::memory_order_acq_rel);
+	return true;
+}
+
+bool ThreadPool::Pop(unsigned queue, bool back, Task& task)
+{
+	WorkQueue& q = *m_queues[queue];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if (q.tasks.empty())
+		return false;
+
+	if (back)
+	{
+		task = std::move(q.tasks.back());
+		q.tasks.pop_back();
+	}
+	else
+	{
+		task = std::move(q.tasks.front());
+		q.tasks.pop_front();
+	}
+	m_queued.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+}
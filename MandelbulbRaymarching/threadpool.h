@@ -0,0 +1,79 @@
+#pragma once
+
+//------------------------------
+//- threadpool.h
+//------------------------------
+
+// Includes
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks a batch of tasks so a caller can wait on just that batch
+class TaskGroup
+{
+public:
+	// True once every task submitted to this group has finished
+	bool Done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+private:
+	friend class ThreadPool;
+	std::atomic<int> m_pending{ 0 };
+};
+
+// Work-stealing thread pool. Each worker owns a deque it pops from the back of,
+// idle workers steal from the front of the others. Waiting threads run tasks
+// instead of blocking, so tasks may safely submit and wait on nested groups
+class ThreadPool
+{
+public:
+	// Zero threads means one per hardware thread
+	explicit ThreadPool(unsigned threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Queue a task as part of a group
+	void Run(TaskGroup& group, std::function<void()> task);
+	// Help run tasks until the group has finished
+	void Wait(TaskGroup& group);
+
+	// Run task(i) for every i in [0, count) and wait for all of them
+	void ParallelFor(int count, const std::function<void(int)>& task);
+
+	// Workers plus the calling thread, which also runs tasks while waiting
+	unsigned GetThreadCount() const { return unsigned(m_workers.size()) + 1; }
+private:
+	struct Task
+	{
+		std::function<void()> fn;
+		TaskGroup* group;
+	};
+
+	// A worker's queue, the last entry is used by external threads
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::thread> m_workers;
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+
+	// Sleeping workers wait here when every queue is empty
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+	std::atomic<int> m_queued{ 0 };
+	std::atomic<bool> m_stop{ false };
+	std::atomic<unsigned> m_nextExternal{ 0 };
+
+	void WorkerLoop(unsigned index);
+	// Pop a task from our own queue or steal one, then run it
+	bool RunOne(unsigned home);
+	bool Pop(unsigned queue, bool back, Task& task);
+};
@@ -0,0 +1,188 @@
+//------------------------------
+//- tiffwriter.cpp
+//------------------------------
+
+// Includes
+#include "tiffwriter.h"
+
+// Field types, TIFF 6.0 section 2 and BigTIFF
+static const uint16_t g_tiffShort = 3;
+static const uint16_t g_tiffLong = 4;
+static const uint16_t g_tiffRational = 5;
+static const uint16_t g_tiffLong8 = 16;
+
+// A directory entry, rationals as numerator and denominator pairs
+struct TiffField
+{
+	uint16_t tag;
+	uint16_t type;
+	std::vector<uint64_t> values;
+};
+
+static int TiffTypeSize(uint16_t type)
+{
+	switch (type)
+	{
+	case g_tiffShort: return 2;
+	case g_tiffLong: return 4;
+	case g_tiffLong8: return 8;
+	default: return 4;
+	}
+}
+
+// TIFF is written little endian, "II"
+static void PutLittleEndian(std::vector<uint8_t>& out, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		out.push_back(uint8_t(value >> (i * 8)));
+	}
+}
+
+// Destructor
+TiffWriter::~TiffWriter()
+{
+	if (m_file)
+		fclose(m_file);
+}
+
+bool TiffWriter::Open(const std::string& fileName, int width, int height, int dpi)
+{
+	if (width <= 0 || height <= 0 || dpi <= 0)
+		return false;
+
+	m_file = fopen(fileName.c_str(), "wb");
+	if (!m_file)
+		return false;
+
+	m_width = width;
+	m_height = height;
+	m_dpi = dpi;
+	m_rowsWritten = 0;
+	m_rowsPerStrip = 0;
+	m_stripOffsets.clear();
+	m_stripSizes.clear();
+
+	// Strips are uncompressed so the directory's place is known now. The directory is at most 14
+	// entries with a strip offset and size per row and the resolution stored beside it
+	uint64_t pixelBytes = uint64_t(width) * uint64_t(height) * 3;
+	uint64_t classicEnd = 8 + pixelBytes + 1 + 2 + 14 * 12 + 4 + 6 + 16 + uint64_t(height) * 8;
+	m_bigTiff = classicEnd > 0xFFFFFFFFull;
+
+	// Header, the directory offset is patched in by Close
+	std::vector<uint8_t> header;
+	header.push_back('I');
+	header.push_back('I');
+	if (m_bigTiff)
+	{
+		PutLittleEndian(header, 43, 2);
+		PutLittleEndian(header, 8, 2);
+		PutLittleEndian(header, 0, 2);
+	}
+	else
+	{
+		PutLittleEndian(header, 42, 2);
+	}
+	m_offset = header.size() + (m_bigTiff ? 8 : 4);
+
+	// Directories start on a word boundary
+	m_directoryOffset = m_offset + pixelBytes + (pixelBytes & 1);
+	PutLittleEndian(header, m_directoryOffset, m_bigTiff ? 8 : 4);
+	fwrite(header.data(), 1, header.size(), m_file);
+
+	return ferror(m_file) == 0;
+}
+
+bool TiffWriter::WriteRows(const uint8_t* rows, int rowCount)
+{
+	if (!m_file || rowCount <= 0 || m_rowsWritten + rowCount > m_height)
+		return false;
+
+	// Only the last strip may be shorter than the first
+	if (m_rowsPerStrip == 0)
+		m_rowsPerStrip = rowCount;
+	if (rowCount > m_rowsPerStrip || (rowCount < m_rowsPerStrip && m_rowsWritten + rowCount < m_height))
+		return false;
+
+	uint64_t size = uint64_t(m_width) * 3 * uint64_t(rowCount);
+	m_stripOffsets.push_back(m_offset);
+	m_stripSizes.push_back(size);
+	fwrite(rows, 1, size_t(size), m_file);
+	m_offset += size;
+	m_rowsWritten += rowCount;
+
+	return ferror(m_file) == 0;
+}
+
+bool TiffWriter::Close()
+{
+	if (!m_file)
+		return false;
+
+	bool complete = m_rowsWritten == m_height;
+	if (complete)
+	{
+		if (m_offset & 1)
+			fputc(0, m_file);
+
+		uint16_t offsetType = m_bigTiff ? g_tiffLong8 : g_tiffLong;
+		std::vector<TiffField> fields = {
+			{ 256, g_tiffLong, { uint64_t(m_width) } },
+			{ 257, g_tiffLong, { uint64_t(m_height) } },
+			{ 258, g_tiffShort, { 8, 8, 8 } },
+			// No compression, RGB
+			{ 259, g_tiffShort, { 1 } },
+			{ 262, g_tiffShort, { 2 } },
+			{ 273, offsetType, m_stripOffsets },
+			{ 277, g_tiffShort, { 3 } },
+			{ 278, g_tiffLong, { uint64_t(m_rowsPerStrip) } },
+			{ 279, offsetType, m_stripSizes },
+			{ 282, g_tiffRational, { uint64_t(m_dpi), 1 } },
+			{ 283, g_tiffRational, { uint64_t(m_dpi), 1 } },
+			// Samples interleaved, resolution in inches
+			{ 284, g_tiffShort, { 1 } },
+			{ 296, g_tiffShort, { 2 } },
+		};
+
+		// Values that do not fit in an entry go after the directory
+		int countBytes = m_bigTiff ? 8 : 2;
+		int entryBytes = m_bigTiff ? 20 : 12;
+		int inlineBytes = m_bigTiff ? 8 : 4;
+		uint64_t extraOffset = m_directoryOffset + countBytes + fields.size() * entryBytes + inlineBytes;
+
+		std::vector<uint8_t> directory;
+		std::vector<uint8_t> extra;
+		PutLittleEndian(directory, fields.size(), countBytes);
+		for (const TiffField& field : fields)
+		{
+			int typeSize = TiffTypeSize(field.type);
+			uint64_t count = field.type == g_tiffRational ? field.values.size() / 2 : field.values.size();
+			std::vector<uint8_t>& target = count * (field.type == g_tiffRational ? 8 : typeSize) <= uint64_t(inlineBytes) ? directory : extra;
+
+			PutLittleEndian(directory, field.tag, 2);
+			PutLittleEndian(directory, field.type, 2);
+			PutLittleEndian(directory, count, m_bigTiff ? 8 : 4);
+			if (&target == &extra)
+				PutLittleEndian(directory, extraOffset + extra.size(), inlineBytes);
+
+			size_t start = target.size();
+			for (uint64_t value : field.values)
+				PutLittleEndian(target, value, typeSize);
+
+			// Inline values are left justified in the entry, further values start on a word boundary
+			if (&target == &directory)
+				directory.resize(start + inlineBytes, 0);
+			else if (extra.size() & 1)
+				extra.push_back(0);
+		}
+		PutLittleEndian(directory, 0, inlineBytes);
+
+		fwrite(directory.data(), 1, directory.size(), m_file);
+		fwrite(extra.data(), 1, extra.size(), m_file);
+	}
+
+	complete = complete && ferror(m_file) == 0;
+	complete = fclose(m_file) == 0 && complete;
+	m_file = nullptr;
+	return complete;
+}
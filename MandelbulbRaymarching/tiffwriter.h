@@ -0,0 +1,49 @@
+#pragma once
+
+//------------------------------
+//- tiffwriter.h
+//------------------------------
+
+// Includes
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Streaming TIFF encoder for 8-bit RGB, the format print shops take images too big for PNG
+// viewers in. Each batch of rows becomes one uncompressed strip written straight to the file, and
+// the directory goes after the last strip so nothing is held back. Images past 4 GB are BigTIFF
+class TiffWriter
+{
+public:
+	TiffWriter() = default;
+	~TiffWriter();
+
+	TiffWriter(const TiffWriter&) = delete;
+	TiffWriter& operator=(const TiffWriter&) = delete;
+
+	// Write the header for an 8-bit RGB image, tagged with a print resolution in dots per inch
+	bool Open(const std::string& fileName, int width, int height, int dpi = 300);
+	// Append rows as a strip, 3 bytes per pixel. Every strip but the last must have as many rows
+	// as the first, as TIFF only records one strip height
+	bool WriteRows(const uint8_t* rows, int rowCount);
+	// Write the directory, fails if fewer rows than the header promised were written
+	bool Close();
+
+	// True when the image was too big for 32-bit offsets
+	bool IsBigTiff() const { return m_bigTiff; }
+private:
+	FILE* m_file = nullptr;
+	int m_width = 0;
+	int m_height = 0;
+	int m_dpi = 0;
+	int m_rowsWritten = 0;
+	int m_rowsPerStrip = 0;
+	bool m_bigTiff = false;
+	// Where the next strip and the directory go
+	uint64_t m_offset = 0;
+	uint64_t m_directoryOffset = 0;
+
+	std::vector<uint64_t> m_stripOffsets;
+	std::vector<uint64_t> m_stripSizes;
+};
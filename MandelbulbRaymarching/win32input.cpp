@@ -0,0 +1,38 @@
+//------------------------------
+//- win32input.cpp
+//------------------------------
+
+// Includes
+#include "win32input.h"
+
+#include <DirectXMath.h>
+
+InputState Win32Input::Poll()
+{
+	InputState input;
+
+	// W
+	input.forward = (GetAsyncKeyState(0x57) & 0x8000) != 0;
+	// S
+	input.back = (GetAsyncKeyState(0x53) & 0x8000) != 0;
+	// A
+	input.left = (GetAsyncKeyState(0x41) & 0x8000) != 0;
+	// D
+	input.right = (GetAsyncKeyState(0x44) & 0x8000) != 0;
+
+	if (!mouse)
+		return input;
+
+	// Camera
+	auto state = mouse->GetState();
+	m_tracker.Update(state);
+	mouse->SetMode(state.leftButton ? Mouse::MODE_RELATIVE : Mouse::MODE_ABSOLUTE);
+
+	if (state.positionMode == Mouse::MODE_RELATIVE)
+	{
+		input.yaw = XMConvertToRadians(1.0f * static_cast<float>(state.x));
+		input.pitch = XMConvertToRadians(1.0f * static_cast<float>(state.y));
+	}
+
+	return input;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+//------------------------------
+//- win32input.h
+//------------------------------
+
+// Includes
+#include "backend.h"
+
+#include <Windows.h>
+#include <Mouse.h>
+
+using namespace DirectX;
+
+// WASD from the keyboard and mouse look while the left button is held
+class Win32Input : public InputSource
+{
+public:
+	// Pointer to mouse singleton
+	Mouse* mouse = nullptr;
+
+	InputState Poll() override;
+private:
+	// Mouse tracker
+	Mouse::ButtonStateTracker m_tracker;
+};
@@ -18,6 +18,11 @@
 #define ID_SETTINGSMENUQLTMD 7
 #define ID_SETTINGSMENUQLTHI 8
 #define ID_SETTINGSMENURESET 9
+#define ID_SETTINGSMENUPREPASS 10
+#define ID_SETTINGSMENUREPROJECT 11
+#define ID_SETTINGSMENUPROGRESSIVE 12
+#define ID_SETTINGSMENUDYNAMIC 13
+#define ID_FILEMENURECORD 14
 
 using namespace DirectX;
 
@@ -66,11 +71,11 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
 	case WM_SIZE:
 		if (wParam != SIZE_MINIMIZED)
 		{
-			window->m_renderer->ResizeSwapChain();
+			window->m_backend->ResizeSwapChain();
 		}
 		break;
 	case WM_SIZING:
-		window->m_renderer->ResizeSwapChain();
+		window->m_backend->ResizeSwapChain();
 		break;
 	case WM_COMMAND:
 		hmenu = GetMenu(window->hwnd);
@@ -116,12 +121,51 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
 					format = GUID_ContainerFormatBmp;
 				}
 
-				window->m_renderer->SaveRenderToFile(sfn.lpstrFile, format);
+				window->m_backend->SaveRenderToFile(sfn.lpstrFile, format);
 				MessageBeep(MB_OK);
 			}
 
 			break;
 		}
+		// Record the camera input, or stop and save what was recorded
+		case ID_FILEMENURECORD:
+		{
+			if (!window->m_renderer->m_recording)
+			{
+				window->m_trace = InputTrace();
+				window->m_renderer->m_recording = &window->m_trace;
+				CheckMenuItem(hmenu, ID_FILEMENURECORD, MF_CHECKED);
+				break;
+			}
+
+			window->m_renderer->m_recording = nullptr;
+			CheckMenuItem(hmenu, ID_FILEMENURECORD, MF_UNCHECKED);
+
+			OPENFILENAME sfn = { 0 };
+			TCHAR szFile[MAX_PATH] = { 0 };
+
+			// Fields for dialogue box
+			sfn.lStructSize = sizeof(sfn);
+			sfn.hwndOwner = hwnd;
+			sfn.lpstrFile = szFile;
+			sfn.nMaxFile = ARRAYSIZE(szFile);
+			sfn.lpstrFilter = L"Input trace (*.mbtrace)\0*.mbtrace\0";
+			sfn.lpstrDefExt = L"mbtrace";
+			sfn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+
+			if (GetSaveFileName(&sfn) == TRUE)
+			{
+				// Replayed with mandelbulb-cli frames --replay
+				char path[MAX_PATH * 2];
+				WideCharToMultiByte(CP_ACP, 0, sfn.lpstrFile, -1, path, sizeof(path), nullptr, nullptr);
+				if (window->m_trace.Save(path))
+					MessageBeep(MB_OK);
+				else
+					MessageBox(hwnd, L"Failed to save the input trace", L"Mandelbulb", MB_OK | MB_ICONERROR);
+			}
+
+			break;
+		}
 		// Quit
 		case ID_FILEMENUEXIT:
 			PostMessage(hwnd, WM_CLOSE, 0, 0);
@@ -213,6 +257,28 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
 			// Set quality
 			window->m_renderer->m_constants.quality = 2;
 			break;
+		case ID_SETTINGSMENUPREPASS:
+			// Toggle the cone prepass
+			window->m_backend->m_conePrepass = !window->m_backend->m_conePrepass;
+			CheckMenuItem(hmenu, ID_SETTINGSMENUPREPASS, window->m_backend->m_conePrepass ? MF_CHECKED : MF_UNCHECKED);
+			break;
+		case ID_SETTINGSMENUREPROJECT:
+			// Toggle temporal reprojection
+			window->m_backend->m_reprojection = !window->m_backend->m_reprojection;
+			CheckMenuItem(hmenu, ID_SETTINGSMENUREPROJECT, window->m_backend->m_reprojection ? MF_CHECKED : MF_UNCHECKED);
+			break;
+		case ID_SETTINGSMENUPROGRESSIVE:
+			// Toggle progressive refinement
+			window->m_renderer->m_progressive = !window->m_renderer->m_progressive;
+			CheckMenuItem(hmenu, ID_SETTINGSMENUPROGRESSIVE, window->m_renderer->m_progressive ? MF_CHECKED : MF_UNCHECKED);
+			break;
+		case ID_SETTINGSMENUDYNAMIC:
+			// Toggle dynamic quality, starting again from full resolution
+			window->m_renderer->m_dynamicQuality = !window->m_renderer->m_dynamicQuality;
+			window->m_renderer->m_qualityController.Reset();
+			CheckMenuItem(hmenu, ID_SETTINGSMENUDYNAMIC, window->m_renderer->m_dynamicQuality ? MF_CHECKED : MF_UNCHECKED);
+			SetWindowText(hwnd, L"Mandelbulb");
+			break;
 		case ID_SETTINGSMENURESET:
 			// Reset camera
 			window->m_renderer->m_camera.m_position = { -1.3084f, 0.0610f, -2.8699f };
@@ -266,7 +332,9 @@ Window::Window(int width, int height, HINSTANCE hInstance)
 	);
 
 	// Instantiate renderer
-	m_renderer = new Renderer(hwnd);
+	m_backend = new D3D11Backend(hwnd);
+	m_input = new Win32Input();
+	m_renderer = new Renderer(*m_backend, *m_input);
 
 	// Also create menu items
 	SetupMenus(hwnd);
@@ -287,6 +355,7 @@ void Window::SetupMenus(HWND hwnd)
 	// File menu
 	HMENU hFileMenu = CreateMenu();
 	AppendMenuW(hFileMenu, MF_STRING, ID_FILEMENUSAVE, L"Save Image");
+	AppendMenuW(hFileMenu, MF_STRING | MF_UNCHECKED, ID_FILEMENURECORD, L"Record Input");
 	AppendMenuW(hFileMenu, MF_SEPARATOR, NULL, NULL);
 	AppendMenuW(hFileMenu, MF_STRING, ID_FILEMENUEXIT, L"Exit Application");
 
@@ -306,6 +375,10 @@ void Window::SetupMenus(HWND hwnd)
 
 	AppendMenuW(hSettingsMenu, MF_POPUP, (UINT_PTR)hQualityMenu, L"Quality");
 	AppendMenuW(hSettingsMenu, MF_STRING | MF_UNCHECKED, ID_COLOURMENUANIMATED, L"Animation");
+	AppendMenuW(hSettingsMenu, MF_STRING | MF_UNCHECKED, ID_SETTINGSMENUPREPASS, L"Cone Prepass");
+	AppendMenuW(hSettingsMenu, MF_STRING | MF_UNCHECKED, ID_SETTINGSMENUREPROJECT, L"Reprojection");
+	AppendMenuW(hSettingsMenu, MF_STRING | MF_UNCHECKED, ID_SETTINGSMENUPROGRESSIVE, L"Progressive Refinement");
+	AppendMenuW(hSettingsMenu, MF_STRING | MF_UNCHECKED, ID_SETTINGSMENUDYNAMIC, L"Dynamic Quality (60 fps)");
 	AppendMenuW(hSettingsMenu, MF_STRING, ID_SETTINGSMENURESET, L"Reset Camera");
 
 	// Main bar
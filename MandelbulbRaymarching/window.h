@@ -5,7 +5,9 @@
 //------------------------------
 
 // Includes
+#include "d3d11backend.h"
 #include "renderer.h"
+#include "win32input.h"
 
 #include <Windows.h>
 #include <Mouse.h>
@@ -16,8 +18,12 @@ class Window
 public:
 	// HWND for this window
 	HWND hwnd;
-	// Renderer
+	// Renderer, and the backend and input it was created with
 	Renderer* m_renderer;
+	D3D11Backend* m_backend;
+	Win32Input* m_input;
+	// Session File > Record Input is recording
+	InputTrace m_trace;
 
 	// Constructor
 	Window(int width, int height, HINSTANCE hInstance);